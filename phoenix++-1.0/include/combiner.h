@@ -28,6 +28,13 @@
 #define COMBINER_H_
 
 #include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include <new>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 // The assumption with a combiner is that it will be very cheap to copy 
 // (e.g. as cheap as a pointer or two)
@@ -49,19 +56,33 @@ public:
         return data->size() == 0;
     }
 
+    uint64_t count() const {
+        return data->size();
+    }
+
     class combined
     {
         std::vector< std::vector<V, Allocator<V> >*, 
             Allocator<std::vector<V, Allocator<V> >* > > items;
-        mutable unsigned int current_list, current_index;
+        mutable unsigned int current_list;
+        mutable uint64_t current_index;
+        // start of the slice and the number of values left in it
+        unsigned int first_list;
+        uint64_t first_index;
+        mutable uint64_t remaining;
+        uint64_t limit;
     public:
-        combined() : current_list(0), current_index(0) {}
+        combined() : current_list(0), current_index(0), first_list(0), 
+            first_index(0), remaining(~0ULL), limit(~0ULL) {}
 
         void add(buffer_combiner<V, Allocator> const* c) {
             items.push_back(c->data);
         }
 
         bool next(V& v) const {
+            if(remaining == 0)
+                return false;
+
             if(current_list < items.size() && 
                 current_index >= items[current_list]->size())
             {
@@ -77,24 +98,71 @@ public:
                 current_index < items[current_list]->size())
             {
                 v = (*items[current_list])[current_index++];
+                remaining--;
                 return true;
             }
 
             return false;
         }
 
+        // Points vals to the next values, which are contiguous, and returns 
+        // how many there are, or 0 at the end. Can be mixed with next().
+        uint64_t next_batch(V const*& vals) const {
+            while(current_list < items.size() && 
+                current_index >= items[current_list]->size())
+            {
+                current_index = 0;
+                current_list++;
+            }
+
+            if(remaining == 0 || current_list >= items.size())
+                return 0;
+
+            if((current_list+1) < items.size() && 
+                items[current_list+1]->size() > 0)
+                __builtin_prefetch (&(*items[current_list+1])[0], 0, 1);
+
+            uint64_t n = std::min<uint64_t>(remaining, 
+                items[current_list]->size() - current_index);
+            vals = &(*items[current_list])[current_index];
+            current_index += n;
+            remaining -= n;
+            return n;
+        }
+
         void reset() {
-            current_list = 0;
-            current_index = 0;
+            current_list = first_list;
+            current_index = first_index;
+            remaining = limit;
         }
 
         int size() const {
             return items.size();
         }
 
+        // number of values next() will return after a reset
+        uint64_t count() const {
+            uint64_t n = 0;
+            for(size_t i = first_list; i < items.size(); i++)
+                n += items[i]->size();
+            return n > first_index ? std::min(n - first_index, limit) : 0;
+        }
+
+        // restrict to values [begin, end) of the full sequence
+        void slice(uint64_t begin, uint64_t end) {
+            limit = end > begin ? end - begin : 0;
+            first_list = 0;
+            while(first_list < items.size() && 
+                begin >= items[first_list]->size())
+                begin -= items[first_list++]->size();
+            first_index = begin;
+            reset();
+        }
+
         void clear() {
-            current_list = 0;
-            current_index = 0;
+            current_list = first_list = 0;
+            current_index = first_index = 0;
+            remaining = limit = ~0ULL;
             items.clear();
         }
     };
@@ -124,6 +192,10 @@ public:
         return _empty;
     }
 
+    uint64_t count() const {
+        return _empty ? 0 : 1;
+    }
+
     class combined
     {
         V m;
@@ -142,12 +214,23 @@ public:
             v = m;
             return 0 == i++;
         }
+        uint64_t next_batch(V const*& vals) const {
+            vals = &m;
+            return 0 == i++ ? 1 : 0;
+        }
         void reset() {
             i = 0;
         }
         int size() const {
             return _empty ? 0 : 1;
         }
+        uint64_t count() const {
+            return size();
+        }
+        void slice(uint64_t begin, uint64_t end) {
+            if(begin > 0 || end == 0)
+                clear();
+        }
         void clear() {
             Impl::Init(m);
             i = 0;
@@ -177,13 +260,21 @@ public:
         return data->size() == 0;
     }
 
+    uint64_t count() const {
+        return data->size();
+    }
+
     class combined
     {
         std::vector< std::vector<V, Allocator<V> >*, 
             Allocator<std::vector<V, Allocator<V> >* > > items;
         mutable bool done;
+        mutable V result;       // handed out by next_batch()
+        // start of the slice and the number of values in it
+        uint64_t first_list, first_index, limit;
     public:
-        combined() : done(false) {}
+        combined() : done(false), first_list(0), first_index(0), 
+            limit(~0ULL) {}
 
         void add(associative_combiner<Impl, V, Allocator> const* c) {
             items.push_back(c->data);
@@ -194,10 +285,12 @@ public:
             
             V total;
             Impl::Init(total); 
-            for(uint64_t current_list = 0; current_list < items.size(); 
-                current_list++)
+            uint64_t left = limit;
+            for(uint64_t current_list = first_list; 
+                current_list < items.size() && left > 0; current_list++)
             {
-                for(uint64_t i = 0; i < items[current_list]->size(); i++)
+                uint64_t i = (current_list == first_list) ? first_index : 0;
+                for(; i < items[current_list]->size() && left > 0; i++, left--)
                     Impl::F(total, (*items[current_list])[i]);
             } 
             v = total;
@@ -205,6 +298,14 @@ public:
             return true;
         }
 
+        // the reduced value, as a batch of one
+        uint64_t next_batch(V const*& vals) const {
+            if(!next(result))
+                return 0;
+            vals = &result;
+            return 1;
+        }
+
         void reset() {
             done = false;
         }
@@ -213,8 +314,27 @@ public:
             return items.size();
         }
 
+        uint64_t count() const {
+            uint64_t n = 0;
+            for(size_t i = first_list; i < items.size(); i++)
+                n += items[i]->size();
+            return n > first_index ? std::min(n - first_index, limit) : 0;
+        }
+
+        void slice(uint64_t begin, uint64_t end) {
+            limit = end > begin ? end - begin : 0;
+            first_list = 0;
+            while(first_list < items.size() && 
+                begin >= items[first_list]->size())
+                begin -= items[first_list++]->size();
+            first_index = begin;
+            done = false;
+        }
+
         void clear() {
             done = false;
+            first_list = first_index = 0;
+            limit = ~0ULL;
             items.clear();
         }
     };
@@ -242,6 +362,577 @@ public:
      static void Init(V& a) {}
 };
 
+// Posting lists keep every value emitted for a key, in the order emitted, 
+// in a chain of chunks. Chunks come from a pool that belongs to one 
+// map thread: they are carved out of large slabs with a bump pointer and are 
+// never freed one at a time, only all together when the pool goes away. 
+// Slabs start small and double, so a pool holding one short list stays small.
+template<template<class> class Allocator = std::allocator>
+class posting_pool
+{
+    std::vector<char*, Allocator<char*> > slabs;
+    std::vector<uint64_t, Allocator<uint64_t> > slab_sizes;
+    char* cursor;
+    char* end;
+    uint64_t slab_size;
+
+    static const uint64_t min_slab = 1 << 8;
+    static const uint64_t max_slab = 1 << 16;
+
+    posting_pool(posting_pool const&);
+    posting_pool& operator=(posting_pool const&);
+public:
+    posting_pool() : cursor(NULL), end(NULL), slab_size(min_slab) {}
+
+    ~posting_pool() {
+        Allocator<char> a;
+        for(size_t i = 0; i < slabs.size(); i++)
+            a.deallocate(slabs[i], slab_sizes[i]);
+    }
+
+    // 8 byte aligned storage that lives as long as the pool
+    void* allocate(uint64_t bytes) {
+        bytes = (bytes + 7) & ~(uint64_t)7;
+        if(cursor == NULL || (uint64_t)(end - cursor) < bytes) {
+            uint64_t n = std::max(bytes, slab_size);
+            slab_size = std::min(slab_size * 2, max_slab);
+            char* slab = Allocator<char>().allocate(n + 7);
+            slabs.push_back(slab);
+            slab_sizes.push_back(n + 7);
+            cursor = (char*)(((uintptr_t)slab + 7) & ~(uintptr_t)7);
+            end = cursor + n;
+        }
+        void* p = cursor;
+        cursor += bytes;
+        return p;
+    }
+};
+
+template<typename V, template<class> class Allocator = std::allocator>
+class posting_list
+{
+public:
+    // header of a chunk, capacity values follow it
+    struct chunk {
+        chunk* next;
+        uint32_t size;
+        uint32_t capacity;
+
+        V* values() { return (V*)(this + 1); }
+        V const* values() const { return (V const*)(this + 1); }
+    };
+    typedef posting_pool<Allocator> pool_type;
+
+private:
+    chunk* head;
+    chunk* tail;
+    uint64_t n;
+
+    // Chunks double up to the size of the list so far, so long lists take 
+    // few hops to walk while the many keys seen once waste little.
+    static const uint32_t first_chunk = 4;
+    static const uint32_t max_chunk = 1024;
+
+public:
+    posting_list() : head(NULL), tail(NULL), n(0) {}
+
+    void add(V const& v, pool_type& pool) {
+        if(tail == NULL || tail->size == tail->capacity) {
+            uint32_t capacity = (uint32_t)std::min<uint64_t>(max_chunk, 
+                std::max<uint64_t>(first_chunk, n));
+            chunk* c = (chunk*)pool.allocate(
+                sizeof(chunk) + capacity * sizeof(V));
+            c->next = NULL;
+            c->size = 0;
+            c->capacity = capacity;
+            if(tail == NULL)
+                head = c;
+            else
+                tail->next = c;
+            tail = c;
+        }
+        new (&tail->values()[tail->size++]) V(v);
+        n++;
+    }
+
+    // Drops a value equal to the last one appended, so a document that 
+    // emits the same key many times is listed once.
+    void add_unique(V const& v, pool_type& pool) {
+        if(tail == NULL || !(tail->values()[tail->size-1] == v))
+            add(v, pool);
+    }
+
+    // Links other's chunks after ours. Both lists must be done growing, and 
+    // other must not be walked on its own any more: its last chunk is shared.
+    void splice(posting_list const& other) {
+        if(other.n == 0)
+            return;
+        if(tail == NULL)
+            head = other.head;
+        else
+            tail->next = other.head;
+        tail = other.tail;
+        n += other.n;
+    }
+
+    bool empty() const {
+        return n == 0;
+    }
+
+    uint64_t count() const {
+        return n;
+    }
+
+    chunk const* first() const {
+        return head;
+    }
+};
+
+// Combiner over a posting list that brings its own pool. Map threads append 
+// to posting lists through the pools of posting_container; this is what 
+// reduce gets to hand partial results around, and its pool is leaked like 
+// the buffer of buffer_combiner.
+template<typename V, template<class> class Allocator = std::allocator>
+class posting_combiner
+{
+public:
+    typedef posting_list<V, Allocator> list_type;
+    typedef typename list_type::chunk chunk;
+private:
+    typename list_type::pool_type* pool;
+    list_type data;
+public:
+    posting_combiner() : pool(NULL) {}
+
+    void add(V const& v) {
+        if(pool == NULL)
+            pool = new typename list_type::pool_type;
+        data.add(v, *pool);
+    }
+
+    bool empty() const {
+        return data.empty();
+    }
+
+    uint64_t count() const {
+        return data.count();
+    }
+
+    // walks the posting lists of one key from all map threads
+    class combined
+    {
+        std::vector< list_type const*, Allocator<list_type const*> > items;
+        mutable unsigned int current_list, current_index;
+        mutable chunk const* current;
+        // start of the slice and the number of values left in it
+        unsigned int first_list, first_index;
+        chunk const* first_chunk;
+        uint64_t skipped;
+        mutable uint64_t remaining;
+        uint64_t limit;
+
+        // moves current to the next chunk with values left in it
+        bool advance() const {
+            while(current == NULL || current_index >= current->size) {
+                if(current != NULL && current->next != NULL)
+                    current = current->next;
+                else if(current_list + 1 < items.size())
+                    current = items[++current_list]->first();
+                else
+                    return false;
+                current_index = 0;
+                if(current != NULL)
+                    __builtin_prefetch (current->next, 0, 1);
+            }
+            return true;
+        }
+    public:
+        combined() : current_list(0), current_index(0), current(NULL), 
+            first_list(0), first_index(0), first_chunk(NULL), skipped(0), 
+            remaining(~0ULL), limit(~0ULL) {}
+
+        void add(list_type const* l) {
+            if(items.empty())
+                current = first_chunk = l->first();
+            items.push_back(l);
+        }
+
+        void add(posting_combiner<V, Allocator> const* c) {
+            add(&c->data);
+        }
+
+        bool next(V& v) const {
+            if(remaining == 0 || !advance())
+                return false;
+            v = current->values()[current_index++];
+            remaining--;
+            return true;
+        }
+
+        // the rest of the current chunk, see buffer_combiner
+        uint64_t next_batch(V const*& vals) const {
+            if(remaining == 0 || !advance())
+                return 0;
+            uint64_t n = std::min<uint64_t>(remaining, 
+                current->size - current_index);
+            vals = current->values() + current_index;
+            current_index += n;
+            remaining -= n;
+            return n;
+        }
+
+        void reset() {
+            current_list = first_list;
+            current_index = first_index;
+            current = first_chunk;
+            remaining = limit;
+        }
+
+        int size() const {
+            return items.size();
+        }
+
+        // number of values next() will return after a reset
+        uint64_t count() const {
+            uint64_t n = 0;
+            for(size_t i = 0; i < items.size(); i++)
+                n += items[i]->count();
+            return n > skipped ? std::min(n - skipped, limit) : 0;
+        }
+
+        // restrict to values [begin, end) of the full sequence
+        void slice(uint64_t begin, uint64_t end) {
+            limit = end > begin ? end - begin : 0;
+            skipped = begin;
+            first_list = 0;
+            while(first_list < items.size() && 
+                begin >= items[first_list]->count())
+                begin -= items[first_list++]->count();
+            first_chunk = NULL;
+            if(first_list < items.size()) {
+                first_chunk = items[first_list]->first();
+                while(begin >= first_chunk->size) {
+                    begin -= first_chunk->size;
+                    first_chunk = first_chunk->next;
+                }
+            }
+            first_index = begin;
+            reset();
+        }
+
+        void clear() {
+            current_list = first_list = 0;
+            current_index = first_index = 0;
+            current = first_chunk = NULL;
+            skipped = 0;
+            remaining = limit = ~0ULL;
+            items.clear();
+        }
+    };
+
+    void combineinto(combined& m) const {
+        m.add(this);
+    }
+};
+
+// Posting list of integers stored as the zigzag encoded difference to the 
+// previous value, in 7 bit groups (varint). Lists of nearby values such as 
+// document ids or offsets take a byte or two per value instead of sizeof(V). 
+// The first value of every chunk is encoded against 0, so each chunk can be 
+// decoded on its own and lists can be spliced and sliced a chunk at a time.
+template<typename V, template<class> class Allocator = std::allocator>
+class packed_list
+{
+public:
+    // header of a chunk, capacity bytes of varints follow it
+    struct chunk {
+        chunk* next;
+        uint64_t last;          // value the next one is encoded against
+        uint16_t count;
+        uint16_t size;
+        uint16_t capacity;
+
+        uint8_t* bytes() { return (uint8_t*)(this + 1); }
+        uint8_t const* bytes() const { return (uint8_t const*)(this + 1); }
+    };
+    typedef posting_pool<Allocator> pool_type;
+
+    // longest varint of a 64 bit difference
+    static const uint32_t max_varint = 10;
+
+private:
+    chunk* head;
+    chunk* tail;
+    uint64_t n;
+
+    // Each chunk is twice the size of the one before.
+    static const uint32_t first_chunk = 8;
+    static const uint32_t max_chunk = 4096;
+
+    static uint32_t encode(uint64_t delta, uint8_t* out) {
+        uint64_t z = (delta << 1) ^ (uint64_t)((int64_t)delta >> 63);
+        uint32_t len = 0;
+        while(z >= 0x80) {
+            out[len++] = (uint8_t)(z | 0x80);
+            z >>= 7;
+        }
+        out[len++] = (uint8_t)z;
+        return len;
+    }
+
+public:
+    packed_list() : head(NULL), tail(NULL), n(0) {}
+
+    void add(V const& v, pool_type& pool) {
+        uint64_t x = (uint64_t)(int64_t)v;
+        uint8_t buf[max_varint];
+        uint32_t len = encode(tail != NULL ? x - tail->last : x, buf);
+        if(tail == NULL || tail->size + len > tail->capacity || 
+            tail->count == 0xffff) {
+            // at least one varint of any length
+            uint32_t capacity = (uint32_t)std::max<uint64_t>(max_varint, 
+                std::min<uint64_t>(max_chunk, 
+                    tail ? tail->capacity * 2 : first_chunk));
+            chunk* c = (chunk*)pool.allocate(sizeof(chunk) + capacity);
+            c->next = NULL;
+            c->count = 0;
+            c->size = 0;
+            c->capacity = capacity;
+            if(tail == NULL)
+                head = c;
+            else
+                tail->next = c;
+            tail = c;
+            len = encode(x, buf);
+        }
+        memcpy(tail->bytes() + tail->size, buf, len);
+        tail->size += len;
+        tail->count++;
+        tail->last = x;
+        n++;
+    }
+
+    // See posting_list::add_unique.
+    void add_unique(V const& v, pool_type& pool) {
+        if(tail == NULL || (uint64_t)(int64_t)v != tail->last)
+            add(v, pool);
+    }
+
+    // Links other's chunks after ours, see posting_list::splice.
+    void splice(packed_list const& other) {
+        if(other.n == 0)
+            return;
+        if(tail == NULL)
+            head = other.head;
+        else
+            tail->next = other.head;
+        tail = other.tail;
+        n += other.n;
+    }
+
+    bool empty() const {
+        return n == 0;
+    }
+
+    uint64_t count() const {
+        return n;
+    }
+
+    chunk const* first() const {
+        return head;
+    }
+
+    // Decodes all values of a chunk into out, which must have room for 
+    // c->count of them. Runs of 16 one byte varints, the common case for 
+    // dense lists, are found with one SSE2 compare and decoded without 
+    // branches.
+    static void decode(chunk const* c, V* out) {
+        uint8_t const* p = c->bytes();
+        uint8_t const* end = p + c->size;
+        uint64_t x = 0;
+        while(p < end) {
+#ifdef __SSE2__
+            if(end - p >= 16 && _mm_movemask_epi8(
+                _mm_loadu_si128((__m128i const*)p)) == 0) {
+                for(int i = 0; i < 16; i++) {
+                    uint64_t z = p[i];
+                    x += (z >> 1) ^ (0 - (z & 1));
+                    out[i] = (V)x;
+                }
+                p += 16;
+                out += 16;
+                continue;
+            }
+#endif
+            uint64_t z = 0;
+            int shift = 0;
+            while(*p & 0x80) {
+                z |= (uint64_t)(*p++ & 0x7f) << shift;
+                shift += 7;
+            }
+            z |= (uint64_t)*p++ << shift;
+            x += (z >> 1) ^ (0 - (z & 1));
+            *out++ = (V)x;
+        }
+    }
+};
+
+// Combiner over a packed_list, the compressed counterpart of 
+// posting_combiner for integer values. Use it with posting_container, 
+// whose map threads share a pool each; with the other containers every key 
+// gets a pool of its own, which only pays off for keys with long lists.
+template<typename V, template<class> class Allocator = std::allocator>
+class packed_combiner
+{
+public:
+    typedef packed_list<V, Allocator> list_type;
+    typedef typename list_type::chunk chunk;
+private:
+    typename list_type::pool_type* pool;
+    list_type data;
+public:
+    packed_combiner() : pool(NULL) {}
+
+    void add(V const& v) {
+        if(pool == NULL)
+            pool = new typename list_type::pool_type;
+        data.add(v, *pool);
+    }
+
+    bool empty() const {
+        return data.empty();
+    }
+
+    uint64_t count() const {
+        return data.count();
+    }
+
+    // Walks the packed lists of one key from all map threads. Values are 
+    // decoded a chunk at a time into a buffer and handed out from there.
+    class combined
+    {
+        std::vector< list_type const*, Allocator<list_type const*> > items;
+        mutable std::vector< V, Allocator<V> > decoded;
+        mutable unsigned int current_list;
+        mutable chunk const* current;   // chunk in decoded, if any
+        mutable unsigned int pos, stop; // values of it not handed out yet
+        // start of the slice and the number of values left in it
+        unsigned int first_list, first_index;
+        chunk const* first_chunk;
+        uint64_t skipped;
+        mutable uint64_t remaining;
+        uint64_t limit;
+
+        // decodes the next chunk with values in it
+        bool load() const {
+            chunk const* c = current == NULL ? first_chunk : current->next;
+            unsigned int index = current == NULL ? first_index : 0;
+            while(c == NULL || c->count == 0) {
+                if(c != NULL)
+                    c = c->next;
+                else if(current_list + 1 < items.size())
+                    c = items[++current_list]->first();
+                else
+                    return false;
+            }
+            if(decoded.size() < c->count)
+                decoded.resize(c->count);
+            list_type::decode(c, &decoded[0]);
+            current = c;
+            pos = index;
+            stop = c->count;
+            return true;
+        }
+    public:
+        combined() : current_list(0), current(NULL), pos(0), stop(0), 
+            first_list(0), first_index(0), first_chunk(NULL), skipped(0), 
+            remaining(~0ULL), limit(~0ULL) {}
+
+        void add(list_type const* l) {
+            if(items.empty())
+                first_chunk = l->first();
+            items.push_back(l);
+        }
+
+        void add(packed_combiner<V, Allocator> const* c) {
+            add(&c->data);
+        }
+
+        bool next(V& v) const {
+            if(remaining == 0 || (pos == stop && !load()))
+                return false;
+            v = decoded[pos++];
+            remaining--;
+            return true;
+        }
+
+        // the rest of the decoded chunk, see buffer_combiner
+        uint64_t next_batch(V const*& vals) const {
+            if(remaining == 0 || (pos == stop && !load()))
+                return 0;
+            uint64_t n = std::min<uint64_t>(remaining, stop - pos);
+            vals = &decoded[pos];
+            pos += n;
+            remaining -= n;
+            return n;
+        }
+
+        void reset() {
+            current_list = first_list;
+            current = NULL;
+            pos = stop = 0;
+            remaining = limit;
+        }
+
+        int size() const {
+            return items.size();
+        }
+
+        // number of values next() will return after a reset
+        uint64_t count() const {
+            uint64_t n = 0;
+            for(size_t i = 0; i < items.size(); i++)
+                n += items[i]->count();
+            return n > skipped ? std::min(n - skipped, limit) : 0;
+        }
+
+        // Restrict to values [begin, end) of the full sequence. Whole lists 
+        // and chunks are skipped by their counts without decoding.
+        void slice(uint64_t begin, uint64_t end) {
+            limit = end > begin ? end - begin : 0;
+            skipped = begin;
+            first_list = 0;
+            while(first_list < items.size() && 
+                begin >= items[first_list]->count())
+                begin -= items[first_list++]->count();
+            first_chunk = NULL;
+            if(first_list < items.size()) {
+                first_chunk = items[first_list]->first();
+                while(begin >= first_chunk->count) {
+                    begin -= first_chunk->count;
+                    first_chunk = first_chunk->next;
+                }
+            }
+            first_index = begin;
+            reset();
+        }
+
+        void clear() {
+            current_list = first_list = 0;
+            first_index = 0;
+            current = first_chunk = NULL;
+            pos = stop = 0;
+            skipped = 0;
+            remaining = limit = ~0ULL;
+            items.clear();
+        }
+    };
+
+    void combineinto(combined& m) const {
+        m.add(this);
+    }
+};
+
 #endif /* COMBINER_H_ */
 
 // vim: ts=8 sw=4 sts=4 smarttab smartindent
@@ -28,86 +28,225 @@
 #define CONTAINER_H_
 
 #include <tr1/unordered_map>
+#include <tr1/type_traits>
+#include <algorithm>
+#include <vector>
 #include <list>
 #include <map>
+#include <string.h>
+
+#include "stddefines.h"
+#include "atomic.h"
+#include "combiner.h"
+#include "sketch.h"
 
 // storage for flexible cardinality keys
+// Grows incrementally: when the load reaches one half, a table of twice the 
+// size is allocated and every later lookup moves a few slots of the old 
+// table over, so no single insert pays for copying the whole table. Entries 
+// not yet moved are found (and updated) in place in the old table. Slots are 
+// only constructed when used, so allocating a large table is cheap too.
 template<typename K, typename V, class Hash=std::tr1::hash<K>, 
     template<class> class Allocator = std::allocator>
 class hash_table
 {
 private:
     typedef std::pair<K, V> entry;
-    std::vector< entry, Allocator<entry> > table;
-    std::vector< bool, Allocator<bool> > occupied;
+    typedef Allocator<entry> entry_allocator;
+    typedef std::vector< bool, Allocator<bool> > bitmap;
+    entry* table;
+    bitmap occupied;
     Hash kh;
     uint64_t size;
     uint64_t load;
+
+    // table being drained, slots below cursor have been moved
+    entry* old_table;
+    bitmap old_occupied;
+    uint64_t old_size;
+    uint64_t cursor;
+
+    // old slots moved per lookup. Must be above 2 so the move finishes 
+    // before the new table fills up.
+    static const uint64_t rehash_step = 8;
+
+    static void release(entry* t, bitmap const& occ, uint64_t n) {
+        entry_allocator a;
+        for(uint64_t i = 0; i < n; i++) {
+            if(occ[i])
+                a.destroy(&t[i]);
+        }
+        if(t != NULL)
+            a.deallocate(t, n);
+    }
+
+    uint64_t probe(K const& key) const {
+        uint64_t index = kh(key) & (size-1);
+        while(occupied[index] && !(table[index].first == key)) {
+            index = (index+1) & (size-1);
+        }
+        return index;
+    }
+
+    void place(entry const& e) {
+        uint64_t index = probe(e.first);
+        entry_allocator().construct(&table[index], e);
+        occupied[index] = true;
+    }
+
+    void migrate(uint64_t slots) {
+        uint64_t end = std::min(old_size, cursor + slots);
+        for(; cursor < end; cursor++) {
+            if(old_occupied[cursor])
+                place(old_table[cursor]);
+        }
+        if(old_size > 0 && cursor == old_size) {
+            release(old_table, old_occupied, old_size);
+            bitmap().swap(old_occupied);
+            old_table = NULL;
+            old_size = 0;
+            cursor = 0;
+        }
+    }
+
+    void grow(uint64_t newsize) {
+        migrate(old_size);
+        old_table = table;
+        occupied.swap(old_occupied);
+        old_size = size;
+        cursor = 0;
+        table = entry_allocator().allocate(newsize);
+        bitmap(newsize, false).swap(occupied);
+        size = newsize;
+    }
+
+    void swap(hash_table& other) {
+        std::swap(table, other.table);
+        occupied.swap(other.occupied);
+        std::swap(size, other.size);
+        std::swap(load, other.load);
+        std::swap(old_table, other.old_table);
+        old_occupied.swap(other.old_occupied);
+        std::swap(old_size, other.old_size);
+        std::swap(cursor, other.cursor);
+    }
+
 public:
-    hash_table()
+    hash_table() : table(NULL), size(0), load(0), old_table(NULL), 
+        old_size(0), cursor(0)
     {
-        size = 0;
-        load = 0;
         rehash(256);
     }
+
+    // copies come out fully rehashed
+    hash_table(hash_table const& other) : table(NULL), size(0), load(0), 
+        old_table(NULL), old_size(0), cursor(0)
+    {
+        rehash(other.size);
+        for(const_iterator i = other.begin(); i != other.end(); ++i)
+            place(*i);
+        load = other.load;
+    }
+
+    hash_table& operator=(hash_table const& other)
+    {
+        hash_table copy(other);
+        swap(copy);
+        return *this;
+    }
     
     ~hash_table()
     {
+        release(table, occupied, size);
+        release(old_table, old_occupied, old_size);
     }
     
+    // Resize all at once.
     void rehash(uint64_t newsize) {
-        std::vector<entry, Allocator<entry> > newtable(newsize);
-        std::vector<bool, Allocator<bool> > newoccupied(newsize, false);
+        migrate(old_size);
+        entry* newtable = entry_allocator().allocate(newsize);
+        bitmap newoccupied(newsize, false);
         for(uint64_t i = 0; i < size; i++) {
             if(occupied[i]) {
                 uint64_t index = kh(table[i].first) & (newsize-1);
                 while(newoccupied[index])
                     index = (index+1) & (newsize-1);
-                newtable[index] = table[i];
+                entry_allocator().construct(&newtable[index], table[i]);
                 newoccupied[index] = true;
             }
         }
-        newtable.swap(table);
+        release(table, occupied, size);
+        table = newtable;
         newoccupied.swap(occupied);
         size = newsize;
     }
 
+    // Make room for keys entries without growing again.
+    void reserve(uint64_t keys) {
+        uint64_t newsize = 256;
+        while((newsize>>1) <= keys)
+            newsize <<= 1;
+        if(newsize > size)
+            rehash(newsize);
+    }
+
+    uint64_t count() const {
+        return load;
+    }
+
+    uint64_t capacity() const {
+        return size;
+    }
+
     V& operator[] (K const& key) 
     {
-        uint64_t index = kh(key) & (size-1);
-        while(occupied[index] && !(table[index].first == key)) {
-            index = (index+1) & (size-1);
+        if(old_size > 0) {
+            migrate(rehash_step);
+            if(old_size > 0) {
+                uint64_t index = kh(key) & (old_size-1);
+                while(old_occupied[index] && 
+                    !(old_table[index].first == key)) {
+                    index = (index+1) & (old_size-1);
+                }
+                if(old_occupied[index] && index >= cursor)
+                    return old_table[index].second;
+            }
         }
 
+        uint64_t index = probe(key);
         if(occupied[index])
             return table[index].second;
         else {
             load++;
             if(load >= size>>1) {
-                rehash(size<<1);
-                index = kh(key) & (size-1);
-                while(occupied[index] && !(table[index].first == key)) {
-                    index = (index+1) & (size-1);
-                }
+                grow(size<<1);
+                index = probe(key);
             }
-            table[index].first = key;
-            table[index].second = V();
+            entry_allocator().construct(&table[index], entry(key, V()));
             occupied[index] = true;
             return table[index].second;
         }
     }
 
+    // Visits the new table, then the old slots that have not been moved.
     class const_iterator {
         hash_table const* a;
         uint64_t index;
+
+        bool valid() const {
+            if(index < a->size)
+                return a->occupied[index];
+            uint64_t old = index - a->size;
+            return old >= a->cursor && a->old_occupied[old];
+        }
     public:
-        const_iterator(hash_table const& a, int index)
+        const_iterator(hash_table const& a, uint64_t index)
         {
             this->a = &a;
             this->index = index;
             
-            while(this->index < this->a->size && 
-                !this->a->occupied[this->index]) {
+            while(this->index < this->a->size + this->a->old_size && 
+                !valid()) {
                 this->index++;
             }
         }
@@ -115,16 +254,19 @@ public:
             return index != other.index;
         }
         const_iterator& operator++() {
-            if(index < a->size) {
+            uint64_t end = a->size + a->old_size;
+            if(index < end) {
                 index++;
-                while(index < a->size && !a->occupied[index]) {
+                while(index < end && !valid()) {
                     index++;
                 }
             }
             return *this;
         }
         entry const& operator*() {
-            return a->table[index];
+            if(index < a->size)
+                return a->table[index];
+            return a->old_table[index - a->size];
         }
     };
 
@@ -133,7 +275,7 @@ public:
     }
 
     const_iterator end() const {
-        return const_iterator(*this, size); 
+        return const_iterator(*this, size + old_size); 
     }
 };
 
@@ -150,42 +292,108 @@ public:
     typedef std::pair<K, Combiner<V, Allocator> > KCV;
 private:
     std::vector< KCV, Allocator<KCV> >* vals; 
+    uint64_t* weights;
     uint64_t in_size, out_size;
+
+    // Keys seen by each map thread are counted in a sketch that outlives 
+    // run(), so later runs on similar input start with tables of the 
+    // right size instead of growing them from 256 slots.
+    hyperloglog<>* sketches;
+    uint64_t* hints;            // expected keys per map thread
+    uint64_t reserved;          // lower bound from reserve()
+    uint64_t reduce_hint;       // expected keys per reduce task
+    uint64_t estimate;          // distinct keys of the previous run
 public:
 
     typedef hash_table<K, Combiner<V, Allocator>, Hash, Allocator > input_type;
+    typedef Combiner<V, Allocator> combiner_type;
     typedef typename Combiner<V, Allocator>::combined output_type;
 
-    hash_container() : vals(NULL), in_size(0), out_size(0) {}
+    hash_container() : vals(NULL), weights(NULL), in_size(0), out_size(0), 
+        sketches(NULL), hints(NULL), reserved(0), reduce_hint(0), 
+        estimate(0) {}
 
     void init(uint64_t in_size, uint64_t out_size)
     {
+        if(sketches != NULL && this->in_size == in_size) {
+            hyperloglog<> all;
+            for(uint64_t i = 0; i < in_size; i++) {
+                hints[i] = (uint64_t)sketches[i].estimate();
+                all.merge(sketches[i]);
+                sketches[i].clear();
+            }
+            estimate = (uint64_t)all.estimate();
+            reduce_hint = estimate / out_size;
+        } else {
+            delete [] sketches;
+            delete [] hints;
+            sketches = new hyperloglog<>[in_size];
+            hints = new uint64_t[in_size]();
+            reduce_hint = 0;
+            estimate = 0;
+        }
+
+        delete [] vals;
+        delete [] weights;
         this->in_size = in_size;
         this->out_size = out_size;
         vals = new std::vector< KCV, Allocator<KCV> >[in_size * out_size];
+        weights = new uint64_t[in_size * out_size]();
     }
  
     virtual ~hash_container() 
     {
         delete [] vals;
+        delete [] weights;
+        delete [] sketches;
+        delete [] hints;
+    }
+
+    // Hint that each map thread will see about keys distinct keys.
+    void reserve(uint64_t keys)
+    {
+        reserved = keys;
     }
+
+    // Keys the table of map thread in_index is sized for, and the distinct 
+    // keys of the previous run, which are 0 on the first run.
+    uint64_t expected_keys(uint64_t in_index) const
+    {
+        return std::max(reserved, hints[in_index]);
+    }
+    uint64_t estimated_keys() const { return estimate; }
     
     input_type get(uint64_t in_index)
     {
         input_type i;
+        i.reserve(expected_keys(in_index));
         return i;
     }
 
     void add(uint64_t in_index, input_type const& j)
     {
         Hash kh;
+        hyperloglog<>& sketch = sketches[in_index];
         for(typename input_type::const_iterator i = j.begin(); i != j.end(); ++i)
         {
-            if(!(*i).second.empty())
-                vals[(kh((*i).first)%out_size)*in_size + in_index].push_back(*i);
+            sketch.add(kh((*i).first));
+            if(!(*i).second.empty()) {
+                uint64_t out_index = kh((*i).first)%out_size;
+                vals[out_index*in_size + in_index].push_back(*i);
+                weights[in_index*out_size + out_index] += (*i).second.count();
+            }
         }
     }
 
+    // number of values reduce task out_index will see
+    uint64_t weight(uint64_t out_index) const
+    {
+        uint64_t w = 0;
+        for(uint64_t i = 0; i < in_size; i++)
+            w += weights[i*out_size + out_index];
+        return w;
+    }
+
     class iterator
     {
     private:
@@ -197,6 +405,9 @@ public:
     public:
         iterator(hash_container const* ac, uint64_t index) : ac(ac), index(index) 
         {
+            if(ac->reduce_hint > 0)
+                combined.rehash(ac->reduce_hint);
+
             // hash merge 
             for(uint64_t i = 0; i < ac->in_size; i++)
             {
@@ -228,79 +439,300 @@ public:
     }
 };
 
-// Storage for fixed cardinality keys
+// Storage for keys whose values are all kept, e.g. the documents a word or 
+// link occurs in. Each map thread appends values to per-key posting lists 
+// whose chunks come from a pool of its own, so emitting is a hash lookup and 
+// a store in the tail chunk: nothing is allocated per value and the lists 
+// are handed to reduce without being copied. With unique_values(true), a 
+// value equal to the one the map thread last emitted for the key is dropped, 
+// so a document that emits a key many times is listed once. Each reduce task 
+// splices the lists of a key together, so a task can only be iterated once 
+// per run. The pools are released when the container is initialized for the 
+// next run, so reduce must copy out anything it wants to keep. Lists of 
+// integers can be kept compressed by passing packed_combiner as the Combiner.
+template<typename K, typename V, class Hash = std::tr1::hash<K>, 
+    template<class> class Allocator = std::allocator,
+    template<typename, template<class> class> class Combiner = posting_combiner>
+class posting_container
+{
+public:
+    typedef K key_type;
+    typedef V value_type;
+    typedef typename Combiner<V, Allocator>::list_type list_type;
+    typedef typename list_type::pool_type pool_type;
+    typedef std::pair<K, list_type> KL;
+private:
+    std::vector< KL, Allocator<KL> >* vals; 
+    std::vector< KL, Allocator<KL> >* spliced;  // per reduce task
+    uint64_t* weights;
+    pool_type* pools;           // one per map thread
+    uint64_t in_size, out_size;
+    uint64_t reserved;          // lower bound from reserve()
+    bool unique;
+public:
+    // what emit_intermediate's i[k].add(v) appends through
+    class appender
+    {
+        list_type* l;
+        pool_type* pool;
+        bool unique;
+    public:
+        appender(list_type& l, pool_type& pool, bool unique) : 
+            l(&l), pool(&pool), unique(unique) {}
+        void add(V const& v) {
+            if(unique)
+                l->add_unique(v, *pool);
+            else
+                l->add(v, *pool);
+        }
+    };
+
+    class input_type
+    {
+        friend class posting_container;
+        hash_table<K, list_type, Hash, Allocator> table;
+        pool_type* pool;
+        bool unique;
+    public:
+        input_type() : pool(NULL), unique(false) {}
+        appender operator[](K const& key) {
+            return appender(table[key], *pool, unique);
+        }
+    };
+    typedef Combiner<V, Allocator> combiner_type;
+    typedef typename Combiner<V, Allocator>::combined output_type;
+
+    posting_container() : vals(NULL), spliced(NULL), weights(NULL), 
+        pools(NULL), in_size(0), out_size(0), reserved(0), unique(false) {}
+
+    void init(uint64_t in_size, uint64_t out_size)
+    {
+        delete [] vals;
+        delete [] spliced;
+        delete [] weights;
+        delete [] pools;
+        this->in_size = in_size;
+        this->out_size = out_size;
+        vals = new std::vector< KL, Allocator<KL> >[in_size * out_size];
+        spliced = new std::vector< KL, Allocator<KL> >[out_size];
+        weights = new uint64_t[in_size * out_size]();
+        pools = new pool_type[in_size];
+    }
+
+    virtual ~posting_container() 
+    {
+        delete [] vals;
+        delete [] spliced;
+        delete [] weights;
+        delete [] pools;
+    }
+
+    // Hint that each map thread will see about keys distinct keys.
+    void reserve(uint64_t keys)
+    {
+        reserved = keys;
+    }
+
+    // Drop repeats of the value last emitted for a key, see above.
+    void unique_values(bool unique)
+    {
+        this->unique = unique;
+    }
+
+    input_type get(uint64_t in_index)
+    {
+        input_type i;
+        i.table.reserve(reserved);
+        i.pool = &pools[in_index];
+        i.unique = unique;
+        return i;
+    }
+
+    void add(uint64_t in_index, input_type const& j)
+    {
+        Hash kh;
+        typedef hash_table<K, list_type, Hash, Allocator> table_type;
+        for(typename table_type::const_iterator i = j.table.begin(); 
+            i != j.table.end(); ++i)
+        {
+            if(!(*i).second.empty()) {
+                uint64_t out_index = kh((*i).first)%out_size;
+                vals[out_index*in_size + in_index].push_back(*i);
+                weights[in_index*out_size + out_index] += (*i).second.count();
+            }
+        }
+    }
+
+    // number of values reduce task out_index will see
+    uint64_t weight(uint64_t out_index) const
+    {
+        uint64_t w = 0;
+        for(uint64_t i = 0; i < in_size; i++)
+            w += weights[i*out_size + out_index];
+        return w;
+    }
+
+    class iterator
+    {
+    private:
+        typedef hash_table<K, list_type, Hash, Allocator> table_type;
+        std::vector< KL, Allocator<KL> > const* lists;
+        size_t i;
+    public:
+        // The lists a key has from each map thread are spliced into one, in 
+        // map thread order, so reduce walks a single chain per key. The 
+        // spliced lists are kept by the container until the next run, as 
+        // reduce may hold on to the values of a key past the task.
+        iterator(posting_container* pc, uint64_t index) : i(0)
+        {
+            uint64_t keys = 0;
+            for(uint64_t i = 0; i < pc->in_size; i++)
+                keys += pc->vals[index*pc->in_size + i].size();
+            table_type combined;
+            combined.reserve(keys);
+
+            for(uint64_t i = 0; i < pc->in_size; i++)
+            {
+                std::vector< KL, Allocator<KL> > const& iv = 
+                    pc->vals[index*pc->in_size + i];
+                for(size_t j = 0; j < iv.size(); j++)
+                    combined[iv[j].first].splice(iv[j].second);
+            }
+
+            std::vector< KL, Allocator<KL> >& out = pc->spliced[index];
+            out.clear();
+            out.reserve(keys);
+            for(typename table_type::const_iterator j = combined.begin(); 
+                j != combined.end(); ++j)
+                out.push_back(*j);
+            lists = &out;
+        }
+       
+        bool next(K& key, output_type& values)
+        {
+            if(i == lists->size())
+                return false;
+            key = (K)(*lists)[i].first;
+            values.clear();
+            values.add(&(*lists)[i].second);
+            ++i;
+            return true;
+        }
+    };
+
+    iterator begin(uint64_t out_index)
+    {
+        return iterator(this, out_index);
+    }
+};
+
+// Storage for fixed cardinality keys [0, N). Leave N at 0 to give the 
+// number of keys at run time instead, through the constructor or resize(). 
+// Each map thread emits straight into its own slice of combiners; slices are 
+// a cache line apart. Every reduce task walks a contiguous range of keys.
 template<typename K, typename V, 
-	template<typename, template<class> class> class Combiner, int N, 
+	template<typename, template<class> class> class Combiner, int N = 0, 
 	template<class> class Allocator = std::allocator>
 class array_container
 {
 private:
     Combiner<V, Allocator>* vals;
+    uint64_t* weights;
+    uint64_t keys, stride;
     uint64_t in_size, out_size;
+
+    // reduce task out_index gets keys [first_key(out_index), 
+    // first_key(out_index+1))
+    uint64_t first_key(uint64_t out_index) const
+    {
+        return keys * out_index / out_size;
+    }
 public:
 
     typedef K key_type;
     typedef V value_type;
     
     typedef Combiner<V, Allocator>* input_type;
+    typedef Combiner<V, Allocator> combiner_type;
     typedef typename Combiner<V, Allocator>::combined output_type;
 
-    array_container() : vals(NULL), in_size(0), out_size(0) {}
+    explicit array_container(uint64_t keys = N) : vals(NULL), weights(NULL), 
+        keys(keys), stride(0), in_size(0), out_size(0) {}
+
+    void resize(uint64_t keys)
+    {
+        this->keys = keys;
+    }
+
+    uint64_t size() const
+    {
+        return keys;
+    }
 
     void init(uint64_t in_size, uint64_t out_size)
     {
+        assert(keys > 0);
+        delete [] vals;
+        delete [] weights;
         this->in_size = in_size;
         this->out_size = out_size;
-        vals = new Combiner<V, Allocator>[this->in_size * N];
+        stride = keys + (L2_CACHE_LINE_SIZE + sizeof(combiner_type) - 1) / 
+            sizeof(combiner_type);
+        vals = new Combiner<V, Allocator>[in_size * stride];
+        weights = new uint64_t[in_size * out_size]();
     }
  
     virtual ~array_container() 
     {
         delete [] vals;
+        delete [] weights;
     }
 
 
     void add(uint64_t in_index, input_type const& j)
     {
-        for(uint64_t i = 0; i < N; ++i)
+        // map wrote in place, just record the task sizes
+        for(uint64_t i = 0; i < keys; ++i)
         {
-	    vals[i*in_size + in_index] = j[i];
+            weights[in_index*out_size + ((i+1)*out_size - 1) / keys] += 
+                j[i].count();
         }
-        delete [] j;
+    }
+
+    uint64_t weight(uint64_t out_index) const
+    {
+        uint64_t w = 0;
+        for(uint64_t i = 0; i < in_size; i++)
+            w += weights[i*out_size + out_index];
+        return w;
     }
 
     input_type get(uint64_t in_index)
     {
-	//switch to use allocator here...
-        input_type r = new Combiner<V, Allocator>[N];
-        for(uint64_t i = 0; i < N; ++i)
-        {
-	    r[i] = Combiner<V, Allocator>();
-        }
-        return r;
+        return &vals[in_index * stride];
     }
 
     class iterator
     {
     private:
         array_container<K, V, Combiner, N, Allocator> const* ac;
-        uint64_t index, i;
+        uint64_t i, end;
     public:
         iterator(array_container const* ac, uint64_t index) : 
-            ac(ac), index(index), i(index) {}
+            ac(ac), i(ac->first_key(index)), end(ac->first_key(index+1)) {}
        
         bool next(K& key, output_type& values)
         {
-            if(i >= N)
+            if(i >= end)
                 return false;
             key = (K)i;
             values.clear();
             for(size_t j = 0; j < ac->in_size; j++)
             {
-                if(!ac->vals[i*ac->in_size+j].empty())
-                    values.add(&ac->vals[i*ac->in_size+j]);
+                if(!ac->vals[j*ac->stride+i].empty())
+                    values.add(&ac->vals[j*ac->stride+i]);
             }
-            i += ac->in_size;	// XXX: in_size == num reduce threads
+            i++;
             return true;
         }
     };
@@ -313,33 +745,50 @@ public:
 
 // Unlocked storage, everyone writes to the same array. 
 // Assumes that only a single task needs to write to an entry.
+// As with array_container, N == 0 means the size is given at run time.
 template<typename K, typename V, 
-    template<typename, template<class> class> class Combiner, int N, 
+    template<typename, template<class> class> class Combiner, int N = 0, 
     template<class> class Allocator = std::allocator>
 class common_array_container
 {
 private:
     Combiner<V, Allocator>* vals;
+    uint64_t keys;
     uint64_t in_size, out_size;
+
+    uint64_t first_key(uint64_t out_index) const
+    {
+        return keys * out_index / out_size;
+    }
 public:
 
     typedef K key_type;
     typedef V value_type;
     
     typedef Combiner<V, Allocator>* input_type;
+    typedef Combiner<V, Allocator> combiner_type;
     typedef typename Combiner<V, Allocator>::combined output_type;
 
-    common_array_container() : vals(NULL), in_size(0), out_size(0) {}
+    explicit common_array_container(uint64_t keys = N) : vals(NULL), 
+        keys(keys), in_size(0), out_size(0) {}
+
+    void resize(uint64_t keys)
+    {
+        this->keys = keys;
+    }
+
+    uint64_t size() const
+    {
+        return keys;
+    }
 
     void init(uint64_t in_size, uint64_t out_size)
     {
+        assert(keys > 0);
+        delete [] vals;
         this->in_size = in_size;
         this->out_size = out_size;
-        vals = new Combiner<V, Allocator>[N];
-        for(uint64_t i = 0; i < N; ++i)
-        {
-	    vals[i] = Combiner<V, Allocator>();
-        }
+        vals = new Combiner<V, Allocator>[keys];
     }
  
     virtual ~common_array_container() 
@@ -357,23 +806,29 @@ public:
         return vals;
     }
 
+    // every key is written once, so count keys
+    uint64_t weight(uint64_t out_index) const
+    {
+        return first_key(out_index + 1) - first_key(out_index);
+    }
+
     class iterator
     {
     private:
         common_array_container<K, V, Combiner, N, Allocator> const* ac;
-        uint64_t index, i;
+        uint64_t i, end;
     public:
         iterator(common_array_container const* ac, uint64_t index) : 
-            ac(ac), index(index), i(index) {}
+            ac(ac), i(ac->first_key(index)), end(ac->first_key(index+1)) {}
        
         bool next(K& key, output_type& values)
         {
-            if(i >= N)
+            if(i >= end)
                 return false;
             key = (K)i;
             values.clear();
             values.add(&ac->vals[i]);
-            i += ac->in_size;
+            i++;
             return true;
         }
     };
@@ -385,8 +840,10 @@ public:
 };
 
 // Fixed width hash table from Phoenix 2
+// N is the number of buckets. As with array_container, N == 0 means it is 
+// given at run time.
 template<typename K, typename V, 
-    template<typename, template<class> class> class Combiner, int N, 
+    template<typename, template<class> class> class Combiner, int N = 0, 
     class Hash = std::tr1::hash<K>,
     template<class> class Allocator = std::allocator>
 class fixed_hash_container
@@ -400,12 +857,13 @@ private:
     {
     private:
         hash_bucket** buckets;
+        uint64_t size;
     public:    
 
-        hash_table() 
+        explicit hash_table(uint64_t size = N) : size(size)
         {
-            buckets = new hash_bucket*[N];
-            for(size_t i = 0; i < N; ++i)
+            buckets = new hash_bucket*[size];
+            for(size_t i = 0; i < size; ++i)
             {
                 // NOTE: These buckets will be freed during the reduce phase
                 buckets[i] = new hash_bucket();
@@ -420,7 +878,7 @@ private:
         Combiner<V, Allocator>& operator[] (K const& key) 
         {
             Hash kh;
-            hash_bucket* bucket = buckets[kh(key) % N];
+            hash_bucket* bucket = buckets[kh(key) % size];
             typename hash_bucket::iterator i;
 
             for(i = bucket->begin(); i != bucket->end(); ++i)
@@ -440,42 +898,82 @@ private:
         friend class fixed_hash_container;
     };
     
-    hash_table* hash_tables;
+    // in_size rows of num_buckets, NULL for threads that did not map
+    hash_bucket** tables;
+    uint64_t* weights;
+    uint64_t num_buckets;
     uint64_t in_size, out_size;
+
+    // reduce task out_index gets buckets [first_bucket(out_index), 
+    // first_bucket(out_index+1))
+    uint64_t first_bucket(uint64_t out_index) const
+    {
+        return num_buckets * out_index / out_size;
+    }
 public:    
 
     typedef K key_type;
     typedef V value_type;
 
     typedef hash_table input_type;
+    typedef Combiner<V, Allocator> combiner_type;
     typedef typename Combiner<V, Allocator>::combined output_type;
 
-    fixed_hash_container() : hash_tables(NULL), in_size(0), out_size(0) {}
+    explicit fixed_hash_container(uint64_t buckets = N) : tables(NULL), 
+        weights(NULL), num_buckets(buckets), in_size(0), out_size(0) {}
+
+    void resize(uint64_t buckets)
+    {
+        num_buckets = buckets;
+    }
+
+    uint64_t size() const
+    {
+        return num_buckets;
+    }
 
     void init(uint64_t in_size, uint64_t out_size)
     {
+        assert(num_buckets > 0);
+        delete [] tables;
+        delete [] weights;
         this->in_size = in_size;
         this->out_size = out_size;
-        hash_tables = new hash_table[in_size];
+        tables = new hash_bucket*[in_size * num_buckets]();
+        weights = new uint64_t[in_size * out_size]();
     }
  
     virtual ~fixed_hash_container() 
     {
-        delete [] hash_tables;
+        delete [] tables;
+        delete [] weights;
     }
 
     void add(uint64_t in_index, input_type const& j)
     {
-        hash_table& table = hash_tables[in_index];
+        hash_bucket** table = &tables[in_index * num_buckets];
+
+        for(uint64_t i = 0; i < num_buckets; ++i) {
+            table[i] = j.buckets[i];
 
-        for(int i = 0; i < N; ++i) {
-            table.buckets[i] = j.buckets[i];
+            uint64_t out_index = ((i+1) * out_size - 1) / num_buckets;
+            typename hash_bucket::const_iterator b;
+            for(b = j.buckets[i]->begin(); b != j.buckets[i]->end(); ++b)
+                weights[in_index*out_size + out_index] += b->second.count();
         }
     }
+
+    uint64_t weight(uint64_t out_index) const
+    {
+        uint64_t w = 0;
+        for(uint64_t i = 0; i < in_size; i++)
+            w += weights[i*out_size + out_index];
+        return w;
+    }
     
     input_type get(uint64_t in_index)
     {
-        input_type i;
+        input_type i(num_buckets);
         return i;
     }
     
@@ -487,43 +985,35 @@ public:
         uint64_t end_idx;
         std::tr1::unordered_map<K, output_type, Hash> combined;
         typename std::tr1::unordered_map<K, output_type, Hash>::const_iterator i;
+
+        hash_bucket* bucket(uint64_t in_index, uint64_t bucket_idx) const
+        {
+            return fc->tables[in_index * fc->num_buckets + bucket_idx];
+        }
     public:
         iterator(fixed_hash_container const* fc, uint64_t index) : fc(fc)
         {
-            if(index < N)
-            {
-                // Calculate bucket range
-                size_t buckets_per_task = N / fc->out_size;
-                if(buckets_per_task == 0) 
-                    buckets_per_task = 1;
-                size_t remainder = N % fc->out_size;
-                begin_idx = buckets_per_task * index;
-                if(index < remainder) {
-                    begin_idx += index;
-                } else {
-                    begin_idx += remainder;
-                }
-                end_idx = begin_idx + buckets_per_task;
-                if(index < remainder) {
-                    end_idx += 1;
-                }
+            // Calculate bucket range, empty when there are more reduce 
+            // tasks than buckets
+            begin_idx = fc->first_bucket(index);
+            end_idx = fc->first_bucket(index + 1);
                 
-                // hash merge 
-                for(size_t bucket_idx = begin_idx; bucket_idx < end_idx; 
-                    bucket_idx++)
+            // hash merge 
+            for(size_t bucket_idx = begin_idx; bucket_idx < end_idx; 
+                bucket_idx++)
+            {
+                for(uint64_t i = 0; i < fc->in_size; i++)
                 {
-                    for(uint64_t i = 0; i < fc->in_size; i++)
+                    hash_bucket* b = bucket(i, bucket_idx);
+                    if(b == NULL)
+                        continue;
+                    typename hash_bucket::iterator j;
+
+                    for(j = b->begin(); j != b->end(); j++)
                     {
-                        input_type& table = fc->hash_tables[i];
-                        hash_bucket* bucket = table.buckets[bucket_idx];
-                        typename hash_bucket::iterator j;
-
-                        for(j = bucket->begin(); j != bucket->end(); j++)
-                        {
-                            combined[j->first].add(&j->second);
-                        }
-                        
+                        combined[j->first].add(&j->second);
                     }
+                    
                 }
             }
             this->i = combined.begin();
@@ -546,11 +1036,510 @@ public:
             {
                 for(uint64_t i = 0; i < fc->in_size; i++)
                 {
-                    input_type& table = fc->hash_tables[i];
-                    hash_bucket* bucket = table.buckets[bucket_idx];
-                    delete bucket;
+                    delete bucket(i, bucket_idx);
+                }
+            }
+        }
+    };
+
+    iterator begin(uint64_t out_index)
+    {
+        return iterator(this, out_index);
+    }
+};
+
+// Plain per-thread accumulators for pure sums over the keys [0, N). Map adds 
+// straight into a cache line aligned V[N] instead of going through Combiner 
+// objects, and MapReduceDense adds the threads' arrays up with sum(). V must 
+// be an arithmetic type. The iterator only exists so the container also 
+// works with the generic reduce phase.
+template<typename K, typename V, int N>
+class dense_container
+{
+private:
+    char* vals;
+    uint64_t stride;        // bytes per thread, a multiple of a cache line
+    uint64_t in_size, out_size;
+
+    V* slice(uint64_t in_index) const
+    {
+        return (V*)(vals + in_index * stride);
+    }
+public:
+
+    typedef K key_type;
+    typedef V value_type;
+
+    typedef V* input_type;
+    typedef sum_combiner<V> combiner_type;
+    typedef typename combiner_type::combined output_type;
+
+    dense_container() : vals(NULL), stride(0), in_size(0), out_size(0) {}
+
+    void init(uint64_t in_size, uint64_t out_size)
+    {
+        if(vals == NULL || this->in_size != in_size)
+        {
+            free(vals);
+            stride = (N * sizeof(V) + L2_CACHE_LINE_SIZE - 1) & 
+                ~(uint64_t)(L2_CACHE_LINE_SIZE - 1);
+            CHECK_ERROR(posix_memalign((void**)&vals, L2_CACHE_LINE_SIZE, 
+                in_size * stride));
+        }
+        this->in_size = in_size;
+        this->out_size = out_size;
+        memset(vals, 0, in_size * stride);
+    }
+
+    virtual ~dense_container()
+    {
+        free(vals);
+    }
+
+    input_type get(uint64_t in_index)
+    {
+        return slice(in_index);
+    }
+
+    void add(uint64_t in_index, input_type const& j)
+    {
+        // map wrote in place
+    }
+
+    uint64_t weight(uint64_t out_index) const
+    {
+        return (uint64_t)N * (out_index + 1) / out_size - 
+            (uint64_t)N * out_index / out_size;
+    }
+
+    // Sum keys [begin, end) of all threads into the first thread's array, 
+    // pairing threads up in a tree. The inner loop vectorizes.
+    void sum(uint64_t begin, uint64_t end)
+    {
+        for(uint64_t step = 1; step < in_size; step <<= 1)
+        {
+            for(uint64_t t = 0; t + step < in_size; t += step << 1)
+            {
+                V* __restrict__ a = slice(t);
+                V const* __restrict__ b = slice(t + step);
+                for(uint64_t k = begin; k < end; k++)
+                    a[k] += b[k];
+            }
+        }
+    }
+
+    // valid for all keys after sum()
+    V const* totals() const
+    {
+        return slice(0);
+    }
+
+    class iterator
+    {
+    private:
+        dense_container const* dc;
+        uint64_t i, end;
+        combiner_type total;
+    public:
+        iterator(dense_container const* dc, uint64_t index) : dc(dc)
+        {
+            i = (uint64_t)N * index / dc->out_size;
+            end = (uint64_t)N * (index + 1) / dc->out_size;
+        }
+
+        bool next(K& key, output_type& values)
+        {
+            if(i >= end)
+                return false;
+            total = combiner_type();
+            for(uint64_t t = 0; t < dc->in_size; t++)
+                total.add(dc->slice(t)[i]);
+            key = (K)i++;
+            values.clear();
+            values.add(&total);
+            return true;
+        }
+    };
+
+    iterator begin(uint64_t out_index)
+    {
+        return iterator(this, out_index);
+    }
+};
+
+// Maps integral keys onto slots of a dense array. Other key types can never 
+// use the dense layout.
+template<typename K, bool Integral = std::tr1::is_integral<K>::value>
+struct dense_key
+{
+    static const bool enabled = true;
+    // wraps around for keys below base, so a single compare checks range
+    static uint64_t offset(K const& key, K const& base) {
+        return (uint64_t)key - (uint64_t)base;
+    }
+    static K at(K const& base, uint64_t offset) {
+        return (K)((uint64_t)base + offset);
+    }
+};
+
+template<typename K>
+struct dense_key<K, false>
+{
+    static const bool enabled = false;
+    static uint64_t offset(K const& key, K const& base) { return 0; }
+    static K at(K const& base, uint64_t offset) { return base; }
+};
+
+// Storage that picks its layout at run time. Each thread starts out 
+// emitting into an open addressing hash table while it tracks a HyperLogLog 
+// sketch and the min/max of the keys. The first thread to collect 
+// sample_emits values fixes the layout for the rest of the job:
+//  - DENSE: integral keys with a compact range go to a per-thread array 
+//           (keys outside the sampled range spill into the hash table),
+//  - SORT:  keys that rarely repeat are appended to a log that is sorted 
+//           and grouped once at the end of the map phase,
+//  - HASH:  everything else stays in the hash table.
+// Data emitted while sampling is converted when a thread switches over.
+// Keys must support operator< and operator==.
+template<typename K, typename V, 
+    template<typename, template<class> class> class Combiner, 
+    class Hash = std::tr1::hash<K>, 
+    template<class> class Allocator = std::allocator>
+class adaptive_container
+{
+public:
+    typedef K key_type;
+    typedef V value_type;
+    typedef std::pair<K, Combiner<V, Allocator> > KCV;
+    typedef Combiner<V, Allocator> combiner_type;
+    typedef typename Combiner<V, Allocator>::combined output_type;
+
+    enum storage_mode { SAMPLING = 0, DENSE, HASH, SORT };
+
+    // Tunables
+    static const uint64_t sample_emits = 16384;   // emits per thread sample
+    static const uint64_t dense_max_keys = 1<<20; // cap on all dense arrays
+    static const uint64_t dense_small_range = 1024; // always dense below
+    static const uint64_t dense_min_fill = 8;     // max range per sampled key
+
+private:
+    typedef hash_table<K, Combiner<V, Allocator>, Hash, Allocator> table_type;
+    typedef std::pair<K, V> KV;
+
+    struct thread_state
+    {
+        int mode;
+        uint64_t emits;
+        Combiner<V, Allocator>* dense;
+        table_type table;       // sample, hash storage or dense overflow
+        std::vector< KV, Allocator<KV> > log;
+        hyperloglog<> sketch;
+        K min, max;
+        char pad[L2_CACHE_LINE_SIZE];
+
+        thread_state() : mode(SAMPLING), emits(0), dense(NULL) {}
+        ~thread_state() { delete [] dense; }
+    };
+
+    struct key_less {
+        bool operator()(KV const& a, KV const& b) const { 
+            return a.first < b.first; 
+        }
+    };
+
+    thread_state* threads;
+    std::vector< KCV, Allocator<KCV> >* vals;
+    uint64_t* weights;
+    uint64_t in_size, out_size;
+
+    volatile uintptr_t mode;    // global decision, SAMPLING until made
+    uintptr_t deciding;
+    K base;                     // dense key range is [base, base+span)
+    uint64_t span;
+    uint64_t estimated_keys;
+
+    void clear()
+    {
+        delete [] threads;
+        delete [] vals;
+        delete [] weights;
+        threads = NULL;
+        vals = NULL;
+        weights = NULL;
+    }
+
+    uint64_t partition(K const& key) const
+    {
+        Hash kh;
+        return kh(key) % out_size;
+    }
+
+    void push(uint64_t in_index, KCV const& kcv)
+    {
+        uint64_t out_index = partition(kcv.first);
+        vals[out_index*in_size + in_index].push_back(kcv);
+        weights[in_index*out_size + out_index] += kcv.second.count();
+    }
+
+    void insert(thread_state& s, K const& key, V const& v)
+    {
+        switch(s.mode)
+        {
+        case DENSE: {
+            uint64_t slot = dense_key<K>::offset(key, base);
+            if(slot < span)
+                s.dense[slot].add(v);
+            else
+                s.table[key].add(v);
+            break;
+        }
+        case HASH:
+            s.table[key].add(v);
+            break;
+        case SORT:
+            s.log.push_back(KV(key, v));
+            break;
+        default: {
+            Hash kh;
+            s.table[key].add(v);
+            s.sketch.add(kh(key));
+            if(dense_key<K>::enabled) {
+                if(s.emits == 0 || key < s.min) s.min = key;
+                if(s.emits == 0 || s.max < key) s.max = key;
+            }
+            if(++s.emits >= sample_emits || mode != SAMPLING)
+                adopt(s);
+            break;
+        }
+        }
+    }
+
+    // Make the global decision if nobody has yet, then switch this thread.
+    void adopt(thread_state& s)
+    {
+        if(mode == SAMPLING && cmp_and_swp(1, &deciding, 0))
+            decide(s);
+        while(mode == SAMPLING)
+            spin_wait(64);
+        convert(s, (int)mode);
+    }
+
+    void decide(thread_state const& s)
+    {
+        uint64_t keys = std::max((uint64_t)1, (uint64_t)s.sketch.estimate());
+        int m = HASH;
+
+        if(dense_key<K>::enabled && s.emits > 0)
+        {
+            // a range of 0 means the keys cover all 64 bits
+            uint64_t range = dense_key<K>::offset(s.max, s.min) + 1;
+            if(range != 0 && range * in_size <= dense_max_keys &&
+                (range <= dense_small_range || range <= keys * dense_min_fill))
+            {
+                m = DENSE;
+                base = s.min;
+                span = range;
+            }
+        }
+        if(m != DENSE && keys * 2 >= s.emits)
+            m = SORT;
+
+        estimated_keys = keys;
+        asm("" ::: "memory");
+        mode = m;
+
+#ifdef TIMING
+        fprintf(stderr, "adaptive container: %s storage "
+            "(~%llu keys in %llu sampled emits)\n", mode_name(m),
+            (unsigned long long)keys, (unsigned long long)s.emits);
+#endif
+    }
+
+    void convert(thread_state& s, int m)
+    {
+        s.mode = m;
+        if(m == DENSE)
+        {
+            s.dense = new Combiner<V, Allocator>[span];
+            table_type overflow;
+            for(typename table_type::const_iterator i = s.table.begin(); 
+                i != s.table.end(); ++i)
+            {
+                uint64_t slot = dense_key<K>::offset((*i).first, base);
+                if(slot < span)
+                    s.dense[slot] = (*i).second;
+                else
+                    overflow[(*i).first] = (*i).second;
+            }
+            s.table = overflow;
+        }
+        // HASH keeps using the sample table. SORT flushes it in add().
+    }
+
+public:
+    class entry
+    {
+        adaptive_container* c;
+        thread_state* s;
+        K const& key;
+    public:
+        entry(adaptive_container* c, thread_state* s, K const& key) : 
+            c(c), s(s), key(key) {}
+        void add(V const& v) { c->insert(*s, key, v); }
+    };
+
+    // per-thread handle passed to map
+    class table
+    {
+        adaptive_container* c;
+        thread_state* s;
+    public:
+        table() : c(NULL), s(NULL) {}
+        table(adaptive_container* c, thread_state* s) : c(c), s(s) {}
+        entry operator[](K const& key) { return entry(c, s, key); }
+    };
+
+    typedef table input_type;
+
+    adaptive_container() : threads(NULL), vals(NULL), weights(NULL), 
+        in_size(0), out_size(0), mode(SAMPLING), deciding(0), span(0), 
+        estimated_keys(0) {}
+
+    void init(uint64_t in_size, uint64_t out_size)
+    {
+        clear();
+        this->in_size = in_size;
+        this->out_size = out_size;
+        threads = new thread_state[in_size];
+        vals = new std::vector< KCV, Allocator<KCV> >[in_size * out_size];
+        weights = new uint64_t[in_size * out_size]();
+        mode = SAMPLING;
+        deciding = 0;
+        span = 0;
+        estimated_keys = 0;
+    }
+
+    virtual ~adaptive_container()
+    {
+        clear();
+    }
+
+    input_type get(uint64_t in_index)
+    {
+        return input_type(this, &threads[in_index]);
+    }
+
+    void add(uint64_t in_index, input_type const& j)
+    {
+        thread_state& s = threads[in_index];
+        if(s.mode == SAMPLING)
+            adopt(s);
+
+        for(typename table_type::const_iterator i = s.table.begin(); 
+            i != s.table.end(); ++i)
+        {
+            if(!(*i).second.empty())
+                push(in_index, *i);
+        }
+
+        if(s.mode == DENSE)
+        {
+            // the iterator hands out contiguous slot ranges
+            for(uint64_t slot = 0; slot < span; slot++)
+                weights[in_index*out_size + 
+                    ((slot+1)*out_size - 1) / span] += s.dense[slot].count();
+        }
+
+        if(s.mode == SORT)
+        {
+            std::stable_sort(s.log.begin(), s.log.end(), key_less());
+            for(size_t i = 0; i < s.log.size(); )
+            {
+                KCV kcv(s.log[i].first, Combiner<V, Allocator>());
+                size_t j = i;
+                for(; j < s.log.size() && s.log[j].first == s.log[i].first; 
+                    j++)
+                    kcv.second.add(s.log[j].second);
+                push(in_index, kcv);
+                i = j;
+            }
+            std::vector< KV, Allocator<KV> >().swap(s.log);
+        }
+    }
+
+    uint64_t weight(uint64_t out_index) const
+    {
+        uint64_t w = 0;
+        for(uint64_t i = 0; i < in_size; i++)
+            w += weights[i*out_size + out_index];
+        return w;
+    }
+
+    storage_mode storage() const { return (storage_mode)mode; }
+    uint64_t estimated_cardinality() const { return estimated_keys; }
+
+    static char const* mode_name(int m)
+    {
+        switch(m) {
+            case DENSE: return "dense array";
+            case HASH: return "hash";
+            case SORT: return "sort";
+            default: return "sampling";
+        }
+    }
+
+    class iterator
+    {
+    private:
+        adaptive_container const* ac;
+        uint64_t slot, end;     // dense slots left to visit
+        std::tr1::unordered_map<K, output_type, Hash, std::equal_to<K>, 
+            Allocator<std::pair<const K, output_type> > > combined;
+        typename std::tr1::unordered_map<K, output_type, Hash >::const_iterator i;
+    public:
+        iterator(adaptive_container const* ac, uint64_t index) : 
+            ac(ac), slot(0), end(0)
+        {
+            if(ac->mode == DENSE)
+            {
+                // contiguous key range per reduce task
+                slot = ac->span * index / ac->out_size;
+                end = ac->span * (index + 1) / ac->out_size;
+            }
+
+            // hash merge 
+            for(uint64_t i = 0; i < ac->in_size; i++)
+            {
+                std::vector< KCV, Allocator<KCV> > const& iv = 
+                    ac->vals[index*ac->in_size + i];
+                for(size_t j = 0; j < iv.size(); j++)
+                    combined[iv[j].first].add(&iv[j].second);
+            }
+            this->i = combined.begin();
+        }
+
+        bool next(K& key, output_type& values)
+        {
+            while(slot < end)
+            {
+                values.clear();
+                for(uint64_t j = 0; j < ac->in_size; j++)
+                {
+                    thread_state const& s = ac->threads[j];
+                    if(s.dense != NULL && !s.dense[slot].empty())
+                        values.add(&s.dense[slot]);
                 }
+                key = dense_key<K>::at(ac->base, slot++);
+                if(values.size() > 0)
+                    return true;
             }
+
+            if(i == combined.end())
+                return false;
+            key = (K)i->first;
+            values = i->second;
+            ++i;
+            return true;
         }
     };
 
@@ -29,6 +29,7 @@
 
 #include <assert.h>
 #include <algorithm>
+#include <functional>
 #include <vector>
 #include <queue>
 #include <limits>
@@ -42,6 +43,8 @@
 #include "container.h"
 #include "locality.h"
 #include "thread_pool.h"
+#include "runtime.h"
+#include "synch.h"
 
 template<typename Impl, typename D, typename K, typename V, 
     class Container = hash_container<K, V, buffer_combiner> >
@@ -57,6 +60,7 @@ public:
 
     typedef typename container_type::input_type map_container;
     typedef typename container_type::output_type reduce_iterator; 
+    typedef typename container_type::combiner_type reduce_combiner;
  
     struct keyval
     {
@@ -64,13 +68,23 @@ public:
         value_type val;
     };
 
+    // A key with enough values to be reduced in slices on several threads.
+    struct hot_key
+    {
+        key_type key;
+        reduce_iterator values;
+        uint64_t parts;
+        std::vector<keyval>* partials;  // one output vector per slice
+    };
+
 protected:
 
     // Parameters.
     uint64_t num_threads;               // # of threads to run.
     uint64_t thread_offset;             // cores to skip when assigning threads.
 
-    thread_pool* threadPool;            // Thread pool.
+    thread_pool* threadPool;            // Own thread pool, if any.
+    runtime::job* job;                  // This job on the shared runtime.
     task_queue* taskQueue;              // Queues of tasks.
 
     container_type container; 
@@ -79,9 +93,25 @@ protected:
     uint64_t num_map_tasks;
     uint64_t num_reduce_tasks;
 
+    // Skew handling. Reduce is over-partitioned so that large partitions 
+    // can be balanced against small ones, and keys with more values than 
+    // hot_key_values are split across threads if reduce is associative.
+    uint64_t reduce_tasks_per_thread;
+    uint64_t hot_key_min_values;        // never split keys smaller than this
+    uint64_t hot_key_values;            // 0 disables splitting
+    std::vector<hot_key>* hot_keys;     // per thread, found during reduce
+
+    // Set while run() maps the chunks of split(), which map workers take 
+    // one at a time under split_lock as they run out of work.
+    lock* split_lock;
+    bool split_done;
+
+    bool next_split(data_type& chunk, thread_loc const& loc);
+
     virtual void run_map(data_type* data, uint64_t len);
     virtual void run_reduce();
     virtual void run_merge();
+    void run_hot_keys();
     
     virtual void map_worker(
         thread_loc const& loc, double& time, double& user_time, int& tasks);
@@ -89,6 +119,8 @@ protected:
         thread_loc const& loc, double& time, double& user_time, int& tasks);
     virtual void merge_worker(
         thread_loc const& loc, double& time, double& user_time, int& tasks);
+    void hot_key_worker(
+        thread_loc const& loc, double& time, double& user_time, int& tasks);
 
     // Data passed to the callback functions.
     struct thread_arg_t
@@ -113,23 +145,36 @@ protected:
         thread_arg_t* t = (thread_arg_t*)arg; 
         t->mr->merge_worker(loc, t->time, t->user_time, t->tasks); 
     }
+    static void hot_key_callback(void* arg, thread_loc const& loc) { 
+        thread_arg_t* t = (thread_arg_t*)arg; 
+        t->mr->hot_key_worker(loc, t->time, t->user_time, t->tasks); 
+    }
     void start_workers (void (*callback)(void*, thread_loc const&), 
         int num_threads, char const* stage);    
     
     // the default split function...
     int split(data_type &a) { return 0; }
 
-    // the default map function...
+    // the default map function... map may also take a data_type& and
+    // update the element. run(data, count, result) hands map the caller's
+    // elements in place, so state kept in them is still there when the
+    // same array is passed to the next run() (e.g. iterative algorithms).
+    // run(result) maps a local copy of each chunk split() fills in, and
+    // anything map writes to it is thrown away with the copy.
     void map(data_type const& a, map_container& m) const {}
     
     // the default reduce function...
     void reduce(key_type const& key, reduce_iterator const& values, 
         std::vector<keyval>& out) const {
-        value_type val;
-        while (values.next(val))
+        value_type const* vals;
+        uint64_t len;
+        while ((len = values.next_batch(vals)) > 0)
         {
-            keyval kv = {key, val};
-            out.push_back(kv);
+            for (uint64_t i = 0; i < len; i++)
+            {
+                keyval kv = {key, vals[i]};
+                out.push_back(kv);
+            }
         }
     }
 
@@ -138,22 +183,32 @@ protected:
         return (void*)data;
     }
 
+    // by default reduce is not assumed to be associative. Return true if 
+    // reduce emits a single value per key and gives the same result when 
+    // run again over its own partial results (e.g. a sum); large keys are 
+    // then reduced in slices whose outputs are reduced once more.
+    bool reduce_associative() const { return false; }
+
 public:
 
-    MapReduce() : threadPool(NULL), taskQueue(NULL) {
-        // Determine the number of threads to use. 
-        // First check for an environment variable, then use the 
-        // number of processors
-        int threads = atoi(GETENV("MR_NUMTHREADS"));
-        setThreads(threads > 0 ? threads : proc_get_num_cpus(), 0);
+    MapReduce() : threadPool(NULL), taskQueue(NULL), 
+        reduce_tasks_per_thread(16), hot_key_min_values(1<<16), 
+        hot_key_values(0), hot_keys(NULL), split_lock(NULL) {
+        // Jobs run on the threads of the shared runtime, which has as many 
+        // as MR_NUMTHREADS or the number of processors.
+        this->job = runtime::shared().attach();
+        setThreads(runtime::shared().size(), 0);
     }
 
     virtual ~MapReduce() {
         if(this->threadPool != NULL) delete this->threadPool;
         if(this->taskQueue != NULL) delete this->taskQueue;
+        runtime::shared().detach(this->job);
     }
 
-    // override the default thread offset and thread count.
+    // override the default thread count. Without a policy the job keeps 
+    // running on the shared runtime, with num_threads workers per phase; 
+    // with one it gets a thread pool of its own pinned by the policy.
     MapReduce& setThreads(int num_threads, sched_policy const* policy = NULL) {
         this->num_threads = (num_threads > 0) ? num_threads : this->num_threads;
         
@@ -161,11 +216,26 @@ public:
         if(this->taskQueue != NULL) delete this->taskQueue;
 
         // Create thread pool and task queue
-        sched_policy_strand_fill default_policy(0);
-        this->threadPool = new thread_pool(
-            num_threads, policy == NULL ? &default_policy : policy);
-        this->taskQueue = new task_queue(num_threads, num_threads);
+        this->threadPool = policy == NULL ? NULL : 
+            new thread_pool(this->num_threads, policy);
+        this->taskQueue = new task_queue(this->num_threads, this->num_threads);
+
+        return *this;
+    }
+
+    // Number of reduce tasks per thread (16 by default), and the fewest 
+    // values a key must have to be split when reduce is associative.
+    MapReduce& setReduceTasks(uint64_t per_thread, 
+        uint64_t hot_key_min_values = 1<<16) {
+        this->reduce_tasks_per_thread = std::max<uint64_t>(per_thread, 1);
+        this->hot_key_min_values = std::max<uint64_t>(hot_key_min_values, 1);
+        return *this;
+    }
 
+    // Share of the shared runtime's threads while other jobs run: weight 
+    // relative to theirs, and priority over jobs with a lower one.
+    MapReduce& setShare(int weight, int priority = 0) {
+        runtime::shared().set_share(this->job, weight, priority);
         return *this;
     }
     
@@ -179,7 +249,9 @@ public:
      */
     int run(data_type *data, uint64_t count, std::vector<keyval>& result);
 
-    // This version assumes that the split function is provided.
+    // This version assumes that the split function is provided. Chunks 
+    // are mapped as soon as split() returns them. split() is never called
+    // by two threads at once, nor again after it returned 0.
     int run(std::vector<keyval>& result);
 
     void emit_intermediate(typename container_type::input_type& i, 
@@ -192,21 +264,16 @@ template<typename Impl, typename D, typename K, typename V, class Container>
 int MapReduce<Impl, D, K, V, Container>::
 run (std::vector<keyval>& result)
 {
-    timespec begin;    
-    std::vector<D> data;
-    uint64_t count;
-    D chunk;
+    // Map workers split the input themselves, see run_map.
+    this->split_lock = new lock(this->num_threads);
+    this->split_done = false;
 
-    // Run splitter to generate chunks
-    get_time (begin);
-    while (static_cast<Impl const*>(this)->split(chunk))
-    {
-        data.push_back(chunk);
-    }
-    count = data.size();
-    print_time_elapsed("split phase", begin);
+    int ret = run(NULL, 0, result);
+
+    delete this->split_lock;
+    this->split_lock = NULL;
 
-    return run(&data[0], count, result);
+    return ret;
 }
 
 template<typename Impl, typename D, typename K, typename V, class Container>
@@ -221,9 +288,9 @@ run (D *data, uint64_t count, std::vector<keyval>& result)
     // Compute task counts (should make this more adjustable) and then 
     // allocate storage
     this->num_map_tasks = std::min(count, this->num_threads) * 16;
-    this->num_reduce_tasks = this->num_threads;
-    dprintf ("num_map_tasks = %d\n", num_map_tasks);
-    dprintf ("num_reduce_tasks = %d\n", num_reduce_tasks);
+    this->num_reduce_tasks = this->num_threads * this->reduce_tasks_per_thread;
+    dprintf ("num_map_tasks = %llu\n", (unsigned long long)num_map_tasks);
+    dprintf ("num_reduce_tasks = %llu\n", (unsigned long long)num_reduce_tasks);
 
     container.init(this->num_threads, this->num_reduce_tasks);
     this->final_vals = new std::vector<keyval>[this->num_threads];
@@ -235,7 +302,7 @@ run (D *data, uint64_t count, std::vector<keyval>& result)
 
     // Run map tasks and get intermediate values
     get_time (begin);
-    run_map(&data[0], count);
+    run_map(data, count);
     print_time_elapsed("map phase", begin);
 
     dprintf("In scheduler, all map tasks are done, now scheduling reduce tasks\n");
@@ -268,9 +335,15 @@ template<typename Impl, typename D, typename K, typename V, class Container>
 void MapReduce<Impl, D, K, V, Container>::
 run_map (data_type* data, uint64_t count)
 {
+    if (this->split_lock != NULL) {
+        // Chunks come from split(), as workers ask for them.
+        start_workers (&map_callback, num_threads, "map");
+        return;
+    }
+
     // Compute map task chunk size
-    uint64_t chunk_size = 
-        std::max(1, (int)ceil((double)count / this->num_map_tasks));
+    uint64_t tasks = std::max<uint64_t>(this->num_map_tasks, 1);
+    uint64_t chunk_size = std::max<uint64_t>(1, (count + tasks - 1) / tasks);
     
     // Generate tasks by splitting input data and add to queue.
     for(uint64_t i = 0; i < this->num_map_tasks; i++)
@@ -301,6 +374,14 @@ map_worker(thread_loc const& loc, double& time, double& user_time, int& tasks)
 {
     timespec begin = get_time();
     typename container_type::input_type t = container.get(loc.thread);    
+    data_type chunk;
+    while (this->split_lock != NULL && next_split (chunk, loc)) {
+        tasks++;
+        timespec user_begin = get_time();
+        static_cast<Impl const*>(this)->map(chunk, t);
+        user_time += time_elapsed(user_begin);
+    }
+
     task_queue::task_t task;
     while (taskQueue->dequeue (task, loc)) {
         tasks++;
@@ -316,20 +397,61 @@ map_worker(thread_loc const& loc, double& time, double& user_time, int& tasks)
     time += time_elapsed(begin);
 }
 
+/**
+ * Take the next chunk from split(). Returns false once the input is done.
+ */
+template<typename Impl, typename D, typename K, typename V, class Container>
+bool MapReduce<Impl, D, K, V, Container>::
+next_split (data_type& chunk, thread_loc const& loc)
+{
+    split_lock->acquire(loc.thread);
+    bool ret = !split_done && static_cast<Impl*>(this)->split(chunk);
+    if (!ret)
+        split_done = true;
+    split_lock->release(loc.thread);
+    return ret;
+}
+
 /**
  * Run reduce tasks and get final values. 
  */
 template<typename Impl, typename D, typename K, typename V, class Container>
 void MapReduce<Impl, D, K, V, Container>::run_reduce ()
 {
-    // Create tasks and enqueue...
+    // Sizes are known now that map is done. Hand out tasks largest first, 
+    // each to the queue with the least work so far.
+    std::vector<std::pair<uint64_t, uint64_t> > order(this->num_reduce_tasks);
+    uint64_t total = 0;
     for (uint64_t i = 0; i < this->num_reduce_tasks; ++i) {
-        task_queue::task_t task = {    i, 0, i, 0 };
-        this->taskQueue->enqueue_seq(task, this->num_reduce_tasks);
+        order[i] = std::make_pair(container.weight(i), i);
+        total += order[i].first;
     }
+    std::sort(order.begin(), order.end(), 
+        std::greater<std::pair<uint64_t, uint64_t> >());
+
+    std::vector<uint64_t> load(this->num_threads, 0);
+    for (uint64_t i = 0; i < this->num_reduce_tasks; ++i) {
+        int queue = std::min_element(load.begin(), load.end()) - load.begin();
+        // count empty tasks too so they are spread out
+        load[queue] += order[i].first + 1;
+        task_queue::task_t task = { i, 0, order[i].second, 0 };
+        this->taskQueue->enqueue_seq(task, this->num_reduce_tasks, queue);
+    }
+
+    // Keys bigger than an average task are worth splitting.
+    this->hot_key_values = 0;
+    if (static_cast<Impl const*>(this)->reduce_associative())
+        this->hot_key_values = std::max(this->hot_key_min_values, 
+            total / this->num_reduce_tasks);
+    this->hot_keys = new std::vector<hot_key>[this->num_threads];
 
     start_workers (&reduce_callback, 
         std::min(this->num_reduce_tasks, num_threads), "reduce");
+
+    run_hot_keys();
+
+    delete [] this->hot_keys;
+    this->hot_keys = NULL;
 }
 
 /**
@@ -354,9 +476,96 @@ void MapReduce<Impl, D, K, V, Container>::reduce_worker (
         while(i.next(key, values))
         {
             if(values.size() > 0)
-                static_cast<Impl const*>(this)->reduce(
-                    key, values, this->final_vals[loc.thread]);
+            {
+                if(this->hot_key_values > 0 && 
+                    values.count() > this->hot_key_values)
+                {
+                    // defer to run_hot_keys
+                    hot_key h = { key, values, 0, NULL };
+                    this->hot_keys[loc.thread].push_back(h);
+                }
+                else
+                    static_cast<Impl const*>(this)->reduce(
+                        key, values, this->final_vals[loc.thread]);
+            }
+        }
+        user_time += time_elapsed(user_begin);
+    }
+
+    time += time_elapsed(begin);
+}
+
+/**
+ * Reduce the keys deferred by reduce_worker in slices spread over all 
+ * threads, then reduce the partial results of each key.
+ */
+template<typename Impl, typename D, typename K, typename V, class Container>
+void MapReduce<Impl, D, K, V, Container>::run_hot_keys ()
+{
+    std::vector<hot_key> hot;
+    for (uint64_t i = 0; i < this->num_threads; ++i)
+        hot.insert(hot.end(), this->hot_keys[i].begin(), 
+            this->hot_keys[i].end());
+    if (hot.empty())
+        return;
+
+    uint64_t num_tasks = 0;
+    for (size_t h = 0; h < hot.size(); ++h) {
+        uint64_t count = hot[h].values.count();
+        hot[h].parts = std::min(this->num_threads, 
+            (count + this->hot_key_values - 1) / this->hot_key_values);
+        hot[h].parts = std::max(hot[h].parts, (uint64_t)1);
+        hot[h].partials = new std::vector<keyval>[hot[h].parts];
+        num_tasks += hot[h].parts;
+    }
+
+    uint64_t id = 0;
+    for (size_t h = 0; h < hot.size(); ++h) {
+        for (uint64_t part = 0; part < hot[h].parts; ++part, ++id) {
+            task_queue::task_t task = { id, part, (uint64_t)&hot[h], 0 };
+            this->taskQueue->enqueue_seq(task, num_tasks);
+        }
+    }
+
+    dprintf("Splitting %d hot keys into %d reduce tasks\n", 
+        (int)hot.size(), (int)num_tasks);
+    start_workers (&hot_key_callback, 
+        std::min(num_tasks, this->num_threads), "hot key reduce");
+
+    for (size_t h = 0; h < hot.size(); ++h) {
+        reduce_combiner partial;
+        for (uint64_t part = 0; part < hot[h].parts; ++part) {
+            for (size_t j = 0; j < hot[h].partials[part].size(); ++j)
+                partial.add(hot[h].partials[part][j].val);
         }
+        delete [] hot[h].partials;
+
+        if (!partial.empty()) {
+            reduce_iterator values;
+            values.add(&partial);
+            static_cast<Impl const*>(this)->reduce(hot[h].key, values, 
+                this->final_vals[h % this->num_threads]);
+        }
+    }
+}
+
+template<typename Impl, typename D, typename K, typename V, class Container>
+void MapReduce<Impl, D, K, V, Container>::hot_key_worker (
+    thread_loc const& loc, double& time, double& user_time, int& tasks)
+{
+    timespec begin = get_time();
+
+    task_queue::task_t task;
+    while (taskQueue->dequeue (task, loc)) {
+        tasks++;
+        hot_key& h = *(hot_key*)task.data;
+        uint64_t part = task.len;
+
+        timespec user_begin = get_time();
+        reduce_iterator values = h.values;
+        uint64_t count = values.count();
+        values.slice(count * part / h.parts, count * (part + 1) / h.parts);
+        static_cast<Impl const*>(this)->reduce(h.key, values, h.partials[part]);
         user_time += time_elapsed(user_begin);
     }
 
@@ -406,12 +615,19 @@ void MapReduce<Impl, D, K, V, Container>::start_workers (void (*func)(void*, thr
         th_arg_ptrarray[thread] = &(th_arg_array[thread]);        
     }
     
-    CHECK_ERROR (threadPool->set(func, (void **)th_arg_ptrarray, num_threads));
-    // Start worker threads
-    CHECK_ERROR (threadPool->begin());                
-    dprintf("Status: All %d threads have been created\n", num_threads);    
-    // Barrier, wait for all threads to finish.
-    CHECK_ERROR (threadPool->wait());            
+    if (threadPool != NULL) {
+        CHECK_ERROR (threadPool->set(func, (void **)th_arg_ptrarray, num_threads));
+        // Start worker threads
+        CHECK_ERROR (threadPool->begin());                
+        dprintf("Status: All %d threads have been created\n", num_threads);    
+        // Barrier, wait for all threads to finish.
+        CHECK_ERROR (threadPool->wait());            
+    }
+    else {
+        // Returns once all workers are done.
+        CHECK_ERROR (runtime::shared().run(this->job, func, 
+            (void **)th_arg_ptrarray, num_threads));
+    }
 
 #ifdef TIMING
     double user_time = 0, work_time = 0, max_user_time = 0, 
@@ -557,6 +773,68 @@ protected:
     }
 };
 
+// For pure sums over a small, statically known key space [0, N). Map gets a 
+// plain per-thread V[N] (emit_intermediate just adds to it) and reduce adds 
+// the threads' arrays together, one block of keys per task. The user's 
+// reduce function is not called; keys whose total is zero are left out of 
+// the result, just as if they had never been emitted. Results come out 
+// sorted by key.
+template<typename Impl, typename D, typename K, typename V, int N>
+class MapReduceDense : public MapReduce<Impl, D, K, V, 
+    dense_container<K, V, N> >
+{
+public:
+    typedef MapReduce<Impl, D, K, V, dense_container<K, V, N> > base_type;
+    typedef typename base_type::keyval keyval;
+    typedef typename base_type::map_container map_container;
+
+protected:
+    virtual void run_reduce ()
+    {
+        // whole cache lines per task so no two tasks write the same line
+        uint64_t line = std::max((uint64_t)1, 
+            (uint64_t)(L2_CACHE_LINE_SIZE / sizeof(V)));
+        uint64_t block = (N + this->num_reduce_tasks - 1) / 
+            this->num_reduce_tasks;
+        block = (block + line - 1) / line * line;
+
+        uint64_t tasks = 0;
+        for (uint64_t key = 0; key < (uint64_t)N; key += block, ++tasks) {
+            task_queue::task_t task = 
+                { tasks, std::min(block, N - key), key, 0 };
+            this->taskQueue->enqueue_seq(task, (N + block - 1) / block);
+        }
+
+        this->start_workers (&this->reduce_callback, 
+            std::min(tasks, this->num_threads), "reduce");
+
+        V const* totals = this->container.totals();
+        for (uint64_t key = 0; key < (uint64_t)N; ++key) {
+            if (!(totals[key] == V())) {
+                keyval kv = { (K)key, totals[key] };
+                this->final_vals[0].push_back(kv);
+            }
+        }
+    }
+
+    virtual void reduce_worker (thread_loc const& loc, double& time, 
+        double& user_time, int& tasks)
+    {
+        timespec begin = get_time();
+        task_queue::task_t task;
+        while (this->taskQueue->dequeue (task, loc)) {
+            tasks++;
+            this->container.sum(task.data, task.data + task.len);
+        }
+        time += time_elapsed(begin);
+    }
+
+public:
+    void emit_intermediate(map_container& acc, K const& k, V const& v) const {
+        acc[k] += v;
+    }
+};
+
 #endif // MAP_REDUCE_H_
 
 // vim: ts=8 sw=4 sts=4 smarttab smartindent
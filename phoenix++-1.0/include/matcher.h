@@ -0,0 +1,164 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+#ifndef MATCHER_H_
+#define MATCHER_H_
+
+#include <string.h>
+#include <vector>
+
+#include "stddefines.h"
+
+/* Returns the first '\r' or '\n' in [p, end), or end if there is none. 
+   Uses AVX2 when the processor has it. */
+char const* find_line_break(char const* p, char const* end);
+
+/* Returns the first character at or after p that is not a line break. */
+static inline char const* skip_line_breaks(char const* p, char const* end)
+{
+    while (p < end && (*p == '\r' || *p == '\n'))
+        p++;
+    return p;
+}
+
+// A set of patterns matched against whole lines (or any other records) by 
+// hashing. Patterns get ids 0, 1, ... in the order they are first added. 
+// Lookups are read only and may run concurrently.
+class line_set
+{
+    struct entry {
+        uint64_t hash;
+        int id;             // -1 if empty
+    };
+
+    std::vector<char> text;         // all patterns, back to back
+    std::vector<uint64_t> offsets;  // start of each pattern in text
+    std::vector<entry> table;       // open addressing, power of 2 size
+    uint64_t mask;
+    uint64_t lengths;               // bit l set if some pattern has length l
+    int max_length;
+
+    static uint64_t hash(char const* s, int len)
+    {
+        // FNV-1a
+        uint64_t h = 14695981039346656037ULL;
+        for (int i = 0; i < len; i++)
+            h = (h ^ (unsigned char)s[i]) * 1099511628211ULL;
+        return h;
+    }
+
+    void insert(uint64_t h, int id)
+    {
+        uint64_t i = h & mask;
+        while (table[i].id >= 0)
+            i = (i + 1) & mask;
+        table[i].hash = h;
+        table[i].id = id;
+    }
+
+    void grow()
+    {
+        entry empty = { 0, -1 };
+        table.assign(std::max((size_t)16, table.size() * 2), empty);
+        mask = table.size() - 1;
+        for (int id = 0; id < size(); id++) {
+            int len;
+            char const* p = pattern(id, len);
+            insert(hash(p, len), id);
+        }
+    }
+
+public:
+    line_set() : mask(0), lengths(0), max_length(0) 
+    {
+        offsets.push_back(0);
+        grow();
+    }
+
+    int size() const { return (int)offsets.size() - 1; }
+
+    char const* pattern(int id, int& len) const
+    {
+        len = (int)(offsets[id + 1] - offsets[id]);
+        return text.empty() ? "" : &text[0] + offsets[id];
+    }
+
+    // Id of the pattern s[0, len), or -1.
+    int find(char const* s, uint64_t len) const
+    {
+        if (len > (uint64_t)max_length || 
+            (len < 64 && !(lengths & (1ULL << len))))
+            return -1;
+        uint64_t h = hash(s, (int)len);
+        for (uint64_t i = h & mask; table[i].id >= 0; i = (i + 1) & mask) {
+            if (table[i].hash == h) {
+                int plen;
+                char const* p = pattern(table[i].id, plen);
+                if ((uint64_t)plen == len && memcmp(p, s, len) == 0)
+                    return table[i].id;
+            }
+        }
+        return -1;
+    }
+
+    // Adds s[0, len) and returns its id, the old id if it is already there.
+    int add(char const* s, int len)
+    {
+        int id = find(s, len);
+        if (id >= 0)
+            return id;
+
+        id = size();
+        text.insert(text.end(), s, s + len);
+        offsets.push_back(text.size());
+        lengths |= len < 64 ? (1ULL << len) : 0;
+        max_length = std::max(max_length, len);
+
+        // keep the table at most half full
+        if ((uint64_t)size() * 2 > table.size())
+            grow();
+        else
+            insert(hash(s, len), id);
+        return id;
+    }
+
+    // Adds every non-empty line of data[0, len). Returns the number of 
+    // patterns in the set.
+    int add_lines(char const* data, uint64_t len)
+    {
+        char const* end = data + len;
+        for (char const* p = skip_line_breaks(data, end); p < end; ) {
+            char const* eol = find_line_break(p, end);
+            add(p, (int)(eol - p));
+            p = skip_line_breaks(eol, end);
+        }
+        return size();
+    }
+};
+
+#endif /* MATCHER_H_ */
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
@@ -27,6 +27,8 @@
 #ifndef PROCESSOR_H_
 #define PROCESSOR_H_
 
+#include <stdio.h>
+
 #ifdef _LINUX_
 #ifndef _GNU_SOURCE
 #define _GNU_SOURCE
@@ -41,6 +43,8 @@
 // OSX doesn't support assigning threads to processors :(
 #include <unistd.h>
 #include <sched.h>
+#include <sys/types.h>
+#include <sys/sysctl.h>
 #else
 #warning "Unknown system. Threads will not be allocated to processors."
 #endif
@@ -66,6 +70,55 @@ inline int proc_get_num_cpus (void)
     return num_cpus;
 }
 
+/* Query the size in bytes of the level LEVEL (1 to 3) data cache of a 
+   processor, for sizing blocked loops. Returns 0 if it is not known. */
+inline long proc_get_cache_size (int level)
+{
+    long size = 0;
+#if defined (_LINUX_) && defined (_SC_LEVEL1_DCACHE_SIZE)
+    switch (level) {
+        case 1: size = sysconf(_SC_LEVEL1_DCACHE_SIZE); break;
+        case 2: size = sysconf(_SC_LEVEL2_CACHE_SIZE); break;
+        case 3: size = sysconf(_SC_LEVEL3_CACHE_SIZE); break;
+    }
+#elif defined (_DARWIN_)
+    char const* names[] = { "hw.l1dcachesize", "hw.l2cachesize", 
+        "hw.l3cachesize" };
+    int64_t value = 0;
+    size_t len = sizeof(value);
+    if (level >= 1 && level <= 3 && 
+        sysctlbyname(names[level-1], &value, &len, NULL, 0) == 0)
+        size = (long)value;
+#endif
+    return size > 0 ? size : 0;
+}
+
+/* Instruction sets of hand-vectorized kernels, narrowest first. */
+enum { PROC_ISA_AUTO, PROC_ISA_GENERIC, PROC_ISA_AVX2, PROC_ISA_AVX512 };
+
+/* Returns ISA if the processor supports it, or else the widest one it 
+   does, with a note on stdout, so that a kernel forced by the user can't 
+   fault on its first instruction. PROC_ISA_AUTO picks the widest. */
+inline int proc_get_isa (int isa)
+{
+    static char const* names[] = { "auto", "generic", "AVX2", "AVX-512" };
+    int widest = PROC_ISA_GENERIC;
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+    if (__builtin_cpu_supports("avx512f"))
+        widest = PROC_ISA_AVX512;
+    else if (__builtin_cpu_supports("avx2"))
+        widest = PROC_ISA_AVX2;
+#endif
+    if (isa == PROC_ISA_AUTO)
+        return widest;
+    if (isa > widest) {
+        printf("%s is not supported by this processor, using %s\n", 
+            names[isa], names[widest]);
+        return widest;
+    }
+    return isa;
+}
+
 #ifdef _LINUX_
 static cpu_set_t    full_cs;
 static cpu_set_t* proc_get_full_set(void)
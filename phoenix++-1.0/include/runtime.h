@@ -0,0 +1,116 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its
+*       contributors may be used to endorse or promote products derived from
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef RUNTIME_H_
+#define RUNTIME_H_
+
+#include <pthread.h>
+#include <vector>
+
+#include "stddefines.h"
+#include "synch.h"
+#include "thread_pool.h"
+
+class sched_policy;
+
+// A pool of pinned worker threads shared by every job of the process. A job
+// runs each of its phases as a set of workers, which the pool threads pick
+// up as they become free: the next worker always comes from the job with
+// the highest priority and, among those, the fewest running workers for its
+// weight, then the least thread time used so far for its weight. Workers
+// are not preempted: a worker keeps its thread until the job has no tasks
+// left for it, so shares and priorities only take effect as workers finish,
+// and a job that just got threads waits for the running workers of the 
+// others to drain their phase. Workers must not run jobs themselves.
+class runtime
+{
+public:
+    struct job;
+
+    runtime(int num_threads, sched_policy const* policy = NULL);
+    ~runtime();
+
+    // The process-wide runtime, started on first use with MR_NUMTHREADS
+    // threads (one per cpu by default) filling strands from cpu 0.
+    static runtime& shared();
+
+    int size() const { return num_threads; }    // # of pool threads
+
+    // Jobs with a larger weight get proportionally more threads; jobs with
+    // a higher priority get threads before any job with a lower one.
+    job* attach(int weight = 1, int priority = 0);
+    void detach(job* j);
+    void set_share(job* j, int weight, int priority);
+
+    // Runs func(args[i], loc) with loc.thread = i for every i below
+    // num_workers and returns once they have all returned. The task queues
+    // are indexed by loc.thread, so a worker starts at its own queue on any
+    // pool thread; loc.cpu and loc.lgrp are those of the pool thread
+    // running the worker. A job runs one phase at a time.
+    int run(job* j, thread_func func, void** args, int num_workers);
+
+private:
+    struct phase {
+        thread_func     func;
+        void**          args;
+        int             num_workers;
+        int             next;           // next worker to start
+        int             done;
+        semaphore       finished;
+    };
+
+    struct thread_arg_t {
+        runtime*        rt;
+        thread_loc      loc;
+    };
+
+    int             num_threads;
+    bool            die;
+    uint64_t        num_attached;       // orders jobs that are otherwise tied
+    pthread_mutex_t mutex;              // guards everything below
+    pthread_cond_t  work;               // a phase was submitted
+    std::vector<job*> jobs;
+    pthread_t       *threads;
+    thread_arg_t    *thread_args;
+
+    job* pick() const;
+
+    static void* loop (void*);
+};
+
+struct runtime::job
+{
+    int             weight;
+    int             priority;
+    uint64_t        seq;
+    int             running;            // workers on pool threads
+    double          service;            // thread seconds used
+    phase*          current;            // NULL between phases
+};
+
+#endif /* RUNTIME_H_ */
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
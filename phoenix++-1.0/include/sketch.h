@@ -0,0 +1,95 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+#ifndef SKETCH_H_
+#define SKETCH_H_
+
+#include <string.h>
+#include <stdint.h>
+#include <cmath>
+
+// HyperLogLog cardinality estimator (Flajolet et al., 2007). Uses 2^P one 
+// byte registers, so the default precision costs 1 KB and has a standard 
+// error of about 3%. Sketches built on different threads can be merged.
+template<int P = 10>
+class hyperloglog
+{
+    uint8_t reg[1 << P];
+
+    // Finalizer from MurmurHash3. std::tr1::hash is the identity function 
+    // for integral types, so the incoming hashes need to be mixed first.
+    static uint64_t mix(uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+public:
+    hyperloglog() { clear(); }
+
+    void clear() {
+        memset(reg, 0, sizeof(reg));
+    }
+
+    void add(uint64_t hash) {
+        uint64_t h = mix(hash);
+        uint64_t index = h >> (64 - P);
+        // guard bit bounds the rank to 64-P+1
+        uint64_t rest = (h << P) | (1ULL << (P - 1));
+        uint8_t rank = (uint8_t)(__builtin_clzll(rest) + 1);
+        if(rank > reg[index])
+            reg[index] = rank;
+    }
+
+    void merge(hyperloglog const& other) {
+        for(int i = 0; i < (1 << P); i++) {
+            if(other.reg[i] > reg[i])
+                reg[i] = other.reg[i];
+        }
+    }
+
+    double estimate() const {
+        const double m = (double)(1 << P);
+        double sum = 0;
+        int zeros = 0;
+        for(int i = 0; i < (1 << P); i++) {
+            sum += 1.0 / (double)(1ULL << reg[i]);
+            if(reg[i] == 0) zeros++;
+        }
+        double e = (0.7213 / (1 + 1.079 / m)) * m * m / sum;
+        // small range correction, fall back to linear counting
+        if(e <= 2.5 * m && zeros > 0)
+            e = m * std::log(m / zeros);
+        return e;
+    }
+};
+
+#endif /* SKETCH_H_ */
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
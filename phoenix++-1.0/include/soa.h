@@ -0,0 +1,128 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+#ifndef SOA_H_
+#define SOA_H_
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "stddefines.h"
+
+template<typename T> class soa_table;
+
+// One block of rows of a soa_table, used as the MapReduce data_type so that 
+// map is handed a whole block at a time.
+template<typename T>
+struct soa_block
+{
+    soa_table<T>* table;
+    uint64_t block;     // block number
+    uint64_t first;     // first row in the block
+    uint64_t rows;      // rows in use, the rest of the block is zero padding
+
+    // width() values of column col, cache line aligned
+    T* column(uint64_t col) const {
+        return table->column(block, col);
+    }
+    uint64_t width() const {
+        return table->width();
+    }
+};
+
+// Blocked structure-of-arrays storage for rows of cols values. The rows are 
+// cut into blocks of width rows and each block stores its columns one after 
+// the other, so within a block every column is a contiguous, cache line 
+// aligned array that vector loops can stream through. width is rounded up 
+// to a whole number of cache lines; the last block is padded with zeros.
+template<typename T>
+class soa_table
+{
+    T* data;
+    uint64_t num_rows, num_cols, block_width, num_blocks;
+
+    // not copyable
+    soa_table(soa_table const&);
+    soa_table& operator=(soa_table const&);
+
+public:
+    soa_table(uint64_t rows, uint64_t cols, uint64_t width = 256) : 
+        num_rows(rows), num_cols(cols)
+    {
+        uint64_t line = L2_CACHE_LINE_SIZE / sizeof(T);
+        if(line == 0) line = 1;
+        block_width = (width + line - 1) / line * line;
+        num_blocks = (rows + block_width - 1) / block_width;
+
+        uint64_t bytes = num_blocks * num_cols * block_width * sizeof(T);
+        CHECK_ERROR(posix_memalign((void**)&data, L2_CACHE_LINE_SIZE, 
+            bytes > 0 ? bytes : L2_CACHE_LINE_SIZE));
+        memset(data, 0, bytes);
+    }
+
+    ~soa_table()
+    {
+        free(data);
+    }
+
+    uint64_t rows() const { return num_rows; }
+    uint64_t cols() const { return num_cols; }
+    uint64_t width() const { return block_width; }
+    uint64_t blocks() const { return num_blocks; }
+
+    T* column(uint64_t block, uint64_t col) const
+    {
+        return data + (block * num_cols + col) * block_width;
+    }
+
+    T& at(uint64_t row, uint64_t col)
+    {
+        return column(row / block_width, col)[row % block_width];
+    }
+
+    T const& at(uint64_t row, uint64_t col) const
+    {
+        return column(row / block_width, col)[row % block_width];
+    }
+
+    // One entry per block, to pass to MapReduce::run().
+    void split(std::vector< soa_block<T> >& out)
+    {
+        out.clear();
+        for(uint64_t b = 0; b < num_blocks; b++)
+        {
+            soa_block<T> block = { this, b, b * block_width, 
+                std::min(block_width, num_rows - b * block_width) };
+            out.push_back(block);
+        }
+    }
+};
+
+#endif /* SOA_H_ */
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
@@ -33,6 +33,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <unistd.h>
 
 // Tunables
 #define L2_CACHE_LINE_SIZE          64
@@ -65,6 +66,21 @@ static inline char const* GETENV(char const* envstr)
    else return env;
 }
 
+// read() returns at most about 2 GB at a time, so files are read in a loop.
+// Returns the # of bytes read, short only at end of file, or -1.
+static inline ssize_t read_all (int fd, void* buf, size_t count)
+{
+    size_t done = 0;
+    while (done < count)
+    {
+        ssize_t ret = read (fd, (char*)buf + done, count - done);
+        if (ret < 0) return -1;
+        if (ret == 0) break;
+        done += ret;
+    }
+    return done;
+}
+
 static inline double time_diff (
     timespec const& end, timespec const& begin)
 {
@@ -0,0 +1,85 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+#ifndef TOKENIZER_H_
+#define TOKENIZER_H_
+
+#include <vector>
+
+#include "stddefines.h"
+
+// A word found by tokenize(). The input itself is left untouched; words are 
+// compared and hashed as if folded to upper case.
+struct word_token {
+    uint64_t offset;    // from the start of the tokenized data
+    uint64_t length;
+    uint64_t hash;      // fold_hash() of the word
+};
+
+enum tokenize_mode {
+    TOKENIZE_ASCII,     // words are ASCII letters
+    TOKENIZE_UTF8       // bytes of multi-byte UTF-8 characters count as 
+                        // letters too, so non-English words stay whole
+};
+
+/* Appends a descriptor for every word in data[0, len) to words and returns 
+   how many were added. A word starts with a letter and continues through 
+   letters and apostrophes. Classifies 64 bytes at a time with AVX-512 or 
+   AVX2 when the processor has them. */
+uint64_t tokenize(char const* data, uint64_t len, 
+    std::vector<word_token>& words, tokenize_mode mode = TOKENIZE_ASCII);
+
+// ASCII upper case; other bytes are unchanged
+static inline unsigned char fold_upper(unsigned char c)
+{
+    return (c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c;
+}
+
+// FNV-1a over the folded bytes of s[0, len)
+static inline uint64_t fold_hash(char const* s, uint64_t len)
+{
+    uint64_t v = 14695981039346656037ULL;
+    for (uint64_t i = 0; i < len; i++)
+        v = (v ^ fold_upper(s[i])) * 1099511628211ULL;
+    return v;
+}
+
+// strcmp() of the folded strings a[0, alen) and b[0, blen)
+static inline int fold_compare(char const* a, uint64_t alen, 
+    char const* b, uint64_t blen)
+{
+    uint64_t n = alen < blen ? alen : blen;
+    for (uint64_t i = 0; i < n; i++) {
+        int d = (int)fold_upper(a[i]) - (int)fold_upper(b[i]);
+        if (d != 0)
+            return d;
+    }
+    return alen < blen ? -1 : (alen > blen ? 1 : 0);
+}
+
+#endif /* TOKENIZER_H_ */
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
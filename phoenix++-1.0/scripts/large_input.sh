@@ -0,0 +1,126 @@
+#!/bin/sh
+
+#------------------------------------------------------------------------------
+# Copyright (c) 2007-2011, Stanford University
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#     * Redistributions of source code must retain the above copyright
+#       notice, this list of conditions and the following disclaimer.
+#     * Redistributions in binary form must reproduce the above copyright
+#       notice, this list of conditions and the following disclaimer in the
+#       documentation and/or other materials provided with the distribution.
+#     * Neither the name of Stanford University nor the names of its
+#       contributors may be used to endorse or promote products derived from
+#       this software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+# EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+# DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+# (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+# LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+# ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+# SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#------------------------------------------------------------------------------
+
+# Runs the sample applications on inputs larger than 4 GB and checks their
+# results. The inputs are sparse files of zeros with a few records written
+# past the 4 GB mark, so they take no disk space, but the applications still
+# map and scan all of them. Sizes of 13 GB and more also push the histogram
+# counts past 32 bits. Build the library and applications first.
+
+if [ $# -gt 2 ]; then
+    echo "Usage: large_input.sh [size in GB (default 5)] [directory (default /tmp)]"
+    exit 1
+fi
+
+GB=${1:-5}
+DIR=${2:-/tmp}
+SIZE=$(($GB * 1024 * 1024 * 1024))
+FOUR_GB=4294967296
+TESTS=$(cd "$(dirname "$0")/../tests" && pwd)
+
+if [ $SIZE -le $FOUR_GB ]; then
+    echo "The size has to be over 4 GB"
+    exit 1
+fi
+
+TEXT=$DIR/large_input_$$.txt
+BMP=$DIR/large_input_$$.bmp
+POINTS=$DIR/large_input_$$.pts
+trap 'rm -f "$TEXT" "$BMP" "$POINTS"' 0
+trap 'exit 1' 1 2 15
+failed=0
+
+# put file offset bytes: writes printf-style bytes at the offset in place.
+put () {
+    printf "$3" | dd of="$1" bs=1 seek="$2" conv=notrunc 2>/dev/null
+}
+
+# check name pattern count: the last output holds count lines matching.
+check () {
+    if [ "$(echo "$out" | grep -c -i -e "$2")" = "$3" ]; then
+        echo "ok      $1"
+    else
+        echo "FAILED  $1 (expected $3 lines of '$2')"
+        echo "$out" | tail -20
+        failed=1
+    fi
+}
+
+# run app args...: runs tests/app/app and keeps its output in $out.
+run () {
+    app=$1
+    shift
+    if ! out=$(cd "$TESTS/$app" && "./$app" "$@" 2>/dev/null); then
+        echo "FAILED  $app exited with an error"
+        out=
+        failed=1
+    fi
+}
+
+# Text: 8 lines of Helloworld, 1 MB apart from 4 GB on.
+truncate -s $SIZE "$TEXT" || exit 1
+for k in 0 1 2 3 4 5 6 7; do
+    put "$TEXT" $(($FOUR_GB + $k * 1048576 - 1)) '\nHelloworld\n'
+done
+
+run word_count "$TEXT" 10
+check word_count 'helloworld - 8$' 1
+check word_count '^Total: 8$' 1
+
+run string_match "$TEXT"
+check string_match "Helloworld: 8 times, first at offset $FOUR_GB\$" 1
+rm -f "$TEXT"
+
+# Bitmap: 24 bit pixels of 0 but for one of (1, 2, 3) past 4 GB.
+BMP_SIZE=$(($SIZE - ($SIZE - 54) % 3))
+PIXELS=$((($BMP_SIZE - 54) / 3))
+truncate -s $BMP_SIZE "$BMP" || exit 1
+put "$BMP" 0 'BM'
+put "$BMP" 10 '\066\000'
+put "$BMP" 28 '\030\000'
+put "$BMP" $((54 + 3 * ($FOUR_GB / 3 + 1))) '\001\002\003'
+
+run histogram "$BMP"
+check histogram "$(($BMP_SIZE - 54)) bytes of image data, $PIXELS pixels" 1
+check histogram " - $(($PIXELS - 1))\$" 3
+check histogram "^1 - 1\$" 1
+rm -f "$BMP"
+
+# Points: (2, 3) at 4 GB and at the end, (0, 0) everywhere else.
+truncate -s $SIZE "$POINTS" || exit 1
+put "$POINTS" $FOUR_GB '\002\003'
+put "$POINTS" $(($SIZE - 2)) '\002\003'
+
+run linear_regression "$POINTS"
+check linear_regression 'SX *= 4$' 1
+check linear_regression 'SYY *= 18$' 1
+check linear_regression 'SXY *= 12$' 1
+rm -f "$POINTS"
+
+exit $failed
@@ -0,0 +1,83 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+#include "../include/matcher.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MATCHER_X86
+#include <immintrin.h>
+#endif
+
+/* Two memchr calls: one for the next '\n', then one for a '\r' before 
+   it. Both are vectorized by the C library. */
+static char const* find_line_break_memchr(char const* p, char const* end)
+{
+    char const* nl = (char const*)memchr(p, '\n', end - p);
+    if (nl == NULL)
+        nl = end;
+    char const* cr = (char const*)memchr(p, '\r', nl - p);
+    return cr != NULL ? cr : nl;
+}
+
+#ifdef MATCHER_X86
+__attribute__((target("avx2")))
+static char const* find_line_break_avx2(char const* p, char const* end)
+{
+    __m256i const nl = _mm256_set1_epi8('\n');
+    __m256i const cr = _mm256_set1_epi8('\r');
+    for (; end - p >= 32; p += 32) {
+        __m256i v = _mm256_loadu_si256((__m256i const*)p);
+        unsigned int hits = _mm256_movemask_epi8(_mm256_or_si256(
+            _mm256_cmpeq_epi8(v, nl), _mm256_cmpeq_epi8(v, cr)));
+        if (hits != 0)
+            return p + __builtin_ctz(hits);
+    }
+    while (p < end && *p != '\n' && *p != '\r')
+        p++;
+    return p;
+}
+#endif
+
+typedef char const* (*find_fn)(char const*, char const*);
+
+static find_fn pick_find_line_break()
+{
+#ifdef MATCHER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return find_line_break_avx2;
+#endif
+    return find_line_break_memchr;
+}
+
+static find_fn const find_impl = pick_find_line_break();
+
+char const* find_line_break(char const* p, char const* end)
+{
+    return find_impl(p, end);
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
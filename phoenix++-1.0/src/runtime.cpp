@@ -0,0 +1,231 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its
+*       contributors may be used to endorse or promote products derived from
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <assert.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <algorithm>
+
+#include "../include/runtime.h"
+#include "../include/scheduler.h"
+
+static double seconds()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+runtime::runtime(int num_threads, sched_policy const* policy)
+{
+    sched_policy_strand_fill default_policy(0);
+    if (policy == NULL)
+        policy = &default_policy;
+
+    this->num_threads = num_threads;
+    this->die = false;
+    this->num_attached = 0;
+    CHECK_ERROR (pthread_mutex_init (&this->mutex, NULL));
+    CHECK_ERROR (pthread_cond_init (&this->work, NULL));
+
+    this->threads = new pthread_t[num_threads];
+    this->thread_args = new thread_arg_t[num_threads];
+
+    for (int i = 0; i < num_threads; ++i) {
+        this->thread_args[i].rt = this;
+        this->thread_args[i].loc.thread = i;
+        this->thread_args[i].loc.cpu = policy->thr_to_cpu(i);
+        // we'll get this when the thread runs...
+        this->thread_args[i].loc.lgrp = -1;
+        this->thread_args[i].loc.seed = i;
+
+        CHECK_ERROR (pthread_create (
+            &this->threads[i], NULL, loop, &this->thread_args[i]));
+    }
+}
+
+runtime::~runtime()
+{
+    pthread_mutex_lock (&this->mutex);
+    assert (this->jobs.empty());
+    this->die = true;
+    pthread_cond_broadcast (&this->work);
+    pthread_mutex_unlock (&this->mutex);
+
+    for (int i = 0; i < this->num_threads; ++i)
+        pthread_join (this->threads[i], NULL);
+
+    pthread_cond_destroy (&this->work);
+    pthread_mutex_destroy (&this->mutex);
+    delete [] this->threads;
+    delete [] this->thread_args;
+}
+
+runtime& runtime::shared()
+{
+    // Never deleted: jobs in static objects may outlive any destructor.
+    static runtime* rt = new runtime(atoi(GETENV("MR_NUMTHREADS")) > 0 ?
+        atoi(GETENV("MR_NUMTHREADS")) : proc_get_num_cpus());
+    return *rt;
+}
+
+runtime::job* runtime::attach(int weight, int priority)
+{
+    job* j = new job;
+    j->weight = std::max(weight, 1);
+    j->priority = priority;
+    j->running = 0;
+    j->service = 0;
+    j->current = NULL;
+
+    pthread_mutex_lock (&this->mutex);
+    j->seq = this->num_attached++;
+    this->jobs.push_back(j);
+    pthread_mutex_unlock (&this->mutex);
+    return j;
+}
+
+void runtime::detach(job* j)
+{
+    pthread_mutex_lock (&this->mutex);
+    assert (j->current == NULL);
+    this->jobs.erase(std::find(this->jobs.begin(), this->jobs.end(), j));
+    pthread_mutex_unlock (&this->mutex);
+    delete j;
+}
+
+void runtime::set_share(job* j, int weight, int priority)
+{
+    pthread_mutex_lock (&this->mutex);
+    j->weight = std::max(weight, 1);
+    j->priority = priority;
+    pthread_mutex_unlock (&this->mutex);
+}
+
+int runtime::run(job* j, thread_func func, void** args, int num_workers)
+{
+    if (num_workers == 0)
+        return 0;
+
+    phase p;
+    p.func = func;
+    p.args = args;
+    p.num_workers = num_workers;
+    p.next = 0;
+    p.done = 0;
+
+    pthread_mutex_lock (&this->mutex);
+    assert (j->current == NULL);
+    j->current = &p;
+    pthread_cond_broadcast (&this->work);
+    pthread_mutex_unlock (&this->mutex);
+
+    p.finished.wait();
+
+    pthread_mutex_lock (&this->mutex);
+    j->current = NULL;
+    pthread_mutex_unlock (&this->mutex);
+    return 0;
+}
+
+/* Returns the job whose worker should run next, or NULL if no job has
+   workers left to start. Called with the mutex held. */
+runtime::job* runtime::pick() const
+{
+    job* best = NULL;
+    for (size_t i = 0; i < this->jobs.size(); ++i) {
+        job* j = this->jobs[i];
+        if (j->current == NULL || j->current->next == j->current->num_workers)
+            continue;
+        if (best == NULL || j->priority > best->priority)
+            best = j;
+        else if (j->priority < best->priority)
+            continue;
+        else if (j->running * best->weight != best->running * j->weight) {
+            if (j->running * best->weight < best->running * j->weight)
+                best = j;
+        }
+        else if (j->service * best->weight != best->service * j->weight) {
+            if (j->service * best->weight < best->service * j->weight)
+                best = j;
+        }
+        else if (j->seq < best->seq)
+            best = j;
+    }
+    return best;
+}
+
+void* runtime::loop(void* arg)
+{
+    thread_arg_t*   thread_arg = (thread_arg_t*)arg;
+
+    assert (thread_arg);
+
+    runtime*        rt = thread_arg->rt;
+    thread_loc&     loc = thread_arg->loc;
+
+    if(loc.cpu >= 0)
+        proc_bind_thread (loc.cpu);
+
+    loc.lgrp = loc_get_lgrp();
+
+    pthread_mutex_lock (&rt->mutex);
+    while (!rt->die)
+    {
+        job* j = rt->pick();
+        if (j == NULL) {
+            pthread_cond_wait (&rt->work, &rt->mutex);
+            continue;
+        }
+
+        phase* p = j->current;
+        int worker = p->next++;
+        j->running++;
+        pthread_mutex_unlock (&rt->mutex);
+
+        // Run thread function as worker # of the job's phase, which is
+        // also the task queue it starts at.
+        thread_loc worker_loc = loc;
+        worker_loc.thread = worker;
+        double begin = seconds();
+        (*p->func)(p->args[worker], worker_loc);
+        double time = seconds() - begin;
+        loc.seed = worker_loc.seed;
+
+        pthread_mutex_lock (&rt->mutex);
+        j->running--;
+        j->service += time;
+        if (++p->done == p->num_workers) {
+            // Everybody's done.
+            p->finished.post();
+        }
+    }
+    pthread_mutex_unlock (&rt->mutex);
+
+    return NULL;
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
@@ -80,7 +80,9 @@ void task_queue::enqueue_seq (const task_t& task, int total_tasks, int lgrp)
 
 int task_queue::dequeue (task_t& task, thread_loc const& loc)
 {
-    int index = (loc.lgrp < 0) ? loc.cpu : loc.lgrp;
+    // Start at the worker's own queue, where run_reduce packs its share of 
+    // the tasks, or with NUMA support at the queue of its locality group.
+    int index = ((loc.lgrp < 0) ? loc.thread : loc.lgrp) % this->num_queues;
     
    /* Do task stealing if nothing on our queue.
       Cycle through all indexes until success or exhaustion */
@@ -0,0 +1,168 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+#include <string.h>
+
+#include "../include/tokenizer.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TOKENIZER_X86
+#include <immintrin.h>
+#endif
+
+/* Bit i of letters is set if p[i] is a letter, bit i of apostrophes if it 
+   is an apostrophe, for the 64 bytes at p. */
+typedef void (*classify_fn)(char const* p, bool utf8, 
+    uint64_t& letters, uint64_t& apostrophes);
+
+static void classify_generic(char const* p, bool utf8, 
+    uint64_t& letters, uint64_t& apostrophes)
+{
+    letters = apostrophes = 0;
+    for (int i = 0; i < 64; i++) {
+        unsigned char c = p[i];
+        unsigned char lower = c | 0x20;
+        if ((lower >= 'a' && lower <= 'z') || (utf8 && c >= 0x80))
+            letters |= 1ULL << i;
+        else if (c == '\'')
+            apostrophes |= 1ULL << i;
+    }
+}
+
+#ifdef TOKENIZER_X86
+// Letters are bytes whose lower case form is in 'a'..'z'. The signed 
+// compares exclude bytes >= 0x80, which are the sign bit in UTF-8 mode.
+__attribute__((target("avx2")))
+static void classify_avx2(char const* p, bool utf8, 
+    uint64_t& letters, uint64_t& apostrophes)
+{
+    uint64_t l[2], a[2];
+    for (int h = 0; h < 2; h++) {
+        __m256i v = _mm256_loadu_si256((__m256i const*)(p + 32 * h));
+        __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+        __m256i letter = _mm256_and_si256(
+            _mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+            _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower));
+        if (utf8)
+            letter = _mm256_or_si256(letter, v);
+        l[h] = (uint32_t)_mm256_movemask_epi8(letter);
+        a[h] = (uint32_t)_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\'')));
+    }
+    letters = l[0] | (l[1] << 32);
+    apostrophes = a[0] | (a[1] << 32);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void classify_avx512(char const* p, bool utf8, 
+    uint64_t& letters, uint64_t& apostrophes)
+{
+    __m512i v = _mm512_loadu_si512(p);
+    __m512i lower = _mm512_or_si512(v, _mm512_set1_epi8(0x20));
+    __mmask64 letter = _mm512_cmpge_epu8_mask(lower, _mm512_set1_epi8('a')) &
+        _mm512_cmple_epu8_mask(lower, _mm512_set1_epi8('z'));
+    if (utf8)
+        letter |= _mm512_movepi8_mask(v);
+    letters = letter;
+    apostrophes = _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('\''));
+}
+#endif
+
+static classify_fn pick_classify()
+{
+#ifdef TOKENIZER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw"))
+        return classify_avx512;
+    if (__builtin_cpu_supports("avx2"))
+        return classify_avx2;
+#endif
+    return classify_generic;
+}
+
+static classify_fn const classify = pick_classify();
+
+uint64_t tokenize(char const* data, uint64_t len, 
+    std::vector<word_token>& words, tokenize_mode mode)
+{
+    bool utf8 = (mode == TOKENIZE_UTF8);
+    size_t first = words.size();
+
+    // carried from the previous block: its last byte was a letter or 
+    // apostrophe, was part of a word, was an apostrophe before any letter
+    uint64_t in_any = 0, in_word = 0, in_lead = 0;
+    uint64_t start = 0;
+
+    for (uint64_t base = 0; base < len; base += 64) {
+        uint64_t letters, apostrophes;
+        if (len - base >= 64) {
+            classify(data + base, utf8, letters, apostrophes);
+        } else {
+            // zero padding ends any word at len
+            char tail[64] = { 0 };
+            memcpy(tail, data + base, len - base);
+            classify(tail, utf8, letters, apostrophes);
+        }
+
+        // Apostrophes only belong to a word after a letter. Runs of them 
+        // that start a run of word characters are removed with a carry: 
+        // adding the run's first bit to it clears exactly that run.
+        uint64_t any = letters | apostrophes;
+        uint64_t lead_start = apostrophes & ~((any << 1) | in_any);
+        lead_start |= apostrophes & in_lead;
+        uint64_t lead = ((apostrophes + lead_start) ^ apostrophes) & apostrophes;
+        uint64_t word = any & ~lead;
+
+        uint64_t prev = (word << 1) | in_word;
+        uint64_t starts = word & ~prev;
+        uint64_t stops = ~word & prev;
+        uint64_t edges = starts | stops;
+        while (edges != 0) {
+            int bit = __builtin_ctzll(edges);
+            edges &= edges - 1;
+            if (starts & (1ULL << bit)) {
+                start = base + bit;
+            } else {
+                word_token t = { start, base + bit - start, 0 };
+                words.push_back(t);
+            }
+        }
+
+        in_any = any >> 63;
+        in_word = word >> 63;
+        in_lead = lead >> 63;
+    }
+    if (in_word) {
+        word_token t = { start, len - start, 0 };
+        words.push_back(t);
+    }
+
+    for (size_t i = first; i < words.size(); i++)
+        words[i].hash = fold_hash(data + words[i].offset, words[i].length);
+    return words.size() - first;
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
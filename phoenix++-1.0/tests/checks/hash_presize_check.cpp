@@ -0,0 +1,140 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+
+#include "map_reduce.h"
+
+// Runs a job three times on the same MapReduce object and checks that the 
+// hash tables of the second run are sized from the key count sketched in 
+// the first, that those of the third are sized from reserve(), and that 
+// neither changes the result.
+
+static int failures = 0;
+static const int num_keys = 20000;
+static const int num_threads = 4;
+
+typedef hash_container<int, uint64_t, sum_combiner> count_container;
+
+class CountMR : public MapReduce<CountMR, int, int, uint64_t, count_container>
+{
+public:
+    void map(int const& x, map_container& out) const
+    {
+        emit_intermediate(out, x % num_keys, 1);
+    }
+
+    count_container& table() { return this->container; }
+};
+
+static bool key_less(CountMR::keyval const& a, CountMR::keyval const& b)
+{
+    return a.key < b.key;
+}
+
+static void check(bool ok, char const* what)
+{
+    if (!ok) {
+        printf("%s\n", what);
+        failures++;
+    }
+}
+
+static std::vector<CountMR::keyval> run(CountMR& mr, std::vector<int>& data)
+{
+    std::vector<CountMR::keyval> result;
+    mr.run(&data[0], data.size(), result);
+    std::sort(result.begin(), result.end(), key_less);
+    return result;
+}
+
+static bool same(std::vector<CountMR::keyval> const& a, 
+    std::vector<CountMR::keyval> const& b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].key != b[i].key || a[i].val != b[i].val)
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<int> data(num_keys * 20);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (int)i;
+
+    CountMR mr;
+    mr.setThreads(num_threads);
+    count_container& c = mr.table();
+
+    // nothing to go by on the first run
+    std::vector<CountMR::keyval> first = run(mr, data);
+    check(first.size() == (size_t)num_keys, "first run: wrong number of keys");
+    for (size_t i = 0; i < first.size(); i++)
+        check(first[i].val == 20, "first run: wrong count");
+    check(c.estimated_keys() == 0, "first run: unexpected estimate");
+    for (int i = 0; i < num_threads; i++) {
+        check(c.expected_keys(i) == 0, "first run: unexpected hint");
+        check(c.get(i).capacity() == 256, "first run: table presized");
+    }
+
+    // the second run is sized from the first run's sketches, which are 
+    // good to a few percent; a thread that got no map tasks has no hint, 
+    // but together the threads saw every key
+    std::vector<CountMR::keyval> second = run(mr, data);
+    check(same(first, second), "second run: results differ");
+    check(c.estimated_keys() > num_keys * 0.85 && 
+        c.estimated_keys() < num_keys * 1.15, "second run: bad estimate");
+    uint64_t hinted = 0;
+    for (int i = 0; i < num_threads; i++) {
+        hinted += c.expected_keys(i);
+        check(c.expected_keys(i) < num_keys * 1.15, "second run: bad hint");
+        check(c.get(i).capacity() / 2 > c.expected_keys(i), 
+            "second run: table not presized");
+    }
+    check(hinted > num_keys * 0.85, "second run: keys not hinted");
+
+    // reserve() is a lower bound over the sketches
+    c.reserve(num_keys * 8);
+    std::vector<CountMR::keyval> third = run(mr, data);
+    check(same(first, third), "reserved run: results differ");
+    for (int i = 0; i < num_threads; i++) {
+        check(c.expected_keys(i) == num_keys * 8, "reserved run: bad hint");
+        check(c.get(i).capacity() / 2 > (uint64_t)num_keys * 8, 
+            "reserved run: table not presized");
+    }
+
+    printf("hash_presize_check: %s\n", failures ? "FAILED" : "passed");
+    return failures ? 1 : 0;
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
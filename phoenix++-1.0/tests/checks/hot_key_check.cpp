@@ -0,0 +1,132 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+
+#include "map_reduce.h"
+
+// Runs a sum over a skewed key distribution with reduce_associative() on 
+// and off and checks that splitting the hot key across threads gives the 
+// same result as reducing it whole, with buffered and posting list values.
+
+static int failures = 0;
+static const int num_keys = 101;
+
+// number of reduce calls for key 0, the hot key
+static int hot_calls = 0;
+
+template<class Container, bool Assoc>
+class SkewMR : public MapReduce<SkewMR<Container, Assoc>, int, int, int, 
+    Container>
+{
+    typedef MapReduce<SkewMR<Container, Assoc>, int, int, int, Container> 
+        base_type;
+public:
+    typedef typename base_type::keyval keyval;
+    typedef typename base_type::map_container map_container;
+    typedef typename base_type::reduce_iterator reduce_iterator;
+
+    // half of all values go to key 0
+    void map(int const& x, map_container& out) const
+    {
+        this->emit_intermediate(out, x % 2 == 0 ? 0 : x % num_keys, x % 1000);
+    }
+
+    void reduce(int const& key, reduce_iterator const& values, 
+        std::vector<keyval>& out) const
+    {
+        if (key == 0)
+            __sync_fetch_and_add(&hot_calls, 1);
+        int v, sum = 0;
+        while (values.next(v))
+            sum += v;
+        keyval kv = { key, sum };
+        out.push_back(kv);
+    }
+
+    bool reduce_associative() const { return Assoc; }
+};
+
+static bool key_less(std::pair<int, int> const& a, std::pair<int, int> const& b)
+{
+    return a.first < b.first;
+}
+
+template<class Container, bool Assoc>
+static std::vector<std::pair<int, int> > run(std::vector<int>& data)
+{
+    SkewMR<Container, Assoc> mr;
+    mr.setThreads(4).setReduceTasks(4, 1000);
+    std::vector<typename SkewMR<Container, Assoc>::keyval> result;
+    mr.run(&data[0], data.size(), result);
+
+    std::vector<std::pair<int, int> > sums;
+    for (size_t i = 0; i < result.size(); i++)
+        sums.push_back(std::make_pair(result[i].key, result[i].val));
+    std::sort(sums.begin(), sums.end(), key_less);
+    return sums;
+}
+
+template<class Container>
+static void check(char const* name, std::vector<int>& data)
+{
+    hot_calls = 0;
+    std::vector<std::pair<int, int> > whole = run<Container, false>(data);
+    int whole_calls = hot_calls;
+
+    hot_calls = 0;
+    std::vector<std::pair<int, int> > split = run<Container, true>(data);
+    int split_calls = hot_calls;
+
+    if (whole.size() != (size_t)num_keys || whole != split) {
+        printf("%s: split result differs from whole one\n", name);
+        failures++;
+    }
+    // slices of the hot key and one more call over their partial sums
+    if (whole_calls != 1 || split_calls < 3) {
+        printf("%s: hot key reduced %d times whole, %d split\n", name, 
+            whole_calls, split_calls);
+        failures++;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<int> data(200000);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (int)i;
+
+    check<hash_container<int, int, buffer_combiner> >("buffer", data);
+    check<posting_container<int, int> >("posting", data);
+
+    printf("hot_key_check: %s\n", failures ? "FAILED" : "passed");
+    return failures ? 1 : 0;
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
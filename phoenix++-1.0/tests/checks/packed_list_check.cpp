@@ -0,0 +1,103 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <vector>
+
+#include "combiner.h"
+
+// Round trips values through packed_combiner and posting_combiner, with 
+// differences of every varint length, and checks that repeats are kept.
+
+static int failures = 0;
+
+template<class Combiner, typename V>
+static void check(char const* name, std::vector<V> const& in)
+{
+    Combiner c;
+    for (size_t i = 0; i < in.size(); i++)
+        c.add(in[i]);
+
+    typename Combiner::combined values;
+    c.combineinto(values);
+    std::vector<V> out;
+    V v;
+    while (values.next(v))
+        out.push_back(v);
+
+    if (c.count() != in.size() || out != in) {
+        printf("%s: %zu values in, %zu out\n", name, in.size(), out.size());
+        for (size_t i = 0; i < in.size() && i < out.size(); i++) {
+            if (in[i] != out[i]) {
+                printf("%s: value %zu is %" PRId64 ", expected %" PRId64 "\n",
+                    name, i, (int64_t)out[i], (int64_t)in[i]);
+                break;
+            }
+        }
+        failures++;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<int64_t> big;
+    big.push_back(1LL << 60);           // 9 byte varint in a first chunk
+    big.push_back(-(1LL << 60));
+    big.push_back(INT64_MAX);
+    big.push_back(INT64_MIN);
+    big.push_back(0);
+    big.push_back(-1);
+    for (int shift = 0; shift < 63; shift++) {
+        big.push_back(1LL << shift);
+        big.push_back(-(1LL << shift));
+    }
+    check<packed_combiner<int64_t> >("packed large", big);
+    check<posting_combiner<int64_t> >("posting large", big);
+
+    std::vector<int64_t> one(1, 1LL << 60);
+    check<packed_combiner<int64_t> >("packed single", one);
+
+    // long runs, repeats and negative steps across many chunks
+    std::vector<int> dense;
+    for (int i = 0; i < 100000; i++)
+        dense.push_back(i % 7 == 0 ? -i : i / 3);
+    check<packed_combiner<int> >("packed dense", dense);
+    check<posting_combiner<int> >("posting dense", dense);
+
+    srand(1);
+    std::vector<int64_t> rnd;
+    for (int i = 0; i < 100000; i++)
+        rnd.push_back(((int64_t)rand() << 40) ^ ((int64_t)rand() << 8) ^ 
+            (rand() & 1 ? -1 : 1));
+    check<packed_combiner<int64_t> >("packed random", rnd);
+
+    printf("packed_list_check: %s\n", failures ? "FAILED" : "passed");
+    return failures ? 1 : 0;
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
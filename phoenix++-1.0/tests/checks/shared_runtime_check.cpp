@@ -0,0 +1,128 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <vector>
+
+#include "map_reduce.h"
+
+// Runs several jobs at once on the shared runtime, with different weights, 
+// a priority and different worker counts, and checks that every result is 
+// right and that no job is starved by the others of its priority: when the
+// first of them is done, each of the rest has finished at least one run.
+// Job 0 has the higher priority and may hold the pool until it is done.
+
+static const int num_jobs = 6;
+static const int num_runs = 20;
+static const int num_keys = 97;
+
+class SumMR : public MapReduce<SumMR, int, int, uint64_t, 
+    hash_container<int, uint64_t, sum_combiner> >
+{
+public:
+    void map(int const& x, map_container& out) const
+    {
+        for (int k = 0; k < 16; k++)
+            emit_intermediate(out, (x + k) % num_keys, (uint64_t)x);
+    }
+};
+
+static std::vector<int> data;
+static pthread_barrier_t start;
+static int done[num_jobs];          // runs finished by each job
+static int done_when_first_ended[num_jobs];
+static int first_ended = 0;         // set by the first job after job 0
+static int failures = 0;
+
+static void* job(void* arg)
+{
+    long id = (long)arg;
+    uint64_t n = data.size();
+    uint64_t expected = 16 * (n * (n - 1) / 2);
+
+    SumMR mr;
+    mr.setShare(1 + id % 3, id == 0 ? 1 : 0);
+    if (id == 4)
+        mr.setThreads(2);
+    if (id == 5)
+        mr.setThreads(runtime::shared().size() * 2);
+
+    pthread_barrier_wait(&start);
+    for (int run = 0; run < num_runs; run++) {
+        std::vector<SumMR::keyval> result;
+        mr.run(&data[0], n, result);
+
+        uint64_t total = 0;
+        for (size_t i = 0; i < result.size(); i++)
+            total += result[i].val;
+        if (result.size() != (size_t)num_keys || total != expected) {
+            printf("job %ld run %d: %zu keys, total %llu\n", id, run, 
+                result.size(), (unsigned long long)total);
+            __sync_fetch_and_add(&failures, 1);
+        }
+        __sync_fetch_and_add(&done[id], 1);
+    }
+
+    // the first job of priority 0 to finish notes how far the others got
+    if (id != 0 && __sync_bool_compare_and_swap(&first_ended, 0, 1)) {
+        for (int i = 0; i < num_jobs; i++)
+            done_when_first_ended[i] = done[i];
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    data.resize(100000);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (int)i;
+
+    pthread_t threads[num_jobs];
+    pthread_barrier_init(&start, NULL, num_jobs);
+    for (long i = 0; i < num_jobs; i++)
+        CHECK_ERROR(pthread_create(&threads[i], NULL, job, (void*)i) != 0);
+    for (int i = 0; i < num_jobs; i++)
+        CHECK_ERROR(pthread_join(threads[i], NULL) != 0);
+    pthread_barrier_destroy(&start);
+
+    for (int i = 0; i < num_jobs; i++) {
+        if (done[i] != num_runs) {
+            printf("job %d: %d of %d runs\n", i, done[i], num_runs);
+            failures++;
+        }
+        if (i != 0 && done_when_first_ended[i] == 0) {
+            printf("job %d: starved\n", i);
+            failures++;
+        }
+    }
+
+    printf("shared_runtime_check: %s\n", failures ? "FAILED" : "passed");
+    return failures ? 1 : 0;
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
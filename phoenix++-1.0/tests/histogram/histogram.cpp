@@ -27,6 +27,7 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <inttypes.h>
 
 #include "map_reduce.h"
 
@@ -45,15 +46,21 @@ struct pixel {
 
 #ifdef MUST_USE_HASH
 class HistogramMR : public MapReduceSort<HistogramMR, pixel, intptr_t, uint64_t, hash_container<intptr_t, uint64_t, sum_combiner, std::tr1::hash<intptr_t>
+#elif defined(MUST_USE_ADAPTIVE)
+class HistogramMR : public MapReduceSort<HistogramMR, pixel, intptr_t, uint64_t, adaptive_container<intptr_t, uint64_t, sum_combiner, std::tr1::hash<intptr_t>
 #elif defined(MUST_USE_FIXED_HASH)
 class HistogramMR : public MapReduceSort<HistogramMR, pixel, intptr_t, uint64_t, fixed_hash_container<intptr_t, uint64_t, sum_combiner, 32768, std::tr1::hash<intptr_t>
-#else
+#elif defined(MUST_USE_ARRAY)
 class HistogramMR : public MapReduceSort<HistogramMR, pixel, intptr_t, uint64_t, array_container<intptr_t, uint64_t, sum_combiner, 768
 #endif
+#if defined(MUST_USE_HASH) || defined(MUST_USE_ADAPTIVE) || defined(MUST_USE_FIXED_HASH) || defined(MUST_USE_ARRAY)
 #ifdef TBB
     , tbb::scalable_allocator
 #endif
 > >
+#else
+class HistogramMR : public MapReduceDense<HistogramMR, pixel, intptr_t, uint64_t, 768>
+#endif
 {
 public:
     void map(data_type const& p, map_container& out) const {
@@ -63,12 +70,15 @@ public:
     }
 #ifdef MUST_REDUCE
     void reduce(key_type const& key, reduce_iterator const& values, std::vector<keyval>& out) const {
-        value_type total=0, val;
-        while (values.next(val))
+        value_type total=0;
+        value_type const* vals;
+        uint64_t len;
+        while ((len = values.next_batch(vals)) > 0)
         {
-            total += val;
+            for (uint64_t i = 0; i < len; i++)
+                total += vals[i];
         }
-        keyval kv = {key, val};
+        keyval kv = {key, total};
         out.push_back(kv);
     }
 #endif
@@ -124,19 +134,19 @@ int main(int argc, char *argv[]) {
 #ifdef MMAP_POPULATE
     // Memory map the file
     CHECK_ERROR((fdata = (char*)mmap(0, finfo.st_size + 1, 
-        PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0)) == NULL);
+        PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0)) == MAP_FAILED);
 #else
     // Memory map the file
     CHECK_ERROR((fdata = (char*)mmap(0, finfo.st_size + 1, 
-        PROT_READ, MAP_PRIVATE, fd, 0)) == NULL);
+        PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED);
 #endif
 #else
-    int ret;
+    ssize_t ret;
         
     fdata = (char *)malloc (finfo.st_size);
     CHECK_ERROR (fdata == NULL);
     
-    ret = read (fd, fdata, finfo.st_size);
+    ret = read_all (fd, fdata, finfo.st_size);
     CHECK_ERROR (ret != finfo.st_size);
 #endif
 
@@ -163,8 +173,8 @@ int main(int argc, char *argv[]) {
         data_pos = (data_pos >> 8) + ((data_pos & 255) << 8);
     }
     
-    int imgdata_bytes = (int)finfo.st_size - (int)data_pos;
-    printf("This file has %d bytes of image data, %d pixels\n", 
+    uint64_t imgdata_bytes = finfo.st_size - data_pos;
+    printf("This file has %" PRIu64 " bytes of image data, %" PRIu64 " pixels\n", 
         imgdata_bytes, imgdata_bytes / 3);
     get_time (end);
     print_time("initialize", begin, end);
@@ -207,7 +217,7 @@ int main(int argc, char *argv[]) {
             red = true;
         }
         
-        printf("%hd - %ld\n", pix_val%256, freq);
+        printf("%hd - %" PRIdPTR "\n", pix_val%256, freq);
         
         prev = pix_val;
     }
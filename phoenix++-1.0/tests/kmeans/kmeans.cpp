@@ -151,10 +151,12 @@ public:
 
 #ifdef MUST_USE_HASH
 class KmeansMR : public MapReduce<KmeansMR, point, intptr_t, point, hash_container<intptr_t, point, point_combiner, std::tr1::hash<intptr_t>
+#elif defined(MUST_USE_ADAPTIVE)
+class KmeansMR : public MapReduce<KmeansMR, point, intptr_t, point, adaptive_container<intptr_t, point, point_combiner, std::tr1::hash<intptr_t>
 #elif defined(MUST_USE_FIXED_HASH)
 class KmeansMR : public MapReduce<KmeansMR, point, intptr_t, point, fixed_hash_container<intptr_t, point, point_combiner, 256, std::tr1::hash<intptr_t>
 #else
-class KmeansMR : public MapReduce<KmeansMR, point, intptr_t, point, array_container<intptr_t, point, point_combiner, DEF_NUM_MEANS
+class KmeansMR : public MapReduce<KmeansMR, point, intptr_t, point, array_container<intptr_t, point, point_combiner, 0
 #endif
 #ifdef TBB
     , tbb::scalable_allocator
@@ -196,16 +198,23 @@ public:
     KmeansMR(std::vector<point> const& means)
 #ifdef MUST_USE_HASH 
         : MapReduce<KmeansMR, point, intptr_t, point, hash_container<intptr_t, point, point_combiner, std::tr1::hash<intptr_t>
+#elif defined(MUST_USE_ADAPTIVE)
+        : MapReduce<KmeansMR, point, intptr_t, point, adaptive_container<intptr_t, point, point_combiner, std::tr1::hash<intptr_t>
 #elif defined(MUST_USE_FIXED_HASH)
         : MapReduce<KmeansMR, point, intptr_t, point, fixed_hash_container<intptr_t, point, point_combiner, 256, std::tr1::hash<intptr_t>
 #else
-        : MapReduce<KmeansMR, point, intptr_t, point, array_container<intptr_t, point, point_combiner, DEF_NUM_MEANS
+        : MapReduce<KmeansMR, point, intptr_t, point, array_container<intptr_t, point, point_combiner, 0
 #endif
 #ifdef TBB
     , tbb::scalable_allocator
 #endif
     > >(), means(means)
-    {}
+    {
+#if !defined(MUST_USE_HASH) && !defined(MUST_USE_ADAPTIVE) && !defined(MUST_USE_FIXED_HASH)
+        // one key per mean, any number of them
+        this->container.resize(means.size());
+#endif
+    }
 };
 
 int main(int argc, char **argv)
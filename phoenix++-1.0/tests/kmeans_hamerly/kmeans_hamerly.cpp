@@ -0,0 +1,376 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <limits>
+
+#include "map_reduce.h"
+
+#ifdef TBB
+#include "tbb/scalable_allocator.h"
+#endif
+
+#define DEF_NUM_POINTS 100000
+#define DEF_NUM_MEANS 100
+#define DEF_DIM 3
+#define DEF_GRID_SIZE 1000
+
+// Kmeans with Hamerly's bounds. Every point remembers its cluster, an upper 
+// bound on the distance to that cluster's mean and a lower bound on the 
+// distance to any other mean. After the means move the bounds are loosened 
+// by how far they moved, and only points whose bounds cross are measured 
+// again, so late iterations skip almost all distance computations. The 
+// bounds live in the points themselves, which map updates in place and 
+// which are passed to every run(). Given the same arguments the result is 
+// identical to ../kmeans, which is the reference to benchmark against.
+
+int num_points; // number of vectors
+int dim;         // Dimension of each vector
+int num_means; // number of clusters
+int grid_size; // size of each dimension of vector space
+int modified;
+
+struct point
+{
+    int* d;
+    int cluster;  // Cluster id or cluster point count (for means)
+    double upper; // >= distance to the mean of cluster
+    double lower; // <= distance to any other mean
+    
+    point() { d = NULL; cluster = -1; upper = lower = 0; }
+    point(int* d, int cluster) { 
+        this->d = d; this->cluster = cluster; upper = lower = 0; 
+    }
+    
+    point& normalize() {
+	for(int i = 0; i < dim; ++i)
+             d[i] /= cluster;
+        cluster = 1;
+        return *this;
+    }
+    
+    unsigned int sq_dist(point const& p) const
+    {
+        unsigned int sum = 0;
+        for (int i = 0; i < dim; i++) 
+        {
+            int diff = d[i] - p.d[i];
+            sum += diff * diff;
+        }
+        return sum;
+    }
+    
+    void dump() {
+        for(int j = 0; j < dim; j++)
+            printf("%5d ", d[j]);
+        printf("\n");
+    }
+    
+    void generate() {
+        for(int j = 0; j < dim; j++)
+            d[j] = rand() % grid_size;
+    }
+};
+
+/** parse_args()
+ *  Parse the user arguments
+ */
+void parse_args(int argc, char **argv) 
+{
+    int c;
+    extern char *optarg;
+    
+    num_points = DEF_NUM_POINTS;
+    num_means = DEF_NUM_MEANS;
+    dim = DEF_DIM;
+    grid_size = DEF_GRID_SIZE;
+    
+    while ((c = getopt(argc, argv, "d:c:p:s:")) != EOF) 
+    {
+        switch (c) {
+            case 'd':
+                dim = atoi(optarg);
+                break;
+            case 'c':
+                num_means = atoi(optarg);
+                break;
+            case 'p':
+                num_points = atoi(optarg);
+                break;
+            case 's':
+                grid_size = atoi(optarg);
+                break;
+            case '?':
+                printf("Usage: %s -d <vector dimension> -c <num clusters> -p <num points> -s <max value>\n", argv[0]);
+                exit(1);
+        }
+    }
+    
+    if (dim <= 0 || num_means <= 0 || num_points <= 0 || grid_size <= 0) {
+        printf("Illegal argument value. All values must be numeric and greater than 0\n");
+        exit(1);
+    }
+    
+    printf("Dimension = %d\n", dim);
+    printf("Number of clusters = %d\n", num_means);
+    printf("Number of points = %d\n", num_points);
+    printf("Size of each dimension = %d\n", grid_size);    
+}
+
+// How far the means moved in the last iteration and how far apart they are.
+struct mean_motion
+{
+    std::vector<double> drift;      // distance each mean moved
+    std::vector<double> half_gap;   // half the distance to the nearest mean
+    int fastest;                    // mean that moved furthest
+    double max_drift, second_drift; // furthest and second furthest move
+    double slack;                   // covers rounding in the bounds
+    bool prune;                     // bounds are usable
+
+    mean_motion() : fastest(0), max_drift(0), second_drift(0), slack(0), 
+        prune(false) {}
+
+    void update(std::vector<int> const& old, std::vector<point> const& means)
+    {
+        drift.assign(num_means, 0);
+        half_gap.assign(num_means, std::numeric_limits<double>::infinity());
+        fastest = 0;
+        max_drift = second_drift = 0;
+        for (int j = 0; j < num_means; j++) {
+            if (!old.empty()) {
+                point was(const_cast<int*>(&old[j * dim]), 0);
+                drift[j] = sqrt((double)was.sq_dist(means[j]));
+            }
+            if (drift[j] > max_drift) {
+                second_drift = max_drift;
+                max_drift = drift[j];
+                fastest = j;
+            } else if (drift[j] > second_drift) {
+                second_drift = drift[j];
+            }
+            for (int k = 0; k < j; k++) {
+                double gap = sqrt((double)means[j].sq_dist(means[k])) / 2;
+                half_gap[j] = std::min(half_gap[j], gap);
+                half_gap[k] = std::min(half_gap[k], gap);
+            }
+        }
+        // Squared distances are unsigned ints as in ../kmeans. If they 
+        // can wrap, the bounds mean nothing and every point is measured.
+        double most = (double)dim * grid_size * grid_size;
+        prune = most < 4294967296.0;
+        slack = sqrt(most) * 1e-9;
+    }
+};
+
+template<class V, template<class> class Allocator>
+class point_combiner : public associative_combiner<point_combiner<V, Allocator>, V, Allocator> 
+{
+public:
+     static void F(point& a, point const& b) { 
+         a.cluster += b.cluster;
+         for(int i = 0; i < dim; i++) a.d[i] += b.d[i]; 
+     }
+     static void Init(point& a) { 
+         a.cluster = 0;
+         a.d = (int*)calloc(dim, sizeof(int)); 
+     }
+     static bool Empty(point const& a) { 
+         return a.cluster == 0; 
+     }
+};
+
+class KmeansHamerlyMR : public MapReduce<KmeansHamerlyMR, point, intptr_t, point, array_container<intptr_t, point, point_combiner, 0
+#ifdef TBB
+    , tbb::scalable_allocator
+#endif
+> >
+{
+    std::vector<point> const& means;
+    mean_motion const& motion;
+
+    // Measure p against every mean. Ties go to the lowest mean, as in 
+    // ../kmeans.
+    void assign(point& p) const
+    {
+        unsigned int min_dist = std::numeric_limits<unsigned int>::max();
+        unsigned int next_dist = std::numeric_limits<unsigned int>::max();
+        int min_idx = 0;
+
+        for (int j = 0; j < num_means; j++)
+        {
+            unsigned int cur_dist = p.sq_dist(means[j]);
+            if (cur_dist < min_dist) 
+            {
+                next_dist = min_dist;
+                min_dist = cur_dist;
+                min_idx = j; 
+            }
+            else if (cur_dist < next_dist)
+                next_dist = cur_dist;
+        }
+
+        if (p.cluster != min_idx) 
+        {
+            p.cluster = min_idx;
+            modified = true;
+        }
+        p.upper = sqrt((double)min_dist);
+        p.lower = sqrt((double)next_dist);
+    }
+
+public:    
+
+    void* locate(data_type* d, uint64_t len) const
+    {
+        return d->d;
+    }
+
+    void map(data_type& p, map_container& out) const
+    {
+        if (p.cluster < 0 || !motion.prune) {
+            assign(p);
+        } else {
+            int a = p.cluster;
+            p.upper += motion.drift[a] + motion.slack;
+            p.lower -= (a == motion.fastest ? motion.second_drift : 
+                motion.max_drift) + motion.slack;
+
+            // The cluster can only change if the bounds cross, and then 
+            // only if they still cross once upper is made exact. Ties 
+            // count as crossed so they are settled like ../kmeans.
+            double bound = std::max(motion.half_gap[a], p.lower);
+            if (p.upper >= bound) {
+                p.upper = sqrt((double)p.sq_dist(means[a]));
+                if (p.upper >= bound)
+                    assign(p);
+            }
+        }
+
+        emit_intermediate(out, p.cluster, point(p.d, 1));
+    }
+    
+    KmeansHamerlyMR(std::vector<point> const& means, mean_motion const& motion)
+        : means(means), motion(motion)
+    {
+        // one key per mean, any number of them
+        this->container.resize(means.size());
+    }
+};
+
+int main(int argc, char **argv)
+{
+    std::vector<point> means;
+    mean_motion motion;
+    std::vector<int> old;
+    int iterations = 0;
+    
+    struct timespec begin, end, ibegin, iend;
+    double library_time = 0;
+    double inter_library_time = 0;
+
+    get_time (begin);
+    
+    parse_args(argc, argv);    
+    
+    // get points
+    int* pointdata = (int *)malloc(sizeof(int) * num_points * dim);
+    point* points = new point[num_points];
+    for(int i = 0; i < num_points; i++) {
+        points[i] = point(&pointdata[i*dim], -1);
+        points[i].generate();
+    }
+
+    // get means
+    for (int i=0; i<num_means; i++) {
+        means.push_back(point((int*)malloc(sizeof(int) * dim), 0));
+        means[i].generate();
+    } 
+    motion.update(old, means);
+    
+    modified = true;
+
+    get_time (end);
+    print_time("initialize", begin, end);
+
+    printf("KMeans: Calling MapReduce Scheduler\n");
+
+    KmeansHamerlyMR* mapReduce = new KmeansHamerlyMR(means, motion);
+    while (modified == true)
+    {
+        get_time (ibegin);
+        modified = false;
+        std::vector<KmeansHamerlyMR::keyval> result;
+        get_time (begin);        
+        CHECK_ERROR( mapReduce->run(points, num_points, result) < 0);
+        get_time (end);
+        library_time += time_diff (end, begin);
+        iterations++;
+
+        old.resize(num_means * dim);
+        for (int i = 0; i < num_means; i++)
+            memcpy(&old[i * dim], means[i].d, sizeof(int) * dim);
+        for (size_t i = 0; i < result.size(); i++)
+        {
+            result[i].val.normalize();
+            memcpy(means[result[i].key].d, result[i].val.d, sizeof(int) * dim);
+            free(result[i].val.d);
+        }
+        motion.update(old, means);
+        get_time (iend);
+        inter_library_time += time_diff (iend, ibegin) - time_diff(end, begin);
+    } 
+    delete mapReduce;
+
+    print_time("library", library_time);
+    print_time("library per iteration", library_time / iterations);
+    print_time("inter library", inter_library_time);
+
+    get_time (begin);
+
+    dprintf("\n");
+    printf("KMeans: MapReduce Completed\n");  
+
+    printf("\n\nFinal means:\n");
+    for(int i = 0; i < num_means; i++) {
+        means[i].dump();
+        free(means[i].d);
+    }
+
+    free(pointdata);
+    delete [] points;
+    
+    get_time (end);
+
+    print_time("finalize", begin, end);
+
+    return 0;
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
@@ -0,0 +1,522 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits>
+
+#include "map_reduce.h"
+#include "processor.h"
+#include "soa.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KMEANS_X86
+#include <immintrin.h>
+#endif
+
+#define DEF_NUM_POINTS 100000
+#define DEF_NUM_MEANS 100
+#define DEF_DIM 3
+#define DEF_GRID_SIZE 1000
+#define DEF_BLOCK 256
+
+// Kmeans over points stored as a blocked structure of arrays. Each map task 
+// gets a block of points as one contiguous array per dimension and finds the 
+// nearest mean for the whole block with a vector kernel. Given the same 
+// arguments it generates the same data as ../kmeans and must print the same 
+// means, which makes ../kmeans the reference to benchmark against.
+
+int num_points; // number of vectors
+int dim;         // Dimension of each vector
+int num_means; // number of clusters
+int grid_size; // size of each dimension of vector space
+int use_float; // run the kernel on floats instead of ints
+int modified;
+
+enum { KERNEL_AUTO = PROC_ISA_AUTO, KERNEL_SCALAR = PROC_ISA_GENERIC, 
+    KERNEL_AVX2 = PROC_ISA_AVX2, KERNEL_AVX512 = PROC_ISA_AVX512 };
+int kernel;
+
+/** parse_args()
+ *  Parse the user arguments
+ */
+void parse_args(int argc, char **argv) 
+{
+    int c;
+    extern char *optarg;
+    
+    num_points = DEF_NUM_POINTS;
+    num_means = DEF_NUM_MEANS;
+    dim = DEF_DIM;
+    grid_size = DEF_GRID_SIZE;
+    use_float = 0;
+    kernel = KERNEL_AUTO;
+    
+    while ((c = getopt(argc, argv, "d:c:p:s:fk:")) != EOF) 
+    {
+        switch (c) {
+            case 'd':
+                dim = atoi(optarg);
+                break;
+            case 'c':
+                num_means = atoi(optarg);
+                break;
+            case 'p':
+                num_points = atoi(optarg);
+                break;
+            case 's':
+                grid_size = atoi(optarg);
+                break;
+            case 'f':
+                use_float = 1;
+                break;
+            case 'k':
+                if (!strcmp(optarg, "scalar")) kernel = KERNEL_SCALAR;
+                else if (!strcmp(optarg, "avx2")) kernel = KERNEL_AVX2;
+                else if (!strcmp(optarg, "avx512")) kernel = KERNEL_AVX512;
+                break;
+            case '?':
+                printf("Usage: %s -d <vector dimension> -c <num clusters> -p <num points> -s <max value> [-f] [-k scalar|avx2|avx512]\n", argv[0]);
+                exit(1);
+        }
+    }
+    
+    if (dim <= 0 || num_means <= 0 || num_points <= 0 || grid_size <= 0) {
+        printf("Illegal argument value. All values must be numeric and greater than 0\n");
+        exit(1);
+    }
+    
+    printf("Dimension = %d\n", dim);
+    printf("Number of clusters = %d\n", num_means);
+    printf("Number of points = %d\n", num_points);
+    printf("Size of each dimension = %d\n", grid_size);    
+
+    kernel = proc_get_isa(kernel);
+}
+
+// Means are stored by dimension like the points: coordinate d of mean j is 
+// m[d*stride + j]. Tiles of means sized to stay in L1 are tried against a 
+// block of points before moving on to the next tile.
+template<typename T>
+struct mean_table
+{
+    std::vector<T> m;
+    int stride;
+    int tile;
+
+    mean_table() : stride(0), tile(0) {}
+    void resize(int means, int dims) {
+        stride = means;
+        m.assign((size_t)means * dims, 0);
+        // about 16KB of means per tile
+        tile = std::max(16, (int)(16384 / (dims * sizeof(T))));
+    }
+    T& at(int mean, int d) { return m[(size_t)d * stride + mean]; }
+    T const* column(int d) const { return &m[(size_t)d * stride]; }
+};
+
+// Distances are unsigned ints for int points, which wrap exactly like 
+// the reference's sq_dist, and floats for float points.
+template<typename T> struct distance_type { typedef unsigned int type; };
+template<> struct distance_type<float> { typedef float type; };
+
+/* Scalar kernel: best[r] and dist[r] receive the nearest mean to each of 
+   the n rows in cols and its distance. Ties go to the lowest mean, as in 
+   the reference. */
+template<typename T>
+static void assign_scalar(T const* const* cols, int n, mean_table<T> const& means,
+    int* best, typename distance_type<T>::type* dist)
+{
+    typedef typename distance_type<T>::type D;
+    for (int r = 0; r < n; r++) {
+        dist[r] = std::numeric_limits<D>::max();
+        best[r] = 0;
+    }
+    for (int t0 = 0; t0 < num_means; t0 += means.tile) {
+        int t1 = std::min(num_means, t0 + means.tile);
+        for (int r = 0; r < n; r++) {
+            for (int j = t0; j < t1; j++) {
+                D sum = 0;
+                for (int d = 0; d < dim; d++) {
+                    T diff = cols[d][r] - means.column(d)[j];
+                    sum += (D)(diff * diff);
+                }
+                if (sum < dist[r]) {
+                    dist[r] = sum;
+                    best[r] = j;
+                }
+            }
+        }
+    }
+}
+
+#ifdef KMEANS_X86
+
+__attribute__((target("avx2")))
+static void assign_avx2(int const* const* cols, int n, 
+    mean_table<int> const& means, int* best, unsigned int* dist)
+{
+    for (int t0 = 0; t0 < num_means; t0 += means.tile) {
+        int t1 = std::min(num_means, t0 + means.tile);
+        for (int r = 0; r < n; r += 8) {
+            __m256i bd, bi;
+            if (t0 == 0) {
+                bd = _mm256_set1_epi32(-1);
+                bi = _mm256_setzero_si256();
+            } else {
+                bd = _mm256_load_si256((__m256i const*)&dist[r]);
+                bi = _mm256_load_si256((__m256i const*)&best[r]);
+            }
+            for (int j = t0; j < t1; j++) {
+                __m256i sum = _mm256_setzero_si256();
+                for (int d = 0; d < dim; d++) {
+                    __m256i diff = _mm256_sub_epi32(
+                        _mm256_load_si256((__m256i const*)&cols[d][r]), 
+                        _mm256_set1_epi32(means.column(d)[j]));
+                    sum = _mm256_add_epi32(sum, _mm256_mullo_epi32(diff, diff));
+                }
+                // unsigned sum < bd  <=>  max(sum, bd) != sum
+                __m256i lt = _mm256_xor_si256(_mm256_cmpeq_epi32(
+                    _mm256_max_epu32(sum, bd), sum), _mm256_set1_epi32(-1));
+                bd = _mm256_blendv_epi8(bd, sum, lt);
+                bi = _mm256_blendv_epi8(bi, _mm256_set1_epi32(j), lt);
+            }
+            _mm256_store_si256((__m256i*)&dist[r], bd);
+            _mm256_store_si256((__m256i*)&best[r], bi);
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static void assign_avx2(float const* const* cols, int n, 
+    mean_table<float> const& means, int* best, float* dist)
+{
+    for (int t0 = 0; t0 < num_means; t0 += means.tile) {
+        int t1 = std::min(num_means, t0 + means.tile);
+        for (int r = 0; r < n; r += 8) {
+            __m256 bd;
+            __m256i bi;
+            if (t0 == 0) {
+                bd = _mm256_set1_ps(std::numeric_limits<float>::max());
+                bi = _mm256_setzero_si256();
+            } else {
+                bd = _mm256_load_ps(&dist[r]);
+                bi = _mm256_load_si256((__m256i const*)&best[r]);
+            }
+            for (int j = t0; j < t1; j++) {
+                __m256 sum = _mm256_setzero_ps();
+                for (int d = 0; d < dim; d++) {
+                    __m256 diff = _mm256_sub_ps(_mm256_load_ps(&cols[d][r]), 
+                        _mm256_set1_ps(means.column(d)[j]));
+                    sum = _mm256_add_ps(sum, _mm256_mul_ps(diff, diff));
+                }
+                __m256 lt = _mm256_cmp_ps(sum, bd, _CMP_LT_OQ);
+                bd = _mm256_blendv_ps(bd, sum, lt);
+                bi = _mm256_castps_si256(_mm256_blendv_ps(
+                    _mm256_castsi256_ps(bi), 
+                    _mm256_castsi256_ps(_mm256_set1_epi32(j)), lt));
+            }
+            _mm256_store_ps(&dist[r], bd);
+            _mm256_store_si256((__m256i*)&best[r], bi);
+        }
+    }
+}
+
+__attribute__((target("avx512f")))
+static void assign_avx512(int const* const* cols, int n, 
+    mean_table<int> const& means, int* best, unsigned int* dist)
+{
+    for (int t0 = 0; t0 < num_means; t0 += means.tile) {
+        int t1 = std::min(num_means, t0 + means.tile);
+        for (int r = 0; r < n; r += 16) {
+            __m512i bd, bi;
+            if (t0 == 0) {
+                bd = _mm512_set1_epi32(-1);
+                bi = _mm512_setzero_si512();
+            } else {
+                bd = _mm512_load_si512(&dist[r]);
+                bi = _mm512_load_si512(&best[r]);
+            }
+            for (int j = t0; j < t1; j++) {
+                __m512i sum = _mm512_setzero_si512();
+                for (int d = 0; d < dim; d++) {
+                    __m512i diff = _mm512_sub_epi32(
+                        _mm512_load_si512(&cols[d][r]), 
+                        _mm512_set1_epi32(means.column(d)[j]));
+                    sum = _mm512_add_epi32(sum, _mm512_mullo_epi32(diff, diff));
+                }
+                __mmask16 lt = _mm512_cmplt_epu32_mask(sum, bd);
+                bd = _mm512_mask_blend_epi32(lt, bd, sum);
+                bi = _mm512_mask_blend_epi32(lt, bi, _mm512_set1_epi32(j));
+            }
+            _mm512_store_si512(&dist[r], bd);
+            _mm512_store_si512(&best[r], bi);
+        }
+    }
+}
+
+__attribute__((target("avx512f")))
+static void assign_avx512(float const* const* cols, int n, 
+    mean_table<float> const& means, int* best, float* dist)
+{
+    for (int t0 = 0; t0 < num_means; t0 += means.tile) {
+        int t1 = std::min(num_means, t0 + means.tile);
+        for (int r = 0; r < n; r += 16) {
+            __m512 bd;
+            __m512i bi;
+            if (t0 == 0) {
+                bd = _mm512_set1_ps(std::numeric_limits<float>::max());
+                bi = _mm512_setzero_si512();
+            } else {
+                bd = _mm512_load_ps(&dist[r]);
+                bi = _mm512_load_si512(&best[r]);
+            }
+            for (int j = t0; j < t1; j++) {
+                __m512 sum = _mm512_setzero_ps();
+                for (int d = 0; d < dim; d++) {
+                    __m512 diff = _mm512_sub_ps(_mm512_load_ps(&cols[d][r]), 
+                        _mm512_set1_ps(means.column(d)[j]));
+                    sum = _mm512_add_ps(sum, _mm512_mul_ps(diff, diff));
+                }
+                __mmask16 lt = _mm512_cmp_ps_mask(sum, bd, _CMP_LT_OQ);
+                bd = _mm512_mask_blend_ps(lt, bd, sum);
+                bi = _mm512_mask_blend_epi32(lt, bi, _mm512_set1_epi32(j));
+            }
+            _mm512_store_ps(&dist[r], bd);
+            _mm512_store_si512(&best[r], bi);
+        }
+    }
+}
+
+#endif
+
+/* Run the kernel parse_args() picked: the one -k asked for if the CPU 
+   supports it, or else the widest one it does. Block widths are whole cache lines, so the vector loops need no tail. */
+template<typename T>
+static void assign(T const* const* cols, int n, mean_table<T> const& means,
+    int* best, typename distance_type<T>::type* dist)
+{
+#ifdef KMEANS_X86
+    if (kernel == KERNEL_AVX512)
+        return assign_avx512(cols, n, means, best, dist);
+    if (kernel == KERNEL_AVX2)
+        return assign_avx2(cols, n, means, best, dist);
+#endif
+    assign_scalar(cols, n, means, best, dist);
+}
+
+// Per cluster coordinate sums followed by the point count.
+typedef std::vector<long long> centroid;
+
+template<class V, template<class> class Allocator>
+class centroid_combiner : public associative_combiner<centroid_combiner<V, Allocator>, V, Allocator> 
+{
+public:
+     static void F(centroid& a, centroid const& b) { 
+         for(int i = 0; i <= dim; i++) a[i] += b[i]; 
+     }
+     static void Init(centroid& a) { 
+         a.assign(dim + 1, 0);
+     }
+};
+
+template<typename T>
+class KmeansSoaMR : public MapReduce<KmeansSoaMR<T>, soa_block<T>, intptr_t, 
+    centroid, array_container<intptr_t, centroid, centroid_combiner, 0> >
+{
+    typedef MapReduce<KmeansSoaMR<T>, soa_block<T>, intptr_t, centroid, 
+        array_container<intptr_t, centroid, centroid_combiner, 0> > base;
+
+    mean_table<T> const& means;
+    int* clusters;          // current cluster of each point
+public:
+    typedef typename base::data_type data_type;
+    typedef typename base::map_container map_container;
+
+    void* locate(data_type* b, uint64_t len) const
+    {
+        return b->column(0);
+    }
+
+    void map(data_type const& b, map_container& out) const
+    {
+        int width = (int)b.width();
+        std::vector<T const*> cols(dim);
+        for (int d = 0; d < dim; d++)
+            cols[d] = b.column(d);
+
+        // aligned scratch for the kernel's results
+        int* best;
+        typename distance_type<T>::type* dist;
+        CHECK_ERROR(posix_memalign((void**)&best, L2_CACHE_LINE_SIZE, 
+            width * sizeof(int)));
+        CHECK_ERROR(posix_memalign((void**)&dist, L2_CACHE_LINE_SIZE, 
+            width * sizeof(*dist)));
+        assign(&cols[0], width, means, best, dist);
+
+        std::vector<centroid> sums(num_means);
+        for (uint64_t r = 0; r < b.rows; r++) {
+            int c = best[r];
+            if (clusters[b.first + r] != c) {
+                clusters[b.first + r] = c;
+                modified = true;
+            }
+            centroid& s = sums[c];
+            if (s.empty())
+                s.assign(dim + 1, 0);
+            for (int d = 0; d < dim; d++)
+                s[d] += (long long)cols[d][r];
+            s[dim]++;
+        }
+        free(best);
+        free(dist);
+
+        for (int c = 0; c < num_means; c++) {
+            if (!sums[c].empty())
+                this->emit_intermediate(out, c, sums[c]);
+        }
+    }
+
+    KmeansSoaMR(mean_table<T> const& means, int* clusters) : 
+        means(means), clusters(clusters)
+    {
+        // one key per mean
+        this->container.resize(num_means);
+    }
+};
+
+template<typename T>
+static void run_kmeans(soa_table<T>& points, std::vector<int*>& final_means)
+{
+    struct timespec begin, end, ibegin, iend;
+    double library_time = 0;
+    double inter_library_time = 0;
+
+    mean_table<T> means;
+    means.resize(num_means, dim);
+    for (int i = 0; i < num_means; i++)
+        for (int d = 0; d < dim; d++)
+            means.at(i, d) = (T)final_means[i][d];
+
+    int* clusters = new int[num_points];
+    for (int i = 0; i < num_points; i++)
+        clusters[i] = -1;
+
+    std::vector< soa_block<T> > blocks;
+    points.split(blocks);
+
+    modified = true;
+    printf("KMeans: Calling MapReduce Scheduler\n");
+
+    KmeansSoaMR<T>* mapReduce = new KmeansSoaMR<T>(means, clusters);
+    while (modified == true)
+    {
+        get_time (ibegin);
+        modified = false;
+        std::vector<typename KmeansSoaMR<T>::keyval> result;
+        get_time (begin);        
+        CHECK_ERROR( mapReduce->run(&blocks[0], blocks.size(), result) < 0);
+        get_time (end);
+        library_time += time_diff (end, begin);
+
+        // new mean = coordinate sums / point count, rounded like the 
+        // reference's integer normalize()
+        for (size_t i = 0; i < result.size(); i++)
+        {
+            centroid const& s = result[i].val;
+            for (int d = 0; d < dim; d++) {
+                final_means[result[i].key][d] = (int)(s[d] / s[dim]);
+                means.at(result[i].key, d) = (T)final_means[result[i].key][d];
+            }
+        }
+        get_time (iend);
+        inter_library_time += time_diff (iend, ibegin) - time_diff(end, begin);
+    } 
+    delete mapReduce;
+    delete [] clusters;
+
+    print_time("library", library_time);
+    print_time("inter library", inter_library_time);
+}
+
+int main(int argc, char **argv)
+{
+    struct timespec begin, end;
+
+    get_time (begin);
+    
+    parse_args(argc, argv);    
+    
+    // get points, drawing from rand() in the same order as ../kmeans
+    soa_table<int> ipoints(num_points, dim, DEF_BLOCK);
+    for (int i = 0; i < num_points; i++)
+        for (int d = 0; d < dim; d++)
+            ipoints.at(i, d) = rand() % grid_size;
+
+    // get means
+    std::vector<int*> means;
+    for (int i = 0; i < num_means; i++) {
+        means.push_back((int*)malloc(sizeof(int) * dim));
+        for (int d = 0; d < dim; d++)
+            means[i][d] = rand() % grid_size;
+    }
+
+    get_time (end);
+    print_time("initialize", begin, end);
+
+    if (use_float) {
+        soa_table<float> fpoints(num_points, dim, DEF_BLOCK);
+        for (int i = 0; i < num_points; i++)
+            for (int d = 0; d < dim; d++)
+                fpoints.at(i, d) = (float)ipoints.at(i, d);
+        run_kmeans(fpoints, means);
+    } else {
+        run_kmeans(ipoints, means);
+    }
+
+    get_time (begin);
+
+    dprintf("\n");
+    printf("KMeans: MapReduce Completed\n");  
+
+    printf("\n\nFinal means:\n");
+    for (int i = 0; i < num_means; i++) {
+        for (int j = 0; j < dim; j++)
+            printf("%5d ", means[i][j]);
+        printf("\n");
+        free(means[i]);
+    }
+
+    get_time (end);
+
+    print_time("finalize", begin, end);
+
+    return 0;
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
@@ -27,6 +27,7 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <inttypes.h>
 
 #include "map_reduce.h"
 
@@ -50,15 +51,21 @@ enum {
 
 #ifdef MUST_USE_HASH
 class lrMR : public MapReduce<lrMR, POINT_T, unsigned char, uint64_t, hash_container< unsigned char, uint64_t, sum_combiner, std::tr1::hash<unsigned char>
+#elif defined(MUST_USE_ADAPTIVE)
+class lrMR : public MapReduce<lrMR, POINT_T, unsigned char, uint64_t, adaptive_container< unsigned char, uint64_t, sum_combiner, std::tr1::hash<unsigned char>
 #elif defined(MUST_USE_FIXED_HASH)
 class lrMR : public MapReduce<lrMR, POINT_T, unsigned char, uint64_t, fixed_hash_container< unsigned char, uint64_t, sum_combiner, 32768, std::tr1::hash<unsigned char>
-#else
+#elif defined(MUST_USE_ARRAY)
 class lrMR : public MapReduce<lrMR, POINT_T, unsigned char, uint64_t, array_container< unsigned char, uint64_t, sum_combiner, KEY_COUNT
 #endif
+#if defined(MUST_USE_HASH) || defined(MUST_USE_ADAPTIVE) || defined(MUST_USE_FIXED_HASH) || defined(MUST_USE_ARRAY)
 #ifdef TBB
     , tbb::scalable_allocator
 #endif
 > >
+#else
+class lrMR : public MapReduceDense<lrMR, POINT_T, unsigned char, uint64_t, KEY_COUNT>
+#endif
 {
 public:
     void map(data_type const& p, map_container& out) const
@@ -102,24 +109,24 @@ int main(int argc, char *argv[]) {
 #ifdef MMAP_POPULATE
     // Memory map the file
     CHECK_ERROR((fdata = (char*)mmap(0, finfo.st_size + 1, 
-        PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0)) == NULL);
+        PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0)) == MAP_FAILED);
 #else
     // Memory map the file
     CHECK_ERROR((fdata = (char*)mmap(0, finfo.st_size + 1, 
-        PROT_READ, MAP_PRIVATE, fd, 0)) == NULL);
+        PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED);
 #endif
 #else
-    uint64_t ret;
+    ssize_t ret;
 
     fdata = (char *)malloc (finfo.st_size);
     CHECK_ERROR (fdata == NULL);
 
-    ret = read (fd, fdata, finfo.st_size);
+    ret = read_all (fd, fdata, finfo.st_size);
     CHECK_ERROR (ret != finfo.st_size);
 #endif
 
-    int data_size = finfo.st_size / sizeof(POINT_T);
-    printf("data size: %d\n", data_size);
+    uint64_t data_size = finfo.st_size / sizeof(POINT_T);
+    printf("data size: %" PRIu64 "\n", data_size);
     printf("Linear Regression: Calling MapReduce Scheduler\n");
 
     get_time (end);
@@ -44,16 +44,18 @@ class MatrixMulMR : public MapReduce<MatrixMulMR, mm_data_t, int, int>
 {
     int *matrix_A, *matrix_B;
     int matrix_size;
+    int row_block_len;
     int row;
     int *output;
 
 public:
-    explicit MatrixMulMR(int* _mA, int* _mB, int size, int* out) : 
-        matrix_A(_mA), matrix_B(_mB), matrix_size(size), row(0), output(out) {}
+    explicit MatrixMulMR(int* _mA, int* _mB, int size, int block, int* out) : 
+        matrix_A(_mA), matrix_B(_mB), matrix_size(size), 
+        row_block_len(block > 0 ? block : 1), row(0), output(out) {}
         
     void* locate(mm_data_t* d, uint64_t len) const
     {
-        return d->matrix_A + d->row_num * d->matrix_len;
+        return d->matrix_A + (size_t)d->row_num * d->matrix_len;
     }
 
     /** matrixmul_map()
@@ -61,21 +63,23 @@ public:
      */
     void map(mm_data_t const& data, map_container& out) const
     {
-        int* a_ptr = data.matrix_A + data.row_num*data.matrix_len + 0;
-        int* b_ptr = data.matrix_B + 0;
+        for(int r = data.row_num; r < data.row_num + data.rows; r++) {
+            int* a_ptr = data.matrix_A + (size_t)r*data.matrix_len + 0;
+            int* b_ptr = data.matrix_B + 0;
             
-        int* output = data.output + data.row_num*data.matrix_len;
-        for(int i = 0; i < data.matrix_len ; i++) {
-            for(int j=0;j<data.matrix_len ; j++) {
-                output[j] += a_ptr[i] * b_ptr[j];
+            int* output = data.output + (size_t)r*data.matrix_len;
+            for(int i = 0; i < data.matrix_len ; i++) {
+                for(int j=0;j<data.matrix_len ; j++) {
+                    output[j] += a_ptr[i] * b_ptr[j];
+                }
+                b_ptr += data.matrix_len;
             }
-            b_ptr += data.matrix_len;
         }
     }
 
     /** matrixmul_split()
-     *  Assign a set of rows of the output matrix to each map task 
-     * (for now, default to one row per task)
+     *  Assign a set of row_block_len rows of the output matrix to each map 
+     *  task 
      */
     int split(mm_data_t& out)
     {
@@ -89,8 +93,9 @@ public:
         out.matrix_B = matrix_B;
         out.matrix_len = matrix_size;
         out.output = output;
-        out.rows = 1;
-        out.row_num = row++;
+        out.rows = std::min(row_block_len, matrix_size - row);
+        out.row_num = row;
+        row += out.rows;
         
         /* Return true since the out data is valid. */
         return 1;
@@ -100,12 +105,13 @@ public:
 int main(int argc, char *argv[]) {
 
     int i,j, create_files;
-    int fd_A, fd_B, file_size;
+    int fd_A, fd_B;
+    size_t file_size;
     int * fdata_A, *fdata_B;
     int matrix_len, row_block_len;
     struct stat finfo_A, finfo_B;
     char const* fname_A, *fname_B;
-    int ret;
+    ssize_t ret;
     
     struct timespec begin, end;
 
@@ -123,9 +129,9 @@ int main(int argc, char *argv[]) {
     fname_A = "matrix_file_A.txt";
     fname_B = "matrix_file_B.txt";
     CHECK_ERROR ( (matrix_len = atoi(argv[1])) < 0);
-    file_size = ((matrix_len*matrix_len))*sizeof(int);
+    file_size = ((size_t)matrix_len*matrix_len)*sizeof(int);
 
-    fprintf(stderr, "***** file size is %d\n", file_size);
+    fprintf(stderr, "***** file size is %zu\n", file_size);
 
     if(argv[2] == NULL)
         row_block_len = 1;
@@ -187,20 +193,20 @@ int main(int argc, char *argv[]) {
 #ifdef MMAP_POPULATE
     // Memory map the file
     CHECK_ERROR((fdata_A = (int*)mmap(0, finfo_A.st_size + 1, 
-        PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd_A, 0)) == NULL);
+        PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd_A, 0)) == MAP_FAILED);
 #else
     // Memory map the file
     CHECK_ERROR((fdata_A = (int*)mmap(0, finfo_A.st_size + 1, 
-        PROT_READ, MAP_PRIVATE, fd_A, 0)) == NULL);
+        PROT_READ, MAP_PRIVATE, fd_A, 0)) == MAP_FAILED);
 #endif
 #else
-    int ret;
+    ssize_t ret;
 
     fdata_A = (char *)malloc (file_size);
     CHECK_ERROR (fdata_A == NULL);
 
-    ret = read (fd_A, fdata_A, file_size);
-    CHECK_ERROR (ret != file_size);
+    ret = read_all (fd_A, fdata_A, file_size);
+    CHECK_ERROR (ret != (ssize_t)file_size);
 #endif
 
     // Read in the file
@@ -211,23 +217,23 @@ int main(int argc, char *argv[]) {
 #ifdef MMAP_POPULATE
     // Memory map the file
     CHECK_ERROR((fdata_B = (int*)mmap(0, finfo_B.st_size + 1, 
-        PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd_B, 0)) == NULL);
+        PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd_B, 0)) == MAP_FAILED);
 #else
     // Memory map the file
     CHECK_ERROR((fdata_B = (int*)mmap(0, finfo_B.st_size + 1, 
-        PROT_READ, MAP_PRIVATE, fd_B, 0)) == NULL);
+        PROT_READ, MAP_PRIVATE, fd_B, 0)) == MAP_FAILED);
 #endif
 #else
     fdata_B = (char *)malloc (file_size);
     CHECK_ERROR (fdata_B == NULL);
 
-    ret = read (fd_B, fdata_B, file_size);
-    CHECK_ERROR (ret != file_size);
+    ret = read_all (fd_B, fdata_B, file_size);
+    CHECK_ERROR (ret != (ssize_t)file_size);
 #endif
 
-    int* output = (int*)calloc(matrix_len*matrix_len, sizeof(int));
+    int* output = (int*)calloc((size_t)matrix_len*matrix_len, sizeof(int));
 
-    fprintf(stderr, "***** data size is %ld\n", (intptr_t)file_size);
+    fprintf(stderr, "***** data size is %zu\n", file_size);
     printf("MatrixMult: Calling MapReduce Scheduler Matrix Multiplication\n");
 
     get_time (end);
@@ -235,16 +241,16 @@ int main(int argc, char *argv[]) {
 
     get_time (begin);
     std::vector<MatrixMulMR::keyval> result;
-    MatrixMulMR mapReduce(fdata_A, fdata_B, matrix_len, output);
+    MatrixMulMR mapReduce(fdata_A, fdata_B, matrix_len, row_block_len, output);
     mapReduce.run(result);
     get_time (end);
     print_time("library", begin, end);
 
     get_time (begin);
     int sum = 0;
-    for(i=0;i<matrix_len*matrix_len;i++)
+    for(size_t k=0;k<(size_t)matrix_len*matrix_len;k++)
     {
-          sum += output[i];
+          sum += output[k];
     }
     printf ("MatrixMult: total sum is %d\n", sum);
 
@@ -0,0 +1,426 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <assert.h>
+#include <unistd.h>
+
+#include "map_reduce.h"
+#include "processor.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MM_X86
+#endif
+
+// Matrix multiply over 2D output tiles. B is packed once into panels of NR 
+// columns; each map task takes an output tile, packs the rows of A it needs 
+// one K step at a time and runs an MR x NR register blocked micro-kernel 
+// over the tile. K steps, tile heights and widths are derived from the L1 
+// and L2 sizes of the machine. The micro-kernel is written with GCC vector 
+// extensions and compiled for AVX-512, AVX2 and plain 16 byte vectors; the 
+// widest one the CPU supports is used.
+//
+// The inputs are the int files of ../matrix_multiply and the total sum is 
+// printed the same way, so the two can be compared.
+
+enum { KERNEL_AUTO = PROC_ISA_AUTO, KERNEL_GENERIC = PROC_ISA_GENERIC, 
+    KERNEL_AVX2 = PROC_ISA_AVX2, KERNEL_AVX512 = PROC_ISA_AVX512 };
+
+// One output tile, a multiple of NR columns wide unless it is the last one.
+struct mm_tile {
+    int row, col;
+    int rows, cols;
+};
+
+template<typename T>
+struct mm_problem {
+    int n;              // side of the matrices
+    T const* A;         // n x n, row major
+    T* packed_B;        // B in panels of nr columns, each n x nr, row major
+    T* C;               // n x n output, row major
+    int mr, nr;         // micro-kernel block
+    int kc;             // K step, a B micro-panel is kc x nr
+    int mt, nt;         // output tile
+};
+
+/* C[rows x cols] += A x B for one MR x NR block. a is kc x MR and b is 
+   kc x NR, both packed and zero padded. */
+template<typename T, int VB, int MR, int NV>
+static inline __attribute__((always_inline)) void
+micro_kernel(int kc, T const* a, T const* b, T* c, int ldc, int rows, int cols)
+{
+    typedef T vec __attribute__((vector_size(VB)));
+    enum { W = VB / sizeof(T), NR = NV * W };
+
+    vec acc[MR][NV];
+    for (int r = 0; r < MR; r++)
+        for (int v = 0; v < NV; v++)
+            acc[r][v] = (vec){};
+
+    for (int k = 0; k < kc; k++, a += MR, b += NR) {
+        vec bv[NV];
+        for (int v = 0; v < NV; v++)
+            bv[v] = *(vec const*)(b + v * W);
+        for (int r = 0; r < MR; r++)
+            for (int v = 0; v < NV; v++)
+                acc[r][v] += bv[v] * a[r];
+    }
+
+    if (rows == MR && cols == NR) {
+        for (int r = 0; r < MR; r++) {
+            for (int v = 0; v < NV; v++) {
+                vec cv;
+                memcpy(&cv, c + r * ldc + v * W, sizeof(cv));
+                cv += acc[r][v];
+                memcpy(c + r * ldc + v * W, &cv, sizeof(cv));
+            }
+        }
+    } else {
+        T out[MR][NR];
+        memcpy(out, acc, sizeof(out));
+        for (int r = 0; r < rows; r++)
+            for (int j = 0; j < cols; j++)
+                c[r * ldc + j] += out[r][j];
+    }
+}
+
+template<typename T, int VB, int MR, int NV>
+static inline __attribute__((always_inline)) void
+multiply_tile(mm_problem<T> const& p, mm_tile const& t)
+{
+    enum { NR = NV * VB / sizeof(T) };
+    int n = p.n;
+    int mpad = (t.rows + MR - 1) / MR * MR;
+
+    T* a_pack;
+    CHECK_ERROR(posix_memalign((void**)&a_pack, L2_CACHE_LINE_SIZE, 
+        (size_t)mpad * p.kc * sizeof(T)));
+
+    for (int k0 = 0; k0 < n; k0 += p.kc) {
+        int kc = std::min(p.kc, n - k0);
+
+        // A block for this K step, in MR row micro-panels
+        for (int ir = 0; ir < mpad; ir += MR) {
+            T* dst = a_pack + (size_t)ir * kc;
+            for (int r = 0; r < MR; r++) {
+                T const* src = p.A + (size_t)(t.row + ir + r) * n + k0;
+                if (ir + r < t.rows)
+                    for (int k = 0; k < kc; k++) dst[k * MR + r] = src[k];
+                else
+                    for (int k = 0; k < kc; k++) dst[k * MR + r] = 0;
+            }
+        }
+
+        // each kc x NR micro-panel of B stays in L1 while it is 
+        // multiplied by all of the A block, which stays in L2
+        for (int jr = 0; jr < t.cols; jr += NR) {
+            T const* b = p.packed_B + 
+                (size_t)((t.col + jr) / NR) * n * NR + (size_t)k0 * NR;
+            for (int ir = 0; ir < t.rows; ir += MR) {
+                micro_kernel<T, VB, MR, NV>(kc, a_pack + (size_t)ir * kc, b, 
+                    p.C + (size_t)(t.row + ir) * n + t.col + jr, n, 
+                    std::min(MR, t.rows - ir), std::min((int)NR, t.cols - jr));
+            }
+        }
+    }
+
+    free(a_pack);
+}
+
+// Micro-kernel shapes: MR rows by NV vectors, keeping the accumulators and 
+// one row of B in registers (16 vector registers for AVX2, 32 for AVX-512).
+template<typename T>
+static void multiply_tile_generic(mm_problem<T> const& p, mm_tile const& t)
+{
+    multiply_tile<T, 16, 4, 2>(p, t);
+}
+
+#ifdef MM_X86
+template<typename T> __attribute__((target("avx2")))
+static void multiply_tile_avx2(mm_problem<T> const& p, mm_tile const& t)
+{
+    multiply_tile<T, 32, 6, 2>(p, t);
+}
+
+template<typename T> __attribute__((target("avx512f")))
+static void multiply_tile_avx512(mm_problem<T> const& p, mm_tile const& t)
+{
+    multiply_tile<T, 64, 12, 2>(p, t);
+}
+#endif
+
+// Packs B one panel of nr columns per map call.
+template<typename T>
+class PackMR : public MapReduce<PackMR<T>, int, int, int>
+{
+    typedef MapReduce<PackMR<T>, int, int, int> base;
+
+    T const* B;
+    mm_problem<T>& p;
+public:
+    typedef typename base::map_container map_container;
+
+    PackMR(T const* B, mm_problem<T>& p) : B(B), p(p) {}
+
+    void map(int const& panel, map_container& out) const
+    {
+        int n = p.n, nr = p.nr;
+        int col = panel * nr, cols = std::min(nr, n - col);
+        T* dst = p.packed_B + (size_t)panel * n * nr;
+        for (int k = 0; k < n; k++, dst += nr) {
+            for (int j = 0; j < cols; j++)
+                dst[j] = B[(size_t)k * n + col + j];
+            for (int j = cols; j < nr; j++)
+                dst[j] = 0;
+        }
+    }
+};
+
+template<typename T>
+class MatrixMulTiledMR : public MapReduce<MatrixMulTiledMR<T>, mm_tile, int, int>
+{
+    typedef MapReduce<MatrixMulTiledMR<T>, mm_tile, int, int> base;
+    typedef void (*tile_fn)(mm_problem<T> const&, mm_tile const&);
+
+    mm_problem<T> const& p;
+    tile_fn multiply;
+public:
+    typedef typename base::map_container map_container;
+
+    MatrixMulTiledMR(mm_problem<T> const& p, tile_fn multiply) : 
+        p(p), multiply(multiply) {}
+
+    void* locate(mm_tile* t, uint64_t len) const
+    {
+        return (void*)(p.A + (size_t)t->row * p.n);
+    }
+
+    void map(mm_tile const& t, map_container& out) const
+    {
+        multiply(p, t);
+    }
+};
+
+/* Multiply the int matrices A and B as T, and return the sum of the 
+   output as ../matrix_multiply computes it. */
+template<typename T>
+static int multiply(int const* fA, int const* fB, int n, int kernel)
+{
+    struct timespec begin, end;
+    mm_problem<T> p;
+    void (*fn)(mm_problem<T> const&, mm_tile const&);
+
+    kernel = proc_get_isa(kernel);
+#ifdef MM_X86
+    if (kernel == KERNEL_AVX512) {
+        p.mr = 12; p.nr = 2 * 64 / sizeof(T); fn = multiply_tile_avx512<T>;
+    } else if (kernel == KERNEL_AVX2) {
+        p.mr = 6; p.nr = 2 * 32 / sizeof(T); fn = multiply_tile_avx2<T>;
+    } else
+#endif
+    {
+        p.mr = 4; p.nr = 2 * 16 / sizeof(T); fn = multiply_tile_generic<T>;
+    }
+
+    // A kc x nr micro-panel of B takes half of L1 and an mt x kc block of 
+    // A half of L2, but there should be a few tiles per thread. Tiles are 
+    // as wide as they are tall.
+    long l1 = proc_get_cache_size(1), l2 = proc_get_cache_size(2);
+    if (l1 <= 0) l1 = 32 * 1024;
+    if (l2 <= 0) l2 = 256 * 1024;
+    int threads = atoi(GETENV("MR_NUMTHREADS"));
+    if (threads <= 0) threads = proc_get_num_cpus();
+    p.n = n;
+    p.kc = std::max(16, std::min(n, (int)(l1 / 2 / (p.nr * sizeof(T)))));
+    p.mt = std::min((int)(l2 / 2 / (p.kc * sizeof(T))), 
+        (int)(n / sqrt(4.0 * threads)));
+    p.mt = std::max(p.mr, p.mt / p.mr * p.mr);
+    p.nt = std::max(p.nr, p.mt / p.nr * p.nr);
+    printf("MatrixMult: %dx%d tiles, K step %d, %dx%d micro-kernel\n", 
+        p.mt, p.nt, p.kc, p.mr, p.nr);
+
+    get_time (begin);
+    T* A = (T*)malloc((size_t)n * n * sizeof(T));
+    T* B = (T*)malloc((size_t)n * n * sizeof(T));
+    for (size_t i = 0; i < (size_t)n * n; i++) {
+        A[i] = (T)fA[i];
+        B[i] = (T)fB[i];
+    }
+    int panels = (n + p.nr - 1) / p.nr;
+    CHECK_ERROR(posix_memalign((void**)&p.packed_B, L2_CACHE_LINE_SIZE, 
+        (size_t)panels * n * p.nr * sizeof(T)));
+    p.A = A;
+    p.C = (T*)calloc((size_t)n * n, sizeof(T));
+    get_time (end);
+    print_time("convert", begin, end);
+
+    get_time (begin);
+    std::vector<int> panel_ids;
+    for (int i = 0; i < panels; i++)
+        panel_ids.push_back(i);
+    std::vector<typename PackMR<T>::keyval> packed;
+    PackMR<T> pack(B, p);
+    pack.run(&panel_ids[0], panel_ids.size(), packed);
+    get_time (end);
+    print_time("pack", begin, end);
+
+    // tiles down each column of tiles in turn, so neighbouring tasks share 
+    // their B panels
+    get_time (begin);
+    std::vector<mm_tile> tiles;
+    for (int j = 0; j < n; j += p.nt) {
+        for (int i = 0; i < n; i += p.mt) {
+            mm_tile t = { i, j, std::min(p.mt, n - i), std::min(p.nt, n - j) };
+            tiles.push_back(t);
+        }
+    }
+    std::vector<typename MatrixMulTiledMR<T>::keyval> result;
+    MatrixMulTiledMR<T> mapReduce(p, fn);
+    mapReduce.run(&tiles[0], tiles.size(), result);
+    get_time (end);
+    print_time("library", begin, end);
+
+    int sum = 0;
+    for (size_t i = 0; i < (size_t)n * n; i++)
+        sum += (int)p.C[i];
+
+    free(A);
+    free(B);
+    free(p.packed_B);
+    free(p.C);
+    return sum;
+}
+
+static int* map_file(char const* fname, int& fd, size_t size)
+{
+    int* data;
+    CHECK_ERROR((fd = open(fname, O_RDONLY)) < 0);
+#ifdef MMAP_POPULATE
+    CHECK_ERROR((data = (int*)mmap(0, size + 1, PROT_READ, 
+        MAP_PRIVATE | MAP_POPULATE, fd, 0)) == MAP_FAILED);
+#else
+    CHECK_ERROR((data = (int*)mmap(0, size + 1, PROT_READ, 
+        MAP_PRIVATE, fd, 0)) == MAP_FAILED);
+#endif
+    return data;
+}
+
+static void create_file(char const* fname, int matrix_len)
+{
+    int fd, ret;
+    CHECK_ERROR((fd = open(fname, O_CREAT | O_RDWR | O_TRUNC, S_IRWXU)) < 0);
+    for (size_t i = 0; i < (size_t)matrix_len * matrix_len; i++) {
+        int value = (rand())%11;
+        ret = write(fd, &value, sizeof(int));
+        assert(ret == sizeof(int));
+    }
+    CHECK_ERROR(close(fd) < 0);
+}
+
+int main(int argc, char *argv[]) 
+{
+    int c, create_files = 0, kernel = KERNEL_AUTO;
+    char const* type = "int";
+    int fd_A, fd_B, matrix_len;
+    int *fdata_A, *fdata_B;
+    char const* fname_A = "matrix_file_A.txt";
+    char const* fname_B = "matrix_file_B.txt";
+    struct timespec begin, end;
+
+    get_time (begin);
+
+    srand( (unsigned)time( NULL ) );
+
+    while ((c = getopt(argc, argv, "t:k:c")) != EOF) {
+        switch (c) {
+            case 't':
+                type = optarg;
+                break;
+            case 'k':
+                if (!strcmp(optarg, "generic")) kernel = KERNEL_GENERIC;
+                else if (!strcmp(optarg, "avx2")) kernel = KERNEL_AVX2;
+                else if (!strcmp(optarg, "avx512")) kernel = KERNEL_AVX512;
+                break;
+            case 'c':
+                create_files = 1;
+                break;
+        }
+    }
+
+    if (optind >= argc || (matrix_len = atoi(argv[optind])) <= 0 ||
+        (strcmp(type, "int") && strcmp(type, "float") && 
+         strcmp(type, "double")))
+    {
+        printf("USAGE: %s [-t int|float|double] [-k generic|avx2|avx512] [-c] <side of matrix>\n", argv[0]);
+        exit(1);
+    }
+    size_t file_size = (size_t)matrix_len * matrix_len * sizeof(int);
+
+    printf("MatrixMult: Side of the matrix is %d\n", matrix_len);
+    printf("MatrixMult: Element type is %s\n", type);
+    printf("MatrixMult: Running...\n");
+
+    if (create_files) {
+        dprintf("Creating files\n");
+        create_file(fname_A, matrix_len);
+        create_file(fname_B, matrix_len);
+    }
+
+    fdata_A = map_file(fname_A, fd_A, file_size);
+    fdata_B = map_file(fname_B, fd_B, file_size);
+
+    printf("MatrixMult: Calling MapReduce Scheduler Matrix Multiplication\n");
+
+    get_time (end);
+    print_time("initialize", begin, end);
+
+    int sum;
+    if (!strcmp(type, "float"))
+        sum = multiply<float>(fdata_A, fdata_B, matrix_len, kernel);
+    else if (!strcmp(type, "double"))
+        sum = multiply<double>(fdata_A, fdata_B, matrix_len, kernel);
+    else
+        sum = multiply<int>(fdata_A, fdata_B, matrix_len, kernel);
+
+    get_time (begin);
+    printf ("MatrixMult: total sum is %d\n", sum);
+
+    printf("MatrixMult: MapReduce Completed\n");
+
+    CHECK_ERROR(munmap(fdata_A, file_size + 1) < 0);
+    CHECK_ERROR(close(fd_A) < 0);
+    CHECK_ERROR(munmap(fdata_B, file_size + 1) < 0);
+    CHECK_ERROR(close(fd_B) < 0);
+
+    get_time (end);
+    print_time("finalize", begin, end);
+
+    return 0;
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
@@ -132,7 +132,7 @@ class MeanMR : public MapReduce<MeanMR, pca_map_data_t, int, long long, hash_con
 #elif defined(MUST_USE_FIXED_HASH)
 class MeanMR : public MapReduce<MeanMR, pca_map_data_t, int, long long, fixed_hash_container<int, long long, one_combiner, 32768, std::tr1::hash<int>
 #else
-class MeanMR : public MapReduce<MeanMR, pca_map_data_t, int, long long, common_array_container<int, long long, one_combiner, 1000
+class MeanMR : public MapReduce<MeanMR, pca_map_data_t, int, long long, common_array_container<int, long long, one_combiner, 0
 #endif
 #ifdef TBB
     , tbb::scalable_allocator
@@ -143,7 +143,13 @@ class MeanMR : public MapReduce<MeanMR, pca_map_data_t, int, long long, common_a
     int row;
 
 public:
-    explicit MeanMR(int* _matrix) : matrix(_matrix), row(0) {}
+    explicit MeanMR(int* _matrix) : matrix(_matrix), row(0)
+    {
+#if !defined(MUST_USE_HASH) && !defined(MUST_USE_FIXED_HASH)
+        // one key per row
+        this->container.resize(num_rows);
+#endif
+    }
 
     void* locate(data_type* d, uint64_t len) const
     {
@@ -185,7 +191,7 @@ class CovMR : public MapReduceSort<CovMR, pca_cov_data_t, intptr_t, long long, h
 #elif defined(MUST_USE_FIXED_HASH)
 class CovMR : public MapReduceSort<CovMR, pca_cov_data_t, intptr_t, long long, fixed_hash_container<intptr_t, long long, one_combiner, 256, std::tr1::hash<intptr_t>
 #else
-class CovMR : public MapReduceSort<CovMR, pca_cov_data_t, intptr_t, long long, common_array_container<intptr_t, long long, one_combiner, 1000*1000
+class CovMR : public MapReduceSort<CovMR, pca_cov_data_t, intptr_t, long long, common_array_container<intptr_t, long long, one_combiner, 0
 #endif
 #ifdef TBB
     , tbb::scalable_allocator
@@ -199,7 +205,13 @@ class CovMR : public MapReduceSort<CovMR, pca_cov_data_t, intptr_t, long long, c
 
 public:
     explicit CovMR(int* _matrix, long long const* _means) : 
-        matrix(_matrix), means(_means), row(0), col(0) {}
+        matrix(_matrix), means(_means), row(0), col(0)
+    {
+#if !defined(MUST_USE_HASH) && !defined(MUST_USE_FIXED_HASH)
+        // keys are row*num_rows + col
+        this->container.resize((uint64_t)num_rows * num_rows);
+#endif
+    }
 
     void* locate(data_type* d, uint64_t len) const
     {
@@ -222,7 +234,7 @@ public:
             sum += (v1[i] - m1) * (v2[i] - m2);
         }
         sum /= (num_cols-1);
-        emit_intermediate(out, data.row_num*num_cols + data.col_num, sum);
+        emit_intermediate(out, (intptr_t)data.row_num*num_rows + data.col_num, sum);
     }
 
     /** pca_cov_split()
@@ -0,0 +1,434 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "map_reduce.h"
+#include "processor.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PCA_X86
+#include <immintrin.h>
+#endif
+
+// Covariance matrix of the rows of a matrix, computed in cache blocks. One 
+// streaming pass computes each row's mean and writes the centered row as 
+// 32-bit ints. Map tasks are then upper triangular tiles of the covariance 
+// matrix: a task takes the column range in steps that keep both of its row 
+// panels in L2 and computes 2 x 4 blocks of row pair dot products with 
+// vector multiplies into 64-bit sums, exactly as ../pca does in long long. 
+// The covariance matrix is kept as a packed upper triangle, so no per key 
+// storage is needed and thousands of rows are fine. The matrix and the 
+// covariance sum are the same as ../pca's for the same arguments.
+
+#define DEF_GRID_SIZE 100  // all values in the matrix are from 0 to this value 
+#define DEF_NUM_ROWS 10
+#define DEF_NUM_COLS 10
+
+enum { KERNEL_AUTO = PROC_ISA_AUTO, KERNEL_GENERIC = PROC_ISA_GENERIC, 
+    KERNEL_AVX2 = PROC_ISA_AVX2, KERNEL_AVX512 = PROC_ISA_AVX512 };
+
+int num_rows;
+int num_cols;
+int grid_size;
+int kernel;
+
+/** parse_args()
+ *  Parse the user arguments to determine the number of rows and colums
+ */  
+void parse_args(int argc, char **argv) 
+{
+    int c;
+    extern char *optarg;
+    
+    num_rows = DEF_NUM_ROWS;
+    num_cols = DEF_NUM_COLS;
+    grid_size = DEF_GRID_SIZE;
+    kernel = KERNEL_AUTO;
+    
+    while ((c = getopt(argc, argv, "r:c:s:k:")) != EOF) 
+    {
+        switch (c) {
+            case 'r':
+                num_rows = atoi(optarg);
+                break;
+            case 'c':
+                num_cols = atoi(optarg);
+                break;
+            case 's':
+                grid_size = atoi(optarg);
+                break;
+            case 'k':
+                if (!strcmp(optarg, "generic")) kernel = KERNEL_GENERIC;
+                else if (!strcmp(optarg, "avx2")) kernel = KERNEL_AVX2;
+                else if (!strcmp(optarg, "avx512")) kernel = KERNEL_AVX512;
+                break;
+            case '?':
+                printf("Usage: %s -r <num_rows> -c <num_cols> -s <max value> [-k generic|avx2|avx512]\n", argv[0]);
+                exit(1);
+        }
+    }
+    
+    if (num_rows <= 0 || num_cols <= 0 || grid_size <= 0) {
+        printf("Illegal argument value. All values must be numeric and greater than 0\n");
+        exit(1);
+    }
+
+    printf("Number of rows = %d\n", (int)num_rows);
+    printf("Number of cols = %d\n", (int)num_cols);
+    printf("Max value for each element = %d\n", (int)grid_size);    
+}
+
+/** generate_points()
+ *  Create the values in the matrix
+ */
+void generate_points(int *pts, int rows, int cols) 
+{    
+    int i, j;
+       
+    for (i=0; i<rows; i++) 
+    {
+        for (j=0; j<cols; j++) 
+        {
+            pts[i * cols + j] = rand() % grid_size;
+        }
+    }
+}
+
+// Centered rows are padded with zeros to a multiple of PCA_PAD columns, 
+// the widest vector step, and to a multiple of 4 rows.
+#define PCA_PAD 16
+
+struct pca_matrix {
+    int const* matrix;      // num_rows x num_cols input
+    long long* means;
+    int* centered;          // rows x stride, values minus their row's mean
+    int rows, stride;
+    long long* cov;         // packed upper triangle of the covariance matrix
+};
+
+// index of (i, j), i <= j, in the packed upper triangle
+static inline uint64_t cov_index(int i, int j)
+{
+    return (uint64_t)i * num_rows - (uint64_t)i * (i - 1) / 2 + (j - i);
+}
+
+/* sums[a*4 + b] += x[a] . y[b] over len values, for a < 2 and b < 4. len 
+   is a multiple of PCA_PAD. */
+typedef void (*dot_fn)(int const* const* x, int const* const* y, int len, 
+    long long* sums);
+
+static void dot_2x4_generic(int const* const* x, int const* const* y, 
+    int len, long long* sums)
+{
+    for (int a = 0; a < 2; a++) {
+        for (int b = 0; b < 4; b++) {
+            long long sum = 0;
+            for (int k = 0; k < len; k++)
+                sum += (long long)x[a][k] * y[b][k];
+            sums[a * 4 + b] += sum;
+        }
+    }
+}
+
+#ifdef PCA_X86
+
+// mul_epi32 multiplies the low (even) ints of each 64-bit lane into 64-bit 
+// products. Shifting the lanes right by 32 brings the odd ints down; their 
+// sign is recovered by the multiply.
+__attribute__((target("avx2")))
+static void dot_2x4_avx2(int const* const* x, int const* const* y, 
+    int len, long long* sums)
+{
+    __m256i acc[2][4];
+    for (int a = 0; a < 2; a++)
+        for (int b = 0; b < 4; b++)
+            acc[a][b] = _mm256_setzero_si256();
+
+    for (int k = 0; k < len; k += 8) {
+        __m256i xe[2], xo[2];
+        for (int a = 0; a < 2; a++) {
+            xe[a] = _mm256_loadu_si256((__m256i const*)(x[a] + k));
+            xo[a] = _mm256_srli_epi64(xe[a], 32);
+        }
+        for (int b = 0; b < 4; b++) {
+            __m256i ye = _mm256_loadu_si256((__m256i const*)(y[b] + k));
+            __m256i yo = _mm256_srli_epi64(ye, 32);
+            for (int a = 0; a < 2; a++) {
+                acc[a][b] = _mm256_add_epi64(acc[a][b], 
+                    _mm256_add_epi64(_mm256_mul_epi32(xe[a], ye), 
+                        _mm256_mul_epi32(xo[a], yo)));
+            }
+        }
+    }
+
+    for (int a = 0; a < 2; a++) {
+        for (int b = 0; b < 4; b++) {
+            long long lanes[4];
+            _mm256_storeu_si256((__m256i*)lanes, acc[a][b]);
+            sums[a * 4 + b] += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        }
+    }
+}
+
+// The unmasked forms of these intrinsics pass an undefined vector as the 
+// masked-off source, which gcc warns about; the zero-masking forms with
+// every lane selected compute the same without it.
+__attribute__((target("avx512f")))
+static void dot_2x4_avx512(int const* const* x, int const* const* y, 
+    int len, long long* sums)
+{
+    __mmask8 const all = 0xff;
+    __m512i acc[2][4];
+    for (int a = 0; a < 2; a++)
+        for (int b = 0; b < 4; b++)
+            acc[a][b] = _mm512_setzero_si512();
+
+    for (int k = 0; k < len; k += 16) {
+        __m512i xe[2], xo[2];
+        for (int a = 0; a < 2; a++) {
+            xe[a] = _mm512_loadu_si512(x[a] + k);
+            xo[a] = _mm512_maskz_srli_epi64(all, xe[a], 32);
+        }
+        for (int b = 0; b < 4; b++) {
+            __m512i ye = _mm512_loadu_si512(y[b] + k);
+            __m512i yo = _mm512_maskz_srli_epi64(all, ye, 32);
+            for (int a = 0; a < 2; a++) {
+                acc[a][b] = _mm512_add_epi64(acc[a][b], 
+                    _mm512_add_epi64(_mm512_maskz_mul_epi32(all, xe[a], ye), 
+                        _mm512_maskz_mul_epi32(all, xo[a], yo)));
+            }
+        }
+    }
+
+    for (int a = 0; a < 2; a++) {
+        for (int b = 0; b < 4; b++) {
+            long long lanes[8];
+            _mm512_storeu_si512(lanes, acc[a][b]);
+            for (int l = 0; l < 8; l++)
+                sums[a * 4 + b] += lanes[l];
+        }
+    }
+}
+
+#endif
+
+struct row_block {
+    int row, rows;
+};
+
+// Fused mean pass: sums each row, then centers it while it is still cached.
+class CenterMR : public MapReduce<CenterMR, row_block, int, int>
+{
+    pca_matrix& m;
+public:
+    explicit CenterMR(pca_matrix& m) : m(m) {}
+
+    void* locate(data_type* d, uint64_t len) const
+    {
+        return (void*)(m.matrix + (uint64_t)d->row * num_cols);
+    }
+
+    void map(data_type const& data, map_container& out) const
+    {
+        for (int r = data.row; r < data.row + data.rows; r++) {
+            int* c = m.centered + (uint64_t)r * m.stride;
+            if (r >= num_rows) {
+                memset(c, 0, m.stride * sizeof(int));
+                continue;
+            }
+            int const* v = m.matrix + (uint64_t)r * num_cols;
+            long long sum = 0;
+            for (int j = 0; j < num_cols; j++)
+                sum += v[j];
+            long long mean = sum / num_cols;
+            m.means[r] = mean;
+            for (int j = 0; j < num_cols; j++)
+                c[j] = (int)(v[j] - mean);
+            for (int j = num_cols; j < m.stride; j++)
+                c[j] = 0;
+        }
+    }
+};
+
+// Rows [i0, i1) against rows [j0, j1), with i0 <= j0.
+struct cov_tile {
+    int i0, i1, j0, j1;
+};
+
+class CovTileMR : public MapReduce<CovTileMR, cov_tile, int, int>
+{
+    pca_matrix& m;
+    dot_fn dot;
+    int kc;     // columns per step
+public:
+    CovTileMR(pca_matrix& m, dot_fn dot, int kc) : m(m), dot(dot), kc(kc) {}
+
+    void* locate(data_type* d, uint64_t len) const
+    {
+        return (void*)(m.centered + (uint64_t)d->i0 * m.stride);
+    }
+
+    void map(data_type const& t, map_container& out) const
+    {
+        int ni = t.i1 - t.i0, nj = t.j1 - t.j0;
+        std::vector<long long> sums((size_t)ni * nj, 0);
+
+        for (int k0 = 0; k0 < m.stride; k0 += kc) {
+            int len = std::min(kc, m.stride - k0);
+            for (int i = 0; i < ni; i += 2) {
+                int const* x[2];
+                for (int a = 0; a < 2; a++)
+                    x[a] = m.centered + (uint64_t)(t.i0 + i + a) * m.stride + k0;
+                // on the diagonal only blocks reaching the upper triangle
+                int jstart = (t.i0 == t.j0) ? i / 4 * 4 : 0;
+                for (int j = jstart; j < nj; j += 4) {
+                    int const* y[4];
+                    long long block[8] = { 0 };
+                    for (int b = 0; b < 4; b++)
+                        y[b] = m.centered + (uint64_t)(t.j0 + j + b) * m.stride + k0;
+                    dot(x, y, len, block);
+                    for (int a = 0; a < 2 && i + a < ni; a++)
+                        for (int b = 0; b < 4 && j + b < nj; b++)
+                            sums[(size_t)(i + a) * nj + j + b] += block[a * 4 + b];
+                }
+            }
+        }
+
+        for (int i = t.i0; i < t.i1 && i < num_rows; i++) {
+            for (int j = std::max(i, t.j0); j < t.j1 && j < num_rows; j++) {
+                m.cov[cov_index(i, j)] = 
+                    sums[(size_t)(i - t.i0) * nj + j - t.j0] / (num_cols - 1);
+            }
+        }
+    }
+};
+
+int main(int argc, char **argv)
+{
+    struct timespec begin, end;
+    double library_time = 0;
+
+    get_time (begin);
+    
+    parse_args(argc, argv);    
+    
+    // Allocate space for the matrix
+    int* matrix = (int *)malloc(sizeof(int) * num_rows * num_cols);
+    
+    //Generate random values for all the points in the matrix 
+    generate_points(matrix, num_rows, num_cols);
+
+    dot_fn dot = dot_2x4_generic;
+    kernel = proc_get_isa(kernel);
+#ifdef PCA_X86
+    if (kernel == KERNEL_AVX512) dot = dot_2x4_avx512;
+    else if (kernel == KERNEL_AVX2) dot = dot_2x4_avx2;
+#endif
+
+    pca_matrix m;
+    m.matrix = matrix;
+    m.rows = (num_rows + 3) / 4 * 4;
+    m.stride = (num_cols + PCA_PAD - 1) / PCA_PAD * PCA_PAD;
+    m.means = new long long[num_rows];
+    CHECK_ERROR(posix_memalign((void**)&m.centered, L2_CACHE_LINE_SIZE, 
+        (uint64_t)m.rows * m.stride * sizeof(int)));
+    m.cov = new long long[cov_index(num_rows - 1, num_rows - 1) + 1];
+
+    // Two panels of tile rows x kc columns fill half of L2, but there 
+    // should be a few tiles per thread. Tiles are a multiple of 4 rows.
+    long l2 = proc_get_cache_size(2);
+    if (l2 <= 0) l2 = 256 * 1024;
+    int threads = atoi(GETENV("MR_NUMTHREADS"));
+    if (threads <= 0) threads = proc_get_num_cpus();
+    int kc = std::min(m.stride, 1024);
+    int tile = (int)(l2 / 2 / (2 * kc * sizeof(int)));
+    // upper triangular tiles: about (rows/tile)^2 / 2 of them
+    tile = std::min(tile, (int)(m.rows / sqrt(8.0 * threads)));
+    tile = std::max(4, tile / 4 * 4);
+    
+    printf("PCA Mean: Calling MapReduce Scheduler\n");
+
+    get_time (end);
+    print_time("initialize", begin, end);
+
+    get_time (begin); 
+    std::vector<row_block> blocks;
+    for (int r = 0; r < m.rows; r += 4) {
+        row_block b = { r, 4 };
+        blocks.push_back(b);
+    }
+    std::vector<CenterMR::keyval> result;
+    CenterMR centerMR(m);
+    centerMR.run(&blocks[0], blocks.size(), result);
+    get_time (end);
+    library_time += time_diff (end, begin);
+    printf("PCA Mean: MapReduce Completed\n"); 
+
+    printf("PCA Cov: Calling MapReduce Scheduler\n");
+ 
+    get_time (begin);
+    std::vector<cov_tile> tiles;
+    for (int i = 0; i < m.rows; i += tile) {
+        for (int j = i; j < m.rows; j += tile) {
+            cov_tile t = { i, std::min(i + tile, m.rows), 
+                j, std::min(j + tile, m.rows) };
+            tiles.push_back(t);
+        }
+    }
+    std::vector<CovTileMR::keyval> result2;
+    CovTileMR covMR(m, dot, kc);
+    covMR.run(&tiles[0], tiles.size(), result2);
+    get_time (end);
+
+    library_time += time_diff (end, begin);
+    print_time("library", library_time);
+
+    get_time (begin);
+
+    printf("PCA Cov: MapReduce Completed\n"); 
+
+    long long sum = 0;
+    for (uint64_t i = 0; i <= cov_index(num_rows - 1, num_rows - 1); i++) 
+        sum += m.cov[i];
+    printf("\n\nCovariance sum: %lld\n", sum);
+    
+    delete [] m.means;
+    delete [] m.cov;
+    free (m.centered);
+    free (matrix);
+
+    get_time (end);
+    print_time("finalize", begin, end);
+
+    return 0;
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
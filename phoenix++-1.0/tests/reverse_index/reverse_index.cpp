@@ -0,0 +1,485 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <algorithm>
+
+#include "map_reduce.h"
+#define DEFAULT_DISP_NUM 10
+
+enum {
+    START,
+    IN_TAG,
+    IN_ATAG,
+    FOUND_HREF,
+    START_LINK
+};
+
+// an HTML file found by the directory walk, mapped read only
+struct ri_doc {
+    char const* data;
+    uint64_t len;
+    char* name;
+    int id;
+};
+
+// the target of a link, pointing into the document it was found in
+struct ri_link {
+    char const* data;
+    uint64_t len;
+    uint64_t hash;
+
+    bool operator<(ri_link const& other) const {
+        int c = memcmp(data, other.data, std::min(len, other.len));
+        return c < 0 || (c == 0 && len < other.len);
+    }
+    bool operator==(ri_link const& other) const {
+        return hash == other.hash && len == other.len && 
+            memcmp(data, other.data, len) == 0;
+    }
+};
+
+struct ri_link_hash
+{
+    size_t operator()(ri_link const& key) const
+    {
+        return key.hash;
+    }
+};
+
+// FNV-1a hash for 64 bits
+static uint64_t link_hash(char const* s, uint64_t len)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (uint64_t i = 0; i < len; i++)
+    {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/* Directory tree walk on several threads. Directories wait on a shared 
+ * stack; each thread pops one, lists it, pushes the subdirectories it finds 
+ * and maps the files into a list of its own. The walk is over when the stack 
+ * is empty and no thread is still listing a directory. With a data limit 
+ * (RI_DATASIZE) files stop being added once that many bytes are mapped.
+ */
+class dir_walker
+{
+    pthread_mutex_t lock;
+    pthread_cond_t more;
+    std::vector<std::string> dirs;
+    int busy;
+    uint64_t mapped, limit;
+    std::vector<std::vector<ri_doc> > found;
+
+    struct walk_arg {
+        dir_walker* walker;
+        int thread;
+    };
+
+    static void* walk_thread(void* arg)
+    {
+        walk_arg* w = (walk_arg*)arg;
+        w->walker->walk(w->thread);
+        return NULL;
+    }
+
+    // call with lock held
+    bool full() const
+    {
+        return limit > 0 && mapped >= limit;
+    }
+
+    void add_file(std::string const& path, int thread)
+    {
+        struct stat finfo;
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        if (fstat(fd, &finfo) == 0 && finfo.st_size > 0)
+        {
+            void* data = mmap(0, finfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED)
+            {
+                ri_doc doc = { (char const*)data, (uint64_t)finfo.st_size, 
+                    strdup(path.c_str()), 0 };
+                found[thread].push_back(doc);
+                pthread_mutex_lock(&lock);
+                mapped += finfo.st_size;
+                pthread_mutex_unlock(&lock);
+            }
+        }
+        close(fd);
+    }
+
+    void list(std::string const& name, int thread)
+    {
+        DIR* dp = opendir(name.c_str());
+        if (dp == NULL)
+        {
+            add_file(name, thread);
+            return;
+        }
+
+        std::vector<std::string> subdirs;
+        struct dirent* ep;
+        while ((ep = readdir(dp)) != NULL)
+        {
+            if (strcmp(ep->d_name, ".") == 0) continue;
+            if (strcmp(ep->d_name, "..") == 0) continue;
+
+            std::string path = name + "/" + ep->d_name;
+            bool dir = ep->d_type == DT_DIR;
+            if (ep->d_type == DT_UNKNOWN || ep->d_type == DT_LNK)
+            {
+                struct stat finfo;
+                dir = stat(path.c_str(), &finfo) == 0 && S_ISDIR(finfo.st_mode);
+            }
+
+            if (dir)
+            {
+                subdirs.push_back(path);
+                continue;
+            }
+            pthread_mutex_lock(&lock);
+            bool stop = full();
+            pthread_mutex_unlock(&lock);
+            if (!stop)
+                add_file(path, thread);
+        }
+        closedir(dp);
+
+        pthread_mutex_lock(&lock);
+        dirs.insert(dirs.end(), subdirs.begin(), subdirs.end());
+        pthread_cond_broadcast(&more);
+        pthread_mutex_unlock(&lock);
+    }
+
+    void walk(int thread)
+    {
+        pthread_mutex_lock(&lock);
+        while (true)
+        {
+            while (dirs.empty() && busy > 0)
+                pthread_cond_wait(&more, &lock);
+            if (dirs.empty() || full())
+                break;
+
+            std::string name = dirs.back();
+            dirs.pop_back();
+            busy++;
+            pthread_mutex_unlock(&lock);
+
+            list(name, thread);
+
+            pthread_mutex_lock(&lock);
+            busy--;
+            if (busy == 0)
+                pthread_cond_broadcast(&more);
+        }
+        pthread_mutex_unlock(&lock);
+    }
+
+public:
+    dir_walker(uint64_t limit) : busy(0), mapped(0), limit(limit)
+    {
+        pthread_mutex_init(&lock, NULL);
+        pthread_cond_init(&more, NULL);
+    }
+
+    ~dir_walker()
+    {
+        pthread_mutex_destroy(&lock);
+        pthread_cond_destroy(&more);
+    }
+
+    // Walks the tree under root. Documents are numbered in path order, so 
+    // the ids do not depend on the number of threads.
+    void run(char const* root, int num_threads, std::vector<ri_doc>& docs)
+    {
+        dirs.assign(1, root);
+        found.assign(num_threads, std::vector<ri_doc>());
+
+        std::vector<pthread_t> threads(num_threads);
+        std::vector<walk_arg> args(num_threads);
+        for (int i = 0; i < num_threads; i++)
+        {
+            walk_arg a = { this, i };
+            args[i] = a;
+            CHECK_ERROR(pthread_create(&threads[i], NULL, walk_thread, 
+                &args[i]) != 0);
+        }
+        for (int i = 0; i < num_threads; i++)
+            CHECK_ERROR(pthread_join(threads[i], NULL) != 0);
+
+        docs.clear();
+        for (int i = 0; i < num_threads; i++)
+            docs.insert(docs.end(), found[i].begin(), found[i].end());
+        std::sort(docs.begin(), docs.end(), doc_name_less);
+        for (size_t i = 0; i < docs.size(); i++)
+            docs[i].id = (int)i;
+    }
+
+    uint64_t size() const
+    {
+        return mapped;
+    }
+
+    static bool doc_name_less(ri_doc const& a, ri_doc const& b)
+    {
+        return strcmp(a.name, b.name) < 0;
+    }
+};
+
+#ifdef MUST_USE_HASH
+class ReverseIndexMR : public MapReduce<ReverseIndexMR, ri_doc, ri_link, int, 
+    hash_container<ri_link, int, buffer_combiner, ri_link_hash> >
+#elif defined(MUST_USE_UNPACKED)
+class ReverseIndexMR : public MapReduce<ReverseIndexMR, ri_doc, ri_link, int, 
+    posting_container<ri_link, int, ri_link_hash> >
+#else
+class ReverseIndexMR : public MapReduce<ReverseIndexMR, ri_doc, ri_link, int, 
+    posting_container<ri_link, int, ri_link_hash, std::allocator, 
+        packed_combiner> >
+#endif
+{
+public:
+#ifndef MUST_USE_HASH
+    ReverseIndexMR() { this->container.unique_values(true); }
+#endif
+
+    void* locate(data_type* doc, uint64_t len) const
+    {
+        return (void*)doc->data;
+    }
+
+    /** reverse index map()
+     *  Finds the links (<a href="...">) in a document and emits the document 
+     *  id for each of them. The document is not modified; links point into 
+     *  it.
+     */
+    void map(data_type const& doc, map_container& out) const
+    {
+        char const* data = doc.data;
+        uint64_t len = doc.len;
+        int state = START;
+
+        for (uint64_t j = 0; j < len; j++)
+        {
+            switch (state)
+            {
+                case START:
+                    if (data[j] == '<') state = IN_TAG;
+                    break;
+
+                case IN_TAG:
+                    if (data[j] == 'a') state = IN_ATAG;
+                    else if (data[j] == ' ') state = IN_TAG;
+                    else state = START;
+                    break;
+
+                case IN_ATAG:
+                    if (data[j] == 'h')
+                    {
+                        if (len - j >= 4 && strncmp(&data[j], "href", 4) == 0)
+                        {
+                            state = FOUND_HREF;
+                            j += 3;
+                        }
+                        else state = START;
+                    }
+                    else if (data[j] == ' ') state = IN_ATAG;
+                    else state = START;
+                    break;
+
+                case FOUND_HREF:
+                    if (data[j] == ' ') state = FOUND_HREF;
+                    else if (data[j] == '=') state = FOUND_HREF;
+                    else if (data[j] == '\"') state = START_LINK;
+                    else state = START;
+                    break;
+
+                case START_LINK:
+                    char const* link_end = (char const*)memchr(&data[j], '\"', 
+                        len - j);
+                    if (link_end != NULL)
+                    {
+                        uint64_t link_len = link_end - &data[j];
+                        ri_link link = { &data[j], link_len, 
+                            link_hash(&data[j], link_len) };
+                        emit_intermediate(out, link, doc.id);
+                        j += link_len;
+                    }
+                    state = START;
+                    break;
+            }
+        }
+    }
+
+    // Lists each document a link is found in once. The posting container 
+    // is told to drop repeats as they are emitted; the buffer combiner of 
+    // the hash build keeps them, next to each other.
+    void reduce(key_type const& key, reduce_iterator const& values, 
+        std::vector<keyval>& out) const
+    {
+        int doc, last = -1;
+        while (values.next(doc))
+        {
+            if (doc != last)
+            {
+                keyval kv = {key, doc};
+                out.push_back(kv);
+                last = doc;
+            }
+        }
+    }
+};
+
+static bool more_docs(ReverseIndexMR::keyval const* a, 
+    ReverseIndexMR::keyval const* b)
+{
+    return a->val > b->val || (a->val == b->val && a->key < b->key);
+}
+
+int main(int argc, char *argv[]) 
+{
+    unsigned int disp_num;
+    char * disp_num_str;
+    char * req_data_str;
+    struct timespec begin, end;
+
+    get_time (begin);
+
+    if (argc < 2)
+    {
+        printf("USAGE: %s <start directory> [Top # of results to display]\n", 
+            argv[0]);
+        exit(1);
+    }
+
+    disp_num_str = argc > 2 ? argv[2] : NULL;
+    CHECK_ERROR((disp_num = (disp_num_str == NULL) ? 
+      DEFAULT_DISP_NUM : atoi(disp_num_str)) <= 0);
+
+    req_data_str = getenv("RI_DATASIZE");
+    uint64_t req_data = req_data_str != NULL ? atoll(req_data_str) : 0;
+
+    int threads = atoi(GETENV("MR_NUMTHREADS"));
+    if (threads <= 0)
+        threads = proc_get_num_cpus();
+
+    printf("ReverseIndex: Running...\n");
+
+    // Find and map the documents
+    std::vector<ri_doc> docs;
+    dir_walker walker(req_data);
+    walker.run(argv[1], threads, docs);
+
+    printf("Number of files added = %lu, total size = %lu\n", 
+        (unsigned long)docs.size(), (unsigned long)walker.size());
+    CHECK_ERROR(docs.empty());
+
+    get_time (end);
+
+#ifdef TIMING
+    print_time("initialize", begin, end);
+#endif
+
+    printf("ReverseIndex: Calling MapReduce Scheduler\n");
+    get_time (begin);
+    std::vector<ReverseIndexMR::keyval> result;
+    ReverseIndexMR mapReduce;
+    CHECK_ERROR( mapReduce.run(&docs[0], docs.size(), result) < 0);
+    get_time (end);
+
+#ifdef TIMING
+    print_time("library", begin, end);
+#endif
+    printf("ReverseIndex: MapReduce Completed\n");
+
+    get_time (begin);
+
+    // Reduce hands out the documents of a link together, so each run of 
+    // equal keys in the result is one link.
+    std::vector<ReverseIndexMR::keyval> links;
+    for (size_t i = 0; i < result.size(); )
+    {
+        size_t j = i + 1;
+        while (j < result.size() && result[j].key == result[i].key)
+            j++;
+        ReverseIndexMR::keyval kv = { result[i].key, (int)(j - i) };
+        links.push_back(kv);
+        i = j;
+    }
+
+    std::vector<ReverseIndexMR::keyval const*> order(links.size());
+    for (size_t i = 0; i < links.size(); i++)
+        order[i] = &links[i];
+    unsigned int dn = std::min(disp_num, (unsigned int)links.size());
+    std::partial_sort(order.begin(), order.begin() + dn, order.end(), 
+        more_docs);
+
+    printf("\nReverseIndex: Results (TOP %d of %lu links):\n", dn, 
+        (unsigned long)links.size());
+    for (size_t i = 0; i < dn; i++)
+    {
+        std::string link(order[i]->key.data, order[i]->key.len);
+        printf("%s - %d documents\n", link.c_str(), order[i]->val);
+    }
+    printf("Total: %lu\n", (unsigned long)result.size());
+
+    for (size_t i = 0; i < result.size(); i++)
+    {
+        dprintf("%.*s found in %s\n", (int)result[i].key.len, 
+            result[i].key.data, docs[result[i].val].name);
+    }
+
+    for (size_t i = 0; i < docs.size(); i++)
+    {
+        CHECK_ERROR(munmap((void*)docs[i].data, docs[i].len) < 0);
+        free(docs[i].name);
+    }
+
+    get_time (end);
+
+#ifdef TIMING
+    print_time("finalize", begin, end);
+#endif
+
+    return 0;
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
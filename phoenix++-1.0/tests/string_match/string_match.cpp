@@ -28,84 +28,50 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <string.h>
+#include <algorithm>
 
 #include "map_reduce.h"
-
-#define DEFAULT_UNIT_SIZE 5
-#define SALT_SIZE 2
-#define MAX_REC_LEN 1024
-#define OFFSET 5
+#include "matcher.h"
 
 typedef struct {
   char *keys;
-  int keys_len;
+  uint64_t keys_len;
   char *encrypt_file;
 } str_map_data_t;
 
- char const* key1 = "Helloworld";
- char const* key2 = "howareyou";
- char const* key3 = "ferrari";
- char const* key4 = "whotheman";
-
- char *key1_final;
- char *key2_final;
- char *key3_final;
- char *key4_final;
-
-/** compute_hashes()
- *  Simple Cipher to generate a hash of the word 
- */
-void compute_hashes(char const* word, unsigned int length, char* final_word)
-{
-    unsigned int i;
-    for(i=0;i<length;i++)
-        final_word[i] = word[i]+OFFSET;
-    final_word[i] = 0;
-}
+// used when no pattern file is given
+char const* default_keys[] = { "Helloworld", "howareyou", "ferrari", "whotheman" };
 
-class MatchMR : public MapReduce<MatchMR, str_map_data_t, int, int>
+// Emits (pattern id, offset of the line) for every line of the keys file 
+// that equals one of the patterns.
+class MatchMR : public MapReduce<MatchMR, str_map_data_t, int, uint64_t>
 {
     char *keys_file, *encrypt_file;
-    int keys_file_len, encrypt_file_len;
-    int splitter_pos, chunk_size;    
+    uint64_t keys_file_len, encrypt_file_len;
+    uint64_t splitter_pos, chunk_size;    
+    line_set const& patterns;
 
 public:
-    explicit MatchMR(char* keys, int keys_len, char* encrypt, int encrypt_len, int chunk_size) : keys_file(keys), encrypt_file(encrypt), keys_file_len(keys_len), encrypt_file_len(encrypt_len), splitter_pos(0), chunk_size(chunk_size) {}
+    explicit MatchMR(char* keys, uint64_t keys_len, char* encrypt, uint64_t encrypt_len, uint64_t chunk_size, line_set const& patterns) : keys_file(keys), encrypt_file(encrypt), keys_file_len(keys_len), encrypt_file_len(encrypt_len), splitter_pos(0), chunk_size(chunk_size), patterns(patterns) {}
 
     void *locate (data_type *data, uint64_t len) const
     {
         return data->keys;
     }
 
-    void map(data_type& data, map_container& out) const
+    void map(data_type const& data, map_container& out) const
     {
-        char cur_word_final[MAX_REC_LEN];
-
-        int index = 0;
-        while(index < data.keys_len)
+        char const* end = data.keys + data.keys_len;
+        char const* line = skip_line_breaks(data.keys, end);
+        while (line < end)
         {
-            char* key = data.keys + index;
-            int len = 0;
-            while(index+len < data.keys_len && data.keys[index+len] != '\r' && data.keys[index+len] != '\n')
-                len++;
-
-            compute_hashes(key, len, cur_word_final);
+            char const* eol = find_line_break(line, end);
 
-            if(!strcmp(key1_final, cur_word_final));
-                dprintf("FOUND: WORD IS %s\n", key1);
+            int id = patterns.find(line, eol - line);
+            if (id >= 0)
+                emit_intermediate(out, id, (uint64_t)(line - keys_file));
 
-            if(!strcmp(key2_final, cur_word_final));
-                dprintf("FOUND: WORD IS %s\n", key2);
-
-            if(!strcmp(key3_final, cur_word_final));
-                dprintf("FOUND: WORD IS %s\n", key3);
-
-            if(!strcmp(key4_final, cur_word_final));
-                dprintf("FOUND: WORD IS %s\n", key4);
-
-            index += len;
-            while(index < data.keys_len && (data.keys[index] == '\r' || data.keys[index] == '\n'))
-                index++;
+            line = skip_line_breaks(eol, end);
         }
     }
 
@@ -115,85 +81,106 @@ public:
     int split(str_map_data_t& out)
     {
         /* End of data reached, return FALSE. */
-        if ((int)splitter_pos >= keys_file_len)
+        if (splitter_pos >= keys_file_len)
         {
             return 0;
         }
 
         /* Determine the nominal end point. */
-        int end = std::min(splitter_pos + chunk_size, keys_file_len);
+        uint64_t end = std::min(splitter_pos + chunk_size, keys_file_len);
 
         /* Move end point to next word break */
-        while(end < keys_file_len && keys_file[end] != '\r' && keys_file[end] != '\n')
-            end++;
+        end = find_line_break(keys_file + end, keys_file + keys_file_len) - 
+            keys_file;
 
         /* Set the start of the next data. */
         out.keys = keys_file + splitter_pos;
         out.keys_len = end - splitter_pos;
         
         // Skip line breaks...
-        while(end < keys_file_len && keys_file[end] == '\r' && keys_file[end] == '\n')
-            end++;
-        splitter_pos = end;
+        splitter_pos = skip_line_breaks(keys_file + end, 
+            keys_file + keys_file_len) - keys_file;
 
         /* Return true since the out data is valid. */
         return 1;
     }
 };
 
-int main(int argc, char *argv[]) {
-    
-    int fd_keys;
-    char *fdata_keys;
-    struct stat finfo_keys;
-    char *fname_keys;
-
-    struct timespec begin, end;
-
-    get_time (begin);
-
-    if (argv[1] == NULL)
-    {
-        printf("USAGE: %s <keys filename>\n", argv[0]);
-        exit(1);
-    }
-    fname_keys = argv[1];
-
-    printf("String Match: Running...\n");
+/** map_file()
+ *  Map (or read) the file fname into memory
+ */
+char* map_file(char const* fname, int& fd, struct stat& finfo)
+{
+    char* fdata;
 
     // Read in the file
-    CHECK_ERROR((fd_keys = open(fname_keys,O_RDONLY)) < 0);
+    CHECK_ERROR((fd = open(fname,O_RDONLY)) < 0);
     // Get the file info (for file length)
-    CHECK_ERROR(fstat(fd_keys, &finfo_keys) < 0);
+    CHECK_ERROR(fstat(fd, &finfo) < 0);
 #ifndef NO_MMAP
 #ifdef MMAP_POPULATE
     // Memory map the file
-    CHECK_ERROR((fdata_keys = (char*)mmap(0, finfo_keys.st_size + 1, 
-        PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd_keys, 0)) == NULL);
+    CHECK_ERROR((fdata = (char*)mmap(0, finfo.st_size + 1, 
+        PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0)) == MAP_FAILED);
 #else
     // Memory map the file
-    CHECK_ERROR((fdata_keys = (char*)mmap(0, finfo_keys.st_size + 1, 
-        PROT_READ, MAP_PRIVATE, fd_keys, 0)) == NULL);
+    CHECK_ERROR((fdata = (char*)mmap(0, finfo.st_size + 1, 
+        PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED);
 #endif
 #else
-    int ret;
+    ssize_t ret;
 
-    fdata_keys = (char *)malloc (finfo_keys.st_size);
-    CHECK_ERROR (fdata_keys == NULL);
+    fdata = (char *)malloc (finfo.st_size);
+    CHECK_ERROR (fdata == NULL);
 
-    ret = read (fd_keys, fdata_keys, finfo_keys.st_size);
-    CHECK_ERROR (ret != finfo_keys.st_size);
+    ret = read_all (fd, fdata, finfo.st_size);
+    CHECK_ERROR (ret != finfo.st_size);
 #endif
+    return fdata;
+}
 
-    key1_final = (char*)malloc(strlen(key1)+1);
-    key2_final = (char*)malloc(strlen(key2)+1);
-    key3_final = (char*)malloc(strlen(key3)+1);
-    key4_final = (char*)malloc(strlen(key4)+1);
+void unmap_file(char* fdata, int fd, struct stat& finfo)
+{
+#ifndef NO_MMAP
+    CHECK_ERROR(munmap(fdata, finfo.st_size + 1) < 0);
+#else
+    free (fdata);
+#endif
+    CHECK_ERROR(close(fd) < 0);
+}
+
+int main(int argc, char *argv[]) {
+    
+    int fd_keys, fd_patterns;
+    char *fdata_keys, *fdata_patterns = NULL;
+    struct stat finfo_keys, finfo_patterns;
+    line_set patterns;
+
+    struct timespec begin, end;
+
+    get_time (begin);
+
+    if (argv[1] == NULL)
+    {
+        printf("USAGE: %s <keys filename> [patterns filename]\n", argv[0]);
+        exit(1);
+    }
+
+    printf("String Match: Running...\n");
+
+    fdata_keys = map_file(argv[1], fd_keys, finfo_keys);
 
-    compute_hashes(key1, strlen(key1), key1_final);
-    compute_hashes(key2, strlen(key2), key2_final);
-    compute_hashes(key3, strlen(key3), key3_final);
-    compute_hashes(key4, strlen(key4), key4_final);
+    if (argv[2] != NULL)
+    {
+        fdata_patterns = map_file(argv[2], fd_patterns, finfo_patterns);
+        patterns.add_lines(fdata_patterns, finfo_patterns.st_size);
+    }
+    else
+    {
+        for (size_t i = 0; i < sizeof(default_keys)/sizeof(default_keys[0]); i++)
+            patterns.add(default_keys[i], strlen(default_keys[i]));
+    }
+    printf("String Match: %d patterns\n", patterns.size());
     
     get_time (end);
 
@@ -202,7 +189,7 @@ int main(int argc, char *argv[]) {
     printf("String Match: Calling String Match\n");
 
     get_time (begin);
-    MatchMR mr(fdata_keys, finfo_keys.st_size, NULL, 0, 64*1024);
+    MatchMR mr(fdata_keys, finfo_keys.st_size, NULL, 0, 64*1024, patterns);
     std::vector<MatchMR::keyval> out;
     CHECK_ERROR (mr.run(out) < 0);
     get_time (end);
@@ -211,17 +198,30 @@ int main(int argc, char *argv[]) {
 
     get_time (begin);
 
-    free(key1_final);
-    free(key2_final);
-    free(key3_final);
-    free(key4_final);
+    // one keyval per match, ordered by pattern then line offset
+    std::vector<std::pair<int, uint64_t> > matches;
+    for (size_t i = 0; i < out.size(); i++)
+        matches.push_back(std::make_pair(out[i].key, out[i].val));
+    std::sort(matches.begin(), matches.end());
 
-#ifndef NO_MMAP
-    CHECK_ERROR(munmap(fdata_keys, finfo_keys.st_size + 1) < 0);
-#else
-    free (fdata_keys);
-#endif
-    CHECK_ERROR(close(fd_keys) < 0);
+    printf("String Match: %d matches\n", (int)matches.size());
+    for (size_t i = 0; i < matches.size(); )
+    {
+        size_t j = i;
+        while (j < matches.size() && matches[j].first == matches[i].first)
+            j++;
+        int len;
+        char const* p = patterns.pattern(matches[i].first, len);
+        printf("FOUND: %.*s: %d times, first at offset %llu\n", len, p, 
+            (int)(j - i), (unsigned long long)matches[i].second);
+        for (size_t k = i; k < j; k++)
+            dprintf("  %llu\n", (unsigned long long)matches[k].second);
+        i = j;
+    }
+
+    if (fdata_patterns != NULL)
+        unmap_file(fdata_patterns, fd_patterns, finfo_patterns);
+    unmap_file(fdata_keys, fd_keys, finfo_keys);
 
     get_time (end);
 
@@ -28,31 +28,38 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <string.h>
-#include <ctype.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <string>
 
 #ifdef TBB
 #include "tbb/scalable_allocator.h"
 #endif
 
 #include "map_reduce.h"
+#include "tokenizer.h"
 #define DEFAULT_DISP_NUM 10
 
 // a passage from the text. The input data to the Map-Reduce
 struct wc_string {
-    char* data;
+    char const* data;
     uint64_t len;
 };
 
-// a single null-terminated word
+// a single word in the input, which is not modified. Words are compared 
+// and counted in upper case.
 struct wc_word {
-    char* data;
+    char const* data;
+    uint64_t len;
+    uint64_t hash;
     
     // necessary functions to use this as a key
     bool operator<(wc_word const& other) const {
-        return strcmp(data, other.data) < 0;
+        return fold_compare(data, len, other.data, other.len) < 0;
     }
     bool operator==(wc_word const& other) const {
-        return strcmp(data, other.data) == 0;
+        return hash == other.hash && 
+            fold_compare(data, len, other.data, other.len) == 0;
     }
 };
 
@@ -60,19 +67,17 @@ struct wc_word {
 // a hash for the word
 struct wc_word_hash
 {
-    // FNV-1a hash for 64 bits
+    // FNV-1a hash for 64 bits, computed by the tokenizer
     size_t operator()(wc_word const& key) const
     {
-        char* h = key.data;
-        uint64_t v = 14695981039346656037ULL;
-        while (*h != 0)
-            v = (v ^ (size_t)(*(h++))) * 1099511628211ULL;
-        return v;
+        return key.hash;
     }
 };
 
 #ifdef MUST_USE_FIXED_HASH
 class WordsMR : public MapReduceSort<WordsMR, wc_string, wc_word, uint64_t, fixed_hash_container<wc_word, uint64_t, sum_combiner, 32768, wc_word_hash
+#elif defined(MUST_USE_ADAPTIVE)
+class WordsMR : public MapReduceSort<WordsMR, wc_string, wc_word, uint64_t, adaptive_container<wc_word, uint64_t, sum_combiner, wc_word_hash
 #else
 class WordsMR : public MapReduceSort<WordsMR, wc_string, wc_word, uint64_t, hash_container<wc_word, uint64_t, sum_combiner, wc_word_hash 
 #endif
@@ -81,43 +86,50 @@ class WordsMR : public MapReduceSort<WordsMR, wc_string, wc_word, uint64_t, hash
 #endif
 > >
 {
-    char* data;
+    char const* data;
     uint64_t data_size;
     uint64_t chunk_size;
     uint64_t splitter_pos;
+    tokenize_mode mode;
 public:
-    explicit WordsMR(char* _data, uint64_t length, uint64_t _chunk_size) :
+    explicit WordsMR(char const* _data, uint64_t length, uint64_t _chunk_size,
+        tokenize_mode _mode) :
         data(_data), data_size(length), chunk_size(_chunk_size), 
-            splitter_pos(0) {}
+            splitter_pos(0), mode(_mode) {}
 
     void* locate(data_type* str, uint64_t len) const
     {
-        return str->data;
+        return (void*)str->data;
     }
 
     void map(data_type const& s, map_container& out) const
     {
-        for (uint64_t i = 0; i < s.len; i++)
+        std::vector<word_token> words;
+        tokenize(s.data, s.len, words, mode);
+        for (size_t i = 0; i < words.size(); i++)
         {
-            s.data[i] = toupper(s.data[i]);
+            wc_word word = { s.data + words[i].offset, words[i].length, 
+                words[i].hash };
+            emit_intermediate(out, word, 1);
         }
+    }
 
-        uint64_t i = 0;
-        while(i < s.len)
-        {            
-            while(i < s.len && (s.data[i] < 'A' || s.data[i] > 'Z'))
-                i++;
-            uint64_t start = i;
-            while(i < s.len && ((s.data[i] >= 'A' && s.data[i] <= 'Z') || s.data[i] == '\''))
-                i++;
-            if(i > start)
-            {
-                s.data[i] = 0;
-                wc_word word = { s.data+start };
-                emit_intermediate(out, word, 1);
-            }
+#ifdef MUST_REDUCE
+    void reduce(key_type const& key, reduce_iterator const& values, 
+        std::vector<keyval>& out) const
+    {
+        value_type total = 0;
+        value_type const* vals;
+        uint64_t len;
+        while ((len = values.next_batch(vals)) > 0)
+        {
+            for (uint64_t i = 0; i < len; i++)
+                total += vals[i];
         }
+        keyval kv = {key, total};
+        out.push_back(kv);
     }
+#endif
 
     /** wordcount split()
      *  Memory map the file and divide file on a word border i.e. a space.
@@ -151,32 +163,38 @@ public:
 
     bool sort(keyval const& a, keyval const& b) const
     {
-        return a.val < b.val || (a.val == b.val && strcmp(a.key.data, b.key.data) > 0);
+        return a.val < b.val || (a.val == b.val && 
+            fold_compare(a.key.data, a.key.len, b.key.data, b.key.len) > 0);
     }
 };
 
-#define NO_MMAP
-
 int main(int argc, char *argv[]) 
 {
-    int fd;
+    int fd, c;
     char * fdata;
     unsigned int disp_num;
     struct stat finfo;
     char * fname, * disp_num_str;
+    tokenize_mode mode = TOKENIZE_ASCII;
     struct timespec begin, end;
 
     get_time (begin);
 
+    while ((c = getopt(argc, argv, "u")) != EOF)
+    {
+        if (c == 'u')
+            mode = TOKENIZE_UTF8;
+    }
+
     // Make sure a filename is specified
-    if (argv[1] == NULL)
+    if (optind >= argc)
     {
-        printf("USAGE: %s <filename> [Top # of results to display]\n", argv[0]);
+        printf("USAGE: %s [-u] <filename> [Top # of results to display]\n", argv[0]);
         exit(1);
     }
 
-    fname = argv[1];
-    disp_num_str = argv[2];
+    fname = argv[optind];
+    disp_num_str = optind + 1 < argc ? argv[optind + 1] : NULL;
 
     printf("Wordcount: Running...\n");
 
@@ -186,13 +204,13 @@ int main(int argc, char *argv[])
     CHECK_ERROR(fstat(fd, &finfo) < 0);
 #ifndef NO_MMAP
 #ifdef MMAP_POPULATE
-    // Memory map the file
+    // Memory map the file, read only since the input is never modified
     CHECK_ERROR((fdata = (char*)mmap(0, finfo.st_size + 1, 
-        PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0)) == NULL);
+        PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0)) == MAP_FAILED);
 #else
-    // Memory map the file
+    // Memory map the file, read only since the input is never modified
     CHECK_ERROR((fdata = (char*)mmap(0, finfo.st_size + 1, 
-        PROT_READ, MAP_PRIVATE, fd, 0)) == NULL);
+        PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED);
 #endif
 #else
     uint64_t r = 0;
@@ -217,7 +235,7 @@ int main(int argc, char *argv[])
     printf("Wordcount: Calling MapReduce Scheduler Wordcount\n");
     get_time (begin);
     std::vector<WordsMR::keyval> result;    
-    WordsMR mapReduce(fdata, finfo.st_size, 1024*1024);
+    WordsMR mapReduce(fdata, finfo.st_size, 1024*1024, mode);
     CHECK_ERROR( mapReduce.run(result) < 0);
     get_time (end);
 
@@ -229,11 +247,16 @@ int main(int argc, char *argv[])
     get_time (begin);
 
     unsigned int dn = std::min(disp_num, (unsigned int)result.size());
-    printf("\nWordcount: Results (TOP %d of %lu):\n", dn, result.size());
+    printf("\nWordcount: Results (TOP %d of %zu):\n", dn, result.size());
     uint64_t total = 0;
     for (size_t i = 0; i < dn; i++)
     {
-        printf("%15s - %lu\n", result[result.size()-1-i].key.data, result[result.size()-1-i].val);
+        wc_word const& w = result[result.size()-1-i].key;
+        std::string word(w.data, w.len);
+        for (size_t j = 0; j < word.size(); j++)
+            word[j] = fold_upper(word[j]);
+        printf("%15s - %" PRIu64 "\n", word.c_str(), 
+            (uint64_t)result[result.size()-1-i].val);
     }
 
     for(size_t i = 0; i < result.size(); i++)
@@ -241,7 +264,7 @@ int main(int argc, char *argv[])
         total += result[i].val;
     }
 
-    printf("Total: %lu\n", total);
+    printf("Total: %" PRIu64 "\n", total);
 
 #ifndef NO_MMAP
     CHECK_ERROR(munmap(fdata, finfo.st_size + 1) < 0);
@@ -28,6 +28,7 @@
 #define MAP_REDUCE_H_
 
 #include <sys/types.h>
+#include <stdint.h>
 #include <stdbool.h>
 
 /* Standard data types for the function arguments and results */
@@ -59,10 +60,20 @@ typedef struct
  */
 typedef struct
 {
-   int length;
+   intptr_t length;
    keyval_t *data;
 } final_data_t;
 
+/* Intermediate key value pair for emit_intermediate_batch()
+ * key_size - length of the key in bytes, as passed to emit_intermediate()
+ */
+typedef struct
+{
+   void *key;
+   void *val;
+   int key_size;
+} intermediate_t;
+
 /* Scheduler function pointer type definitions */
 
 /* Map function takes in map_args_t, as supplied by the splitter
@@ -74,7 +85,21 @@ typedef void (*map_t)(map_args_t *);
 struct iterator_t;
 typedef struct iterator_t iterator_t;
 int iter_next (iterator_t *itr, void **);
-int iter_size (iterator_t *itr);
+intptr_t iter_size (iterator_t *itr);
+
+/* Batch variant of iter_next(). Points *vals to an array of the next values,
+ * which are stored contiguously, and returns their number, or 0 once all the
+ * values have been read. Calls can be mixed with iter_next().
+ */
+int iter_next_batch (iterator_t *itr, void ***vals);
+
+/* Typed view of the values for jobs that set value_size. Points *vals to an
+ * array of the next values, value_size bytes each, which can be cast to the
+ * value type, and returns their number, or 0 once all the values have been 
+ * read. Without value_size it works as iter_next_batch(). Calls can be mixed 
+ * with iter_next(), which then returns a pointer to each value.
+ */
+int iter_next_values (iterator_t *itr, void **vals);
 
 /* Reduce function takes in a key pointer, a list of value pointers, and a 
  * length of the list. emit() should be called on any key value pairs 
@@ -82,18 +107,44 @@ int iter_size (iterator_t *itr);
  */
 typedef void (*reduce_t)(void *, iterator_t *itr);
 
+/* Per-thread runtime handle. The runtime hands one to map_ctx_t and 
+ * reduce_ctx_t functions; emitting through it goes straight to the calling 
+ * thread's queues instead of looking them up on every emit_intermediate() 
+ * or emit(). It is only valid for the duration of the call it was passed to.
+ */
+struct mr_ctx_t;
+typedef struct mr_ctx_t mr_ctx_t;
+
+/* Context variants of map_t and reduce_t. */
+typedef void (*map_ctx_t)(map_args_t *, mr_ctx_t *ctx);
+typedef void (*reduce_ctx_t)(void *, iterator_t *itr, mr_ctx_t *ctx);
+
 /* Combiner function takes in an iterator for a particular key,
  * and returns a reduced value. The operation should be identical to the 
  * reduce function, except that this function returns the reduced value 
  * directly. */
 typedef void *(*combiner_t)(iterator_t *itr);
 
-/* Splitter function takes in a pointer to the input data, an interger of
- * the number of bytes requested, and an uninitialized pointer to a 
+/* In-place combiner. Instead of returning a new value, it folds the values of 
+ * a key into an accumulator of combiner_size bytes, which the runtime keeps 
+ * with the key and owns, and may copy byte by byte. The reduce function is 
+ * then handed a pointer to the accumulator as the only value of the key.
+ *   combiner_init_t sets acc to the identity of the operation.
+ *   combiner_accumulate_t folds a value, as emitted, into acc.
+ *   combiner_merge_t folds the accumulator other into acc.
+ */
+typedef void (*combiner_init_t)(void *acc);
+typedef void (*combiner_accumulate_t)(void *acc, void *val);
+typedef void (*combiner_merge_t)(void *acc, const void *other);
+
+/* Splitter function takes in a pointer to the input data, the number of 
+ * units of unit_size bytes requested, and an uninitialized pointer to a 
  * map_args_t pointer. The result is stored in map_args_t. The splitter
  * should return 1 if the result is valid or 0 if there is no more data.
+ * It is called by the map threads as they need more work, but never by two
+ * threads at once, nor again after it returned 0.
  */
-typedef int (*splitter_t)(void *, int, map_args_t *);
+typedef int (*splitter_t)(void *, intptr_t, map_args_t *);
 
 /* Locator function takes in a pointer to map_args_t, and returns
  * the memory address where this map task would be heavily accessing.
@@ -108,6 +159,12 @@ typedef void* (*locator_t)(map_args_t *);
  */
 typedef int (*partition_t)(int, void *, int);
 
+/* Hash function takes in a pointer to a key and the length of the key in
+ * bytes, as passed to emit_intermediate(). Keys that compare equal must hash
+ * to the same value. It is used to find keys in the intermediate store.
+ */
+typedef unsigned int (*hash_t)(void *, int);
+
 /* key_cmp(key1, key2) returns:
  *   0 if key1 == key2
  *   + if key1 > key2
@@ -115,6 +172,17 @@ typedef int (*partition_t)(int, void *, int);
  */
 typedef int (*key_cmp_t)(const void *, const void*);
 
+/* Types of keys the runtime can compare and hash by itself. Keys are still 
+ * passed around as pointers to them.
+ */
+typedef enum
+{
+    KEY_TYPE_OPAQUE = 0,        /* Compared with key_cmp. */
+    KEY_TYPE_U32,               /* uint32_t, in ascending order. */
+    KEY_TYPE_U64,               /* uint64_t, in ascending order. */
+    KEY_TYPE_BYTES,             /* key_size bytes, in memcmp() order. */
+} key_type_t;
+
 /* The arguments to operate the runtime. */
 typedef struct
 {
@@ -124,7 +192,8 @@ typedef struct
     int unit_size;              /* # of bytes for one element 
                                  * (if necessary, on average) */
 
-    map_t map;                  /* Map function pointer, must be user defined */
+    map_t map;                  /* Map function pointer, must be user defined
+                                 * unless map_ctx is given. */
     reduce_t reduce;            /* If NULL, identity reduce function is used, 
                                  * which emits a keyval pair for each val. */
     combiner_t combiner;        /* If NULL, no combiner would be called. */                             
@@ -132,7 +201,8 @@ typedef struct
     locator_t locator;          /* If NULL, no locality based optimization is
                                    performed. */
     key_cmp_t key_cmp;          /* Key comparison function. 
-                                   Must be user defined.*/
+                                   Must be user defined unless key_type 
+                                   is set. */
 
     final_data_t *result;       /* Pointer to output data. 
                                  * Must be allocated by user */
@@ -164,6 +234,46 @@ typedef struct
     float key_match_factor;     /* Magic number that describes the ratio of 
     * the input data size to the output data size.
     * This is used as a hint. */
+
+    map_ctx_t map_ctx;          /* If set, used instead of map. */
+    reduce_ctx_t reduce_ctx;    /* If set, used instead of reduce. */
+
+    hash_t hash;                /* Key hash function. If NULL, the default
+                                 * hash is used when partition is also NULL;
+                                 * otherwise the key bytes are not assumed to
+                                 * be readable and the sorted store is used. */
+
+    /* Keeps each intermediate queue sorted on every emit instead of hashing
+    * keys and sorting once at the end of the map phase. This is faster
+    * only if keys are emitted mostly in order. */
+    bool use_sorted_intermediate;
+
+    /* In-place combiner, used instead of combiner if set. All four of
+    * these must then be given. */
+    combiner_init_t combiner_init;
+    combiner_accumulate_t combiner_accumulate;
+    combiner_merge_t combiner_merge;
+    int combiner_size;          /* # of bytes of an accumulator */
+
+    /* Type of the keys. Typed keys are compared inline instead of with 
+    * key_cmp, are hashed and partitioned with a multiplicative hash unless
+    * hash or partition is set, and are radix sorted if they are integers. */
+    key_type_t key_type;
+    int key_size;               /* # of bytes of KEY_TYPE_BYTES keys */
+
+    /* # of bytes of a value. If set, the runtime copies the value_size
+    * bytes val points to on every emit instead of keeping val, and the
+    * reduce function reads the copies through iter_next_values(). The
+    * copies only live until the reduce phase ends. An in-place combiner
+    * then keeps its accumulator as the only value of a key, so
+    * combiner_size must be 0 or value_size, and combiner cannot be used. */
+    int value_size;
+
+    /* Combines the values of a key while they are emitted instead of at
+    * the end of the map phase: on every emit with an in-place combiner,
+    * otherwise whenever the values fill up their chunk. This keeps little
+    * intermediate data around but costs a combine per emit or chunk. */
+    bool use_incremental_combiner;
 } map_reduce_args_t;
 
 /* Runtime defined functions. */
@@ -190,14 +300,31 @@ int map_reduce (map_reduce_args_t * args);
  */
 void emit_intermediate(void *key, void *val, int key_size);
 
+/* Same as emit_intermediate(), for map_ctx_t functions. */
+void emit_intermediate_ctx(mr_ctx_t *ctx, void *key, void *val, int key_size);
+
+/* Stores num_pairs intermediate pairs at once. Equivalent to calling
+ * emit_intermediate_ctx() on each pair in order.
+ */
+void emit_intermediate_batch(mr_ctx_t *ctx, intermediate_t *pairs, 
+                             int num_pairs);
+
 /* This should be called from the reduce function. It stores a key and a value 
  * in the reduce queue. This will be in the final result array.
  */
 void emit(void *key, void *val);
 
+/* Same as emit(), for reduce_ctx_t functions. */
+void emit_ctx(mr_ctx_t *ctx, void *key, void *val);
+
 /* This is the built in partition function which is a hash.  It is global so 
  * the user defined partition function can call it.
  */
 int default_partition(int reduce_tasks, void* key, int key_size);
 
+/* This is the built in hash function over the key_size bytes of the key. 
+ * It is independent of default_partition().
+ */
+unsigned int default_hash(void* key, int key_size);
+
 #endif // MAP_REDUCE_H_
@@ -32,6 +32,7 @@
 #include <sys/time.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <unistd.h>
 
 //#define TIMING
 
@@ -74,6 +75,23 @@ static inline char *GETENV(char *envstr)
    else return env;
 }
 
+/* read() returns at most about 2 GB at a time, so files are read in a loop. 
+   Returns the # of bytes read, short only at end of file, or -1. */
+static inline ssize_t read_all (int fd, void *buf, size_t count)
+{
+   size_t done = 0;
+   ssize_t ret;
+
+   while (done < count)
+   {
+      ret = read (fd, (char *)buf + done, count - done);
+      if (ret < 0) return -1;
+      if (ret == 0) break;
+      done += ret;
+   }
+   return done;
+}
+
 #define GET_TIME(start, end, duration)                                     \
    duration.tv_sec = (end.tv_sec - start.tv_sec);                         \
    if (end.tv_nsec >= start.tv_nsec) {                                     \
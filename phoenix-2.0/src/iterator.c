@@ -35,7 +35,7 @@
 
 typedef struct iterator_t iterator_t;
 
-int iter_init (iterator_t *itr, int num_lists)
+int iter_init (iterator_t *itr, int num_lists, int value_size)
 {
     assert (itr);
     assert (num_lists > 0);
@@ -53,6 +53,7 @@ int iter_init (iterator_t *itr, int num_lists)
     itr->current_index = 0;
     itr->val = NULL;
     itr->size = 0;
+    itr->value_size = value_size;
 
     return 0;
 }
@@ -108,51 +109,90 @@ int iter_add (iterator_t *itr, keyvals_t *list)
     return 0;
 }
 
+/* Moves on to the next chunk when the current one is used up.
+   Returns 0 when endpoint reached. */
+static inline int iter_next_chunk (iterator_t *itr)
+{
+    if (itr->current_index < itr->val->next_insert_pos)
+        return 1;
+
+    if (itr->val->next_val)
+    {
+        /* Hop to next chunk on the same list. */
+        itr->val = itr->val->next_val;
+        itr->current_index = 0;
+    }
+    else if (itr->current_list + 1 < itr->next_insert_pos)
+    {
+        /* Hop to the first block of next list. */
+        itr->current_list += 1;
+        itr->val = itr->list_array[itr->current_list]->vals;
+        itr->current_index = 0;
+    }
+    else
+    {
+        /* Endpoint reached. */
+        return 0;
+    }
+
+    /* Prefetch next chunk on the same list. */
+    if (itr->val->next_val) {
+        __builtin_prefetch (itr->val->next_val->array, 0, 0);
+    }
+
+    return 1;
+}
+
 /* Returns 1 when element exists.
    Returns 0 when endpoint reached. */
 int iter_next (iterator_t *itr, void **addr)
 {
     assert (itr);
 
-    if (itr->current_index >= itr->val->next_insert_pos)
+    if (! iter_next_chunk (itr))
     {
-        /* Should hop to a different chunk. */
-        if (itr->val->next_val)
-        {
-            /* Hop to next chunk on the same list. */
-            itr->val = itr->val->next_val;
-            itr->current_index = 0;
-
-            /* Prefetch next chunk on the same list. */
-            if (itr->val->next_val) {
-                __builtin_prefetch (itr->val->next_val->array, 0, 0);
-            }
-        }
-        else if (itr->current_list + 1 < itr->next_insert_pos)
-        {
-            /* Hop to the first block of next list. */
-            itr->current_list += 1;
-            itr->val = itr->list_array[itr->current_list]->vals;
-            itr->current_index = 0;
-
-            /* Prefetch next chunk on the same list. */
-            if (itr->val->next_val) {
-                __builtin_prefetch (itr->val->next_val->array, 0, 0);
-            }
-        }
-        else
-        {
-            /* Endpoint reached. */
-            *addr = NULL;
-            return 0;
-        }
+        *addr = NULL;
+        return 0;
     }
 
-    *addr = itr->val->array[itr->current_index++];
+    *addr = val_get (itr->val, itr->value_size, itr->current_index++);
 
     return 1;
 }
 
+/* Returns the number of values left in the current chunk, pointed to by 
+   *vals as stored: copies of value_size bytes each, or pointers. Moves 
+   past them.
+   Returns 0 when endpoint reached. */
+int iter_next_values (iterator_t *itr, void **vals)
+{
+    int len;
+
+    assert (itr);
+
+    if (! iter_next_chunk (itr))
+    {
+        *vals = NULL;
+        return 0;
+    }
+
+    len = itr->val->next_insert_pos - itr->current_index;
+    *vals = (char *)itr->val->array + 
+        (size_t)itr->current_index * VAL_STRIDE (itr->value_size);
+    itr->current_index = itr->val->next_insert_pos;
+
+    return len;
+}
+
+/* Same as iter_next_values(), for values kept as pointers. */
+int iter_next_batch (iterator_t *itr, void ***vals)
+{
+    assert (itr);
+    assert (itr->value_size == 0);
+
+    return iter_next_values (itr, (void **)vals);
+}
+
 int iter_next_list (iterator_t *itr, keyvals_t **list)
 {
     assert (itr);
@@ -167,7 +207,7 @@ int iter_next_list (iterator_t *itr, keyvals_t **list)
     return 1;
 }
 
-int iter_size (iterator_t *itr)
+intptr_t iter_size (iterator_t *itr)
 {
     assert (itr);
 
@@ -37,10 +37,11 @@ struct iterator_t
     int                 current_list;
     int                 current_index;
     val_t               *val;
-    int                 size;
+    intptr_t            size;
+    int                 value_size;     /* 0 if the values are pointers. */
 };
 
-inline int iter_init (struct iterator_t *, int);
+inline int iter_init (struct iterator_t *, int, int);
 inline void iter_reset (struct iterator_t *);
 inline void iter_rewind (struct iterator_t *);
 inline int iter_next_list (struct iterator_t *, keyvals_t **);
@@ -0,0 +1,98 @@
+/* Copyright (c) 2007-2009, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+#ifndef KEY_H_
+#define KEY_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include "map_reduce.h"
+
+/* How the runtime compares and hashes the keys of a job. Typed keys are
+   handled inline; only KEY_TYPE_OPAQUE keys go through key_cmp. */
+typedef struct
+{
+    key_type_t  type;
+    int         size;       /* # of bytes of KEY_TYPE_BYTES keys. */
+    key_cmp_t   cmp;
+} key_ops_t;
+
+/* Multiplier of the multiplicative hash, 2^64 divided by the golden ratio. */
+#define KEY_HASH_MULT 0x9e3779b97f4a7c15ULL
+
+/* Integer value of a KEY_TYPE_U32 or KEY_TYPE_U64 key. */
+static inline uint64_t key_int (const key_ops_t *ops, const void *key)
+{
+    if (ops->type == KEY_TYPE_U32)
+        return *(const uint32_t *)key;
+    return *(const uint64_t *)key;
+}
+
+/* Same as key_cmp_t. */
+static inline int key_compare (
+    const key_ops_t *ops, const void *key1, const void *key2)
+{
+    uint64_t a, b;
+
+    switch (ops->type)
+    {
+        case KEY_TYPE_U32:
+        case KEY_TYPE_U64:
+            a = key_int (ops, key1);
+            b = key_int (ops, key2);
+            return (a > b) - (a < b);
+        case KEY_TYPE_BYTES:
+            return memcmp (key1, key2, ops->size);
+        default:
+            return ops->cmp (key1, key2);
+    }
+}
+
+/* 64 bit multiplicative hash of a typed key. The high bits are the well 
+   mixed ones. */
+static inline uint64_t key_hash (const key_ops_t *ops, const void *key)
+{
+    const unsigned char *p = (const unsigned char *)key;
+    uint64_t h = 0, word;
+    int left;
+
+    if (ops->type != KEY_TYPE_BYTES)
+        return (key_int (ops, key) + 1) * KEY_HASH_MULT;
+
+    /* Fold the bytes in 8 at a time. */
+    for (left = ops->size; left > 0; left -= 8, p += 8)
+    {
+        word = 0;
+        memcpy (&word, p, left < 8 ? left : 8);
+        h = (h ^ word) * KEY_HASH_MULT;
+        h ^= h >> 29;
+    }
+
+    return h * KEY_HASH_MULT;
+}
+
+#endif /* KEY_H_ */
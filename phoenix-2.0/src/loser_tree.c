@@ -0,0 +1,138 @@
+/* Copyright (c) 2007-2009, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+#include <assert.h>
+
+#include "loser_tree.h"
+#include "memory.h"
+
+#if defined(_LINUX_)
+#include <stdlib.h>
+#endif
+
+char lt_end;
+
+/* Does run a win over run b? Exhausted runs lose to everything. */
+static inline int 
+lt_beats (loser_tree_t *lt, int a, int b)
+{
+    int cmp;
+
+    if (lt->keys[b] == LT_END) return 1;
+    if (lt->keys[a] == LT_END) return 0;
+
+    cmp = key_compare (&lt->key_ops, lt->keys[a], lt->keys[b]);
+    return cmp < 0 || (cmp == 0 && a < b);
+}
+
+int lt_init (loser_tree_t *lt, int k, const key_ops_t *key_ops)
+{
+    int i;
+
+    assert (lt);
+    assert (k > 0);
+
+    /* The matches of lt_build() are played in the 2k entries after the
+       tree itself. */
+    lt->tree = (int *)mem_malloc (sizeof (int) * 3 * k);
+    lt->keys = (void **)mem_malloc (sizeof (void *) * k);
+
+    if (! lt->tree || ! lt->keys) {
+        return -1;
+    }
+
+    for (i = 0; i < k; i++)
+        lt->keys[i] = LT_END;
+
+    lt->k = k;
+    lt->key_ops = *key_ops;
+    lt->tree[0] = 0;
+
+    return 0;
+}
+
+/* Plays all matches from scratch. Runs are leaves k..2k-1 of an implicit
+   binary tree, the match at node i is between the winners of 2i and 2i+1. */
+void lt_build (loser_tree_t *lt)
+{
+    int k = lt->k;
+    int *winner;
+    int i, l, r;
+
+    assert (lt);
+
+    if (k == 1) {
+        lt->tree[0] = 0;
+        return;
+    }
+
+    winner = lt->tree + k;
+
+    for (i = 0; i < k; i++)
+        winner[k + i] = i;
+
+    for (i = k - 1; i >= 1; i--)
+    {
+        l = winner[2 * i];
+        r = winner[2 * i + 1];
+        if (lt_beats (lt, l, r)) {
+            winner[i] = l;
+            lt->tree[i] = r;
+        } else {
+            winner[i] = r;
+            lt->tree[i] = l;
+        }
+    }
+
+    lt->tree[0] = winner[1];
+}
+
+/* Replays the matches on the path of the last winner after its key has
+   changed. */
+void lt_replay (loser_tree_t *lt)
+{
+    int w = lt->tree[0];
+    int node, tmp;
+
+    for (node = (w + lt->k) / 2; node >= 1; node /= 2)
+    {
+        if (lt_beats (lt, lt->tree[node], w)) {
+            tmp = lt->tree[node];
+            lt->tree[node] = w;
+            w = tmp;
+        }
+    }
+
+    lt->tree[0] = w;
+}
+
+void lt_finalize (loser_tree_t *lt)
+{
+    assert (lt);
+
+    mem_free (lt->tree);
+    mem_free (lt->keys);
+}
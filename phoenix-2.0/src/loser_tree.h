@@ -0,0 +1,58 @@
+/* Copyright (c) 2007-2009, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+#ifndef LOSER_TREE_H_
+#define LOSER_TREE_H_
+
+#include "key.h"
+
+/* Tournament tree over the heads of k sorted runs. The caller keeps the 
+   current head key of each run in keys[], LT_END once the run is exhausted
+   (keys themselves may be NULL), and replays the tree after advancing the 
+   winning run. Equal keys are won 
+   by the lower run, so merging through the tree is stable. */
+typedef struct
+{
+    int         k;                  /* # of runs. */
+    int         *tree;              /* tree[0] is the winner, the rest 
+                                       hold the loser of each match. */
+    void        **keys;             /* Current head key of each run. */
+    key_ops_t   key_ops;
+} loser_tree_t;
+
+extern char lt_end;
+#define LT_END ((void *)&lt_end)
+
+int lt_init (loser_tree_t *, int k, const key_ops_t *);
+void lt_build (loser_tree_t *);
+void lt_replay (loser_tree_t *);
+void lt_finalize (loser_tree_t *);
+
+/* Run holding the smallest head key, or -1 if all runs are exhausted. */
+#define lt_winner(lt) \
+    ((lt)->keys[(lt)->tree[0]] != LT_END ? (lt)->tree[0] : -1)
+
+#endif /* LOSER_TREE_H_ */
@@ -51,6 +51,8 @@
 #include "queue.h"
 #include "stddefines.h"
 #include "iterator.h"
+#include "key.h"
+#include "loser_tree.h"
 #include "locality.h"
 #include "struct.h"
 #include "tpool.h"
@@ -60,14 +62,16 @@
 #endif
 
 /* Begin tunables. */
-//#define INCREMENTAL_COMBINER
-
 #define DEFAULT_NUM_REDUCE_TASKS    256
 #define EXTENDED_NUM_REDUCE_TASKS   (DEFAULT_NUM_REDUCE_TASKS * 128)
 #define DEFAULT_CACHE_SIZE          (64 * 1024)
 //#define DEFAULT_CACHE_SIZE        (8 * 1024)
 #define DEFAULT_KEYVAL_ARR_LEN      10
 #define DEFAULT_VALS_ARR_LEN        10
+#define MAX_VALS_ARR_LEN            (1 << 20)   /* Chunks stop doubling here. */
+#define DEFAULT_HASH_ARR_LEN        16  /* Must be a power of 2. */
+#define PARTITION_BLOCK_LEN         64
+#define RADIX_SORT_MIN_LEN          64  /* Shorter queues are quicksorted. */
 #define L2_CACHE_LINE_SIZE          64
 /* End tunables. */
 
@@ -87,21 +91,32 @@ typedef struct
     /* TODO add static assertion to make sure this fits in L2 line */
     union {
         struct {
-            int         len;
-            int         alloc_len;
-            int         pos;
+            intptr_t    len;
+            intptr_t    alloc_len;
+            intptr_t    pos;
             keyval_t    *arr;
+            int         num_runs;   /* # of sorted runs after the first. */
+            int         alloc_runs;
+            intptr_t    *runs;      /* Start of each of those runs. */
         };
         char pad[L2_CACHE_LINE_SIZE];
     };
 } keyval_arr_t;
 
+/* Sorted run of keyval_t's to merge. */
+typedef struct
+{
+    keyval_t    *arr;
+    intptr_t    len;
+} merge_run_t;
+
 /* Array of keyvals_t. */
 typedef struct 
 {
     int len;
     int alloc_len;
     int pos;
+    intptr_t num_vals;      /* # of values, weighs the reduce task. */
     keyvals_t *arr;
 } keyvals_arr_t;
 
@@ -134,7 +149,7 @@ typedef struct {
 typedef struct
 {
     /* Parameters. */
-    int num_map_tasks;              /* # of map tasks. */
+    int num_map_tasks;              /* # of map tasks split so far. */
     int num_reduce_tasks;           /* # of reduce tasks. */
     int chunk_size;                 /* # of units of data for each map task. */
     int num_procs;                  /* # of processors to run on. */
@@ -146,29 +161,53 @@ typedef struct
 
     bool oneOutputQueuePerMapTask;      /* One output queue per map task? */
     bool oneOutputQueuePerReduceTask;   /* One output queue per reduce task? */
+    bool sortedIntermediate;            /* Keep intermediate queues sorted? */
+    bool incrementalCombiner;           /* Combine values as emitted? */
 
     int intermediate_task_alloc_len;
 
     /* Callbacks. */
     map_t map;                      /* Map function. */
+    map_ctx_t map_ctx;              /* Map function taking a context. */
     reduce_t reduce;                /* Reduce function. */
+    reduce_ctx_t reduce_ctx;        /* Reduce function taking a context. */
     combiner_t combiner;            /* Combiner function. */
+    combiner_init_t combiner_init;  /* In-place combiner functions. */
+    combiner_accumulate_t combiner_accumulate;
+    combiner_merge_t combiner_merge;
+    int combiner_size;              /* # of bytes of an accumulator. */
+    int value_size;                 /* # of bytes of a value copied on 
+                                       emit, 0 to keep the pointers. */
     partition_t partition;          /* Partition function. */     
+    hash_t hash;                    /* Key hash function. */
     splitter_t splitter;            /* Splitter function. */
     locator_t locator;              /* Locator function. */
-    key_cmp_t key_cmp;              /* Key comparator function. */
+    key_ops_t key_ops;              /* Key comparison and hashing. */
 
     /* Structures. */
     map_reduce_args_t * args;       /* Args passed in by the user. */
     thread_info_t * tinfo;          /* Thread information array. */
 
-    keyvals_arr_t **intermediate_vals;
-                                    /* Array to send to reduce task. */
+    keyvals_arr_t ***intermediate_vals;
+                                    /* Array to send to reduce task. Each 
+                                       thread has a directory of blocks of
+                                       PARTITION_BLOCK_LEN queues, allocated
+                                       on first emit. */
+    int num_partition_blocks;       /* # of blocks in each directory. */
+    mem_arena_t **arenas;           /* Arena of each map thread, holding
+                                       the blocks, queues and values it
+                                       emits until the end of reduce. */
 
     keyval_arr_t *final_vals;       /* Array to send to merge task. */
-    keyval_arr_t *merge_vals;       /* Array to send to user. */
+    merge_run_t *merge_runs;        /* Runs to merge in the current round. */
+    int num_merge_runs;
+    merge_run_t *merged_runs;       /* Output of each thread in a grouping
+                                       round. */
+    keyval_t *merge_out;            /* Array to send to user. */
 
     uintptr_t splitter_pos;         /* Tracks position in array_splitter(). */
+    mr_lock_t split_lock;           /* Map workers split under this lock. */
+    bool split_done;                /* Splitter has run out of data? */
 
     /* Policy for mapping threads to cpus. */
     sched_policy    *schedPolicies[TASK_TYPE_TOTAL];
@@ -178,10 +217,19 @@ typedef struct
     tpool_t         *tpool;         /* Thread pool. */
 } mr_env_t;
 
-#ifdef TIMING
-static pthread_key_t emit_time_key;
-#endif
+/* Emit context of a map or reduce worker. The queues are resolved when a 
+   task is dequeued, so emitting needs no thread lookup. */
+struct mr_ctx_t
+{
+    mr_env_t        *env;
+    keyvals_arr_t   **intermediate; /* Map: directory of queues. */
+    keyval_arr_t    *final;         /* Reduce: output queue. */
+    mem_arena_t     *arena;         /* Map: arena of the thread. */
+    uintptr_t       emit_time;      /* Time spent emitting. */
+};
+
 static pthread_key_t env_key;       /* Environment for current thread. */
+static pthread_key_t ctx_key;       /* Emit context for current thread. */
 static pthread_key_t tpool_key;
 
 /* Data passed on to each worker thread. */
@@ -190,8 +238,6 @@ typedef struct
     int             cpu_id;             /* CPU this thread is to run. */
     int             thread_id;          /* Thread index. */
     TASK_TYPE_T     task_type;          /* Assigned task type. */
-    int             merge_len;
-    keyval_arr_t    *merge_input;
     int             merge_round;
     mr_env_t        *env;
 } thread_arg_t;
@@ -201,34 +247,50 @@ static void env_fini(mr_env_t* env);
 static inline void env_print (mr_env_t* env);
 static inline void start_workers (mr_env_t* env, thread_arg_t *);
 static inline void *start_my_work (thread_arg_t *);
-static inline void emit_inline (mr_env_t* env, void *, void *);
+static inline void emit_inline (mr_ctx_t* ctx, void *, void *);
 static inline mr_env_t* get_env(void);
-static inline int getCurrThreadIndex (TASK_TYPE_T);
+static inline mr_ctx_t* get_ctx(void);
 static inline int getNumTaskThreads (mr_env_t* env, TASK_TYPE_T);
 static inline void insert_keyval (
     mr_env_t* env, keyval_arr_t *, void *, void *);
 static inline void insert_keyval_merged (
-    mr_env_t* env, keyvals_arr_t *, void *, void *);
-
-static int array_splitter (void *, int, map_args_t *);
-static void identity_reduce (void *, iterator_t *itr);
-static inline void merge_results (mr_env_t* env, keyval_arr_t*, int);
+    mr_ctx_t* ctx, keyvals_arr_t *, void *, void *);
+static inline void insert_keyval_hashed (
+    mr_ctx_t* ctx, keyvals_arr_t *, void *, int, void *);
+static inline void insert_val (mr_ctx_t* ctx, keyvals_t *, void *);
+static inline val_t *new_acc_vals (mr_env_t* env, mem_arena_t *);
+
+/* Offset of an in-place combiner's accumulator from its value chunk: past the 
+   one value pointing to it, 16 byte aligned. */
+static const size_t acc_offset = 
+    (sizeof (val_t) + sizeof (void *) + 15) & ~(size_t)15;
+static inline keyvals_arr_t *get_partition (
+    mem_arena_t *, keyvals_arr_t **, int);
+static inline keyvals_arr_t *find_partition (keyvals_arr_t **, int);
+static inline int key_partition (mr_env_t* env, void *, int);
+static void sort_intermediate (mr_env_t* env, int thread_idx);
+
+static int array_splitter (void *, intptr_t, map_args_t *);
+static void identity_reduce (void *, iterator_t *itr, mr_ctx_t *ctx);
+static void merge_runs (mr_env_t* env, merge_run_t *, int, keyval_t *);
+static void merge_co_rank (
+    mr_env_t* env, merge_run_t *, int, uint64_t, intptr_t *, intptr_t *);
+static void merge_group (mr_env_t* env, int thread_idx);
+static void merge_split (mr_env_t* env, int thread_idx);
 
 static void *map_worker (void *);
 static void *reduce_worker (void *);
 static void *merge_worker (void *);
 
 static int gen_map_tasks (mr_env_t* env);
-static int gen_map_tasks_split(mr_env_t* env, queue_t* q);
+static int gen_map_tasks_split(mr_env_t* env, queue_t* q, int max_tasks);
 static int gen_reduce_tasks (mr_env_t* env);
 
 static void map(mr_env_t* mr);
 static void reduce(mr_env_t* mr);
 static void merge(mr_env_t* mr);
 
-#ifndef INCREMENTAL_COMBINER
 static void run_combiner (mr_env_t* env, int thread_idx);
-#endif
 
 int 
 map_reduce_init ()
@@ -247,10 +309,19 @@ map_reduce (map_reduce_args_t * args)
     mr_env_t* env;
 
     assert (args != NULL);
-    assert (args->map != NULL);
-    assert (args->key_cmp != NULL);
+    assert (args->map != NULL || args->map_ctx != NULL);
+    assert (args->key_cmp != NULL || args->key_type != KEY_TYPE_OPAQUE);
+    assert (args->key_type != KEY_TYPE_BYTES || args->key_size > 0);
     assert (args->unit_size > 0);
     assert (args->result != NULL);
+    assert (args->value_size >= 0);
+    assert (args->combiner_accumulate == NULL || 
+        (args->combiner_init != NULL && args->combiner_merge != NULL && 
+         (args->combiner_size > 0 || args->value_size > 0)));
+    assert (args->value_size == 0 || 
+        (args->combiner == NULL || args->combiner_accumulate != NULL));
+    assert (args->value_size == 0 || args->combiner_size == 0 || 
+        args->combiner_size == args->value_size);
 
     get_time (&begin);
 
@@ -276,10 +347,8 @@ map_reduce (map_reduce_args_t * args)
         CHECK_ERROR (pthread_setspecific (tpool_key, tpool));
     }
 
-#ifdef TIMING
-    CHECK_ERROR (pthread_key_create (&emit_time_key, NULL));
-#endif
     CHECK_ERROR (pthread_key_create (&env_key, NULL));
+    CHECK_ERROR (pthread_key_create (&ctx_key, NULL));
 
     pthread_setspecific (env_key, env);
 
@@ -323,11 +392,11 @@ map_reduce (map_reduce_args_t * args)
     get_time (&begin);
     env_fini(env);
     CHECK_ERROR (pthread_key_delete (env_key));
+    CHECK_ERROR (pthread_key_delete (ctx_key));
     get_time (&end);
 
 #ifdef TIMING
     fprintf (stderr, "library finalize: %u\n", time_diff (&end, &begin));
-    CHECK_ERROR (pthread_key_delete (emit_time_key));
 #endif
 
     return 0;
@@ -358,6 +427,7 @@ static void env_fini (mr_env_t* env)
     for (i = 0; i < TASK_TYPE_TOTAL; i++)
         sched_policy_put(env->schedPolicies[i]);
 
+    lock_free (env->split_lock);
     mem_free (env);
 }
 
@@ -368,6 +438,8 @@ env_init (map_reduce_args_t *args)
     mr_env_t    *env;
     int         i;
     int         num_procs;
+    int         cache_size;
+    uint64_t    num_keys, num_reduce_tasks, max_reduce_tasks;
 
     env = mem_malloc (sizeof (mr_env_t));
     if (env == NULL) {
@@ -403,10 +475,6 @@ env_init (map_reduce_args_t *args)
     env->num_merge_threads = (args->num_merge_threads > 0) ? 
         args->num_merge_threads : env->num_reduce_threads;
 
-    if (env->oneOutputQueuePerReduceTask == false) {
-        env->num_merge_threads = env->num_reduce_threads / 2;
-    }
-
     /* Assign at least one merge thread. */
     env->num_merge_threads = MAX(env->num_merge_threads, 1);
 
@@ -414,39 +482,17 @@ env_init (map_reduce_args_t *args)
         args->key_match_factor : 2;
 
     /* Set num_map_tasks to 0 since we cannot anticipate how many map tasks
-       there would be. This does not matter since map workers will loop
+       there would be. Map workers split the input as they go, and loop
        until there is no more data left. */
     env->num_map_tasks = 0;
+    env->split_lock = lock_alloc ();
+    env->split_done = false;
 
-    if (args->L1_cache_size > 0)
-    {
-        env->chunk_size = args->L1_cache_size / args->unit_size;
-        env->num_reduce_tasks = (int)
-            ( (env->key_match_factor * args->data_size) /
-                args->L1_cache_size);
-    }
-    else
-    {
-        env->chunk_size = DEFAULT_CACHE_SIZE / args->unit_size;
-        env->num_reduce_tasks = (int) 
-            ( (env->key_match_factor * args->data_size) / 
-                DEFAULT_CACHE_SIZE );
-    }
+    cache_size = (args->L1_cache_size > 0) ? 
+        args->L1_cache_size : DEFAULT_CACHE_SIZE;
 
-    if (env->num_reduce_tasks <= 0) env->num_reduce_tasks = 1;
+    env->chunk_size = cache_size / args->unit_size;
     if (env->chunk_size <= 0) env->chunk_size = 1;
-
-    if (env->oneOutputQueuePerReduceTask == false) 
-    {
-        env->num_reduce_tasks = EXTENDED_NUM_REDUCE_TASKS;
-    } 
-    else 
-    {
-        env->num_reduce_tasks = DEFAULT_NUM_REDUCE_TASKS;
-    }
-    env->num_merge_threads = MIN (
-        env->num_merge_threads, env->num_reduce_tasks / 2);
-
     if (env->oneOutputQueuePerMapTask) 
         env->intermediate_task_alloc_len = 
             args->data_size / env->chunk_size + 1;
@@ -455,24 +501,72 @@ env_init (map_reduce_args_t *args)
 
     /* Register callbacks. */
     env->map = args->map;
-    env->reduce = (args->reduce) ? args->reduce : identity_reduce;
-    env->combiner = args->combiner;
-    env->partition = (args->partition) ? args->partition : default_partition;
+    env->map_ctx = args->map_ctx;
+    env->reduce = args->reduce;
+    env->reduce_ctx = args->reduce_ctx;
+    if (env->reduce_ctx == NULL && env->reduce == NULL)
+        env->reduce_ctx = identity_reduce;
+    env->combiner_init = args->combiner_init;
+    env->combiner_accumulate = args->combiner_accumulate;
+    env->combiner_merge = args->combiner_merge;
+    env->value_size = args->value_size;
+    env->combiner_size = (env->value_size > 0) ? 
+        env->value_size : args->combiner_size;
+    env->combiner = (env->combiner_accumulate == NULL) ? args->combiner : NULL;
+    env->incrementalCombiner = args->use_incremental_combiner;
+    env->key_ops.type = args->key_type;
+    env->key_ops.size = args->key_size;
+    env->key_ops.cmp = args->key_cmp;
+
+    /* Typed keys are partitioned and hashed by key_partition() and 
+       insert_keyval_hashed() themselves, unless told otherwise. */
+    env->partition = args->partition;
+    if (env->partition == NULL && env->key_ops.type == KEY_TYPE_OPAQUE)
+        env->partition = default_partition;
+    env->hash = args->hash;
+    if (env->hash == NULL && args->partition == NULL && 
+        env->key_ops.type == KEY_TYPE_OPAQUE)
+        env->hash = default_hash;
     env->splitter = (args->splitter) ? args->splitter : array_splitter;
     env->locator = args->locator;
-    env->key_cmp = args->key_cmp;
+
+    /* Hash the keys unless told otherwise or there is no safe hash. Per
+       map task queues are only used for in order emits. */
+    env->sortedIntermediate = args->use_sorted_intermediate || 
+        (env->hash == NULL && env->key_ops.type == KEY_TYPE_OPAQUE) || 
+        env->oneOutputQueuePerMapTask;
+
+    /* Size the reduce tasks so that the keys of each are expected to fit in
+       the L1 cache, taking one key per key_match_factor units of input. 
+       Sorted queues cost linear time per insert, so they get as many tasks 
+       as possible. Empty tasks are never run. */
+    num_keys = args->data_size / args->unit_size / env->key_match_factor;
+    num_reduce_tasks = num_keys * sizeof (keyvals_t) / cache_size;
+    max_reduce_tasks = (env->oneOutputQueuePerReduceTask) ?
+        DEFAULT_NUM_REDUCE_TASKS : EXTENDED_NUM_REDUCE_TASKS;
+
+    if (env->sortedIntermediate)
+        num_reduce_tasks = max_reduce_tasks;
+
+    env->num_reduce_tasks = (int)MAX (MIN (num_reduce_tasks, 
+        max_reduce_tasks), MIN (DEFAULT_NUM_REDUCE_TASKS, max_reduce_tasks));
+    env->num_partition_blocks = 
+        (env->num_reduce_tasks + PARTITION_BLOCK_LEN - 1) / PARTITION_BLOCK_LEN;
 
     /* 2. Initialize structures. */
 
-    env->intermediate_vals = (keyvals_arr_t **)mem_malloc (
-        env->intermediate_task_alloc_len * sizeof (keyvals_arr_t*));
+    env->intermediate_vals = (keyvals_arr_t ***)mem_malloc (
+        env->intermediate_task_alloc_len * sizeof (keyvals_arr_t**));
 
     for (i = 0; i < env->intermediate_task_alloc_len; i++)
     {
-        env->intermediate_vals[i] = (keyvals_arr_t *)mem_calloc (
-            env->num_reduce_tasks, sizeof (keyvals_arr_t));
+        env->intermediate_vals[i] = (keyvals_arr_t **)mem_calloc (
+            env->num_partition_blocks, sizeof (keyvals_arr_t*));
     }
 
+    env->arenas = (mem_arena_t **)mem_calloc (
+        env->num_map_threads, sizeof (mem_arena_t *));
+
     if (env->oneOutputQueuePerReduceTask)
     {
         env->final_vals = 
@@ -665,38 +759,116 @@ start_workers (mr_env_t* env, thread_arg_t *th_arg)
 }
 
 typedef struct {
+    mr_ctx_t            ctx;
+    mr_lock_t           split_lock;     /* Thread's handle on split_lock. */
     uint64_t            run_time;
     int                 lgrp;
 } map_worker_task_args_t;
 
 /**
- * Dequeue the latest task and run it
+ * Splits off the next map task under split_lock
+ * @return true if there was more data, false otherwise
+ */
+static bool map_worker_split_task (
+    mr_env_t *env, map_worker_task_args_t *args, task_t *task)
+{
+    map_args_t  split_args;
+    bool        ret = false;
+
+    lock_acquire (args->split_lock);
+    if (!env->split_done) {
+        if (env->splitter (
+                env->args->task_data, env->chunk_size, &split_args)) {
+            mem_memset (task, 0, sizeof (task_t));
+            task->id = env->num_map_tasks++;
+            task->len = (uint64_t)split_args.length;
+            task->data = (uint64_t)split_args.data;
+            ret = true;
+        } else {
+            env->split_done = true;
+        }
+    }
+    lock_release (args->split_lock);
+
+    return ret;
+}
+
+/**
+ * Returns the locality group of the data of a map task, or -1 if that is 
+ * not known
+ */
+static int map_task_lgrp (mr_env_t *env, task_t *task)
+{
+    map_args_t  args;
+
+    if (env->splitter != array_splitter && env->locator == NULL)
+        return -1;
+
+    args.length = task->len;
+    args.data = (void *)task->data;
+
+    return loc_mem_to_lgrp ((env->locator != NULL) ? 
+        env->locator (&args) : args.data);
+}
+
+/**
+ * Gets the next map task. Queued tasks go first; once there are none,
+ * the worker splits more of the input. Tasks whose data is in another 
+ * locality group are queued for the threads there.
+ * @return true if got a task, false if all the input has been mapped
+ */
+static bool map_worker_get_task (
+    mr_env_t *env, int thread_index, map_worker_task_args_t *args, 
+    task_t *task)
+{
+    int lgrp;
+
+    if (tq_dequeue (env->taskQueue, task, args->lgrp, thread_index))
+        return true;
+
+    while (map_worker_split_task (env, args, task)) {
+        lgrp = map_task_lgrp (env, task);
+        if (lgrp < 0 || lgrp == args->lgrp)
+            return true;
+
+        task->v[3] = lgrp;              /* For debugging. */
+        CHECK_ERROR (tq_enqueue (
+            env->taskQueue, task, lgrp, thread_index) != 0);
+    }
+
+    /* The input is done, but other threads may have queued tasks. */
+    return tq_dequeue (env->taskQueue, task, args->lgrp, thread_index);
+}
+
+/**
+ * Get the next task and run it
  * @return true if ran a task, false otherwise
  */
 static bool map_worker_do_next_task (
     mr_env_t *env, int thread_index, map_worker_task_args_t *args)
 {
     struct timeval  begin, end;
-    int             alloc_len;
     int             curr_task;
     task_t          map_task;
     map_args_t      thread_func_arg;
     bool            oneOutputQueuePerMapTask;
-    int             lgrp = args->lgrp;
 
     oneOutputQueuePerMapTask = env->oneOutputQueuePerMapTask;
 
-    alloc_len = env->intermediate_task_alloc_len;
-
     /* Get new map task. */
-    if (tq_dequeue (env->taskQueue, &map_task, lgrp, thread_index) == 0) {
+    if (!map_worker_get_task (env, thread_index, args, &map_task)) {
         /* no more map tasks */
         return false;
     }
 
-    curr_task = env->num_map_tasks++;
+    curr_task = map_task.id;
     env->tinfo[thread_index].curr_task = curr_task;
 
+    if (oneOutputQueuePerMapTask) {
+        assert (curr_task < env->intermediate_task_alloc_len);
+        args->ctx.intermediate = env->intermediate_vals[curr_task];
+    }
+
     thread_func_arg.length = map_task.len;
     thread_func_arg.data = (void *)map_task.data;
 
@@ -704,7 +876,10 @@ static bool map_worker_do_next_task (
 
     /* Perform map task. */
     get_time (&begin);
-    env->map (&thread_func_arg);
+    if (env->map_ctx != NULL)
+        env->map_ctx (&thread_func_arg, &args->ctx);
+    else
+        env->map (&thread_func_arg);
     get_time (&end);
 
 #ifdef TIMING
@@ -746,18 +921,28 @@ map_worker (void *args)
     /* Bind thread. */
     CHECK_ERROR (proc_bind_thread (th_arg->cpu_id) != 0);
 
-    CHECK_ERROR (pthread_setspecific (env_key, env));
-#ifdef TIMING
-    CHECK_ERROR (pthread_setspecific (emit_time_key, 0));
-#endif
-
+    mwta.ctx.env = env;
+    mwta.ctx.intermediate = env->intermediate_vals[thread_index];
+    mwta.ctx.final = NULL;
+    mwta.ctx.arena = mem_arena_create ();
+    mwta.ctx.emit_time = 0;
+    env->arenas[thread_index] = mwta.ctx.arena;
+    mwta.split_lock = lock_alloc_per_thread (env->split_lock);
     mwta.lgrp = loc_get_lgrp();
 
+    CHECK_ERROR (pthread_setspecific (env_key, env));
+    CHECK_ERROR (pthread_setspecific (ctx_key, &mwta.ctx));
+
     get_time (&work_begin);
     while (map_worker_do_next_task (env, thread_index, &mwta)) {
         user_time += mwta.run_time;
         num_assigned++;
     }
+    lock_free_per_thread (mwta.split_lock);
+
+    /* Hashed queues are sorted once here for the reduce phase. */
+    if (!env->sortedIntermediate)
+        sort_intermediate (env, thread_index);
     get_time (&work_end);
 
 #ifdef TIMING
@@ -767,10 +952,9 @@ map_worker (void *args)
     get_time (&begin);
 
     /* Apply combiner to local map results. */
-#ifndef INCREMENTAL_COMBINER
-    if (env->combiner != NULL)
+    if (!env->incrementalCombiner && 
+        (env->combiner != NULL || env->combiner_accumulate != NULL))
         run_combiner (env, thread_index);
-#endif
 
     get_time (&end);
 
@@ -786,8 +970,7 @@ map_worker (void *args)
 
 #ifdef TIMING
     thread_timing_t *timing = calloc (1, sizeof (thread_timing_t));
-    uintptr_t emit_time = (uintptr_t)pthread_getspecific (emit_time_key);
-    timing->user_time = user_time - emit_time;
+    timing->user_time = user_time - mwta.ctx.emit_time;
     timing->work_time = work_time - timing->user_time;
     timing->combiner_time = combiner_time;
     return (void *)timing;
@@ -797,7 +980,11 @@ map_worker (void *args)
 }
 
 typedef struct {
+    mr_ctx_t            ctx;
     struct iterator_t   itr;
+    loser_tree_t        lt;
+    keyvals_arr_t       **arrs;         /* Queue of each map thread for
+                                           the current task. */
     uint64_t            run_time;
     int                 num_map_threads;
     int                 lgrp;
@@ -813,8 +1000,8 @@ static bool reduce_worker_do_next_task (
 {
     struct timeval  begin, end;
     intptr_t        curr_reduce_task = 0;
-    keyvals_t       *min_key_val, *next_min;
     task_t          reduce_task;
+    loser_tree_t    *lt;
     int             num_map_threads;
     int             curr_thread;
     int             lgrp = args->lgrp;
@@ -829,94 +1016,78 @@ static bool reduce_worker_do_next_task (
 
     env->tinfo[thread_index].curr_task = curr_reduce_task;
 
+    if (env->oneOutputQueuePerReduceTask)
+        args->ctx.final = &env->final_vals[curr_reduce_task];
+
     num_map_threads =  args->num_map_threads;
+    lt = &args->lt;
 
     args->run_time = 0;
-    min_key_val = NULL;
-    next_min = NULL;
 
-    do {
-        for (curr_thread = 0; curr_thread < num_map_threads; curr_thread++) {
-            keyvals_t       *curr_key_val;
-            keyvals_arr_t   *thread_array;
+    /* Seed the tree with the first key of each map thread. */
+    for (curr_thread = 0; curr_thread < num_map_threads; curr_thread++) {
+        keyvals_arr_t   *thread_array;
+
+        thread_array = find_partition (
+            env->intermediate_vals[curr_thread], curr_reduce_task);
+        args->arrs[curr_thread] = thread_array;
+        lt->keys[curr_thread] = (thread_array != NULL && 
+                                 thread_array->pos < thread_array->len) ? 
+            thread_array->arr[thread_array->pos].key : LT_END;
+    }
+    lt_build (lt);
 
-            /* Find the next array to search. */
-            thread_array = 
-                &env->intermediate_vals[curr_thread][curr_reduce_task];
+    while ((curr_thread = lt_winner (lt)) >= 0) {
+        void            *min_key;
+        void            *acc = NULL;
 
-            /* Check if the current processor array has been 
-               completely searched. */
-            if (thread_array->pos >= thread_array->len) {
-                continue;
-            }
+        /* Gather the key from every map thread that has it. The 
+           accumulators of an in-place combiner are merged into the first 
+           one instead, which the reduce function gets as the only value. */
+        min_key = lt->keys[curr_thread];
+        do {
+            keyvals_arr_t   *thread_array;
+            keyvals_t       *entry;
 
-            /* Get the next key in the processor array. */
-            curr_key_val = &thread_array->arr[thread_array->pos];
+            thread_array = args->arrs[curr_thread];
+            entry = &thread_array->arr[thread_array->pos];
 
-            /* If the key matches the minimum value, 
-               add the value to the list of values for that key. */
-            if (min_key_val != NULL &&
-                !env->key_cmp(curr_key_val->key, min_key_val->key)) {
-                CHECK_ERROR (iter_add (&args->itr, curr_key_val));
-                thread_array->pos += 1;
-                --curr_thread;
-            }
-            /* Find the location of the next min. */
-            else if (next_min == NULL || 
-                env->key_cmp(curr_key_val->key, next_min->key) < 0)
+            if (acc != NULL)
+                env->combiner_merge (
+                    acc, val_get (entry->vals, env->value_size, 0));
+            else
             {
-                next_min = curr_key_val;
+                CHECK_ERROR (iter_add (&args->itr, entry));
+                if (env->combiner_merge != NULL)
+                    acc = val_get (entry->vals, env->value_size, 0);
             }
-        }
+            thread_array->pos += 1;
+
+            lt->keys[curr_thread] = (thread_array->pos < thread_array->len) ?
+                thread_array->arr[thread_array->pos].key : LT_END;
+            lt_replay (lt);
 
-        if (min_key_val != NULL) {
-            keyvals_t       *curr_key_val;
+            curr_thread = lt_winner (lt);
+        } while (curr_thread >= 0 && 
+                 !key_compare (&env->key_ops, lt->keys[curr_thread], min_key));
 
-            if (env->reduce != identity_reduce) {
-                get_time (&begin);
-                env->reduce (min_key_val->key, &args->itr);
-                get_time (&end);
+        if (env->reduce_ctx != identity_reduce) {
+            get_time (&begin);
+            if (env->reduce_ctx != NULL)
+                env->reduce_ctx (min_key, &args->itr, &args->ctx);
+            else
+                env->reduce (min_key, &args->itr);
+            get_time (&end);
 #ifdef TIMING
-                args->run_time += time_diff (&end, &begin);
+            args->run_time += time_diff (&end, &begin);
 #endif
-            } else {
-                env->reduce (min_key_val->key, &args->itr);
-            }
-
-            /* Free up memory */
-            iter_rewind (&args->itr);
-            while (iter_next_list (&args->itr, &curr_key_val)) {
-                val_t   *vals, *next;
-
-                vals = curr_key_val->vals;
-                while (vals != NULL) {
-                    next = vals->next_val;
-                    mem_free (vals);
-                    vals = next;
-                }
-            }
-
-            iter_reset(&args->itr);
+        } else {
+            identity_reduce (min_key, &args->itr, &args->ctx);
         }
 
-        min_key_val = next_min;
-        next_min = NULL;
-
-        /* See if there are any elements left. */
-        for(curr_thread = 0;
-            curr_thread < num_map_threads &&
-            env->intermediate_vals[curr_thread][curr_reduce_task].pos >=
-            env->intermediate_vals[curr_thread][curr_reduce_task].len;
-            curr_thread++);
-    } while (curr_thread != num_map_threads);
-
-    /* Free up the memory. */
-    for (curr_thread = 0; curr_thread < num_map_threads; curr_thread++) {
-        keyvals_arr_t   *arr;
-
-        arr = &env->intermediate_vals[curr_thread][curr_reduce_task];
-        if (arr->alloc_len != 0)
-            mem_free(arr->arr);
+        /* The values stay in the map threads' arenas until the end of 
+           the reduce phase. */
+        iter_reset(&args->itr);
     }
 
     return true;
@@ -943,10 +1114,14 @@ reduce_worker (void *args)
     /* Bind thread. */
     CHECK_ERROR (proc_bind_thread (th_arg->cpu_id) != 0);
 
+    rwta.ctx.env = env;
+    rwta.ctx.intermediate = NULL;
+    rwta.ctx.final = &env->final_vals[thread_index];
+    rwta.ctx.arena = NULL;
+    rwta.ctx.emit_time = 0;
+
     CHECK_ERROR (pthread_setspecific (env_key, env));
-#ifdef TIMING
-    CHECK_ERROR (pthread_setspecific (emit_time_key, 0));
-#endif
+    CHECK_ERROR (pthread_setspecific (ctx_key, &rwta.ctx));
 
     if (env->oneOutputQueuePerMapTask)
         num_map_threads = env->num_map_tasks;
@@ -954,7 +1129,11 @@ reduce_worker (void *args)
         num_map_threads = env->num_map_threads;
 
     /* Assuming !oneOutputQueuePerMapTask */
-    CHECK_ERROR (iter_init (&rwta.itr, env->num_map_threads));
+    CHECK_ERROR (iter_init (
+        &rwta.itr, env->num_map_threads, env->value_size));
+    CHECK_ERROR (lt_init (&rwta.lt, num_map_threads, &env->key_ops));
+    rwta.arrs = (keyvals_arr_t **)mem_malloc (
+        num_map_threads * sizeof (keyvals_arr_t *));
     rwta.num_map_threads = num_map_threads;
     rwta.lgrp = loc_get_lgrp();
 
@@ -971,14 +1150,15 @@ reduce_worker (void *args)
 #endif
 
     iter_finalize (&rwta.itr);
+    lt_finalize (&rwta.lt);
+    mem_free (rwta.arrs);
 
     /* Unbind thread. */
     CHECK_ERROR (proc_unbind_thread () != 0);
 
 #ifdef TIMING
     thread_timing_t *timing = calloc (1, sizeof (thread_timing_t));
-    uintptr_t emit_time = (uintptr_t)pthread_getspecific (emit_time_key);
-    timing->user_time = user_time - emit_time;
+    timing->user_time = user_time - rwta.ctx.emit_time;
     timing->work_time = work_time - timing->user_time;
     return (void *)timing;
 #else
@@ -999,56 +1179,30 @@ merge_worker (void *args)
     thread_arg_t    *th_arg = (thread_arg_t *)args;
     int             thread_index = th_arg->thread_id;
     mr_env_t        *env = th_arg->env;
-    int             cpu;
 #ifdef TIMING
     uintptr_t       work_time = 0;
 #endif
 
     env->tinfo[thread_index].tid = pthread_self();
 
-    /* Bind thread.
-       Spread out the merge workers as much as possible. */
-    if (env->oneOutputQueuePerReduceTask)
-        cpu = th_arg->cpu_id * (1 << (th_arg->merge_round - 1));
-    else
-        cpu = th_arg->cpu_id * (1 << th_arg->merge_round);
-
-    CHECK_ERROR (proc_bind_thread (cpu) != 0);
+    /* Bind thread. */
+    CHECK_ERROR (proc_bind_thread (th_arg->cpu_id) != 0);
 
     CHECK_ERROR (pthread_setspecific (env_key, env));
 
-    /* Assumes num_merge_threads is modified before each call. */
-    int length = th_arg->merge_len / env->num_merge_threads;
-    int modlen = th_arg->merge_len % env->num_merge_threads;
-
-    /* Let's make some progress here. */
-    if (length <= 1) {
-        length = 2;
-        modlen = th_arg->merge_len % 2;
-    }
-
-    int pos = thread_index * length + 
-                ((thread_index < modlen) ? thread_index : modlen);
-
-    if (pos < th_arg->merge_len) {
-
-        keyval_arr_t *vals = &th_arg->merge_input[pos];
+    get_time (&work_begin);
 
-        dprintf("Thread %d: cpu_id -> %d - Started\n", 
-                    thread_index, th_arg->cpu_id);
+    if (th_arg->merge_round == 1)
+        merge_group (env, thread_index);
+    else
+        merge_split (env, thread_index);
 
-        get_time (&work_begin);
-        merge_results (th_arg->env, vals, length + (thread_index < modlen));
-        get_time (&work_end);
+    get_time (&work_end);
 
 #ifdef TIMING
-        work_time = time_diff (&work_end, &work_begin);
+    work_time = time_diff (&work_end, &work_begin);
 #endif
 
-        dprintf("Thread %d: cpu_id -> %d - Done\n", 
-                    thread_index, th_arg->cpu_id);
-    }
-
     /* Unbind thread. */
     CHECK_ERROR (proc_unbind_thread () != 0);
 
@@ -1068,16 +1222,21 @@ merge_worker (void *args)
  * @param q     queue to place tasks into
  * @return number of tasks generated, or 0 on error
  */
-static int gen_map_tasks_split (mr_env_t* env, queue_t* q)
+static int gen_map_tasks_split (mr_env_t* env, queue_t* q, int max_tasks)
 {
     int                 cur_task_id;
     map_args_t          args;
     task_queued         *task = NULL;
 
-    /* split until complete */
+    /* split up to max_tasks, the map workers split the rest */
     cur_task_id = 0;
-    while (env->splitter (env->args->task_data, env->chunk_size, &args))
+    while (cur_task_id < max_tasks)
     {
+        if (!env->splitter (env->args->task_data, env->chunk_size, &args)) {
+            env->split_done = true;
+            break;
+        }
+
         task = (task_queued *)mem_malloc (sizeof (task_queued));
         task->task.id = cur_task_id;
         task->task.len = (uint64_t)args.length;
@@ -1223,7 +1382,7 @@ static int gen_map_tasks_distribute (
 }
 
 /**
- * Generate all map tasks and queue them up
+ * Generate the first map task of each map thread and queue them up
  * @return number of map tasks created if successful, negative value on error
  */
 static int gen_map_tasks (mr_env_t* env)
@@ -1235,10 +1394,12 @@ static int gen_map_tasks (mr_env_t* env)
 
     queue_init (&temp_queue);
 
-    num_map_tasks = gen_map_tasks_split (env, &temp_queue);
+    num_map_tasks = gen_map_tasks_split (
+        env, &temp_queue, env->num_map_threads);
     if (num_map_tasks <= 0) {
         return -1;
     }
+    env->num_map_tasks = num_map_tasks;
 
     num_map_threads = env->num_map_threads;
     if (num_map_tasks < num_map_threads)
@@ -1251,51 +1412,94 @@ static int gen_map_tasks (mr_env_t* env)
     return num_map_tasks;
 }
 
+/** task_weight_cmp()
+ *  Orders reduce tasks by decreasing weight, kept in task_t.len
+ */
+static int task_weight_cmp (const void *v1, const void *v2)
+{
+    const task_t *t1 = (const task_t *)v1;
+    const task_t *t2 = (const task_t *)v2;
+
+    if (t1->len != t2->len)
+        return (t1->len < t2->len) ? 1 : -1;
+    return (t1->id < t2->id) ? -1 : (t1->id > t2->id);
+}
+
+/** gen_reduce_tasks()
+ *  Queues a task for each reduce task that got any values, weighted by 
+ *  its number of values. Tasks are dealt largest first to the least 
+ *  loaded locality group, and threads dequeue them largest first.
+ */
 static int gen_reduce_tasks (mr_env_t* env)
 {
-    int ret, tid;
-    int tasks_per_thread;
-    int tasks_leftover;
-    uint64_t task_id;
-    task_t reduce_task;
+    int ret, tid, lgrp, min_lgrp;
+    int num_lgrps, num_tasks, block, slot;
+    uint64_t *lgrp_load;
+    uint64_t weight[PARTITION_BLOCK_LEN];
+    task_t *tasks;
+    keyvals_arr_t *arr;
 
     tq_reset (env->taskQueue, env->num_reduce_threads);
 
-    tasks_per_thread = env->num_reduce_tasks / env->num_reduce_threads;
-    tasks_leftover = env->num_reduce_tasks - 
-        tasks_per_thread * env->num_map_threads;
+    /* Sum up the weight of each task across the map threads. Blocks
+       no map thread has touched are skipped entirely. */
+    tasks = (task_t *)mem_malloc (env->num_reduce_tasks * sizeof (task_t));
+    num_tasks = 0;
+    for (block = 0; block < env->num_partition_blocks; ++block) {
+        bool used = false;
+
+        mem_memset (weight, 0, sizeof (weight));
+        for (tid = 0; tid < env->intermediate_task_alloc_len; ++tid) {
+            arr = env->intermediate_vals[tid][block];
+            if (arr == NULL)
+                continue;
 
-    task_id = 0;
-    for (tid = 0; tid < env->num_reduce_threads; ++tid) {
-        int remaining_cur_thread_tasks;
+            used = true;
+            for (slot = 0; slot < PARTITION_BLOCK_LEN; ++slot)
+                weight[slot] += arr[slot].num_vals;
+        }
+        if (!used)
+            continue;
 
-        remaining_cur_thread_tasks = tasks_per_thread;
-        if (tasks_leftover > 0) {
-            remaining_cur_thread_tasks += 1;
-            --tasks_leftover;
+        for (slot = 0; slot < PARTITION_BLOCK_LEN; ++slot) {
+            if (weight[slot] == 0)
+                continue;
+
+            mem_memset (&tasks[num_tasks], 0, sizeof (task_t));
+            tasks[num_tasks].id = block * PARTITION_BLOCK_LEN + slot;
+            tasks[num_tasks].len = weight[slot];
+            num_tasks++;
         }
-        do {
-            if (task_id == env->num_reduce_tasks) {
-                return 0;
-            }
+    }
 
-            /* New task. */
-            reduce_task.id = task_id;
+    qsort (tasks, num_tasks, sizeof (task_t), task_weight_cmp);
 
-            /* TODO: Implement locality optimization. */
-            ret = tq_enqueue_seq (env->taskQueue, &reduce_task,  -1);
-            if (ret < 0) {
-                return -1;
-            }
-            ++task_id;
-            --remaining_cur_thread_tasks;
-        } while (remaining_cur_thread_tasks);
+    num_lgrps = loc_get_num_lgrps ();
+    lgrp_load = (uint64_t *)mem_calloc (num_lgrps, sizeof (uint64_t));
+
+    ret = 0;
+    for (tid = 0; tid < num_tasks; ++tid) {
+        min_lgrp = 0;
+        for (lgrp = 1; lgrp < num_lgrps; ++lgrp) {
+            if (lgrp_load[lgrp] < lgrp_load[min_lgrp])
+                min_lgrp = lgrp;
+        }
+        lgrp_load[min_lgrp] += tasks[tid].len;
+
+        ret = tq_enqueue_seq (env->taskQueue, &tasks[tid], min_lgrp);
+        if (ret < 0)
+            break;
     }
 
-    return 0;
+    mem_free (lgrp_load);
+    mem_free (tasks);
+
+    return ret;
 }
 
-#ifndef INCREMENTAL_COMBINER
+/** run_combiner()
+ *  Combines the values of each key a map thread emitted into one
+ */
 static void run_combiner (mr_env_t* env, int thread_index)
 {
     assert (! env->oneOutputQueuePerMapTask);
@@ -1304,14 +1508,30 @@ static void run_combiner (mr_env_t* env, int thread_index)
     keyvals_arr_t *my_output;
     keyvals_t *reduce_pos;
     void *reduced_val;
+    void *acc = NULL;
     iterator_t itr;
-    val_t *val, *next;
+    val_t *val;
 
-    CHECK_ERROR (iter_init (&itr, 1));
+    CHECK_ERROR (iter_init (&itr, 1, env->value_size));
+
+    /* In-place combiners accumulate here first, as the values being read 
+       may be where the accumulator ends up. */
+    if (env->combiner_accumulate != NULL)
+    {
+        acc = mem_malloc (env->combiner_size);
+        CHECK_ERROR (acc == NULL);
+    }
 
     for (i = 0; i < env->num_reduce_tasks; ++i)
     {
-        my_output = &env->intermediate_vals[thread_index][i];
+        my_output = find_partition (env->intermediate_vals[thread_index], i);
+        if (my_output == NULL) {
+            /* Skip the rest of the unused block. */
+            i += PARTITION_BLOCK_LEN - 1 - i % PARTITION_BLOCK_LEN;
+            continue;
+        }
+        my_output->num_vals = my_output->len;
+
         for (j = 0; j < my_output->len; ++j)
         {
             reduce_pos = &(my_output->arr[j]);
@@ -1319,17 +1539,42 @@ static void run_combiner (mr_env_t* env, int thread_index)
 
             CHECK_ERROR (iter_add (&itr, reduce_pos));
 
+            if (env->combiner_accumulate != NULL)
+            {
+                env->combiner_init (acc);
+                while (iter_next (&itr, &reduced_val))
+                    env->combiner_accumulate (acc, reduced_val);
+
+                /* Keep the accumulator in the newest chunk if it fits, 
+                   like new_acc_vals() lays it out. Other chunks go with 
+                   the arena. */
+                val = reduce_pos->vals;
+                if (env->value_size > 0)
+                    val->next_insert_pos = 1;
+                else if (acc_offset + env->combiner_size <= 
+                    sizeof (val_t) + val->size * sizeof (void *))
+                {
+                    val->next_insert_pos = 1;
+                    val->array[0] = (char *)val + acc_offset;
+                }
+                else
+                {
+                    val = new_acc_vals (env, env->arenas[thread_index]);
+                    reduce_pos->vals = val;
+                }
+                val->next_val = NULL;
+                mem_memcpy (val_get (val, env->value_size, 0), acc, 
+                            env->combiner_size);
+                reduce_pos->len = 1;
+
+                iter_reset (&itr);
+                continue;
+            }
+
             reduced_val = env->combiner (&itr);
 
-            /* Shed off trailing chunks. */
+            /* Shed off trailing chunks. Their memory goes with the arena. */
             assert (reduce_pos->vals);
-            val = reduce_pos->vals->next_val;
-            while (val)
-            {
-                next = val->next_val;
-                mem_free (val);
-                val = next;
-            }
 
             /* Update the entry. */
             val = reduce_pos->vals;
@@ -1343,50 +1588,82 @@ static void run_combiner (mr_env_t* env, int thread_index)
     }
 
     iter_finalize (&itr);
+    if (acc != NULL)
+        mem_free (acc);
 }
-#endif
 
 /** emit_intermediate()
  *  inserts the key, val pair into the intermediate array
  */
 void 
 emit_intermediate (void *key, void *val, int key_size)
+{
+    emit_intermediate_ctx (get_ctx(), key, val, key_size);
+}
+
+/** emit_intermediate_ctx()
+ *  inserts the key, val pair into the intermediate array of the thread
+ *  owning ctx
+ */
+void 
+emit_intermediate_ctx (mr_ctx_t *ctx, void *key, void *val, int key_size)
 {
     struct timeval  begin, end;
-    static __thread int curr_thread = -1;
-    int             curr_task;
-    bool            oneOutputQueuePerMapTask;
+    mr_env_t        *env = ctx->env;
     keyvals_arr_t   *arr;
-    mr_env_t        *env;
+    int             reduce_pos;
 
     get_time (&begin);
 
-    env = get_env();
-    if (curr_thread < 0)
-        curr_thread = getCurrThreadIndex (TASK_TYPE_MAP);
-
-    oneOutputQueuePerMapTask = env->oneOutputQueuePerMapTask;
+    reduce_pos = key_partition (env, key, key_size);
+    arr = get_partition (ctx->arena, ctx->intermediate, reduce_pos);
 
-    if (oneOutputQueuePerMapTask)
-        curr_task = env->tinfo[curr_thread].curr_task;
+    if (env->sortedIntermediate)
+        insert_keyval_merged (ctx, arr, key, val);
     else
-        curr_task = curr_thread;
-   
-    int reduce_pos = env->partition (env->num_reduce_tasks, key, key_size);
-    reduce_pos %= env->num_reduce_tasks;
+        insert_keyval_hashed (ctx, arr, key, key_size, val);
+    arr->num_vals++;
 
-    /* Insert sorted in global queue at pos curr_proc */
-    arr = &env->intermediate_vals[curr_task][reduce_pos];
+    get_time (&end);
 
-    insert_keyval_merged (env, arr, key, val);
+#ifdef TIMING
+    ctx->emit_time += time_diff (&end, &begin);
+#endif
+}
+
+/** emit_intermediate_batch()
+ *  inserts num_pairs key, val pairs into the intermediate array of the 
+ *  thread owning ctx
+ */
+void 
+emit_intermediate_batch (mr_ctx_t *ctx, intermediate_t *pairs, int num_pairs)
+{
+    struct timeval  begin, end;
+    mr_env_t        *env = ctx->env;
+    keyvals_arr_t   **intermediate = ctx->intermediate;
+    keyvals_arr_t   *arr;
+    int             reduce_pos;
+    int             i;
+
+    get_time (&begin);
+
+    for (i = 0; i < num_pairs; i++)
+    {
+        reduce_pos = key_partition (env, pairs[i].key, pairs[i].key_size);
+        arr = get_partition (ctx->arena, intermediate, reduce_pos);
+
+        if (env->sortedIntermediate)
+            insert_keyval_merged (ctx, arr, pairs[i].key, pairs[i].val);
+        else
+            insert_keyval_hashed (ctx, arr, pairs[i].key, pairs[i].key_size, 
+                                  pairs[i].val);
+        arr->num_vals++;
+    }
 
     get_time (&end);
 
 #ifdef TIMING
-    uintptr_t total_emit_time = (uintptr_t)pthread_getspecific (emit_time_key);
-    uintptr_t emit_time = time_diff (&end, &begin);
-    total_emit_time += emit_time;
-    CHECK_ERROR (pthread_setspecific (emit_time_key, (void *)total_emit_time));
+    ctx->emit_time += time_diff (&end, &begin);
 #endif
 }
 
@@ -1394,59 +1671,91 @@ emit_intermediate (void *key, void *val, int key_size)
  *  inserts the key, val pair into the final output array
  */
 static inline void 
-emit_inline (mr_env_t* env, void *key, void *val)
+emit_inline (mr_ctx_t* ctx, void *key, void *val)
 {
-    keyval_arr_t    *arr;
-    int             curr_red_queue;
-    static __thread int thread_index = -1;
-
-    if (thread_index < 0)
-        thread_index = getCurrThreadIndex (TASK_TYPE_REDUCE);
-
-    if (env->oneOutputQueuePerReduceTask) {
-        curr_red_queue = env->tinfo[thread_index].curr_task;
-    }
-    else {
-        curr_red_queue = thread_index;
-    }
-
     /* Insert sorted in global queue at pos curr_proc */
-    arr = &env->final_vals[curr_red_queue];
-    insert_keyval (env, arr, key, val);
+    insert_keyval (ctx->env, ctx->final, key, val);
 }
 
 /** emit ()
  */
 void
 emit (void *key, void *val)
+{
+    emit_ctx (get_ctx(), key, val);
+}
+
+/** emit_ctx ()
+ */
+void
+emit_ctx (mr_ctx_t *ctx, void *key, void *val)
 {
     struct timeval begin, end;
 
     get_time (&begin);
 
-    emit_inline (get_env(), key, val);
+    emit_inline (ctx, key, val);
 
     get_time (&end);
 
 #ifdef TIMING
-    uintptr_t total_emit_time = (uintptr_t)pthread_getspecific (emit_time_key);
-    uintptr_t emit_time = time_diff (&end, &begin);
-    total_emit_time += emit_time;
-    CHECK_ERROR (pthread_setspecific (emit_time_key, (void *)total_emit_time));
+    ctx->emit_time += time_diff (&end, &begin);
 #endif
 }
 
+/** get_partition()
+ *  Returns the queue of a reduce task in a map thread's directory, 
+ *  allocating its block from arena on first use
+ */
+static inline keyvals_arr_t *
+get_partition (mem_arena_t *arena, keyvals_arr_t **dir, int reduce_pos)
+{
+    keyvals_arr_t **block = &dir[reduce_pos / PARTITION_BLOCK_LEN];
+
+    if (*block == NULL)
+        *block = (keyvals_arr_t *)mem_arena_calloc (
+            arena, PARTITION_BLOCK_LEN, sizeof (keyvals_arr_t));
+
+    return &(*block)[reduce_pos % PARTITION_BLOCK_LEN];
+}
+
+/** find_partition()
+ *  Returns the queue of a reduce task in a map thread's directory, or NULL
+ *  if its block was never used
+ */
+static inline keyvals_arr_t *
+find_partition (keyvals_arr_t **dir, int reduce_pos)
+{
+    keyvals_arr_t *block = dir[reduce_pos / PARTITION_BLOCK_LEN];
+
+    return (block != NULL) ? &block[reduce_pos % PARTITION_BLOCK_LEN] : NULL;
+}
+
+/** key_partition()
+ *  Returns the reduce task of key. Typed keys without a partition function 
+ *  are spread by the top bits of their hash.
+ */
+static inline int 
+key_partition (mr_env_t* env, void *key, int key_size)
+{
+    if (env->partition != NULL)
+        return env->partition (env->num_reduce_tasks, key, key_size) % 
+            env->num_reduce_tasks;
+
+    return (int)(((key_hash (&env->key_ops, key) >> 32) * 
+                  (uint64_t)env->num_reduce_tasks) >> 32);
+}
+
 static inline void 
-insert_keyval_merged (mr_env_t* env, keyvals_arr_t *arr, void *key, void *val)
+insert_keyval_merged (mr_ctx_t* ctx, keyvals_arr_t *arr, void *key, void *val)
 {
+    mr_env_t *env = ctx->env;
     int high = arr->len, low = -1, next;
     int cmp = 1;
-    keyvals_t *insert_pos;
-    val_t *new_vals;
 
     assert(arr->len <= arr->alloc_len);
     if (arr->len > 0)
-        cmp = env->key_cmp(arr->arr[arr->len - 1].key, key);
+        cmp = key_compare (&env->key_ops, arr->arr[arr->len - 1].key, key);
 
     if (cmp > 0)
     {
@@ -1454,7 +1763,7 @@ insert_keyval_merged (mr_env_t* env, keyvals_arr_t *arr, void *key, void *val)
         while (high - low > 1)
         {
             next = (high + low) / 2;
-            if (env->key_cmp(arr->arr[next].key, key) > 0)
+            if (key_compare (&env->key_ops, arr->arr[next].key, key) > 0)
                 high = next;
             else
                 low = next;
@@ -1462,7 +1771,7 @@ insert_keyval_merged (mr_env_t* env, keyvals_arr_t *arr, void *key, void *val)
 
         if (low < 0) low = 0;
         if (arr->len > 0 &&
-                (cmp = env->key_cmp(arr->arr[low].key, key)) < 0)
+                (cmp = key_compare (&env->key_ops, arr->arr[low].key, key)) < 0)
             low++;
     }
     else if (cmp < 0)
@@ -1478,14 +1787,15 @@ insert_keyval_merged (mr_env_t* env, keyvals_arr_t *arr, void *key, void *val)
             if (arr->alloc_len == 0)
             {
                 arr->alloc_len = DEFAULT_KEYVAL_ARR_LEN;
-                arr->arr = (keyvals_t *)
-                    mem_malloc (arr->alloc_len * sizeof (keyvals_t));
+                arr->arr = (keyvals_t *)mem_arena_alloc (
+                    ctx->arena, arr->alloc_len * sizeof (keyvals_t));
             }
             else
             {
+                arr->arr = (keyvals_t *)mem_arena_realloc (ctx->arena, 
+                    arr->arr, arr->alloc_len * sizeof (keyvals_t), 
+                    2 * arr->alloc_len * sizeof (keyvals_t));
                 arr->alloc_len *= 2;
-                arr->arr = (keyvals_t *)
-                    mem_realloc (arr->arr, arr->alloc_len * sizeof (keyvals_t));
             }
         }
 
@@ -1499,16 +1809,127 @@ insert_keyval_merged (mr_env_t* env, keyvals_arr_t *arr, void *key, void *val)
         arr->len++;
     }
 
-    insert_pos = &(arr->arr[low]);
+    insert_val (ctx, &arr->arr[low], val);
+}
+
+/** insert_keyval_hashed()
+ *  Finds key in the open addressing table held by arr, adding it if new,
+ *  and appends val. The table is kept at most 3/4 full.
+ */
+static inline void 
+insert_keyval_hashed (
+    mr_ctx_t* ctx, keyvals_arr_t *arr, void *key, int key_size, void *val)
+{
+    mr_env_t *env = ctx->env;
+    unsigned int hash, mask;
+    int i;
+    keyvals_t *slot;
+
+    if (env->hash != NULL)
+    {
+        /* Mix the bits so that weak hashes still spread over the table. */
+        hash = env->hash (key, key_size);
+        hash ^= hash >> 16;
+        hash *= 0x85ebca6b;
+        hash ^= hash >> 13;
+        hash *= 0xc2b2ae35;
+        hash ^= hash >> 16;
+    }
+    else
+    {
+        /* The top bits pick the partition, see key_partition(). */
+        hash = (unsigned int)(key_hash (&env->key_ops, key) >> 24);
+    }
+
+    if (4 * (arr->len + 1) > 3 * arr->alloc_len)
+    {
+        keyvals_t *old_arr = arr->arr;
+        int old_len = arr->alloc_len;
+
+        /* Grow the table and rehash. */
+        arr->alloc_len = (old_len == 0) ? DEFAULT_HASH_ARR_LEN : old_len * 2;
+        arr->arr = (keyvals_t *)mem_arena_calloc (
+            ctx->arena, arr->alloc_len, sizeof (keyvals_t));
+        mask = arr->alloc_len - 1;
+
+        for (i = 0; i < old_len; i++)
+        {
+            unsigned int pos;
+
+            if (old_arr[i].len == 0) continue;
+
+            for (pos = old_arr[i].hash & mask; 
+                arr->arr[pos].len != 0; pos = (pos + 1) & mask);
+            arr->arr[pos] = old_arr[i];
+        }
+
+        mem_arena_free (ctx->arena, old_arr, old_len * sizeof (keyvals_t));
+    }
+
+    mask = arr->alloc_len - 1;
+    for (i = hash & mask; ; i = (i + 1) & mask)
+    {
+        slot = &arr->arr[i];
+        if (slot->len == 0)
+        {
+            slot->hash = hash;
+            slot->key = key;
+            slot->vals = NULL;
+            arr->len++;
+            break;
+        }
+        if (slot->hash == hash && !key_compare (&env->key_ops, slot->key, key))
+            break;
+    }
+
+    insert_val (ctx, slot, val);
+}
+
+/** val_chunk_len()
+ *  Returns how many values a chunk for at least len values can take, 
+ *  filling up the size class it is allocated from
+ */
+static inline int 
+val_chunk_len (mr_env_t* env, int len)
+{
+    size_t stride = VAL_STRIDE (env->value_size);
+    size_t size = mem_arena_size (sizeof (val_t) + len * stride);
+
+    return (size - sizeof (val_t)) / stride;
+}
+
+/** insert_val()
+ *  Appends val to the values of insert_pos
+ */
+static inline void 
+insert_val (mr_ctx_t* ctx, keyvals_t *insert_pos, void *val)
+{
+    mr_env_t *env = ctx->env;
+    val_t *new_vals;
+
+    if (env->incrementalCombiner && env->combiner_accumulate != NULL)
+    {
+        /* Fold val into the accumulator, the only value of the key. */
+        if (insert_pos->vals == NULL)
+        {
+            insert_pos->vals = new_acc_vals (env, ctx->arena);
+            insert_pos->len = 1;
+        }
+        env->combiner_accumulate (
+            val_get (insert_pos->vals, env->value_size, 0), val);
+        return;
+    }
 
     if (insert_pos->vals == NULL)
     {
         /* Allocate a chunk for the first time. */
-        new_vals = mem_malloc 
-            (sizeof (val_t) + DEFAULT_VALS_ARR_LEN * sizeof (void *));
+        int alloc_size = val_chunk_len (env, DEFAULT_VALS_ARR_LEN);
+
+        new_vals = mem_arena_alloc (ctx->arena, sizeof (val_t) + 
+            alloc_size * VAL_STRIDE (env->value_size));
         assert (new_vals);
 
-        new_vals->size = DEFAULT_VALS_ARR_LEN;
+        new_vals->size = alloc_size;
         new_vals->next_insert_pos = 0;
         new_vals->next_val = NULL;
 
@@ -1516,12 +1937,11 @@ insert_keyval_merged (mr_env_t* env, keyvals_arr_t *arr, void *key, void *val)
     }
     else if (insert_pos->vals->next_insert_pos >= insert_pos->vals->size)
     {
-#ifdef INCREMENTAL_COMBINER
-        if (env->combiner != NULL) {
+        if (env->incrementalCombiner && env->combiner != NULL) {
             iterator_t itr;
             void *reduced_val;
 
-            CHECK_ERROR (iter_init (&itr, 1));
+            CHECK_ERROR (iter_init (&itr, 1, 0));
             CHECK_ERROR (iter_add (&itr, insert_pos));
 
             reduced_val = env->combiner (&itr);
@@ -1532,12 +1952,13 @@ insert_keyval_merged (mr_env_t* env, keyvals_arr_t *arr, void *key, void *val)
 
             iter_finalize (&itr);
         } else {
-#endif
             /* Need a new chunk. */
             int alloc_size;
 
-            alloc_size = insert_pos->vals->size * 2;
-            new_vals = mem_malloc (sizeof (val_t) + alloc_size * sizeof (void *));
+            alloc_size = val_chunk_len (env, 
+                MIN (insert_pos->vals->size * 2, MAX_VALS_ARR_LEN));
+            new_vals = mem_arena_alloc (ctx->arena, sizeof (val_t) + 
+                alloc_size * VAL_STRIDE (env->value_size));
             assert (new_vals);
 
             new_vals->size = alloc_size;
@@ -1545,22 +1966,48 @@ insert_keyval_merged (mr_env_t* env, keyvals_arr_t *arr, void *key, void *val)
             new_vals->next_val = insert_pos->vals;
 
             insert_pos->vals = new_vals;
-#ifdef INCREMENTAL_COMBINER
         }
-#endif
     }
 
-    insert_pos->vals->array[insert_pos->vals->next_insert_pos++] = val;
+    if (env->value_size > 0)
+        mem_memcpy (val_get (insert_pos->vals, env->value_size, 
+                             insert_pos->vals->next_insert_pos++), 
+                    val, env->value_size);
+    else
+        insert_pos->vals->array[insert_pos->vals->next_insert_pos++] = val;
 
     insert_pos->len += 1;
 }
 
+/** new_acc_vals()
+ *  Allocates a chunk whose only value is a new accumulator of the in-place 
+ *  combiner. Unless values are copied, the value points to the accumulator,
+ *  which is kept in the same allocation at acc_offset.
+ */
+static inline val_t *
+new_acc_vals (mr_env_t* env, mem_arena_t *arena)
+{
+    val_t *vals;
+
+    if (env->value_size > 0)
+        vals = mem_arena_alloc (arena, sizeof (val_t) + env->value_size);
+    else
+        vals = mem_arena_alloc (arena, acc_offset + env->combiner_size);
+    assert (vals);
+
+    vals->size = 1;
+    vals->next_insert_pos = 1;
+    vals->next_val = NULL;
+    if (env->value_size == 0)
+        vals->array[0] = (char *)vals + acc_offset;
+    env->combiner_init (val_get (vals, env->value_size, 0));
+
+    return vals;
+}
+
 static inline void 
 insert_keyval (mr_env_t* env, keyval_arr_t *arr, void *key, void *val)
 {
-    int high = arr->len, low = -1, next;
-    int cmp = 1;
-
     assert(arr->len <= arr->alloc_len);
 
     /* If array is full, double and copy over. */
@@ -1578,106 +2025,382 @@ insert_keyval (mr_env_t* env, keyval_arr_t *arr, void *key, void *val)
         }
     }
 
-    if (env->oneOutputQueuePerReduceTask == false)
+    /* Append, and start a new sorted run if the key goes backwards. The
+       runs are merged in the merge phase. */
+    if (arr->len > 0 && 
+        key_compare (&env->key_ops, arr->arr[arr->len - 1].key, key) > 0)
     {
-        /* Need to sort. */
-        if (arr->len > 0)
-            cmp = env->key_cmp(arr->arr[arr->len - 1].key, key);
+        if (arr->num_runs == arr->alloc_runs)
+        {
+            arr->alloc_runs = (arr->alloc_runs == 0) ? 
+                DEFAULT_KEYVAL_ARR_LEN : arr->alloc_runs * 2;
+            arr->runs = (intptr_t *)mem_realloc (
+                arr->runs, arr->alloc_runs * sizeof (intptr_t));
+        }
+        arr->runs[arr->num_runs++] = arr->len;
+    }
 
-        if (cmp > 0)
+    arr->arr[arr->len].key = key;
+    arr->arr[arr->len].val = val;
+
+    arr->len++;
+}
+
+/** radix_sort_keyvals()
+ *  Sorts len integer keys of arr least significant byte first, skipping 
+ *  the bytes that all keys share. tmp must have room for len keys.
+ */
+static void 
+radix_sort_keyvals (mr_env_t* env, keyvals_t *arr, keyvals_t *tmp, int len)
+{
+    const key_ops_t *ops = &env->key_ops;
+    int         count[8][256];
+    int         num_bytes = (ops->type == KEY_TYPE_U32) ? 4 : 8;
+    keyvals_t   *src = arr, *dst = tmp, *swap;
+    uint64_t    key;
+    int         i, b, sum, c;
+
+    mem_memset (count, 0, sizeof (count));
+    for (i = 0; i < len; i++)
+    {
+        key = key_int (ops, arr[i].key);
+        for (b = 0; b < num_bytes; b++)
+            count[b][(key >> (8 * b)) & 0xff]++;
+    }
+
+    for (b = 0; b < num_bytes; b++)
+    {
+        key = key_int (ops, src[0].key);
+        if (count[b][(key >> (8 * b)) & 0xff] == len)
+            continue;
+
+        for (sum = 0, i = 0; i < 256; i++)
         {
-            /* Binary search the array to find the key. */
-            while (high - low > 1)
-            {
-                next = (high + low) / 2;
-                if (env->key_cmp(arr->arr[next].key, key) > 0)
-                    high = next;
-                else
-                    low = next;
-            }
+            c = count[b][i];
+            count[b][i] = sum;
+            sum += c;
+        }
 
-            if (low < 0) low = 0;
-            if (arr->len > 0 && env->key_cmp(arr->arr[low].key, key) < 0)
-                low++;
+        for (i = 0; i < len; i++)
+        {
+            key = key_int (ops, src[i].key);
+            dst[count[b][(key >> (8 * b)) & 0xff]++] = src[i];
         }
-        else
-            low = arr->len;
 
+        swap = src;
+        src = dst;
+        dst = swap;
+    }
 
-        /* Insert into array. */
-        memmove (&arr->arr[low+1], &arr->arr[low], 
-            (arr->len - low) * sizeof(keyval_t));
+    if (src != arr)
+        mem_memcpy (arr, src, len * sizeof (keyvals_t));
+}
 
-        arr->arr[low].key = key;
-        arr->arr[low].val = val;
+/** sort_keyvals()
+ *  Sorts len keys of arr with the key comparator. Quicksort down to short
+ *  runs, which are left for a final insertion sort.
+ */
+static void 
+sort_keyvals (mr_env_t* env, keyvals_t *arr, int len)
+{
+    const key_ops_t *ops = &env->key_ops;
+    keyvals_t   tmp, pivot;
+    int         lo = 0, hi = len - 1;
+    int         i, j;
+
+#define SWAP_KEYVALS(a, b) do { tmp = (a); (a) = (b); (b) = tmp; } while (0)
+
+    while (hi - lo > 16)
+    {
+        /* Median of three as the pivot, which also guards the scans. */
+        int mid = lo + (hi - lo) / 2;
+        if (key_compare (ops, arr[mid].key, arr[lo].key) < 0)
+            SWAP_KEYVALS (arr[mid], arr[lo]);
+        if (key_compare (ops, arr[hi].key, arr[mid].key) < 0)
+        {
+            SWAP_KEYVALS (arr[hi], arr[mid]);
+            if (key_compare (ops, arr[mid].key, arr[lo].key) < 0)
+                SWAP_KEYVALS (arr[mid], arr[lo]);
+        }
+        pivot = arr[mid];
+
+        i = lo;
+        j = hi;
+        for (;;)
+        {
+            while (key_compare (ops, arr[++i].key, pivot.key) < 0);
+            while (key_compare (ops, pivot.key, arr[--j].key) < 0);
+            if (i >= j) break;
+            SWAP_KEYVALS (arr[i], arr[j]);
+        }
+
+        /* Recurse into the smaller side, loop on the larger one. */
+        if (j - lo < hi - j)
+        {
+            sort_keyvals (env, arr + lo, j - lo + 1);
+            lo = j + 1;
+        }
+        else
+        {
+            sort_keyvals (env, arr + j + 1, hi - j);
+            hi = j;
+        }
     }
-    else
+
+    for (i = lo + 1; i <= hi; i++)
     {
-        /* No need to sort. Just append. */
-        arr->arr[arr->len].key = key;
-        arr->arr[arr->len].val = val;
+        tmp = arr[i];
+        for (j = i; j > lo && key_compare (ops, arr[j - 1].key, tmp.key) > 0; j--)
+            arr[j] = arr[j - 1];
+        arr[j] = tmp;
     }
 
-    arr->len++;
+#undef SWAP_KEYVALS
 }
 
-static inline void 
-merge_results (mr_env_t* env, keyval_arr_t *vals, int length) 
+/** sort_intermediate()
+ *  Packs the keys of each hashed queue of a map thread to the front and 
+ *  sorts them, leaving the queues as insert_keyval_merged() would have.
+ */
+static void 
+sort_intermediate (mr_env_t* env, int thread_index)
 {
-    int data_idx;
-    int total_num_keys = 0;
-    int i;
-    static __thread int curr_thread = -1;
-    
-    if (curr_thread < 0)
-        curr_thread = getCurrThreadIndex (TASK_TYPE_MERGE);
+    keyvals_arr_t *arr;
+    keyvals_t *tmp = NULL;
+    int tmp_len = 0;
+    int i, j, len;
+
+    for (i = 0; i < env->num_reduce_tasks; i++)
+    {
+        arr = find_partition (env->intermediate_vals[thread_index], i);
+        if (arr == NULL) {
+            /* Skip the rest of the unused block. */
+            i += PARTITION_BLOCK_LEN - 1 - i % PARTITION_BLOCK_LEN;
+            continue;
+        }
+
+        len = 0;
+        for (j = 0; j < arr->alloc_len && len < arr->len; j++)
+        {
+            if (arr->arr[j].len != 0)
+                arr->arr[len++] = arr->arr[j];
+        }
+        assert (len == arr->len);
 
-    for (i = 0; i < length; i++) {
-        total_num_keys += vals[i].len;
+        if ((env->key_ops.type == KEY_TYPE_U32 || 
+             env->key_ops.type == KEY_TYPE_U64) && len >= RADIX_SORT_MIN_LEN)
+        {
+            if (tmp_len < len)
+            {
+                tmp_len = len;
+                tmp = (keyvals_t *)mem_realloc (
+                    tmp, tmp_len * sizeof (keyvals_t));
+                CHECK_ERROR (tmp == NULL);
+            }
+            radix_sort_keyvals (env, arr->arr, tmp, len);
+        }
+        else
+            sort_keyvals (env, arr->arr, len);
     }
 
-    env->merge_vals[curr_thread].len = total_num_keys;
-    env->merge_vals[curr_thread].alloc_len = total_num_keys;
-    env->merge_vals[curr_thread].pos = 0;
-    env->merge_vals[curr_thread].arr = (keyval_t *)
-        mem_malloc(sizeof(keyval_t) * total_num_keys);
+    if (tmp != NULL)
+        mem_free (tmp);
+}
+
+/** merge_runs()
+ *  Merges num_runs sorted runs into out with a loser tree
+ */
+static void 
+merge_runs (mr_env_t* env, merge_run_t *runs, int num_runs, keyval_t *out)
+{
+    loser_tree_t    lt;
+    intptr_t        *pos;
+    int             i, w;
+
+    if (num_runs == 1) {
+        mem_memcpy (out, runs[0].arr, runs[0].len * sizeof (keyval_t));
+        return;
+    }
 
-    for (data_idx = 0; data_idx < total_num_keys; data_idx++) {
-        /* For each keyval_t. */
-        int         min_idx;
-        keyval_t    *min_keyval;
+    CHECK_ERROR (lt_init (&lt, num_runs, &env->key_ops));
+    pos = (intptr_t *)mem_calloc (num_runs, sizeof (intptr_t));
+    CHECK_ERROR (pos == NULL);
 
-        for (i = 0; i < length && vals[i].pos >= vals[i].len; i++);
+    for (i = 0; i < num_runs; i++) {
+        if (runs[i].len > 0)
+            lt.keys[i] = runs[i].arr[0].key;
+    }
+    lt_build (&lt);
 
-        if (i == length) break;
+    while ((w = lt_winner (&lt)) >= 0) {
+        *out++ = runs[w].arr[pos[w]++];
+        lt.keys[w] = (pos[w] < runs[w].len) ? runs[w].arr[pos[w]].key : LT_END;
+        lt_replay (&lt);
+    }
 
-        /* Determine the minimum key. */
-        min_idx = i;
-        min_keyval = &vals[i].arr[vals[i].pos];
+    mem_free (pos);
+    lt_finalize (&lt);
+}
 
-        for (i++; i < length; i++) {
-            if (vals[i].pos < vals[i].len)
-            {
-                int cmp_ret;
-                cmp_ret = env->key_cmp(
-                    min_keyval->key, 
-                    vals[i].arr[vals[i].pos].key);
-
-                if (cmp_ret > 0) {
-                    min_idx = i;
-                    min_keyval = &vals[i].arr[vals[i].pos];
+/** merge_co_rank()
+ *  Finds how many elements of each run come before global rank r in the 
+ *  merged order, where equal keys are ordered by run. Repeatedly takes the 
+ *  middle element of the widest remaining window, ranks it by binary search
+ *  in every other window and shrinks all windows to its side of r.
+ *  pos - receives the result, scratch - 2 * num_runs positions
+ */
+static void 
+merge_co_rank (mr_env_t* env, merge_run_t *runs, int num_runs, uint64_t r, 
+               intptr_t *pos, intptr_t *scratch)
+{
+    intptr_t    *lo = pos, *hi = scratch, *cnt = scratch + num_runs;
+    intptr_t    mid, l, h, m;
+    int         i, widest;
+    uint64_t    total;
+    void        *key;
+
+    for (i = 0; i < num_runs; i++) {
+        lo[i] = 0;
+        hi[i] = runs[i].len;
+    }
+
+    for (;;) {
+        widest = 0;
+        for (i = 1; i < num_runs; i++) {
+            if (hi[i] - lo[i] > hi[widest] - lo[widest])
+                widest = i;
+        }
+        if (hi[widest] == lo[widest])
+            break;
+
+        mid = lo[widest] + (hi[widest] - lo[widest]) / 2;
+        key = runs[widest].arr[mid].key;
+
+        total = 0;
+        for (i = 0; i < num_runs; i++) {
+            if (i == widest) {
+                cnt[i] = mid;
+            } else {
+                /* Elements of earlier runs equal to key come before it, 
+                   those of later runs after it. */
+                l = lo[i];
+                h = hi[i];
+                while (l < h) {
+                    int cmp;
+
+                    m = l + (h - l) / 2;
+                    cmp = key_compare (&env->key_ops, runs[i].arr[m].key, key);
+                    if (cmp < 0 || (cmp == 0 && i < widest))
+                        l = m + 1;
+                    else
+                        h = m;
                 }
+                cnt[i] = l;
             }
+            total += cnt[i];
         }
 
-        mem_memcpy (&env->merge_vals[curr_thread].arr[data_idx], 
-                        min_keyval, sizeof(keyval_t));
-        vals[min_idx].pos += 1;
+        if (total < r) {
+            /* The middle element and everything before it are in. */
+            for (i = 0; i < num_runs; i++)
+                lo[i] = cnt[i];
+            lo[widest] = mid + 1;
+        } else {
+            for (i = 0; i < num_runs; i++)
+                hi[i] = cnt[i];
+            hi[widest] = mid;
+        }
     }
+}
 
-    for (i = 0; i < length; i++) {
-        mem_free(vals[i].arr);
+/** merge_group()
+ *  First merge round when there are more runs than merge threads. Each 
+ *  thread merges a contiguous group of about equal total length.
+ */
+static void 
+merge_group (mr_env_t* env, int thread_index)
+{
+    int         num_threads = env->num_merge_threads;
+    uint64_t    total = 0, begin, end, prefix;
+    int         first, last, i;
+    intptr_t    len;
+    keyval_t    *out;
+
+    for (i = 0; i < env->num_merge_runs; i++)
+        total += env->merge_runs[i].len;
+
+    begin = total * thread_index / num_threads;
+    end = total * (thread_index + 1) / num_threads;
+
+    /* A run belongs to the thread whose range holds its first element. */
+    first = last = -1;
+    prefix = 0;
+    for (i = 0; i < env->num_merge_runs; i++) {
+        if (env->merge_runs[i].len > 0 && prefix >= begin && prefix < end) {
+            if (first < 0) first = i;
+            last = i;
+        }
+        prefix += env->merge_runs[i].len;
     }
+
+    env->merged_runs[thread_index].arr = NULL;
+    env->merged_runs[thread_index].len = 0;
+    if (first < 0)
+        return;
+
+    len = 0;
+    for (i = first; i <= last; i++)
+        len += env->merge_runs[i].len;
+
+    out = (keyval_t *)mem_malloc (len * sizeof (keyval_t));
+    CHECK_ERROR (out == NULL);
+
+    merge_runs (env, &env->merge_runs[first], last - first + 1, out);
+
+    env->merged_runs[thread_index].arr = out;
+    env->merged_runs[thread_index].len = len;
+}
+
+/** merge_split()
+ *  Final merge round. Each thread co-ranks the bounds of its share of the
+ *  output and merges the matching slices of all runs into place.
+ */
+static void 
+merge_split (mr_env_t* env, int thread_index)
+{
+    int             num_threads = env->num_merge_threads;
+    int             num_runs = env->num_merge_runs;
+    merge_run_t     *slices;
+    intptr_t        *pos_begin, *pos_end, *scratch;
+    uint64_t        total = 0, begin, end;
+    int             i;
+
+    for (i = 0; i < num_runs; i++)
+        total += env->merge_runs[i].len;
+
+    begin = total * thread_index / num_threads;
+    end = total * (thread_index + 1) / num_threads;
+    if (begin == end)
+        return;
+
+    slices = (merge_run_t *)mem_malloc (num_runs * sizeof (merge_run_t));
+    pos_begin = (intptr_t *)mem_malloc (4 * num_runs * sizeof (intptr_t));
+    CHECK_ERROR (slices == NULL || pos_begin == NULL);
+    pos_end = pos_begin + num_runs;
+    scratch = pos_end + num_runs;
+
+    merge_co_rank (env, env->merge_runs, num_runs, begin, pos_begin, scratch);
+    merge_co_rank (env, env->merge_runs, num_runs, end, pos_end, scratch);
+
+    for (i = 0; i < num_runs; i++) {
+        slices[i].arr = env->merge_runs[i].arr + pos_begin[i];
+        slices[i].len = pos_end[i] - pos_begin[i];
+    }
+
+    merge_runs (env, slices, num_runs, env->merge_out + begin);
+
+    mem_free (pos_begin);
+    mem_free (slices);
 }
 
 static inline int 
@@ -1708,38 +2431,17 @@ getNumTaskThreads (mr_env_t* env, TASK_TYPE_T task_type)
     return num_threads;
 }
 
-/** getCurrThreadIndex()
- *  Returns the processor the current thread is running on
- */
-static inline int 
-getCurrThreadIndex (TASK_TYPE_T task_type)
-{
-    int         i;
-    int         num_threads;
-    mr_env_t    *env;
-    pthread_t   mytid;
-
-    env = get_env();
-    num_threads = getNumTaskThreads (env, task_type);
-    mytid = pthread_self();
-    for (i = 0; i < num_threads && env->tinfo[i].tid != mytid; i++);
-
-    assert(i != num_threads);
-
-    return i;
-}
-
 /** array_splitter()
  *
  */
 int 
-array_splitter (void *data_in, int req_units, map_args_t *out)
+array_splitter (void *data_in, intptr_t req_units, map_args_t *out)
 {
     assert(out != NULL);
 
     mr_env_t    *env;
     int         unit_size;
-    int         data_units;
+    uintptr_t   data_units;
 
     env = get_env();
     unit_size = env->args->unit_size;
@@ -1765,15 +2467,22 @@ array_splitter (void *data_in, int req_units, map_args_t *out)
 }
 
 void 
-identity_reduce (void *key, iterator_t *itr)
+identity_reduce (void *key, iterator_t *itr, mr_ctx_t *ctx)
 {
+    mr_env_t    *env = ctx->env;
     void        *val;
-    mr_env_t    *env;
 
-    env = get_env();
     while (iter_next (itr, &val))
     {
-        emit_inline (env, key, val);
+        /* Copied values go away with the arenas, the output keeps its own. */
+        if (env->value_size > 0)
+        {
+            void *copy = mem_malloc (env->value_size);
+            CHECK_ERROR (copy == NULL);
+            mem_memcpy (copy, val, env->value_size);
+            val = copy;
+        }
+        emit_inline (ctx, key, val);
     }
 }
 
@@ -1792,6 +2501,21 @@ default_partition (int num_reduce_tasks, void* key, int key_size)
     return hash % num_reduce_tasks;
 }
 
+unsigned int 
+default_hash (void* key, int key_size)
+{
+    unsigned int hash = 2166136261u;
+    unsigned char *str = (unsigned char *)key;
+    int i;
+
+    for (i = 0; i < key_size; i++)
+    {
+        hash = (hash ^ str[i]) * 16777619u;     /* FNV-1a */
+    }
+
+    return hash;
+}
+
 /**
  * Run map tasks and get intermediate values
  */
@@ -1803,7 +2527,7 @@ static void map (mr_env_t* env)
     num_map_tasks = gen_map_tasks (env);
     assert (num_map_tasks >= 0);
 
-    env->num_map_tasks = num_map_tasks;
+    /* Fewer tasks than threads only if the splitter is done already. */
     if (num_map_tasks < env->num_map_threads)
         env->num_map_threads = num_map_tasks;
 
@@ -1830,12 +2554,18 @@ static void reduce (mr_env_t* env)
 
     start_workers (env, &th_arg);
 
-    /* Cleanup intermediate results. */
+    /* Cleanup intermediate results. Everything the map threads allocated
+       for them goes with their arenas. */
     for (i = 0; i < env->intermediate_task_alloc_len; ++i)
-    {
         mem_free (env->intermediate_vals[i]);
-    }
     mem_free (env->intermediate_vals);
+
+    for (i = 0; i < env->num_map_threads; ++i)
+    {
+        if (env->arenas[i] != NULL)
+            mem_arena_destroy (env->arenas[i]);
+    }
+    mem_free (env->arenas);
 }
 
 /**
@@ -1843,57 +2573,102 @@ static void reduce (mr_env_t* env)
  */
 static void merge (mr_env_t* env)
 {
-    thread_arg_t   th_arg;
+    thread_arg_t    th_arg;
+    keyval_arr_t    *queue;
+    int             num_queues, num_runs;
+    int             i, j;
+    intptr_t        start;
+    uint64_t        total;
 
     mem_memset (&th_arg, 0, sizeof (thread_arg_t));
     th_arg.task_type = TASK_TYPE_MERGE;
 
     if (env->oneOutputQueuePerReduceTask) {
-        th_arg.merge_len = env->num_reduce_tasks;
+        num_queues = env->num_reduce_tasks;
     } else {
-        th_arg.merge_len = env->num_reduce_threads;
+        num_queues = env->num_reduce_threads;
     }
-    th_arg.merge_input = env->final_vals;
 
-    if (th_arg.merge_len <= 1) {
-        /* Already merged, nothing to do here */
-        env->args->result->data = env->final_vals->arr;
-        env->args->result->length = env->final_vals->len;
-
-        mem_free(env->final_vals);
+    /* Split every output queue into its sorted runs. */
+    num_runs = 0;
+    for (i = 0; i < num_queues; i++) {
+        if (env->final_vals[i].len > 0)
+            num_runs += env->final_vals[i].num_runs + 1;
+    }
 
-        return;
+    env->merge_runs = (merge_run_t *)mem_malloc (
+        MAX (num_runs, 1) * sizeof (merge_run_t));
+    env->num_merge_runs = 0;
+    total = 0;
+    for (i = 0; i < num_queues; i++) {
+        queue = &env->final_vals[i];
+        if (queue->len == 0)
+            continue;
+
+        start = 0;
+        for (j = 0; j <= queue->num_runs; j++) {
+            intptr_t next = (j < queue->num_runs) ? queue->runs[j] : queue->len;
+            env->merge_runs[env->num_merge_runs].arr = queue->arr + start;
+            env->merge_runs[env->num_merge_runs].len = next - start;
+            env->num_merge_runs++;
+            start = next;
+        }
+        total += queue->len;
     }
 
-    /* have work to merge! */
-    while (th_arg.merge_len > 1) {
-        th_arg.merge_round += 1;
+    if (num_runs <= 1) {
+        /* Already merged, nothing to do here */
+        env->args->result->data = (num_runs == 1) ? 
+            env->merge_runs[0].arr : NULL;
+        env->args->result->length = total;
+    } else {
+        /* Cut the runs down to one per merge thread. */
+        if (num_runs > env->num_merge_threads) {
+            env->merged_runs = (merge_run_t *)mem_malloc (
+                env->num_merge_threads * sizeof (merge_run_t));
 
-        /* This is the worst case length, 
-           depending on the value of num_merge_threads. */
-        env->merge_vals = (keyval_arr_t*) 
-            mem_malloc (env->num_merge_threads * sizeof(keyval_arr_t));
+            th_arg.merge_round = 1;
+            start_workers (env, &th_arg);
 
-        /* Run merge tasks and get merge values. */
-        start_workers (env, &th_arg);
+            mem_free (env->merge_runs);
+            env->merge_runs = env->merged_runs;
+            env->num_merge_runs = env->num_merge_threads;
+        }
 
-        mem_free (th_arg.merge_input);
-        th_arg.merge_len = env->num_merge_threads;
+        env->merge_out = (keyval_t *)mem_malloc (total * sizeof (keyval_t));
 
-        env->num_merge_threads /= 2;
-        if (env->num_merge_threads == 0)
-            env->num_merge_threads = 1;
+        th_arg.merge_round = 2;
+        start_workers (env, &th_arg);
 
-        th_arg.merge_input = env->merge_vals;
+        env->args->result->data = env->merge_out;
+        env->args->result->length = total;
     }
 
-    env->args->result->data = env->merge_vals[0].arr;
-    env->args->result->length = env->merge_vals[0].len;
+    /* Free the output queues, except one handed over as the result. */
+    for (i = 0; i < num_queues; i++) {
+        queue = &env->final_vals[i];
+        if (queue->alloc_runs != 0)
+            mem_free (queue->runs);
+        if (queue->alloc_len != 0 && queue->arr != env->args->result->data)
+            mem_free (queue->arr);
+    }
+    mem_free (env->final_vals);
 
-    mem_free(env->merge_vals);
+    if (env->merge_runs != NULL && num_runs > env->num_merge_threads) {
+        for (i = 0; i < env->num_merge_runs; i++) {
+            if (env->merge_runs[i].len > 0)
+                mem_free (env->merge_runs[i].arr);
+        }
+    }
+    mem_free (env->merge_runs);
 }
 
 static inline mr_env_t* get_env (void)
 {
     return (mr_env_t*)pthread_getspecific (env_key);
 }
+
+static inline mr_ctx_t* get_ctx (void)
+{
+    return (mr_ctx_t*)pthread_getspecific (ctx_key);
+}
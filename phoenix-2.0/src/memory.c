@@ -26,10 +26,11 @@
 
 #include <assert.h>
 #include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
 #ifdef _SOLARIS_
 #define PAGE_SIZE (8 * 1024)
 #include <mtmalloc.h>
-#include <sys/mman.h>
 #else
 #include <stdlib.h>
 #define PAGE_SIZE (4 * 1024)
@@ -37,7 +38,57 @@
 
 #define ALIGN_PAGE(ptr) (void *)((uintptr_t)(ptr) & (~(PAGE_SIZE - 1)))
 
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
 #include "memory.h"
+#include "stddefines.h"
+
+/* Begin tunables. */
+//#define MEM_HUGEPAGES
+
+#define ARENA_BLOCK_SIZE    (2 * 1024 * 1024)   /* One x86_64 huge page. */
+/* End tunables. */
+
+/* Size classes are 16 B apart up to 128 B, and then split each doubling 
+   in four, up to 256 KB. */
+#define ARENA_ALIGN         16
+#define ARENA_NUM_SMALL     8
+#define ARENA_MAX_SIZE      (256 * 1024)
+#define ARENA_NUM_CLASSES   (ARENA_NUM_SMALL + (18 - 7) * 4)
+
+/* Header of a block, at its start. */
+typedef union arena_block_t
+{
+    union arena_block_t *next;
+    char                pad[ARENA_ALIGN];
+} arena_block_t;
+
+/* Header of a request larger than ARENA_MAX_SIZE, right before it. */
+typedef union arena_large_t
+{
+    struct {
+        union arena_large_t *prev;
+        union arena_large_t *next;
+    };
+    char                pad[ARENA_ALIGN];
+} arena_large_t;
+
+/* Memory of a free list entry. */
+typedef struct arena_free_t
+{
+    struct arena_free_t *next;
+} arena_free_t;
+
+struct mem_arena_t
+{
+    char            *pos;           /* Next free byte in the current block. */
+    char            *end;           /* End of the current block. */
+    arena_block_t   *blocks;        /* Blocks, the current one first. */
+    arena_large_t   *large;         /* Requests larger than ARENA_MAX_SIZE. */
+    arena_free_t    *free_list[ARENA_NUM_CLASSES];
+};
 
 void *mem_malloc (size_t size)
 {
@@ -85,3 +136,296 @@ void mem_free (void *ptr)
 {
     free (ptr);
 }
+
+/** arena_class()
+ *  Returns the smallest size class that fits size bytes
+ */
+static inline int arena_class (size_t size)
+{
+    int shift;
+
+    if (size <= ARENA_NUM_SMALL * ARENA_ALIGN)
+        return (size == 0) ? 0 : (size - 1) / ARENA_ALIGN;
+
+    /* size - 1 falls in [2^shift, 2^(shift + 1)). */
+    shift = (int)(sizeof (unsigned long) * 8) - 1 - 
+        __builtin_clzl ((unsigned long)(size - 1));
+
+    return ARENA_NUM_SMALL + (shift - 7) * 4 + 
+        (int)(((size - 1) >> (shift - 2)) & 3);
+}
+
+/** arena_class_size()
+ *  Returns the size of a size class
+ */
+static inline size_t arena_class_size (int c)
+{
+    int shift;
+
+    if (c < ARENA_NUM_SMALL)
+        return (size_t)(c + 1) * ARENA_ALIGN;
+
+    shift = 7 + (c - ARENA_NUM_SMALL) / 4;
+
+    return ((size_t)1 << shift) + 
+        ((size_t)((c - ARENA_NUM_SMALL) % 4 + 1) << (shift - 2));
+}
+
+/** arena_map_block()
+ *  Maps a new block of ARENA_BLOCK_SIZE bytes, backed by huge pages when 
+ *  MEM_HUGEPAGES is defined
+ */
+static void *arena_map_block (void)
+{
+    void *block;
+
+#ifdef MEM_HUGEPAGES
+#ifdef MAP_HUGETLB
+    block = mmap (NULL, ARENA_BLOCK_SIZE, PROT_READ | PROT_WRITE, 
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (block != MAP_FAILED)
+        return block;
+#endif
+
+    /* No huge pages are reserved. Transparent huge pages need the block 
+       to be aligned, so map twice the size and trim. */
+    char *base, *aligned;
+
+    base = mmap (NULL, 2 * ARENA_BLOCK_SIZE, PROT_READ | PROT_WRITE, 
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    CHECK_ERROR (base == MAP_FAILED);
+
+    aligned = (char *)(((uintptr_t)base + ARENA_BLOCK_SIZE - 1) & 
+                       ~(uintptr_t)(ARENA_BLOCK_SIZE - 1));
+    if (aligned > base)
+        munmap (base, aligned - base);
+    munmap (aligned + ARENA_BLOCK_SIZE, base + ARENA_BLOCK_SIZE - aligned);
+
+#ifdef MADV_HUGEPAGE
+    madvise (aligned, ARENA_BLOCK_SIZE, MADV_HUGEPAGE);
+#endif
+    block = aligned;
+#else
+    block = mmap (NULL, ARENA_BLOCK_SIZE, PROT_READ | PROT_WRITE, 
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    CHECK_ERROR (block == MAP_FAILED);
+#endif
+
+    return block;
+}
+
+/** arena_new_block()
+ *  Moves the arena on to a new block. What is left of the current one 
+ *  goes to the free lists.
+ */
+static void arena_new_block (mem_arena_t *arena)
+{
+    arena_block_t *block;
+
+    while (arena->end - arena->pos >= ARENA_ALIGN)
+    {
+        arena_free_t *entry = (arena_free_t *)arena->pos;
+        size_t left = arena->end - arena->pos;
+        int c;
+
+        c = (left >= ARENA_MAX_SIZE) ? 
+            ARENA_NUM_CLASSES - 1 : arena_class (left);
+        if (arena_class_size (c) > left)
+            c--;
+
+        entry->next = arena->free_list[c];
+        arena->free_list[c] = entry;
+        arena->pos += arena_class_size (c);
+    }
+
+    block = (arena_block_t *)arena_map_block ();
+    block->next = arena->blocks;
+    arena->blocks = block;
+    arena->pos = (char *)(block + 1);
+    arena->end = (char *)block + ARENA_BLOCK_SIZE;
+}
+
+mem_arena_t *mem_arena_create (void)
+{
+    mem_arena_t *arena = (mem_arena_t *)mem_calloc (1, sizeof (mem_arena_t));
+
+    return arena;
+}
+
+void mem_arena_destroy (mem_arena_t *arena)
+{
+    arena_block_t *block, *next_block;
+    arena_large_t *large, *next_large;
+
+    for (block = arena->blocks; block != NULL; block = next_block)
+    {
+        next_block = block->next;
+        munmap (block, ARENA_BLOCK_SIZE);
+    }
+
+    for (large = arena->large; large != NULL; large = next_large)
+    {
+        next_large = large->next;
+        free (large);
+    }
+
+    mem_free (arena);
+}
+
+/** arena_alloc_large()
+ *  Allocates a request too large for the size classes, on its own
+ */
+static void *arena_alloc_large (mem_arena_t *arena, size_t size)
+{
+    arena_large_t *large = (arena_large_t *)
+        mem_malloc (sizeof (arena_large_t) + size);
+
+    large->prev = NULL;
+    large->next = arena->large;
+    if (arena->large != NULL)
+        arena->large->prev = large;
+    arena->large = large;
+
+    return large + 1;
+}
+
+/** arena_unlink_large()
+ *  Returns the header of a large request, taken off the arena's list
+ */
+static arena_large_t *arena_unlink_large (mem_arena_t *arena, void *ptr)
+{
+    arena_large_t *large = (arena_large_t *)ptr - 1;
+
+    if (large->prev != NULL)
+        large->prev->next = large->next;
+    else
+        arena->large = large->next;
+    if (large->next != NULL)
+        large->next->prev = large->prev;
+
+    return large;
+}
+
+void *mem_arena_alloc (mem_arena_t *arena, size_t size)
+{
+    arena_free_t *entry;
+    size_t class_size;
+    int c;
+
+    if (size > ARENA_MAX_SIZE)
+        return arena_alloc_large (arena, size);
+
+    c = arena_class (size);
+    entry = arena->free_list[c];
+    if (entry != NULL)
+    {
+        arena->free_list[c] = entry->next;
+        return entry;
+    }
+
+    class_size = arena_class_size (c);
+    if (arena->pos + class_size > arena->end)
+        arena_new_block (arena);
+
+    entry = (arena_free_t *)arena->pos;
+    arena->pos += class_size;
+
+    return entry;
+}
+
+void *mem_arena_calloc (mem_arena_t *arena, size_t num, size_t size)
+{
+    void *temp;
+    size_t total = num * size;
+
+    /* Memory that was never handed out is still zero from mmap(). */
+    if (total <= ARENA_MAX_SIZE && 
+        arena->free_list[arena_class (total)] == NULL)
+    {
+        return mem_arena_alloc (arena, total);
+    }
+
+    temp = mem_arena_alloc (arena, total);
+    mem_memset (temp, 0, total);
+
+    return temp;
+}
+
+void *mem_arena_realloc (
+    mem_arena_t *arena, void *ptr, size_t old_size, size_t size)
+{
+    void *temp;
+
+    if (ptr == NULL)
+        return mem_arena_alloc (arena, size);
+
+    if (old_size > ARENA_MAX_SIZE)
+    {
+        arena_large_t *large;
+
+        if (size <= ARENA_MAX_SIZE)
+        {
+            temp = mem_arena_alloc (arena, size);
+            mem_memcpy (temp, ptr, size);
+            mem_arena_free (arena, ptr, old_size);
+            return temp;
+        }
+
+        large = arena_unlink_large (arena, ptr);
+        large = (arena_large_t *)
+            mem_realloc (large, sizeof (arena_large_t) + size);
+        large->prev = NULL;
+        large->next = arena->large;
+        if (arena->large != NULL)
+            arena->large->prev = large;
+        arena->large = large;
+
+        return large + 1;
+    }
+
+    /* It already fits in its size class. */
+    if (size <= arena_class_size (arena_class (old_size)))
+        return ptr;
+
+    /* Grow in place if it was the last memory carved from the block. */
+    if (size <= ARENA_MAX_SIZE && 
+        (char *)ptr + arena_class_size (arena_class (old_size)) == arena->pos &&
+        (char *)ptr + arena_class_size (arena_class (size)) <= arena->end)
+    {
+        arena->pos = (char *)ptr + arena_class_size (arena_class (size));
+        return ptr;
+    }
+
+    temp = mem_arena_alloc (arena, size);
+    mem_memcpy (temp, ptr, old_size);
+    mem_arena_free (arena, ptr, old_size);
+
+    return temp;
+}
+
+void mem_arena_free (mem_arena_t *arena, void *ptr, size_t size)
+{
+    arena_free_t *entry = (arena_free_t *)ptr;
+    int c;
+
+    if (ptr == NULL)
+        return;
+
+    if (size > ARENA_MAX_SIZE)
+    {
+        free (arena_unlink_large (arena, ptr));
+        return;
+    }
+
+    c = arena_class (size);
+    entry->next = arena->free_list[c];
+    arena->free_list[c] = entry;
+}
+
+size_t mem_arena_size (size_t size)
+{
+    if (size > ARENA_MAX_SIZE)
+        return size;
+
+    return arena_class_size (arena_class (size));
+}
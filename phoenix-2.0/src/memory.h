@@ -37,4 +37,25 @@ inline void *mem_memcpy (void *dest, const void *src, size_t size);
 inline void *mem_memset (void *s, int c, size_t n);
 inline void mem_free (void *ptr);
 
+/* Arena for the allocations of a single thread. Memory is carved out of 
+ * large blocks: requests are rounded up to size classes, and 
+ * freed memory is kept on a free list per class for reuse by the same 
+ * arena. Larger requests get memory of their own. Everything is released 
+ * at once by mem_arena_destroy(), so memory need not be freed piece by 
+ * piece. An arena must not be used by two threads at the same time. 
+ * Callers pass the size of the memory they free or reallocate.
+ */
+typedef struct mem_arena_t mem_arena_t;
+
+mem_arena_t *mem_arena_create (void);
+void mem_arena_destroy (mem_arena_t *arena);
+void *mem_arena_alloc (mem_arena_t *arena, size_t size);
+void *mem_arena_calloc (mem_arena_t *arena, size_t num, size_t size);
+void *mem_arena_realloc (
+    mem_arena_t *arena, void *ptr, size_t old_size, size_t size);
+void mem_arena_free (mem_arena_t *arena, void *ptr, size_t size);
+
+/* Returns the number of bytes actually set aside for a request of size. */
+size_t mem_arena_size (size_t size);
+
 #endif // MEMORY_H_
@@ -27,6 +27,11 @@
 #ifndef STRUCT_H_
 #define STRUCT_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
+/* Chunk of values. array holds the pointers emitted, or copies of the 
+   values themselves if the job sets value_size. */
 typedef struct _val_t
 {
     int                 size;
@@ -35,10 +40,24 @@ typedef struct _val_t
     void                *array[];
 } val_t;
 
+/* # of bytes each value takes in array. */
+#define VAL_STRIDE(value_size) \
+    ((value_size) > 0 ? (size_t)(value_size) : sizeof (void *))
+
+/* Value i of a chunk as handed to the user: the pointer emitted, or a 
+   pointer to the copy. */
+static inline void *val_get (val_t *vals, int value_size, int i)
+{
+    if (value_size > 0)
+        return (char *)vals->array + (size_t)i * value_size;
+    return vals->array[i];
+}
+
 /* A key and an array of values associated with it. */
 typedef struct
 {
-    int len;
+    intptr_t len;
+    unsigned int hash;      /* Hash of the key, for the hashed store. */
     void *key;
     val_t *vals;
 } keyvals_t;
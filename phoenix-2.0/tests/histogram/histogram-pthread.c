@@ -35,6 +35,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <inttypes.h>
 #include <pthread.h>
 
 #include "stddefines.h"
@@ -46,11 +47,11 @@ int swap;      // to indicate if we need to swap byte order of header informatio
 
 typedef struct {
    unsigned char *data;
-   long data_pos;
-   long data_len;
-   int red[256];
-   int green[256];
-   int blue[256];
+   off_t data_pos;
+   off_t data_len;
+   intptr_t red[256];
+   intptr_t green[256];
+   intptr_t blue[256];
 } thread_arg_t;
 
 /* test_endianess
@@ -94,10 +95,10 @@ void swap_bytes(char *bytes, int num_bytes) {
  */
 void *calc_hist(void *arg) {
    
-   int *red;
-   int *green;
-   int *blue;
-   int i;
+   intptr_t *red;
+   intptr_t *green;
+   intptr_t *blue;
+   off_t i;
    thread_arg_t *thread_arg = (thread_arg_t *)arg;
    unsigned char *val;
    /*
@@ -143,11 +144,11 @@ int main(int argc, char *argv[]) {
    pthread_t *pid;
    pthread_attr_t attr;
    thread_arg_t *arg;
-   int red[256];
-   int green[256];
-   int blue[256];
+   intptr_t red[256];
+   intptr_t green[256];
+   intptr_t blue[256];
    int num_procs;
-   int num_per_thread;
+   off_t num_per_thread;
    int excess;
 
 
@@ -165,7 +166,7 @@ int main(int argc, char *argv[]) {
    CHECK_ERROR(fstat(fd, &finfo) < 0);
    // Memory map the file
    CHECK_ERROR((fdata = mmap(0, finfo.st_size + 1, 
-      PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == NULL);
+      PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == MAP_FAILED);
    
    if ((fdata[0] != 'B') || (fdata[1] != 'M')) {
       printf("File is not a valid bitmap file. Exiting\n");
@@ -189,17 +190,17 @@ int main(int argc, char *argv[]) {
       swap_bytes((char *)(data_pos), sizeof(*data_pos));
    }
    
-   int imgdata_bytes = (int)finfo.st_size - (int)(*(data_pos));
-   int num_pixels = ((int)finfo.st_size - (int)(*(data_pos))) / 3;
-   printf("This file has %d bytes of image data, %d pixels\n", imgdata_bytes,
-                                                            num_pixels);
+   off_t imgdata_bytes = finfo.st_size - *data_pos;
+   off_t num_pixels = imgdata_bytes / 3;
+   printf("This file has %" PRId64 " bytes of image data, %" PRId64 " pixels\n", 
+          (int64_t)imgdata_bytes, (int64_t)num_pixels);
 
    printf("Starting pthreads histogram\n");
    
 
-   memset(&(red[0]), 0, sizeof(int) * 256);
-   memset(&(green[0]), 0, sizeof(int) * 256);
-   memset(&(blue[0]), 0, sizeof(int) * 256);
+   memset(&(red[0]), 0, sizeof(intptr_t) * 256);
+   memset(&(green[0]), 0, sizeof(intptr_t) * 256);
+   memset(&(blue[0]), 0, sizeof(intptr_t) * 256);
    
    /* Set a global scope */
    pthread_attr_init(&attr);
@@ -213,7 +214,7 @@ int main(int argc, char *argv[]) {
    CHECK_ERROR( (arg = (thread_arg_t *)calloc(sizeof(thread_arg_t), num_procs)) == NULL);
    
    /* Assign portions of the image to each thread */
-   long curr_pos = (long)(*data_pos);
+   off_t curr_pos = *data_pos;
    for (i = 0; i < num_procs; i++) {
       arg[i].data = (unsigned char *)fdata;
       arg[i].data_pos = curr_pos;
@@ -244,19 +245,19 @@ int main(int argc, char *argv[]) {
    dprintf("\n\nBlue\n");
    dprintf("----------\n\n");
    for (i = 0; i < 256; i++) {
-      dprintf("%d - %d\n", i, blue[i]);        
+      dprintf("%d - %" PRIdPTR "\n", i, blue[i]);        
    }
 
    dprintf("\n\nGreen\n");
    dprintf("----------\n\n");
    for (i = 0; i < 256; i++) {
-      dprintf("%d - %d\n", i, green[i]);        
+      dprintf("%d - %" PRIdPTR "\n", i, green[i]);        
    }
    
    dprintf("\n\nRed\n");
    dprintf("----------\n\n");
    for (i = 0; i < 256; i++) {
-      dprintf("%d - %d\n", i, red[i]);        
+      dprintf("%d - %" PRIdPTR "\n", i, red[i]);        
    }
 
    CHECK_ERROR(munmap(fdata, finfo.st_size + 1) < 0);
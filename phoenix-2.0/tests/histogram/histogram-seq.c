@@ -35,6 +35,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <inttypes.h>
 
 #include "stddefines.h"
 
@@ -81,14 +82,14 @@ void swap_bytes(char *bytes, int num_bytes) {
 
 int main(int argc, char *argv[]) {
       
-   int i;
+   off_t i;
    int fd;
    char *fdata;
    struct stat finfo;
    char * fname;
-   int red[256];
-   int green[256];
-   int blue[256];
+   intptr_t red[256];
+   intptr_t green[256];
+   intptr_t blue[256];
 
 
    // Make sure a filename is specified
@@ -105,7 +106,7 @@ int main(int argc, char *argv[]) {
    CHECK_ERROR(fstat(fd, &finfo) < 0);
    // Memory map the file
    CHECK_ERROR((fdata = mmap(0, finfo.st_size + 1, 
-      PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == NULL);
+      PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == MAP_FAILED);
    
    if ((fdata[0] != 'B') || (fdata[1] != 'M')) {
       printf("File is not a valid bitmap file. Exiting\n");
@@ -129,16 +130,16 @@ int main(int argc, char *argv[]) {
       swap_bytes((char *)(data_pos), sizeof(*data_pos));
    }
    
-   int imgdata_bytes = (int)finfo.st_size - (int)(*(data_pos));
-   printf("This file has %d bytes of image data, %d pixels\n", imgdata_bytes,
-                                                            imgdata_bytes / 3);
+   off_t imgdata_bytes = finfo.st_size - *data_pos;
+   printf("This file has %" PRId64 " bytes of image data, %" PRId64 " pixels\n", 
+          (int64_t)imgdata_bytes, (int64_t)imgdata_bytes / 3);
                                                             
    printf("Starting sequential histogram\n");                                                            
 
    
-   memset(&(red[0]), 0, sizeof(int) * 256);
-   memset(&(green[0]), 0, sizeof(int) * 256);
-   memset(&(blue[0]), 0, sizeof(int) * 256);
+   memset(&(red[0]), 0, sizeof(intptr_t) * 256);
+   memset(&(green[0]), 0, sizeof(intptr_t) * 256);
+   memset(&(blue[0]), 0, sizeof(intptr_t) * 256);
    
    for (i=*data_pos; i < finfo.st_size; i+=3) {      
       unsigned char *val = (unsigned char *)&(fdata[i]);
@@ -154,19 +155,19 @@ int main(int argc, char *argv[]) {
    dprintf("\n\nBlue\n");
    dprintf("----------\n\n");
    for (i = 0; i < 256; i++) {
-      dprintf("%d - %d\n", i, blue[i]);        
+      dprintf("%d - %" PRIdPTR "\n", (int)i, blue[i]);        
    }
    
    dprintf("\n\nGreen\n");
    dprintf("----------\n\n");
    for (i = 0; i < 256; i++) {
-      dprintf("%d - %d\n", i, green[i]);        
+      dprintf("%d - %" PRIdPTR "\n", (int)i, green[i]);        
    }
    
    dprintf("\n\nRed\n");
    dprintf("----------\n\n");
    for (i = 0; i < 256; i++) {
-      dprintf("%d - %d\n", i, red[i]);        
+      dprintf("%d - %" PRIdPTR "\n", (int)i, red[i]);        
    }
 
    CHECK_ERROR(munmap(fdata, finfo.st_size + 1) < 0);
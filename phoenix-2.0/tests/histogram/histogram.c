@@ -45,9 +45,9 @@
 
 
 int swap;        // to indicate if we need to swap byte order of header information
-short red_keys[256];
-short green_keys[256];
-short blue_keys[256];
+uint32_t red_keys[256];
+uint32_t green_keys[256];
+uint32_t blue_keys[256];
 
 /* test_endianess
  *
@@ -84,33 +84,14 @@ void swap_bytes(char *bytes, int num_bytes) {
     }
 }
 
-/* myshortcmp
- * Comparison function
- */
-int myshortcmp(const void *s1, const void *s2)
-{    
-    short val1 = *((short *)s1);
-    short val2 = *((short *)s2);
-    
-    if (val1 < val2) {
-        return -1;
-    }
-    else if (val1 > val2) {
-        return 1;
-    }
-    else {
-        return 0;
-    }
-}
-
 /** hist_map()
  * Map function that computes the histogram values for the portion
  * of the image assigned to the map task
  */
 void hist_map(map_args_t *args) 
 {
-    int i;
-    short *key;
+    intptr_t i;
+    uint32_t *key;
     unsigned char *val;
     intptr_t red[256];
     intptr_t green[256];
@@ -140,17 +121,17 @@ void hist_map(map_args_t *args)
     {
         if (blue[i] > 0) {
             key = &(blue_keys[i]);
-            emit_intermediate((void *)key, (void *)blue[i], (int)sizeof(short));
+            emit_intermediate((void *)key, &blue[i], (int)sizeof(uint32_t));
         }
         
         if (green[i] > 0) {
             key = &(green_keys[i]);
-            emit_intermediate((void *)key, (void *)green[i], (int)sizeof(short));
+            emit_intermediate((void *)key, &green[i], (int)sizeof(uint32_t));
         }
         
         if (red[i] > 0) {
             key = &(red_keys[i]);
-            emit_intermediate((void *)key, (void *)red[i], (int)sizeof(short));
+            emit_intermediate((void *)key, &red[i], (int)sizeof(uint32_t));
         }
     }
 }
@@ -160,38 +141,41 @@ void hist_map(map_args_t *args)
  */
 void hist_reduce(void *key_in, iterator_t *itr)
 {
-    short *key = (short *)key_in;
-    void *val;
+    uint32_t *key = (uint32_t *)key_in;
+    intptr_t *vals;
     intptr_t sum = 0;
+    int i, len;
 
     assert(key);
     assert(itr);
     
     /* dprintf("For key %hd, there are %d vals\n", *key, vals_len); */
     
-    while (iter_next (itr, &val))
+    while ((len = iter_next_values (itr, (void **)&vals)) > 0)
     {
-        sum += (intptr_t)val;
+        for (i = 0; i < len; i++)
+            sum += vals[i];
     }
 
     emit(key, (void *)sum);
 }
 
-void *hist_combiner (iterator_t *itr)
+/** hist_combine_*()
+ * In-place combiner keeping the count of each location in an intptr_t
+ */
+void hist_combine_init(void *acc)
 {
-    void *val;
-    intptr_t sum = 0;
+    *(intptr_t *)acc = 0;
+}
 
-    assert(itr);
-    
-    /* dprintf("For key %hd, there are %d vals\n", *key, vals_len); */
-    
-    while (iter_next (itr, &val))
-    {
-        sum += (intptr_t)val;
-    }
+void hist_combine_accumulate(void *acc, void *val)
+{
+    *(intptr_t *)acc += *(intptr_t *)val;
+}
 
-    return (void *)sum;
+void hist_combine_merge(void *acc, const void *other)
+{
+    *(intptr_t *)acc += *(const intptr_t *)other;
 }
 
 int main(int argc, char *argv[]) {
@@ -224,14 +208,14 @@ int main(int argc, char *argv[]) {
 #ifndef NO_MMAP
     // Memory map the file
     CHECK_ERROR((fdata = mmap(0, finfo.st_size + 1, 
-        PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == NULL);
+        PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == MAP_FAILED);
 #else
-    int ret;
+    ssize_t ret;
         
     fdata = (char *)malloc (finfo.st_size);
     CHECK_ERROR (fdata == NULL);
 
-    ret = read (fd, fdata, finfo.st_size);
+    ret = read_all (fd, fdata, finfo.st_size);
     CHECK_ERROR (ret != finfo.st_size);
 #endif
 
@@ -257,9 +241,9 @@ int main(int argc, char *argv[]) {
         swap_bytes((char *)(data_pos), sizeof(*data_pos));
     }
     
-    int imgdata_bytes = (int)finfo.st_size - (int)(*(data_pos));
-    printf("This file has %d bytes of image data, %d pixels\n", imgdata_bytes,
-                                                                                imgdata_bytes / 3);
+    off_t imgdata_bytes = finfo.st_size - *data_pos;
+    printf("This file has %" PRId64 " bytes of image data, %" PRId64 " pixels\n", 
+           (int64_t)imgdata_bytes, (int64_t)imgdata_bytes / 3);
     
     // We use this global variable arrays to store the "key" for each histogram
     // bucket. This is to prevent memory leaks in the mapreduce scheduler                                                                                
@@ -277,9 +261,13 @@ int main(int argc, char *argv[]) {
     map_reduce_args.task_data = &(fdata[*data_pos]);    //&hist_data;
     map_reduce_args.map = hist_map;
     map_reduce_args.reduce = hist_reduce;
-    map_reduce_args.combiner = hist_combiner;
+    map_reduce_args.combiner_init = hist_combine_init;
+    map_reduce_args.combiner_accumulate = hist_combine_accumulate;
+    map_reduce_args.combiner_merge = hist_combine_merge;
+    map_reduce_args.value_size = sizeof(intptr_t);
+    map_reduce_args.use_incremental_combiner = true;
     map_reduce_args.splitter = NULL; //hist_splitter;
-    map_reduce_args.key_cmp = myshortcmp;
+    map_reduce_args.key_type = KEY_TYPE_U32;
     
     map_reduce_args.unit_size = 3;  // 3 bytes per pixel
     map_reduce_args.partition = NULL; // use default
@@ -323,7 +311,7 @@ int main(int argc, char *argv[]) {
     for (i = 0; i < hist_vals.length; i++)
     {
         keyval_t * curr = &((keyval_t *)hist_vals.data)[i];
-        pix_val = *((short *)curr->key);
+        pix_val = *((uint32_t *)curr->key);
         freq = (intptr_t)curr->val;
         
         if (pix_val - prev > 700) {
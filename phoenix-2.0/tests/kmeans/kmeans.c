@@ -259,7 +259,7 @@ void find_clusters(int *points, keyval_t *means, int *clusters, int size)
  *  
  * Assigns one or more points to each map task
  */
-int kmeans_splitter(void *data_in, int req_units, map_args_t *out)
+int kmeans_splitter(void *data_in, intptr_t req_units, map_args_t *out)
 {
     kmeans_data_t *kmeans_data = (kmeans_data_t *)data_in;
     kmeans_map_data_t *out_data;
@@ -405,7 +405,7 @@ int main(int argc, char **argv)
     map_reduce_args.unit_size = kmeans_data.unit_size;
     map_reduce_args.partition = NULL; // use default
     map_reduce_args.result = &kmeans_vals;
-    map_reduce_args.data_size = (num_points + num_means) * dim * sizeof(int);  
+    map_reduce_args.data_size = (off_t)(num_points + num_means) * dim * sizeof(int);  
     map_reduce_args.L1_cache_size = atoi(GETENV("MR_L1CACHESIZE"));//1024 * 8;
     map_reduce_args.num_map_threads = atoi(GETENV("MR_NUMTHREADS"));//8;
     map_reduce_args.num_reduce_threads = atoi(GETENV("MR_NUMTHREADS"));//16;
@@ -49,7 +49,7 @@ typedef struct
 {
     pthread_t tid;
     POINT_T *points;
-    int num_elems;
+    long long num_elems;
     long long SX;
     long long SY; 
     long long SXX;
@@ -63,7 +63,7 @@ typedef struct
 void *linear_regression_pthread(void *args_in) 
 {
    lreg_args* args =(lreg_args*)args_in;
-   int i;
+   long long i;
 
    args->SX = 0;
    args->SXX = 0;
@@ -93,7 +93,8 @@ int main(int argc, char *argv[])
    char * fname;
    struct stat finfo;
     
-   int req_units, num_threads, num_procs, i;
+   long long req_units;
+   int num_threads, num_procs, i;
    pthread_attr_t attr;
    lreg_args* tid_args;
 
@@ -113,7 +114,7 @@ int main(int argc, char *argv[])
    CHECK_ERROR(fstat(fd, &finfo) < 0);
    // Memory map the file
    CHECK_ERROR((fdata = mmap(0, finfo.st_size + 1, 
-      PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == NULL);
+      PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == MAP_FAILED);
 
    CHECK_ERROR((num_procs = sysconf(_SC_NPROCESSORS_ONLN)) <= 0);
    printf("The number of processors is %d\n\n", num_procs);
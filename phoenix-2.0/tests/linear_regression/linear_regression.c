@@ -55,18 +55,8 @@ enum {
     KEY_SXY,
 };
 
-static int intkeycmp(const void *v1, const void *v2)
-{
-    intptr_t i1 = (intptr_t)v1;
-    intptr_t i2 = (intptr_t)v2;
-
-    if (i1 < i2) 
-         return 1;
-    else if (i1 > i2) 
-         return -1;
-    else 
-         return 0;
-}
+/* Keys, pointed to by the map function. */
+static uint32_t keys[] = { KEY_SX, KEY_SY, KEY_SXX, KEY_SYY, KEY_SXY };
 
 /** sort_map()
  *  Sorts based on the val output of wordcount
@@ -76,18 +66,12 @@ static void linear_regression_map(map_args_t *args)
     assert(args);
     
     POINT_T *data = (POINT_T *)args->data;
-    int i;
+    intptr_t i;
 
     assert(data);
 
-    long long * SX  = CALLOC(sizeof(long long), 1);
-    long long * SXX = CALLOC(sizeof(long long), 1);
-    long long * SY  = CALLOC(sizeof(long long), 1);
-    long long * SYY = CALLOC(sizeof(long long), 1);
-    long long * SXY = CALLOC(sizeof(long long), 1);
-
     register long long x, y;
-    register long long sx = 0, sxx = 0, sy = 0, syy = 0, sxy = 0;
+    long long sx = 0, sxx = 0, sy = 0, syy = 0, sxy = 0;
 
     for (i = 0; i < args->length; i++)
     {
@@ -102,22 +86,12 @@ static void linear_regression_map(map_args_t *args)
         sxy += x * y;
     }
 
-    *SX = sx;
-    *SXX = sxx;
-    *SY = sy;
-    *SYY = syy;
-    *SXY = sxy;
-
-    emit_intermediate((void*)KEY_SX,  (void*)SX,  sizeof(void*)); 
-    emit_intermediate((void*)KEY_SXX, (void*)SXX, sizeof(void*)); 
-    emit_intermediate((void*)KEY_SY,  (void*)SY,  sizeof(void*)); 
-    emit_intermediate((void*)KEY_SYY, (void*)SYY, sizeof(void*)); 
-    emit_intermediate((void*)KEY_SXY, (void*)SXY, sizeof(void*)); 
-}
-
-static int linear_regression_partition(int reduce_tasks, void* key, int key_size)
-{
-    return default_partition(reduce_tasks, (void *)&key, key_size);
+    /* The sums are copied, see value_size. */
+    emit_intermediate(&keys[KEY_SX],  (void*)&sx,  sizeof(uint32_t)); 
+    emit_intermediate(&keys[KEY_SXX], (void*)&sxx, sizeof(uint32_t)); 
+    emit_intermediate(&keys[KEY_SY],  (void*)&sy,  sizeof(uint32_t)); 
+    emit_intermediate(&keys[KEY_SYY], (void*)&syy, sizeof(uint32_t)); 
+    emit_intermediate(&keys[KEY_SXY], (void*)&sxy, sizeof(uint32_t)); 
 }
 
 /** linear_regression_reduce()
@@ -127,36 +101,37 @@ static void linear_regression_reduce(void *key_in, iterator_t *itr)
 {
     long long *sumptr = CALLOC(sizeof(long long), 1);
     register long long sum = 0;
-    long long *val;
+    long long *vals;
+    int i, len;
 
     assert (itr);
 
-    while (iter_next (itr, (void **)&val))
+    while ((len = iter_next_values (itr, (void **)&vals)) > 0)
     {
-        sum += *val;
-        free (val);
+        for (i = 0; i < len; i++)
+            sum += vals[i];
     }
 
     *sumptr = sum;
     emit(key_in, (void *)sumptr);
 }
 
-static void *linear_regression_combiner (iterator_t *itr)
+/** linear_regression_combine_*()
+ *  In-place combiner adding up the sums
+ */
+static void linear_regression_combine_init (void *acc)
 {
-    long long *sumptr = CALLOC(sizeof(long long), 1);
-    register long long sum = 0;
-    long long *val;
-
-    assert(itr);
+    *(long long *)acc = 0;
+}
 
-    while (iter_next (itr, (void **)&val))
-    {
-        sum += *val;
-        free (val);
-    }
+static void linear_regression_combine_accumulate (void *acc, void *val)
+{
+    *(long long *)acc += *(long long *)val;
+}
 
-    *sumptr = sum;
-    return (void *)sumptr;
+static void linear_regression_combine_merge (void *acc, const void *other)
+{
+    *(long long *)acc += *(const long long *)other;
 }
 
 int main(int argc, char *argv[]) {
@@ -191,14 +166,14 @@ int main(int argc, char *argv[]) {
 #ifndef NO_MMAP
     // Memory map the file
     CHECK_ERROR((fdata = mmap(0, finfo.st_size + 1, 
-        PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == NULL);
+        PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == MAP_FAILED);
 #else
-    uint64_t ret;
+    ssize_t ret;
 
     fdata = (char *)malloc (finfo.st_size);
     CHECK_ERROR (fdata == NULL);
 
-    ret = read (fd, fdata, finfo.st_size);
+    ret = read_all (fd, fdata, finfo.st_size);
     CHECK_ERROR (ret != finfo.st_size);
 #endif
 
@@ -210,11 +185,14 @@ int main(int argc, char *argv[]) {
     map_reduce_args.task_data = fdata; // Array to regress
     map_reduce_args.map = linear_regression_map;
     map_reduce_args.reduce = linear_regression_reduce; // Identity Reduce
-    map_reduce_args.combiner = linear_regression_combiner;
+    map_reduce_args.combiner_init = linear_regression_combine_init;
+    map_reduce_args.combiner_accumulate = linear_regression_combine_accumulate;
+    map_reduce_args.combiner_merge = linear_regression_combine_merge;
+    map_reduce_args.value_size = sizeof(long long);
     map_reduce_args.splitter = NULL; // Array splitter;
-    map_reduce_args.key_cmp = intkeycmp;
+    map_reduce_args.key_type = KEY_TYPE_U32;
     map_reduce_args.unit_size = sizeof(POINT_T);
-    map_reduce_args.partition = linear_regression_partition; 
+    map_reduce_args.partition = NULL; // use default
     map_reduce_args.result = &final_vals;
     map_reduce_args.data_size = finfo.st_size - (finfo.st_size % map_reduce_args.unit_size);
     map_reduce_args.L1_cache_size = atoi(GETENV("MR_L1CACHESIZE"));//1024 * 512;
@@ -253,7 +231,7 @@ int main(int argc, char *argv[]) {
     for (i = 0; i < final_vals.length; i++)
     {
         keyval_t * curr = &final_vals.data[i];
-        switch ((intptr_t)curr->key)
+        switch (*(uint32_t *)curr->key)
         {
         case KEY_SX:
              SX_ll = (*(long long*)curr->val);
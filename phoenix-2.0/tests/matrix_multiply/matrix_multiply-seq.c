@@ -131,7 +131,7 @@ int main(int argc, char *argv[])
    CHECK_ERROR(fstat(fd_A, &finfo_A) < 0);
    // Memory map the file
    CHECK_ERROR((fdata_A= mmap(0, file_size + 1,
-      PROT_READ | PROT_WRITE, MAP_PRIVATE, fd_A, 0)) == NULL);
+      PROT_READ | PROT_WRITE, MAP_PRIVATE, fd_A, 0)) == MAP_FAILED);
 
    // Read in the file
    CHECK_ERROR((fd_B = open(fname_B,O_RDONLY)) < 0);
@@ -139,7 +139,7 @@ int main(int argc, char *argv[])
    CHECK_ERROR(fstat(fd_B, &finfo_B) < 0);
    // Memory map the file
    CHECK_ERROR((fdata_B= mmap(0, file_size + 1,
-      PROT_READ | PROT_WRITE, MAP_PRIVATE, fd_B, 0)) == NULL);
+      PROT_READ | PROT_WRITE, MAP_PRIVATE, fd_B, 0)) == MAP_FAILED);
    
    // Create File
    CHECK_ERROR((fd_out = open(fname_out,O_CREAT | O_RDWR,S_IRWXU)) < 0);
@@ -147,7 +147,7 @@ int main(int argc, char *argv[])
    CHECK_ERROR(ftruncate(fd_out, file_size) < 0);
    // Memory Map
    CHECK_ERROR((fdata_out= mmap(0, file_size + 1,
-      PROT_READ | PROT_WRITE, MAP_PRIVATE, fd_out, 0)) == NULL);
+      PROT_READ | PROT_WRITE, MAP_PRIVATE, fd_out, 0)) == MAP_FAILED);
 
    // Setup splitter args
    mm_data_t mm_data;
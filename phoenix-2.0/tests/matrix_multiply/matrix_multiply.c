@@ -83,7 +83,7 @@ int myintcmp(const void *v1, const void *v2)
 /** matrixmul_splitter()
  *  Assign a set of rows of the output matrix to each map task
  */
-int matrixmult_splitter(void *data_in, int req_units, map_args_t *out)
+int matrixmult_splitter(void *data_in, intptr_t req_units, map_args_t *out)
 {
     /* Make a copy of the mm_data structure */
     mm_data_t * data = (mm_data_t *)data_in; 
@@ -157,7 +157,8 @@ void matrixmult_map(map_args_t *args)
 
     while(row_count < args->length)
     {
-        a_ptr = data->matrix_A + (data->row_num + row_count)*data->matrix_len;
+        a_ptr = data->matrix_A + 
+            (size_t)(data->row_num + row_count)*data->matrix_len;
 
         for(i=0; i < data->matrix_len ; i++)
         {
@@ -171,7 +172,7 @@ void matrixmult_map(map_args_t *args)
             }
             x_loc = (data->row_num + row_count);
             y_loc = i;
-            data->output[x_loc*data->matrix_len + i] = value;
+            data->output[(size_t)x_loc*data->matrix_len + i] = value;
             /* fflush(stdout); */
         }
         /* dprintf("%d Loop\n",data->row_num); */
@@ -189,7 +190,8 @@ int main(int argc, char *argv[]) {
 
     final_data_t mm_vals;
     int i,j, create_files;
-    int fd_A, fd_B, file_size;
+    int fd_A, fd_B;
+    size_t file_size;
     char * fdata_A, *fdata_B;
     int matrix_len, row_block_len;
     struct stat finfo_A, finfo_B;
@@ -212,9 +214,9 @@ int main(int argc, char *argv[]) {
     fname_A = "matrix_file_A.txt";
     fname_B = "matrix_file_B.txt";
     CHECK_ERROR ( (matrix_len = atoi(argv[1])) < 0);
-    file_size = ((matrix_len*matrix_len))*sizeof(int);
+    file_size = ((size_t)matrix_len*matrix_len)*sizeof(int);
 
-    fprintf(stderr, "***** file size is %d\n", file_size);
+    fprintf(stderr, "***** file size is %zu\n", file_size);
 
     if(argv[2] == NULL)
         row_block_len = 1;
@@ -273,15 +275,15 @@ int main(int argc, char *argv[]) {
 #ifndef NO_MMAP
     // Memory map the file
     CHECK_ERROR((fdata_A= mmap(0, file_size + 1,
-        PROT_READ | PROT_WRITE, MAP_PRIVATE, fd_A, 0)) == NULL);
+        PROT_READ | PROT_WRITE, MAP_PRIVATE, fd_A, 0)) == MAP_FAILED);
 #else
-    int ret;
+    ssize_t ret;
 
     fdata_A = (char *)malloc (file_size);
     CHECK_ERROR (fdata_A == NULL);
 
-    ret = read (fd_A, fdata_A, file_size);
-    CHECK_ERROR (ret != file_size);
+    ret = read_all (fd_A, fdata_A, file_size);
+    CHECK_ERROR (ret != (ssize_t)file_size);
 #endif
 
     // Read in the file
@@ -291,13 +293,13 @@ int main(int argc, char *argv[]) {
 #ifndef NO_MMAP
     // Memory map the file
     CHECK_ERROR((fdata_B= mmap(0, file_size + 1,
-        PROT_READ | PROT_WRITE, MAP_PRIVATE, fd_B, 0)) == NULL);
+        PROT_READ | PROT_WRITE, MAP_PRIVATE, fd_B, 0)) == MAP_FAILED);
 #else
     fdata_B = (char *)malloc (file_size);
     CHECK_ERROR (fdata_B == NULL);
 
-    ret = read (fd_B, fdata_B, file_size);
-    CHECK_ERROR (ret != file_size);
+    ret = read_all (fd_B, fdata_B, file_size);
+    CHECK_ERROR (ret != (ssize_t)file_size);
 #endif
 
     // Setup splitter args
@@ -309,7 +311,7 @@ int main(int argc, char *argv[]) {
     mm_data.matrix_B = NULL;
     mm_data.row_num = 0;
 
-    mm_data.output = (int*)malloc(matrix_len*matrix_len*sizeof(int));
+    mm_data.output = (int*)malloc(file_size);
     
     mm_data.matrix_A = matrix_A_ptr = ((int *)fdata_A);
     mm_data.matrix_B = matrix_B_ptr = ((int *)fdata_B);
@@ -361,9 +363,10 @@ int main(int argc, char *argv[]) {
     //dprintf("\n");
     //dprintf("The length of the final output is %d\n",mm_vals.length );
     int sum = 0;
-    for(i=0;i<matrix_len*matrix_len;i++)
+    size_t k;
+    for(k=0;k<(size_t)matrix_len*matrix_len;k++)
     {
-          sum += mm_data.output[i];
+          sum += mm_data.output[k];
     }
     dprintf ("MatrixMult: total sum is %d\n", sum);
     //dprintf("\n");
@@ -162,7 +162,7 @@ int mymeancmp(const void *v1, const void *v2)
  *  
  * Assigns one or more points to each map task
  */
-int pca_mean_splitter(void *data_in, int req_units, map_args_t *out)
+int pca_mean_splitter(void *data_in, intptr_t req_units, map_args_t *out)
 {
     assert(data_in);
     assert(out);
@@ -250,7 +250,7 @@ int mycovcmp(const void *v1, const void *v2)
 /** pca_cov_splitter()
  *  Splitter function for computing the covariance
  */
-int pca_cov_splitter(void *data_in, int req_units, map_args_t *out) 
+int pca_cov_splitter(void *data_in, intptr_t req_units, map_args_t *out) 
 {
     assert(data_in);
     assert(out);
@@ -416,7 +416,7 @@ int main(int argc, char **argv)
     map_reduce_args.unit_size = pca_data.unit_size;
     map_reduce_args.partition = NULL; // use default
     map_reduce_args.result = &pca_mean_vals;
-    map_reduce_args.data_size = num_rows * num_cols * sizeof(int);  
+    map_reduce_args.data_size = (off_t)num_rows * num_cols * sizeof(int);  
     map_reduce_args.L1_cache_size = atoi(GETENV("MR_L1CACHESIZE"));//1024 * 1024 * 16;
     map_reduce_args.num_map_threads = atoi(GETENV("MR_NUMTHREADS"));//8;
     map_reduce_args.num_reduce_threads = atoi(GETENV("MR_NUMTHREADS"));//16;
@@ -464,7 +464,7 @@ int main(int argc, char **argv)
     map_reduce_args.result = &pca_cov_vals;
     // data size is number of elements that need to be calculated in a cov matrix
     // multiplied by the size of two rows for each element
-    map_reduce_args.data_size = ((((num_rows * num_rows) - num_rows)/2) + num_rows) * pca_data.unit_size;  
+    map_reduce_args.data_size = (((((off_t)num_rows * num_rows) - num_rows)/2) + num_rows) * pca_data.unit_size;  
     map_reduce_args.L1_cache_size = atoi(GETENV("MR_L1CACHESIZE"));//1024 * 1024 * 16;
     map_reduce_args.num_map_threads = atoi(GETENV("MR_NUMTHREADS"));//8;
     map_reduce_args.num_reduce_threads = atoi(GETENV("MR_NUMTHREADS"));//16;
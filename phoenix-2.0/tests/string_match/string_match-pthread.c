@@ -50,9 +50,9 @@
 #define OFFSET 5
 
 typedef struct {
-  int keys_file_len;
-  int encrypted_file_len;
-  long bytes_comp;
+  off_t keys_file_len;
+  off_t encrypted_file_len;
+  off_t bytes_comp;
   char * keys_file;
   char * encrypt_file;
 } str_data_t;
@@ -154,7 +154,7 @@ void string_match_splitter(void *data_in)
     pthread_attr_init(&attr);
     pthread_attr_setscope(&attr, PTHREAD_SCOPE_SYSTEM);
 
-    int req_bytes = data->keys_file_len / num_procs;
+    off_t req_bytes = data->keys_file_len / num_procs;
 
     str_map_data_t *map_data = (str_map_data_t*)malloc(sizeof(str_map_data_t) 
                                                                                         * num_procs);
@@ -167,7 +167,7 @@ void string_match_splitter(void *data_in)
 	    map_data[i].TID = i;
 	    	    
 	    /* Assign the required number of bytes */	    
-	    int available_bytes = data->keys_file_len - data->bytes_comp;
+	    off_t available_bytes = data->keys_file_len - data->bytes_comp;
 	    if(available_bytes < 0)
 		    available_bytes = 0;
 
@@ -176,18 +176,18 @@ void string_match_splitter(void *data_in)
 
 
 	    char* final_ptr = map_data[i].keys_file + out[i].length;
-	    int counter = data->bytes_comp + out[i].length;
+	    off_t counter = data->bytes_comp + out[i].length;
 
 		 /* make sure we end at a word */
-	    while(counter <= data->keys_file_len && *final_ptr != '\n'
+	    while(counter < data->keys_file_len && *final_ptr != '\n'
 			 && *final_ptr != '\r' && *final_ptr != '\0')
 	    {
 		    counter++;
 		    final_ptr++;
 	    }
-	    if(*final_ptr == '\r')
+	    if(counter < data->keys_file_len && *final_ptr == '\r')
 		    counter+=2;
-	    else if(*final_ptr == '\n')
+	    else if(counter < data->keys_file_len && *final_ptr == '\n')
 		    counter++;
 
 	    out[i].length = counter - data->bytes_comp;
@@ -222,15 +222,23 @@ void *string_match_map(void *args)
     
     str_map_data_t* data_in = (str_map_data_t*)( ((map_args_t*)args)->data);
 
-	int key_len, total_len = 0;
+	int key_len;
+	intptr_t total_len = 0;
 	char * key_file = data_in->keys_file;
 	char * cur_word = malloc(MAX_REC_LEN);
 	char * cur_word_final = malloc(MAX_REC_LEN);
 	bzero(cur_word, MAX_REC_LEN);
 	bzero(cur_word_final, MAX_REC_LEN);
 
-	while( (total_len < ((map_args_t*)args)->length) && ((key_len = getnextline(cur_word, MAX_REC_LEN, key_file)) >= 0))
+	while(total_len < ((map_args_t*)args)->length)
      {
+		/* Do not read past the end of the task, which may end the file. */
+		intptr_t left = ((map_args_t*)args)->length - total_len;
+		key_len = getnextline(cur_word, 
+		    (left < MAX_REC_LEN) ? (int)left + 1 : MAX_REC_LEN, key_file);
+		if(key_len < 0)
+		    break;
+
 		compute_hashes(cur_word, cur_word_final);
 
 	    if(!strcmp(key1_final, cur_word_final))
@@ -280,7 +288,7 @@ int main(int argc, char *argv[]) {
     CHECK_ERROR(fstat(fd_encrypt, &finfo_encrypt) < 0);
     // Memory map the file
     CHECK_ERROR((fdata_encrypt= mmap(0, finfo_encrypt.st_size + 1,
-        PROT_READ | PROT_WRITE, MAP_PRIVATE, fd_encrypt, 0)) == NULL);*/
+        PROT_READ | PROT_WRITE, MAP_PRIVATE, fd_encrypt, 0)) == MAP_FAILED);*/
 
     // Read in the file
     CHECK_ERROR((fd_keys = open(fname_keys,O_RDONLY)) < 0);
@@ -288,7 +296,7 @@ int main(int argc, char *argv[]) {
     CHECK_ERROR(fstat(fd_keys, &finfo_keys) < 0);
     // Memory map the file
     CHECK_ERROR((fdata_keys= mmap(0, finfo_keys.st_size + 1,
-        PROT_READ | PROT_WRITE, MAP_PRIVATE, fd_keys, 0)) == NULL);
+        PROT_READ | PROT_WRITE, MAP_PRIVATE, fd_keys, 0)) == MAP_FAILED);
 
     // Setup splitter args
 
@@ -46,9 +46,9 @@
 #define OFFSET 5
 
 typedef struct {
-  int keys_file_len;
-  int encrypted_file_len;
-  long bytes_comp;
+  off_t keys_file_len;
+  off_t encrypted_file_len;
+  off_t bytes_comp;
   char * keys_file;
   char * encrypt_file;
   char* salt;
@@ -184,7 +184,7 @@ int main(int argc, char *argv[])
    CHECK_ERROR(fstat(fd_encrypt, &finfo_encrypt) < 0);
    // Memory map the file
    CHECK_ERROR((fdata_encrypt= mmap(0, finfo_encrypt.st_size + 1,
-      PROT_READ | PROT_WRITE, MAP_PRIVATE, fd_encrypt, 0)) == NULL);*/
+      PROT_READ | PROT_WRITE, MAP_PRIVATE, fd_encrypt, 0)) == MAP_FAILED);*/
 
    // Read in the file
    CHECK_ERROR((fd_keys = open(fname_keys,O_RDONLY)) < 0);
@@ -192,7 +192,7 @@ int main(int argc, char *argv[])
    CHECK_ERROR(fstat(fd_keys, &finfo_keys) < 0);
    // Memory map the file
    CHECK_ERROR((fdata_keys= mmap(0, finfo_keys.st_size + 1,
-      PROT_READ | PROT_WRITE, MAP_PRIVATE, fd_keys, 0)) == NULL);
+      PROT_READ | PROT_WRITE, MAP_PRIVATE, fd_keys, 0)) == MAP_FAILED);
 
    // Setup splitter args
 
@@ -49,9 +49,9 @@
 #define OFFSET 5
 
 typedef struct {
-  int keys_file_len;
-  int encrypted_file_len;
-  long bytes_comp;
+  off_t keys_file_len;
+  off_t encrypted_file_len;
+  off_t bytes_comp;
   char * keys_file;
   char * encrypt_file;
 } str_data_t;
@@ -121,7 +121,7 @@ void compute_hashes(char* word, char* final_word)
 /** string_match_splitter()
  *  Splitter Function to assign portions of the file to each map task
  */
-int string_match_splitter(void *data_in, int req_units, map_args_t *out)
+int string_match_splitter(void *data_in, intptr_t req_units, map_args_t *out)
 {
     /* Make a copy of the mm_data structure */
     str_data_t * data = (str_data_t *)data_in; 
@@ -143,8 +143,8 @@ int string_match_splitter(void *data_in, int req_units, map_args_t *out)
     }
 
     /* Assign the required number of bytes */
-    int req_bytes = req_units*DEFAULT_UNIT_SIZE;
-    int available_bytes = data->keys_file_len - data->bytes_comp;
+    off_t req_bytes = req_units*DEFAULT_UNIT_SIZE;
+    off_t available_bytes = data->keys_file_len - data->bytes_comp;
     if(available_bytes < 0)
 	    available_bytes = 0;
 
@@ -152,18 +152,18 @@ int string_match_splitter(void *data_in, int req_units, map_args_t *out)
     out->data = map_data;
 
     char* final_ptr = map_data->keys_file + out->length;
-    int counter = data->bytes_comp + out->length;
+    off_t counter = data->bytes_comp + out->length;
 
     /* make sure we end at a word */
-    while(counter <= data->keys_file_len && *final_ptr != '\n'
+    while(counter < data->keys_file_len && *final_ptr != '\n'
 		 && *final_ptr != '\r' && *final_ptr != '\0')
     {
         counter++;
         final_ptr++;
     }
-    if(*final_ptr == '\r')
+    if(counter < data->keys_file_len && *final_ptr == '\r')
         counter+=2;
-    else if(*final_ptr == '\n')
+    else if(counter < data->keys_file_len && *final_ptr == '\n')
         counter++;
 
     out->length = counter - data->bytes_comp;
@@ -190,15 +190,23 @@ void string_match_map(map_args_t *args)
     
     str_map_data_t* data_in = (str_map_data_t*)(args->data);
 
-    int key_len, total_len = 0;
+    int key_len;
+    intptr_t total_len = 0;
     char * key_file = data_in->keys_file;
     char * cur_word = malloc(MAX_REC_LEN);
     char * cur_word_final = malloc(MAX_REC_LEN);
     bzero(cur_word, MAX_REC_LEN);
     bzero(cur_word_final, MAX_REC_LEN);
 
-    while( (total_len <= args->length) && ((key_len = getnextline(cur_word, MAX_REC_LEN, key_file)) >= 0))
+    while(total_len < args->length)
     {
+        /* Do not read past the end of the task, which may end the file. */
+        intptr_t left = args->length - total_len;
+        key_len = getnextline(cur_word, 
+            (left < MAX_REC_LEN) ? (int)left + 1 : MAX_REC_LEN, key_file);
+        if(key_len < 0)
+            break;
+
         compute_hashes(cur_word, cur_word_final);
 
         if(!strcmp(key1_final, cur_word_final));
@@ -252,14 +260,14 @@ int main(int argc, char *argv[]) {
 #ifndef NO_MMAP
     // Memory map the file
     CHECK_ERROR((fdata_keys= mmap(0, finfo_keys.st_size + 1,
-        PROT_READ | PROT_WRITE, MAP_PRIVATE, fd_keys, 0)) == NULL);
+        PROT_READ | PROT_WRITE, MAP_PRIVATE, fd_keys, 0)) == MAP_FAILED);
 #else
-    int ret;
+    ssize_t ret;
 
     fdata_keys = (char *)malloc (finfo_keys.st_size);
     CHECK_ERROR (fdata_keys == NULL);
 
-    ret = read (fd_keys, fdata_keys, finfo_keys.st_size);
+    ret = read_all (fd_keys, fdata_keys, finfo_keys.st_size);
     CHECK_ERROR (ret != finfo_keys.st_size);
 #endif
 
@@ -61,7 +61,7 @@ static void mr_sort_map(map_args_t *args)
     assert(args);
     
     void *data = (void *)args->data;
-    int i;
+    intptr_t i;
 
     assert(data);
     
@@ -141,7 +141,7 @@ void mapreduce_sort(void *base, size_t num_elems, size_t width,
     get_time (&begin);
     
     char * tmp = (char *)MR_MALLOC(width * num_elems); 
-    int i;
+    intptr_t i;
     
     // Need to copy to temp array first since
     // we could be sorting array of pointers
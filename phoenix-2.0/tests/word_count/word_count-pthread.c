@@ -36,6 +36,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <inttypes.h>
 #include <pthread.h>
 
 #include "stddefines.h"
@@ -46,7 +47,7 @@
 
 typedef struct {
 	char* word;
-	int count;
+	intptr_t count;
 } wc_count_t;
 
 typedef struct {
@@ -58,7 +59,7 @@ typedef struct {
 
 typedef struct
 {
-   int length;
+   intptr_t length;
    void *data;
    int t_num;
 } t_args_t;
@@ -103,8 +104,8 @@ int wordcount_cmp(const void *v1, const void *v2)
    wc_count_t* w1 = (wc_count_t*)v1;
    wc_count_t* w2 = (wc_count_t*)v2;
 
-   int i1 = w1->count;
-   int i2 = w2->count;
+   intptr_t i1 = w1->count;
+   intptr_t i2 = w2->count;
 
    if (i1 < i2) return 1;
    else if (i1 > i2) return -1;
@@ -135,7 +136,7 @@ void wordcount_splitter(void *data_in)
    length = (int*)malloc(num_procs*sizeof(int));
    use_len = (int*)malloc(num_procs*sizeof(int));
 
-   int req_bytes = data->flen / num_procs;
+   long req_bytes = data->flen / num_procs;
 
    for(i=0; i<num_procs; i++)
    {
@@ -146,7 +147,7 @@ void wordcount_splitter(void *data_in)
       t_args_t* out = (t_args_t*)malloc(sizeof(t_args_t));
 	   out->data = &data->fdata[data->fpos];
 
-	   int available_bytes = data->flen - data->fpos;
+	   long available_bytes = data->flen - data->fpos;
 	   if(available_bytes < 0)
 		   available_bytes = 0;
       
@@ -233,7 +234,7 @@ void *wordcount_map(void *args_in)
 
    char *curr_start, curr_ltr;
    int state = NOT_IN_WORD;
-   int i;
+   intptr_t i;
    assert(args);
 
    char *data = (char *)(args->data);
@@ -421,7 +422,7 @@ int main(int argc, char *argv[]) {
    CHECK_ERROR(fstat(fd, &finfo) < 0);
    // Memory map the file
    CHECK_ERROR((fdata = mmap(0, finfo.st_size + 1, 
-      PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == NULL);
+      PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == MAP_FAILED);
    
    // Get the number of results to display
    CHECK_ERROR((disp_num = (disp_num_str == NULL) ? 
@@ -456,7 +457,7 @@ int main(int argc, char *argv[]) {
    for(i=0; i< DEFAULT_DISP_NUM && i < use_len[0] ; i++)
    {
 		wc_count_t* temp = &(words[0][i]);
-		printf("The word is %s and count is %d\n", temp->word, temp->count);
+		printf("The word is %s and count is %" PRIdPTR "\n", temp->word, temp->count);
 		//fflush(stdout);
    }
    free(use_len);
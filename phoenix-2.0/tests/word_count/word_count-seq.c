@@ -35,6 +35,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <inttypes.h>
 #include <pthread.h>
 
 #include "map_reduce.h"
@@ -46,7 +47,7 @@
 
 typedef struct {
 	char* word;
-	int count;
+	intptr_t count;
 } wc_count_t;
 
 typedef struct {
@@ -74,8 +75,8 @@ int wordcount_cmp(const void *v1, const void *v2)
    wc_count_t* w1 = (wc_count_t*)v1;
    wc_count_t* w2 = (wc_count_t*)v2;
 
-   int i1 = w1->count;
-   int i2 = w2->count;
+   intptr_t i1 = w1->count;
+   intptr_t i2 = w2->count;
 
    if (i1 < i2) return 1;
    else if (i1 > i2) return -1;
@@ -113,7 +114,7 @@ void wordcount_getword(void *args_in)
 
    char *curr_start, curr_ltr;
    int state = NOT_IN_WORD;
-   int i;
+   intptr_t i;
    assert(args);
 
    char *data = (char *)(args->data);
@@ -252,7 +253,7 @@ int main(int argc, char *argv[]) {
    CHECK_ERROR(fstat(fd, &finfo) < 0);
    // Memory map the file
    CHECK_ERROR((fdata = mmap(0, finfo.st_size + 1, 
-      PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == NULL);
+      PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == MAP_FAILED);
    
    // Get the number of results to display
    CHECK_ERROR((disp_num = (disp_num_str == NULL) ? 
@@ -275,7 +276,7 @@ int main(int argc, char *argv[]) {
    for(i=0; i< disp_num && i < use_len ; i++)
    {
 		wc_count_t* temp = &(words[i]);
-      dprintf("%s: %d\n", temp->word, temp->count);
+      dprintf("%s: %" PRIdPTR "\n", temp->word, temp->count);
    }
    free(words);
 
@@ -43,9 +43,10 @@
 #include "sort.h"
 
 #define DEFAULT_DISP_NUM 10
+#define EMIT_BATCH_LEN 64
 
 typedef struct {
-    int fpos;
+    off_t fpos;
     off_t flen;
     char *fdata;
     int unit_size;
@@ -56,6 +57,9 @@ enum {
     NOT_IN_WORD
 };
 
+/* Value emitted for every word, copied by the runtime. */
+static intptr_t one = 1;
+
     struct timeval begin, end;
 #ifdef TIMING
     unsigned int library_time = 0;
@@ -99,7 +103,7 @@ int mykeyvalcmp(const void *v1, const void *v2)
 /** wordcount_splitter()
  *  Memory map the file and divide file on a word border i.e. a space.
  */
-int wordcount_splitter(void *data_in, int req_units, map_args_t *out)
+int wordcount_splitter(void *data_in, intptr_t req_units, map_args_t *out)
 {
     wc_data_t * data = (wc_data_t *)data_in; 
     
@@ -124,7 +128,7 @@ int wordcount_splitter(void *data_in, int req_units, map_args_t *out)
         out->length = data->flen - data->fpos;
     
     // Set the length to end at a space
-    for (data->fpos += (long)out->length;
+    for (data->fpos += out->length;
           data->fpos < data->flen && 
           data->fdata[data->fpos] != ' ' && data->fdata[data->fpos] != '\t' &&
           data->fdata[data->fpos] != '\r' && data->fdata[data->fpos] != '\n';
@@ -144,15 +148,19 @@ void *wordcount_locator (map_args_t *task)
 }
 
 /** wordcount_map()
- * Go through the allocated portion of the file and count the words
+ * Go through the allocated portion of the file and count the words.
+ * Words are handed to the runtime EMIT_BATCH_LEN at a time.
  */
-void wordcount_map(map_args_t *args) 
+void wordcount_map(map_args_t *args, mr_ctx_t *ctx) 
 {
     char *curr_start, curr_ltr;
     int state = NOT_IN_WORD;
-    int i;
+    intptr_t i;
+    intermediate_t words[EMIT_BATCH_LEN];
+    int num_words = 0;
   
     assert(args);
+    assert(ctx);
 
     char *data = (char *)args->data;
 
@@ -169,7 +177,14 @@ void wordcount_map(map_args_t *args)
             if ((curr_ltr < 'A' || curr_ltr > 'Z') && curr_ltr != '\'')
             {
                 data[i] = 0;
-                emit_intermediate(curr_start, (void *)1, &data[i] - curr_start + 1);
+                words[num_words].key = curr_start;
+                words[num_words].val = &one;
+                words[num_words].key_size = &data[i] - curr_start + 1;
+                if (++num_words == EMIT_BATCH_LEN)
+                {
+                    emit_intermediate_batch(ctx, words, num_words);
+                    num_words = 0;
+                }
                 state = NOT_IN_WORD;
             }
             break;
@@ -190,43 +205,53 @@ void wordcount_map(map_args_t *args)
     if (state == IN_WORD)
     {
         data[args->length] = 0;
-        emit_intermediate(curr_start, (void *)1, &data[i] - curr_start + 1);
+        words[num_words].key = curr_start;
+        words[num_words].val = &one;
+        words[num_words].key_size = &data[i] - curr_start + 1;
+        num_words++;
     }
+
+    emit_intermediate_batch(ctx, words, num_words);
 }
 
 /** wordcount_reduce()
  * Add up the partial sums for each word
  */
-void wordcount_reduce(void *key_in, iterator_t *itr)
+void wordcount_reduce(void *key_in, iterator_t *itr, mr_ctx_t *ctx)
 {
     char *key = (char *)key_in;
-    void *val;
+    intptr_t *vals;
     intptr_t sum = 0;
+    int i, len;
 
     assert(key);
     assert(itr);
 
-    while (iter_next (itr, &val))
+    while ((len = iter_next_values (itr, (void **)&vals)) > 0)
     {
-        sum += (intptr_t)val;
+        for (i = 0; i < len; i++)
+            sum += vals[i];
     }
 
-    emit(key, (void *)sum);
+    emit_ctx(ctx, key, (void *)sum);
 }
 
-void *wordcount_combiner (iterator_t *itr)
+/** wordcount_combine_*()
+ * In-place combiner keeping the count of each word in an intptr_t
+ */
+void wordcount_combine_init(void *acc)
 {
-    void *val;
-    intptr_t sum = 0;
-
-    assert(itr);
+    *(intptr_t *)acc = 0;
+}
 
-    while (iter_next (itr, &val))
-    {
-        sum += (intptr_t)val;
-    }
+void wordcount_combine_accumulate(void *acc, void *val)
+{
+    *(intptr_t *)acc += *(intptr_t *)val;
+}
 
-    return (void *)sum;
+void wordcount_combine_merge(void *acc, const void *other)
+{
+    *(intptr_t *)acc += *(const intptr_t *)other;
 }
 
 int main(int argc, char *argv[]) 
@@ -262,14 +287,14 @@ int main(int argc, char *argv[])
 #ifndef NO_MMAP
     // Memory map the file
     CHECK_ERROR((fdata = mmap(0, finfo.st_size + 1, 
-      PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == NULL);
+      PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == MAP_FAILED);
 #else
-    int ret;
+    ssize_t ret;
 
     fdata = (char *)malloc (finfo.st_size);
     CHECK_ERROR (fdata == NULL);
 
-    ret = read (fd, fdata, finfo.st_size);
+    ret = read_all (fd, fdata, finfo.st_size);
     CHECK_ERROR (ret != finfo.st_size);
 #endif
 
@@ -290,9 +315,13 @@ int main(int argc, char *argv[])
     map_reduce_args_t map_reduce_args;
     memset(&map_reduce_args, 0, sizeof(map_reduce_args_t));
     map_reduce_args.task_data = &wc_data;
-    map_reduce_args.map = wordcount_map;
-    map_reduce_args.reduce = wordcount_reduce;
-    map_reduce_args.combiner = wordcount_combiner;
+    map_reduce_args.map_ctx = wordcount_map;
+    map_reduce_args.reduce_ctx = wordcount_reduce;
+    map_reduce_args.combiner_init = wordcount_combine_init;
+    map_reduce_args.combiner_accumulate = wordcount_combine_accumulate;
+    map_reduce_args.combiner_merge = wordcount_combine_merge;
+    map_reduce_args.value_size = sizeof(intptr_t);
+    map_reduce_args.use_incremental_combiner = true;
     map_reduce_args.splitter = wordcount_splitter;
     map_reduce_args.locator = wordcount_locator;
     map_reduce_args.key_cmp = mystrcmp;